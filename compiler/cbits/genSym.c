@@ -15,6 +15,65 @@ STATIC_INLINE void checkUniqueRange(HsInt u STG_UNUSED) {
 #endif
 }
 
+#if defined(THREADED_RTS)
+
+/* Note [Unique blocks]
+   ~~~~~~~~~~~~~~~~~~~~
+   With ghc -j several capabilities allocate uniques at once, and if
+   each unique were an atomic_inc on GenSymCounter they would all be
+   fighting over its cache line.  Instead each capability reserves a
+   block of GENSYM_BLOCK_SIZE uniques with a single atomic_inc, and hands
+   them out from its own GenSymBlock.  genSym is an unsafe foreign call,
+   so only the thread holding the capability can be using its block,
+   and we need no synchronisation there.
+
+   The Capability structure is private to the RTS, so we find the block
+   of a capability in a small hash table keyed by its address (a
+   capability never moves or goes away).  If the table is full, which
+   needs more than GENSYM_BLOCKS capabilities, the extra ones use the
+   shared counter as before.
+
+   The uniques are still GenSymInc apart and masked with UNIQUE_MASK.
+   With a single capability we don't use blocks at all, so a sequential
+   compilation allocates exactly the uniques that it always did.
+*/
+
+#define GENSYM_BLOCK_SIZE 4096
+#define GENSYM_BLOCKS 256   // a power of 2
+
+typedef struct {
+    Capability *cap;
+    StgWord next;           // the last unique handed out
+    StgWord left;           // the number left in the block
+    // keep each capability's block in a cache line of its own
+    StgWord8 pad[64 - sizeof(Capability *) - 2 * sizeof(StgWord)];
+} GenSymBlock ATTRIBUTE_ALIGNED(64);
+
+static GenSymBlock GenSymBlocks[GENSYM_BLOCKS];
+
+// The block of the current capability, or NULL if there isn't room for it
+static GenSymBlock *myGenSymBlock(void) {
+    Capability *cap = rts_unsafeGetMyCapability();
+    StgWord h = (StgWord)cap >> 6;
+    GenSymBlock *b;
+    uint32_t i;
+
+    h ^= h >> 8;
+    for (i = 0; i < GENSYM_BLOCKS; i++) {
+        b = &GenSymBlocks[(h + i) & (GENSYM_BLOCKS - 1)];
+        if (b->cap == cap) {
+            return b;
+        }
+        if (b->cap == NULL &&
+            cas((StgVolatilePtr)&b->cap, 0, (StgWord)cap) == 0) {
+            return b;
+        }
+    }
+    return NULL;
+}
+
+#endif
+
 HsInt genSym(void) {
 #if defined(THREADED_RTS)
     if (n_capabilities == 1) {
@@ -22,8 +81,23 @@ HsInt genSym(void) {
         checkUniqueRange(GenSymCounter);
         return GenSymCounter;
     } else {
-        HsInt n = atomic_inc((StgWord *)&GenSymCounter, GenSymInc)
-          & UNIQUE_MASK;
+        // See Note [Unique blocks]
+        GenSymBlock *b = myGenSymBlock();
+        HsInt n;
+        if (b == NULL) {
+            n = atomic_inc((StgWord *)&GenSymCounter, GenSymInc)
+              & UNIQUE_MASK;
+        } else {
+            if (b->left == 0) {
+                b->next = atomic_inc((StgWord *)&GenSymCounter,
+                                     GenSymInc * GENSYM_BLOCK_SIZE)
+                          - GenSymInc * GENSYM_BLOCK_SIZE;
+                b->left = GENSYM_BLOCK_SIZE;
+            }
+            b->next += GenSymInc;
+            b->left--;
+            n = b->next & UNIQUE_MASK;
+        }
         checkUniqueRange(n);
         return n;
     }
@@ -37,4 +111,13 @@ HsInt genSym(void) {
 void initGenSym(HsInt NewGenSymCounter, HsInt NewGenSymInc) {
   GenSymCounter = NewGenSymCounter;
   GenSymInc = NewGenSymInc;
+#if defined(THREADED_RTS)
+  {
+    uint32_t i;
+    // throw away any blocks reserved from the old counter
+    for (i = 0; i < GENSYM_BLOCKS; i++) {
+      GenSymBlocks[i].left = 0;
+    }
+  }
+#endif
 }
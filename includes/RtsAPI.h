@@ -141,6 +141,12 @@ typedef struct GCDetails_ {
   Time cpu_ns;
     // The time elapsed during GC itself
   Time elapsed_ns;
+    // In parallel GC, the total time the GC threads spent spinning while
+    // waiting for work or for each other
+  Time spin_ns;
+    // In parallel GC, the total time the GC threads spent blocked while
+    // waiting for work or for each other
+  Time sleep_ns;
 } GCDetails;
 
 //
@@ -190,6 +196,10 @@ typedef struct _RTSStats {
   Time gc_cpu_ns;
     // Total elapsed time used by the GC
   Time gc_elapsed_ns;
+    // Sum of spin_ns across all GCs
+  Time gc_spin_ns;
+    // Sum of sleep_ns across all GCs
+  Time gc_sleep_ns;
     // Total CPU time (at the previous GC)
   Time cpu_ns;
     // Total elapsed time (at the previous GC)
@@ -153,6 +153,15 @@
 /* The size of a megablock (2^MBLOCK_SHIFT bytes) */
 #define MBLOCK_SHIFT   20
 
+/* -----------------------------------------------------------------------------
+   The stable pointer table is an array of segments of
+   2^SPT_SEGMENT_BITS entries each (see rts/Stable.c)
+   -------------------------------------------------------------------------- */
+
+#define SPT_SEGMENT_BITS 10
+#define SPT_SEGMENT_SIZE (1 << SPT_SEGMENT_BITS)
+#define SPT_SEGMENT_MASK (SPT_SEGMENT_SIZE - 1)
+
 /* -----------------------------------------------------------------------------
    Bitmap/size fields (used in info tables)
    -------------------------------------------------------------------------- */
@@ -237,7 +246,13 @@
    by tryWakeupThread() */
 #define ThreadMigrating     13
 
-/* WARNING WARNING top number is BlockedOnMVarRead 14, not 13!! */
+/* The thread is runnable, but waiting in a capability's pool of threads
+   that idle capabilities may steal; see Note [Stealing threads] in
+   rts/Schedule.c */
+#define ThreadStealable     15
+
+/* WARNING WARNING top number is ThreadStealable 15, and 16 and 17 are
+   taken by threadStatus# in PrimOps.cmm */
 
 /*
  * These constants are returned to the scheduler by a thread that has
@@ -290,6 +305,13 @@
  */
 #define TSO_ALLOC_LIMIT 256
 
+/*
+ * TSO_STM_REEXEC is set while a thread re-executes an STM transaction
+ * after being woken from retry, so that we can count the wakeups that
+ * lead to a commit (see Note [STM wakeup batching] in rts/STM.c).
+ */
+#define TSO_STM_REEXEC 512
+
 /*
  * The number of times we spin in a spin lock before yielding (see
  * #3758).  To tune this value, use the benchmark in #3758: run the
@@ -177,12 +177,25 @@
 #define EVENT_HEAP_PROF_SAMPLE_BEGIN       162
 #define EVENT_HEAP_PROF_SAMPLE_COST_CENTRE 163
 #define EVENT_HEAP_PROF_SAMPLE_STRING      164
+#define EVENT_HEAP_PROF_SAMPLE_INFO_TABLE  165 /* (profile_id, residency, info) */
+
+/* Range 181 - 189 is used for allocation sampling (+RTS --alloc-sample). */
+
+#define EVENT_ALLOC_SAMPLE        181 /* (thread, bytes, depth, code_addrs) */
+
+/* Range 190 - 199 is used for STM events. */
+#define EVENT_STM_COUNTERS        190 /* (woken,deferred,skipped,rewaited,
+                                          reexecuted,committed) */
+
+/* Range 200 - 209 is used for work-stealing scheduler events. */
+#define EVENT_STEAL_THREAD        200 /* (thread, victim_cap)   */
+
 /*
  * The highest event code +1 that ghc itself emits. Note that some event
  * ranges higher than this are reserved but not currently emitted by ghc.
  * This must match the size of the EventDesc[] array in EventLog.c
  */
-#define NUM_GHC_EVENT_TAGS        165
+#define NUM_GHC_EVENT_TAGS        201
 
 #if 0  /* DEPRECATED EVENTS: */
 /* we don't actually need to record the thread, it's implicit */
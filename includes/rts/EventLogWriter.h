@@ -35,3 +35,43 @@ typedef struct {
  * a file `program.eventlog`.
  */
 extern const EventLogWriter FileEventLogWriter;
+
+#if !defined(mingw32_HOST_OS)
+/*
+ * An EventLogWriter which streams eventlogs to a Unix domain socket or a
+ * named pipe, as given by +RTS --eventlog-socket=<path>.  Used instead of
+ * FileEventLogWriter when that flag is given.
+ */
+extern const EventLogWriter SocketEventLogWriter;
+#endif
+
+/*
+ * Starting and stopping the eventlog while the program runs.
+ *
+ * startEventLog() starts writing an eventlog with the given writer, or
+ * with the program's default writer if it is NULL.  It returns false if
+ * the eventlog is already running, or if the RTS was built without
+ * eventlog support.  endEventLog() stops it again, flushing the events
+ * logged so far.  Both briefly stop all Haskell threads.
+ */
+bool startEventLog(const EventLogWriter *writer);
+void endEventLog(void);
+bool eventLogRunning(void);
+
+/*
+ * The classes of events that the eventlog records, as chosen by
+ * +RTS -l<flags>.
+ */
+#define EVENTLOG_SCHEDULER      (1 << 0)  /* -ls */
+#define EVENTLOG_GC             (1 << 1)  /* -lg */
+#define EVENTLOG_SPARKS_SAMPLED (1 << 2)  /* -lp */
+#define EVENTLOG_SPARKS_FULL    (1 << 3)  /* -lf */
+#define EVENTLOG_USER           (1 << 4)  /* -lu */
+
+/*
+ * Enable the classes in enable and then disable those in disable, and
+ * return the classes now selected.  This takes effect immediately if the
+ * eventlog is running, and otherwise chooses the classes that the next
+ * startEventLog() records.
+ */
+uint32_t setEventLogClasses(uint32_t enable, uint32_t disable);
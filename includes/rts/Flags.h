@@ -60,6 +60,13 @@ typedef struct _GC_FLAGS {
 
     bool sweep;		/* use "mostly mark-sweep" instead of copying
                                  * for the oldest generation */
+    bool concurrentMark;        /* mark the oldest generation concurrently
+                                 * with the mutator (implies sweep) */
+    Time incrementalSlice;      /* if non-zero, mark and sweep the oldest
+                                 * generation incrementally from the
+                                 * scheduler, in slices of at most this
+                                 * long (implies concurrentMark).
+                                 * units: TIME_RESOLUTION */
     bool ringBell;
 
     Time    idleGCDelayTime;    /* units: TIME_RESOLUTION */
@@ -83,6 +90,11 @@ typedef struct _GC_FLAGS {
 
     bool numa;                   /* Use NUMA */
     StgWord numaMask;
+
+    uint32_t hugePages;          /* back the heap with 2MB pages */
+#define HUGE_PAGES_NONE         0
+#define HUGE_PAGES_TRANSPARENT  1 /* madvise(MADV_HUGEPAGE) */
+#define HUGE_PAGES_EXPLICIT     2 /* mmap(MAP_HUGETLB) */
 } GC_FLAGS;
 
 /* See Note [Synchronization of flags and base APIs] */
@@ -133,6 +145,7 @@ typedef struct _PROFILING_FLAGS {
 # define HEAP_BY_LDV            7
 
 # define HEAP_BY_CLOSURE_TYPE   8
+# define HEAP_BY_INFO_TABLE     9
 
     Time        heapProfileInterval; /* time between samples */
     uint32_t    heapProfileIntervalTicks; /* ticks between samples (derived) */
@@ -168,6 +181,8 @@ typedef struct _TRACE_FLAGS {
     bool sparks_sampled; /* trace spark events by a sampled method */
     bool sparks_full;    /* trace spark events 100% accurately */
     bool user;           /* trace user events (emitted from Haskell code) */
+    const char *eventlogSocket; /* stream the eventlog here (or NULL) */
+    StgWord64 allocSample; /* bytes between allocation samples (0: off) */
 } TRACE_FLAGS;
 
 /* See Note [Synchronization of flags and base APIs] */
@@ -27,14 +27,15 @@ typedef struct {
 } snEntry;
 
 typedef struct {
-    StgPtr addr;
+    StgPtr addr;                        /* Haskell object, or NULL if free */
 } spEntry;
 
 extern DLL_IMPORT_RTS snEntry *stable_name_table;
-extern DLL_IMPORT_RTS spEntry *stable_ptr_table;
+extern DLL_IMPORT_RTS spEntry **stable_ptr_table;  /* array of segments */
 
 EXTERN_INLINE
 StgPtr deRefStablePtr(StgStablePtr sp)
 {
-    return stable_ptr_table[(StgWord)sp].addr;
+    return stable_ptr_table[(StgWord)sp >> SPT_SEGMENT_BITS]
+                           [(StgWord)sp & SPT_SEGMENT_MASK].addr;
 }
@@ -155,6 +155,10 @@ typedef struct bdescr_ {
 #define BF_SWEPT     256
 /* Block is part of a Compact */
 #define BF_COMPACT   512
+/* Block is in the snapshot of a concurrent mark (see NonMovingMark.c) */
+#define BF_NONMOVING 1024
+/* Large object or compact was reached by the concurrent mark */
+#define BF_NONMOVING_MARKED 2048
 /* Maximum flag value (do not define anything higher than this!) */
 #define BF_FLAG_MAX  (1 << 15)
 
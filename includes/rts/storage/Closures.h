@@ -288,9 +288,9 @@ typedef struct {
  *  space for these data structures at the cost of more complexity in the
  *  implementation:
  *
- *   - In StgTVar, current_value and first_watch_queue_entry could be held in
- *     the same field: if any thread is waiting then its expected_value for
- *     the tvar is the current value.
+ *   - In StgTVar, current_value and watchers could be held in the same
+ *     field: if any thread is waiting then its expected_value for the tvar
+ *     is the current value.
  *
  *   - In StgTRecHeader, it might be worthwhile having separate chunks
  *     of read-only and read-write locations.  This would save a
@@ -314,7 +314,7 @@ typedef struct StgTVarWatchQueue_ {
 typedef struct {
   StgHeader                  header;
   StgClosure                *volatile current_value;
-  StgTVarWatchQueue         *volatile first_watch_queue_entry;
+  StgClosure                *volatile watchers; // see Note [TVar watchers] in rts/STM.c
   StgInt                     volatile num_updates;
 } StgTVar;
 
@@ -326,14 +326,14 @@ typedef struct {
 } StgAtomicInvariant;
 
 /* new_value == expected_value for read-only accesses */
-/* new_value is a StgTVarWatchQueue entry when trec in state TREC_WAITING */
+/* new_value is the waiting StgTSO when trec in state TREC_WAITING */
+/* num_updates is the watcher's slot in the TVar's watchers when trec in
+   state TREC_WAITING or is the last_execution of an invariant */
 typedef struct {
   StgTVar                   *tvar;
   StgClosure                *expected_value;
   StgClosure                *new_value;
-#if defined(THREADED_RTS)
   StgInt                     num_updates;
-#endif
 } TRecEntry;
 
 #define TREC_CHUNK_NUM_ENTRIES 16
@@ -365,7 +365,9 @@ struct StgTRecHeader_ {
   struct StgTRecHeader_     *enclosing_trec;
   StgTRecChunk              *current_chunk;
   StgInvariantCheckQueue    *invariants_to_check;
+  StgArrBytes               *entry_index; // see Note [TRec index] in rts/STM.c
   TRecState                  state;
+  StgWord                    read_version; // STM_TL2 only, see rts/STM.c
 };
 
 typedef struct {
@@ -208,6 +208,18 @@ extern W_ large_alloc_lim;
 void performGC(void);
 void performMajorGC(void);
 
+/* -----------------------------------------------------------------------------
+   Compact region files, see Note [Compact region files] in rts/sm/CNF.c
+   -------------------------------------------------------------------------- */
+
+int compactSaveFile (StgCompactNFDataBlock *first, StgClosure *root,
+                     const char *path);
+StgCompactNFDataBlock *compactLoadFile (const char *path, StgClosure **root);
+
+// Parallel compaction, see Note [Parallel compaction] in rts/sm/CNF.c
+StgStablePtr compactAddParallel (StgCompactNFDataBlock *first, StgStablePtr sp,
+                                 uint32_t n_threads);
+
 /* -----------------------------------------------------------------------------
    The CAF table - used to let us revert CAFs in GHCi
    -------------------------------------------------------------------------- */
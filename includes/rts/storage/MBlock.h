@@ -17,6 +17,7 @@ extern W_ mblocks_allocated;
 extern void initMBlocks(void);
 extern void * getMBlock(void);
 extern void * getMBlocks(uint32_t n);
+extern void * getMBlocksAt(void *addr, uint32_t n);
 extern void * getMBlockOnNode(uint32_t node);
 extern void * getMBlocksOnNode(uint32_t node, uint32_t n);
 extern void freeMBlocks(void *addr, uint32_t n);
@@ -229,12 +229,16 @@ void dirty_STACK (Capability *cap, StgStack *stack);
         ----------------------------------------------------------------------
         NotBlocked             END_TSO_QUEUE        runnable_queue, or running
 
+        ThreadStealable        STEALABLE            a cap's stealable threads
+
         BlockedOnBlackHole     MessageBlackHole *   TSO->bq
 
         BlockedOnMVar          the MVAR             the MVAR's queue
 
         BlockedOnSTM           END_TSO_QUEUE        STM wait queue(s)
         BlockedOnSTM           STM_AWOKEN           run queue
+        BlockedOnSTM           STM_DEFERRED         STM wait queue(s), and
+                                                    a cap's deferred wakeups
 
         BlockedOnMsgThrowTo    MessageThrowTo *     TSO->blocked_exception
 
@@ -127,6 +127,8 @@ RTS_ENTRY(stg_MUT_VAR_DIRTY);
 RTS_ENTRY(stg_END_TSO_QUEUE);
 RTS_ENTRY(stg_GCD_CAF);
 RTS_ENTRY(stg_STM_AWOKEN);
+RTS_ENTRY(stg_STM_DEFERRED);
+RTS_ENTRY(stg_STEALABLE);
 RTS_ENTRY(stg_MSG_TRY_WAKEUP);
 RTS_ENTRY(stg_MSG_THROWTO);
 RTS_ENTRY(stg_MSG_BLACKHOLE);
@@ -158,6 +160,8 @@ RTS_ENTRY(stg_COMPACT_NFDATA_DIRTY);
 
 RTS_CLOSURE(stg_END_TSO_QUEUE_closure);
 RTS_CLOSURE(stg_STM_AWOKEN_closure);
+RTS_CLOSURE(stg_STM_DEFERRED_closure);
+RTS_CLOSURE(stg_STEALABLE_closure);
 RTS_CLOSURE(stg_NO_FINALIZER_closure);
 RTS_CLOSURE(stg_dummy_ret_closure);
 RTS_CLOSURE(stg_forceIO_closure);
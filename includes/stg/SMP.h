@@ -252,6 +252,20 @@ load_load_barrier(void) {
 // a busy wait loop for example.
 #define VOLATILE_LOAD(p) (*((StgVolatilePtr)(p)))
 
+/*
+ * C11-style atomic accesses with an explicit memory ordering, for
+ * lock-free structures (such as the work-stealing deque in
+ * rts/WSDeque.c) that only need acquire/release ordering on most
+ * accesses and a full fence in one or two places.  These compile to
+ * plain loads and stores on x86, but to the weaker (and cheaper)
+ * instructions on ARM and POWER.
+ */
+#define RELAXED_LOAD(ptr)       __atomic_load_n(ptr, __ATOMIC_RELAXED)
+#define ACQUIRE_LOAD(ptr)       __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define RELAXED_STORE(ptr,val)  __atomic_store_n(ptr, val, __ATOMIC_RELAXED)
+#define RELEASE_STORE(ptr,val)  __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+#define SEQ_CST_FENCE()         __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
 /* ---------------------------------------------------------------------- */
 #else /* !THREADED_RTS */
 
@@ -300,4 +314,10 @@ atomic_dec(StgVolatilePtr p)
 
 #define VOLATILE_LOAD(p) ((StgWord)*((StgWord*)(p)))
 
+#define RELAXED_LOAD(ptr)       (*(ptr))
+#define ACQUIRE_LOAD(ptr)       (*(ptr))
+#define RELAXED_STORE(ptr,val)  (*(ptr) = (val))
+#define RELEASE_STORE(ptr,val)  (*(ptr) = (val))
+#define SEQ_CST_FENCE()         /* nothing */
+
 #endif /* !THREADED_RTS */
@@ -0,0 +1,54 @@
+{-# LANGUAGE BangPatterns #-}
+-- Check the character properties of every code point against those of
+-- the binary-searched tables that cbits/WCsubst.c used to have.  For
+-- each property we print the number of code points that have it (or
+-- that it changes), and a hash of its value at every code point.
+--
+-- Given an argument n, we compute the properties n times instead, which
+-- makes this a benchmark for the tables in WCsubst.c.
+module Main where
+
+import Control.Exception
+import Control.Monad
+import Data.Bits
+import Data.Char
+import Data.List (foldl')
+import Data.Word
+import System.Environment
+
+properties :: [(String, Char -> Int)]
+properties =
+  [ ("isControl",       fromEnum . isControl)
+  , ("isPrint",         fromEnum . isPrint)
+  , ("isSpace",         fromEnum . isSpace)
+  , ("isUpper",         fromEnum . isUpper)
+  , ("isLower",         fromEnum . isLower)
+  , ("isAlpha",         fromEnum . isAlpha)
+  , ("isAlphaNum",      fromEnum . isAlphaNum)
+  , ("toUpper",         \c -> ord (toUpper c) - ord c)
+  , ("toLower",         \c -> ord (toLower c) - ord c)
+  , ("toTitle",         \c -> ord (toTitle c) - ord c)
+    -- NotAssigned is the last category, so this counts assigned code points
+  , ("generalCategory", \c -> fromEnum NotAssigned
+                                - fromEnum (generalCategory c))
+  ]
+
+-- The number of code points where the property is not 0, and an FNV-1
+-- hash of the property at every code point, starting from seed.
+summarise :: Word32 -> (Char -> Int) -> (Int, Word32)
+summarise seed f = foldl' step (0, seed) [minBound .. maxBound]
+  where
+    step (!n, !h) c = (if x /= 0 then n + 1 else n,
+                       (h * 16777619) `xor` fromIntegral x)
+      where x = f c
+
+main :: IO ()
+main = do
+  args <- getArgs
+  case args of
+    [] -> forM_ properties $ \(name, f) -> do
+            let (n, h) = summarise 2166136261 f
+            putStrLn (name ++ " " ++ show n ++ " " ++ show h)
+    [reps] -> forM_ [1 .. read reps] $ \seed ->
+                forM_ properties $ \(_, f) -> evaluate (summarise seed f)
+    _ -> error "usage: unicode003 [repetitions]"
@@ -66,6 +66,7 @@ module GHC.Compact (
   compactWithSharing,
   compactAdd,
   compactAddWithSharing,
+  compactAddParallel,
 
   -- * Inspecting a Compact
   getCompact,
@@ -81,9 +82,13 @@ module GHC.Compact (
   compactSized,
   ) where
 
+import Control.Concurrent (getNumCapabilities)
 import Control.Concurrent.MVar
+import Foreign.StablePtr
 import GHC.Prim
+import GHC.Ptr (Ptr(..), nullPtr)
 import GHC.Types
+import GHC.Word (Word32)
 
 -- | A 'Compact' contains fully evaluated, pure, immutable data.
 --
@@ -232,6 +237,41 @@ compactAddWithSharing (Compact compact# _ lock) a =
     case compactAddWithSharing# compact# a s of { (# s1, pk #) ->
     (# s1, Compact compact# pk lock #) }
 
+-- | Add a value to an existing 'Compact', like 'compactAddWithSharing',
+-- but copying it with several OS threads (as many as there are
+-- capabilities, see 'getNumCapabilities') while the calling thread
+-- waits.  Sharing is always preserved.
+--
+-- This is for large values that are already fully evaluated, for
+-- example with @Control.DeepSeq.force@.  If the value contains any
+-- thunks, or anything else that can't be compacted, this falls back to
+-- 'compactAddWithSharing', which evaluates the thunks or throws a
+-- 'CompactionFailed' exception as usual.  Other Haskell threads can run
+-- during the copy, but no garbage collection can happen until it has
+-- finished, so a thread that needs one waits for it.
+--
+compactAddParallel :: Compact b -> a -> IO (Compact a)
+compactAddParallel c@(Compact compact# _ lock) a = do
+  n <- getNumCapabilities
+  r <- withMVar lock $ \_ -> do
+    first <- IO $ \s -> case compactGetFirstBlock# compact# s of
+                          (# s', block, _ #) -> (# s', Ptr block #)
+    sp <- newStablePtr a
+    rsp <- c_compactAddParallel first sp (fromIntegral n)
+    freeStablePtr sp
+    if castStablePtrToPtr rsp == nullPtr
+      then return Nothing
+      else do
+        pk <- deRefStablePtr rsp
+        freeStablePtr rsp
+        return (Just (Compact compact# pk lock))
+  case r of
+    Just c' -> return c'
+    Nothing -> compactAddWithSharing c a
+
+foreign import ccall unsafe "compactAddParallel"
+  c_compactAddParallel :: Ptr () -> StablePtr a -> Word32 -> IO (StablePtr a)
+
 -- | Check if the second argument is inside the passed 'Compact'.
 --
 inCompact :: Compact b -> a -> IO Bool
@@ -24,6 +24,8 @@ module GHC.Compact.Serialized(
   withSerializedCompact,
   importCompact,
   importCompactByteStrings,
+  writeCompactFile,
+  readCompactFile,
 ) where
 
 import GHC.Prim
@@ -36,8 +38,14 @@ import Control.Concurrent
 import qualified Data.ByteString as ByteString
 import Data.ByteString.Internal(toForeignPtr)
 import Data.IORef(newIORef, readIORef, writeIORef)
+import Foreign.C.Error(eOK, getErrno, throwErrnoPath,
+                       throwErrnoPathIfMinus1_)
+import Foreign.C.String(CString, withCString)
+import Foreign.C.Types(CInt(..))
 import Foreign.ForeignPtr(withForeignPtr)
+import Foreign.Marshal.Alloc(alloca)
 import Foreign.Marshal.Utils(copyBytes)
+import Foreign.Storable(peek)
 
 import GHC.Compact
 
@@ -208,3 +216,43 @@ importCompactByteStrings serialized stringList =
             copyBytes to (from `plusPtr` off) (fromIntegral size)
           writeIORef state rest
     importCompact serialized filler
+
+-- | Write the 'Compact' to a file that 'readCompactFile' can load
+-- quickly, without copying it.  Only the program that wrote the file can
+-- read it.
+writeCompactFile :: FilePath -> Compact a -> IO ()
+writeCompactFile path (Compact buffer root lock) = withMVar lock $ \_ -> do
+  (firstBlock, _) <- compactGetFirstBlock buffer
+  rootPtr <- IO (\s -> case anyToAddr# root s of
+                    (# s', rootAddr #) -> (# s', Ptr rootAddr #) )
+  withCString path $ \cpath ->
+    throwErrnoPathIfMinus1_ "writeCompactFile" path $
+      c_compactSaveFile firstBlock rootPtr cpath
+  IO (\s -> case touch# buffer s of
+         s' -> (# s', () #) )
+
+-- | Load a 'Compact' from a file written by 'writeCompactFile'.  The
+-- file is mapped into memory where possible, so that this takes the same
+-- time whatever the size of the 'Compact', and the file is only read as
+-- the 'Compact' is used; so the file must not be truncated while the
+-- program runs.  Returns 'Nothing' if the file was not written by
+-- 'writeCompactFile' in this program, and throws an 'IOError' if it
+-- can't be read.
+readCompactFile :: FilePath -> IO (Maybe (Compact a))
+readCompactFile path =
+  withCString path $ \cpath -> alloca $ \prootp -> do
+    Ptr firstBlock <- c_compactLoadFile cpath prootp
+    if addrIsNull firstBlock
+      then do
+        errno <- getErrno
+        if errno == eOK then return Nothing
+          else throwErrnoPath "readCompactFile" path
+      else do
+        Ptr rootAddr <- peek prootp
+        IO (fixupPointers firstBlock rootAddr)
+
+foreign import ccall safe "compactSaveFile"
+  c_compactSaveFile :: Ptr () -> Ptr a -> CString -> IO CInt
+
+foreign import ccall safe "compactLoadFile"
+  c_compactLoadFile :: CString -> Ptr (Ptr ()) -> IO (Ptr ())
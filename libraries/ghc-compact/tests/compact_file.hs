@@ -0,0 +1,55 @@
+module Main where
+
+import Control.Exception
+import Control.Monad
+import Data.Maybe
+import System.Mem
+
+import GHC.Compact
+import GHC.Compact.Serialized
+
+assertFail :: String -> IO ()
+assertFail msg = throwIO $ AssertionFailed msg
+
+assertEquals :: (Eq a, Show a) => a -> a -> IO ()
+assertEquals expected actual =
+  if expected == actual then return ()
+  else assertFail $ "expected " ++ (show expected)
+       ++ ", got " ++ (show actual)
+
+type Val = (String, Int, Integer, Maybe Int, [(Int, String)])
+
+main = do
+  let val = ("hello", 1, 2^100, Just 42, [ (i, show i) | i <- [1..20000] ])
+              :: Val
+
+  -- a compact of several blocks
+  cnf <- compactSized 4096 True val
+  writeCompactFile "compact_file.cnf" cnf
+  performMajorGC
+
+  -- The first load may get the addresses that the file was written
+  -- for, but the second can't while the first is alive, so it has to
+  -- relocate the compact
+  Just cnf1 <- readCompactFile "compact_file.cnf" :: IO (Maybe (Compact Val))
+  Just cnf2 <- readCompactFile "compact_file.cnf" :: IO (Maybe (Compact Val))
+  performMajorGC
+  assertEquals val (getCompact cnf1)
+  assertEquals val (getCompact cnf2)
+
+  -- the loaded compacts can be added to
+  cnf3 <- compactAdd cnf1 (getCompact cnf2, "more")
+  assertEquals (val, "more") (getCompact cnf3)
+  performMajorGC
+
+  writeFile "compact_file.txt" "this is not a compact region"
+  r <- readCompactFile "compact_file.txt" :: IO (Maybe (Compact Val))
+  when (isJust r) $ assertFail "loaded a text file"
+
+  r <- try (readCompactFile "compact_file.missing")
+         :: IO (Either IOException (Maybe (Compact Val)))
+  case r of
+    Left _ -> putStrLn "missing file: IOException"
+    Right _ -> assertFail "loaded a missing file"
+
+  putStrLn "OK"
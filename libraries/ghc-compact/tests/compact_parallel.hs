@@ -0,0 +1,76 @@
+{-# LANGUAGE MagicHash, UnboxedTuples #-}
+
+import Control.Exception
+import Data.Array
+import qualified Data.Map as Map
+import Data.Maybe
+import Data.Word
+import Foreign.Ptr
+import Foreign.StablePtr
+import GHC.Exts
+import GHC.IO
+
+import GHC.Compact
+
+-- The parallel compaction itself, without the fallback to
+-- compactAddWithSharing that compactAddParallel has: Nothing if it
+-- would have fallen back.
+foreign import ccall unsafe "compactAddParallel"
+  c_compactAddParallel :: Ptr () -> StablePtr a -> Word32 -> IO (StablePtr a)
+
+parallelOnly :: Compact b -> a -> IO (Maybe a)
+parallelOnly (Compact compact# _ _) a = do
+  first <- IO $ \s -> case compactGetFirstBlock# compact# s of
+                        (# s', block, _ #) -> (# s', Ptr block #)
+  sp <- newStablePtr a
+  rsp <- c_compactAddParallel first sp 4
+  freeStablePtr sp
+  if castStablePtrToPtr rsp == nullPtr
+    then return Nothing
+    else do
+      r <- deRefStablePtr rsp
+      freeStablePtr rsp
+      return (Just r)
+
+main = do
+  c <- compact ()
+
+  -- An array with more elements than the work-stealing deques hold, so
+  -- that its fields go on the overflow stacks, and each element has
+  -- work for the other threads to steal
+  let n = 20000 :: Int
+      arr = listArray (0, n - 1)
+              [Map.fromList [(j, i) | j <- [1 .. 10 :: Int]] | i <- [1 .. n]]
+  _ <- evaluate (sum (map (sum . Map.elems) (elems arr)))
+  r1 <- parallelOnly c arr
+  print (fmap (== arr) r1)
+  print =<< maybe (return False) (inCompact c) r1
+
+  -- Sharing within a call is preserved: (m, m) takes one copy of m,
+  -- not two
+  let m = Map.fromList [(x, show x) | x <- [1 .. 100000 :: Int]]
+  _ <- evaluate (length (show m))
+  size0 <- compactSize c
+  r2 <- parallelOnly c m
+  size1 <- compactSize c
+  r3 <- parallelOnly c (m, m)
+  size2 <- compactSize c
+  print (fmap (== m) r2, fmap (== (m, m)) r3)
+  print (size2 - size1 < (size1 - size0) * 3 `div` 2)
+
+  -- A cycle
+  let xs = 1 : 2 : 3 : xs :: [Int]
+  _ <- evaluate (xs !! 3)
+  r4 <- parallelOnly c xs
+  print (fmap (take 10) r4)
+
+  -- Thunks make compactAddParallel fall back to compactAddWithSharing
+  let ys = map (* 2) [1 .. 10 :: Int]
+  r5 <- parallelOnly c ys
+  print (isNothing r5)
+  c6 <- compactAddParallel c ys
+  print (getCompact c6)
+  print =<< inCompact c6 (getCompact c6)
+
+  c7 <- compactAddParallel c m
+  print (getCompact c7 == m)
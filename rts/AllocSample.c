@@ -0,0 +1,140 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2017
+ *
+ * Sampling allocation profiler (+RTS --alloc-sample)
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "AllocSample.h"
+#include "Trace.h"
+
+/* Note [Allocation sampling]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~
+   With +RTS --alloc-sample=<size> (in a program linked with -eventlog)
+   the RTS takes a sample every <size> bytes allocated by each
+   capability, and writes it to the eventlog as an EVENT_ALLOC_SAMPLE:
+   the thread, the bytes allocated since the previous sample, and the
+   code addresses of the allocation site and of the return frames above
+   it on the stack (at most ALLOC_SAMPLE_DEPTH of them).  These are info
+   pointers, so a tool can symbolise them offline against the symbol
+   table of the binary, which gives an allocation profile of an
+   optimised program without -prof.
+
+   We count allocation in cap->total_allocated, which is brought up to
+   date whenever a nursery block is finished: by the heap-check failure
+   code (stg_gc_noregs in HeapStackCheck.cmm) when it moves on to the
+   next block, and by allocate().  So we notice that a sample is due at
+   the first block boundary after alloc_sample_next, and the bytes are
+   attributed to whoever fills the block that crosses it, which is a
+   fair sample of the allocation.
+
+   The sample has to be taken with the thread's stack in a consistent
+   state, so in both places we only return to the scheduler:
+   stg_gc_noregs returns with ThreadYielding, and allocate() sets HpLim
+   to zero so that the next heap check does so (see checkAllocSample()).
+   The scheduler calls sampleAllocation(), and since there is no context
+   switch pending the thread carries on straight away.  When we are not
+   sampling, alloc_sample_next is ALLOC_SAMPLE_NEVER, and the cost is one
+   comparison per nursery block.
+
+   The top frame is often one pushed by the heap-check failure code
+   (stg_enter_info or a RET_FUN frame), in which case the allocation
+   site is the closure it saved, i.e. the thunk or function whose heap
+   check failed; otherwise it is the return address itself.
+*/
+
+#define ALLOC_SAMPLE_DEPTH 16
+
+#if defined(TRACING)
+static W_ allocSampleInterval (void)
+{
+    W_ words = RtsFlags.TraceFlags.allocSample / sizeof(W_);
+    return words > 0 ? words : 1;
+}
+#endif
+
+void initAllocSample (Capability *cap)
+{
+    cap->alloc_sample_last = cap->total_allocated;
+#if defined(TRACING)
+    if (RtsFlags.TraceFlags.allocSample != 0) {
+        cap->alloc_sample_next = cap->total_allocated + allocSampleInterval();
+        return;
+    }
+#endif
+    cap->alloc_sample_next = ALLOC_SAMPLE_NEVER;
+}
+
+#if defined(TRACING)
+
+// The allocation site, see Note [Allocation sampling]
+static StgWord allocSite (StgClosure *frame)
+{
+    if (frame->header.info == &stg_enter_info) {
+        return (StgWord)UNTAG_CLOSURE((StgClosure *)frame->payload[0])
+                            ->header.info;
+    }
+    if (get_ret_itbl(frame)->i.type == RET_FUN) {
+        return (StgWord)UNTAG_CLOSURE(((StgRetFun *)frame)->fun)
+                            ->header.info;
+    }
+    return (StgWord)frame->header.info;
+}
+
+static uint32_t sampleStack (StgTSO *tso, StgWord *code_addrs)
+{
+    StgStack *stack = tso->stackobj;
+    StgPtr sp = stack->sp;
+    StgClosure *frame;
+    uint32_t n = 0;
+
+    while (n < ALLOC_SAMPLE_DEPTH) {
+        frame = (StgClosure *)sp;
+        switch (get_ret_itbl(frame)->i.type) {
+        case STOP_FRAME:
+            return n;
+        case UNDERFLOW_FRAME:
+            stack = ((StgUnderflowFrame *)frame)->next_chunk;
+            sp = stack->sp;
+            continue;
+        default:
+            code_addrs[n] = n == 0 ? allocSite(frame)
+                                   : (StgWord)frame->header.info;
+            n++;
+            sp += stack_frame_sizeW(frame);
+        }
+    }
+    return n;
+}
+
+void sampleAllocation (Capability *cap, StgTSO *tso)
+{
+    StgWord code_addrs[ALLOC_SAMPLE_DEPTH];
+    StgWord64 bytes;
+    uint32_t depth;
+
+    bytes = (StgWord64)(cap->total_allocated - cap->alloc_sample_last)
+            * sizeof(W_);
+    initAllocSample(cap);
+
+    if (!eventLogRunning() || tso->what_next == ThreadComplete ||
+        tso->what_next == ThreadKilled) {
+        return;
+    }
+
+    depth = sampleStack(tso, code_addrs);
+    traceAllocSample_(cap, tso, bytes, code_addrs, depth);
+}
+
+#else
+
+void sampleAllocation (Capability *cap, StgTSO *tso STG_UNUSED)
+{
+    initAllocSample(cap);
+}
+
+#endif /* TRACING */
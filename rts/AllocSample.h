@@ -0,0 +1,38 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2017
+ *
+ * Sampling allocation profiler (+RTS --alloc-sample)
+ *
+ * ---------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "Capability.h"
+
+#include "BeginPrivate.h"
+
+// cap->alloc_sample_next when we are not sampling
+#define ALLOC_SAMPLE_NEVER ((W_)-1)
+
+void initAllocSample (Capability *cap);
+
+// Take a sample for the thread that just returned to the scheduler
+void sampleAllocation (Capability *cap, StgTSO *tso);
+
+INLINE_HEADER bool allocSampleDue (Capability *cap)
+{
+    return cap->total_allocated >= cap->alloc_sample_next;
+}
+
+// Called by allocate() after it has added to cap->total_allocated.  We
+// can't look at the stack of the running thread here, so make it return
+// to the scheduler at its next heap check, as a context switch does.
+INLINE_HEADER void checkAllocSample (Capability *cap)
+{
+    if (RTS_UNLIKELY(allocSampleDue(cap))) {
+        cap->r.rHpLim = NULL;
+    }
+}
+
+#include "EndPrivate.h"
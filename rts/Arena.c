@@ -33,7 +33,9 @@ struct _Arena {
 
 // We like to keep track of how many blocks we've allocated for
 // Storage.c:memInventory().
-static long arena_blocks = 0;
+// Updated atomically: the GC threads allocate in arenas of their own
+// during a parallel heap census.
+static volatile StgInt arena_blocks = 0;
 
 // Begin a new arena
 Arena *
@@ -46,7 +48,7 @@ newArena( void )
     arena->current->link = NULL;
     arena->free = arena->current->start;
     arena->lim  = arena->current->start + BLOCK_SIZE_W;
-    arena_blocks++;
+    atomic_inc((StgVolatilePtr)&arena_blocks, 1);
 
     return arena;
 }
@@ -82,7 +84,7 @@ arenaAlloc( Arena *arena, size_t size )
         // allocate a fresh block...
         req_blocks =  (W_)BLOCK_ROUND_UP(size) / BLOCK_SIZE;
         bd = allocGroup_lock(req_blocks);
-        arena_blocks += req_blocks;
+        atomic_inc((StgVolatilePtr)&arena_blocks, req_blocks);
 
         bd->gen_no  = 0;
         bd->gen     = NULL;
@@ -105,7 +107,7 @@ arenaFree( Arena *arena )
 
     for (bd = arena->current; bd != NULL; bd = next) {
         next = bd->link;
-        arena_blocks -= bd->blocks;
+        atomic_inc((StgVolatilePtr)&arena_blocks, -(StgWord)bd->blocks);
         ASSERT(arena_blocks >= 0);
         freeGroup_lock(bd);
     }
@@ -16,6 +16,42 @@
  * Called from STG :  NO
  * Locks assumed   :  sched_mutex
  */
-RTS_PRIVATE void awaitEvent(bool wait);  /* In posix/Select.c or
+RTS_PRIVATE void awaitEvent(bool wait);  /* In posix/Select.c,
+                                          * posix/Epoll.c or
                                           * win32/AwaitEvent.c */
+
+/* Are there any threads blocked on I/O or delays? */
+RTS_PRIVATE bool awaitEventPending(void);
+
+#if !defined(mingw32_HOST_OS)
+
+/* On Linux, threads blocked on I/O and delays are managed by an
+ * epoll()-based backend (posix/Epoll.c).  Elsewhere, the portable
+ * select()-based backend (posix/Select.c) is used.
+ */
+#if defined(HAVE_SYS_EPOLL_H)
+#define AWAIT_EVENT_EPOLL 1
 #endif
+
+/* awaitEventBlockThread(cap, tso)
+ *
+ * Add a thread that is about to block on I/O (BlockedOnRead or
+ * BlockedOnWrite, tso->block_info.fd set) or on a delay
+ * (BlockedOnDelay, tso->block_info.target set) to the set of threads
+ * that awaitEvent() checks.
+ *
+ * Called from STG :  YES (waitRead#, waitWrite#, delay#)
+ */
+RTS_PRIVATE void awaitEventBlockThread (Capability *cap, StgTSO *tso);
+
+/* Remove a blocked thread again, e.g. when it receives an exception */
+RTS_PRIVATE void awaitEventRemoveThread (Capability *cap, StgTSO *tso);
+
+/* GC roots held by the backend */
+RTS_PRIVATE void markAwaitEvent (evac_fn evac, void *user);
+
+RTS_PRIVATE void initAwaitEvent (void);
+RTS_PRIVATE void exitAwaitEvent (void);
+
+#endif /* !mingw32_HOST_OS */
+#endif /* !THREADED_RTS */
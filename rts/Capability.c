@@ -20,6 +20,7 @@
 #include "Rts.h"
 
 #include "Capability.h"
+#include "AllocSample.h"
 #include "Schedule.h"
 #include "Sparks.h"
 #include "Trace.h"
@@ -48,6 +49,13 @@ uint32_t enabled_capabilities = 0;
 // an array of Capability* rather than an array of Capability.
 Capability **capabilities = NULL;
 
+#if defined(THREADED_RTS)
+// The number of Capabilities that releaseCapability_() left free with
+// nothing to do.  scheduleThread() only looks for an idle Capability to
+// wake up when this is non-zero.
+volatile StgWord n_parked_capabilities = 0;
+#endif
+
 // Holds the Capability which last became free.  This is used so that
 // an in-call has a chance of quickly finding a free Capability.
 // Maintaining a global free list of Capabilities would require global
@@ -91,13 +99,25 @@ globalWorkToDo (void)
 #endif
 
 #if defined(THREADED_RTS)
+// Pick a pseudo-random capability to start stealing from (xorshift)
+STATIC_INLINE uint32_t
+nextVictim (Capability *cap)
+{
+    uint32_t x = cap->steal_seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    cap->steal_seed = x;
+    return x % n_capabilities;
+}
+
 StgClosure *
 findSpark (Capability *cap)
 {
   Capability *robbed;
   StgClosurePtr spark;
   bool retry;
-  uint32_t i = 0;
+  uint32_t i = 0, start;
 
   if (!emptyRunQueue(cap) || cap->n_returning_tasks != 0) {
       // If there are other threads, don't try to run any new
@@ -139,21 +159,30 @@ findSpark (Capability *cap)
                  "cap %d: Trying to steal work from other capabilities",
                  cap->no);
 
-      /* visit cap.s 0..n-1 in sequence until a theft succeeds. We could
-      start at a random place instead of 0 as well.  */
+      /* visit the other cap.s, starting at a random one, until a theft
+         succeeds.  Starting at 0 every time means that all the idle
+         capabilities gang up on the same victims.  A successful theft
+         takes half of the victim's sparks and moves the ones we don't
+         run right now into our own pool (see Note [Stealing half of a
+         deque] in WSDeque.c).  */
+      start = nextVictim(cap);
       for ( i=0 ; i < n_capabilities ; i++ ) {
-          robbed = capabilities[i];
+          robbed = capabilities[(start + i) % n_capabilities];
           if (cap == robbed)  // ourselves...
               continue;
 
           if (emptySparkPoolCap(robbed)) // nothing to steal here
               continue;
 
-          spark = tryStealSpark(robbed->sparks);
+          spark = tryStealSparks(robbed->sparks, cap->sparks);
           while (spark != NULL && fizzledSpark(spark)) {
               cap->spark_stats.fizzled++;
               traceEventSparkFizzle(cap);
-              spark = tryStealSpark(robbed->sparks);
+              // the rest of the batch is in our own pool now
+              spark = tryStealSpark(cap->sparks);
+              if (spark == NULL) {
+                  spark = tryStealSparks(robbed->sparks, cap->sparks);
+              }
           }
           if (spark == NULL && !emptySparkPoolCap(robbed)) {
               // we conflicted with another thread while trying to steal;
@@ -258,6 +287,7 @@ initCapability (Capability *cap, uint32_t i)
 #if defined(THREADED_RTS)
     initMutex(&cap->lock);
     cap->running_task      = NULL; // indicates cap is free
+    cap->parked            = false;
     cap->spare_workers     = NULL;
     cap->n_spare_workers   = 0;
     cap->suspended_ccalls  = NULL;
@@ -268,6 +298,8 @@ initCapability (Capability *cap, uint32_t i)
     cap->inbox              = (Message*)END_TSO_QUEUE;
     cap->putMVars           = NULL;
     cap->sparks             = allocSparkPool();
+    cap->stealable_threads  = newWSDeque(STEALABLE_THREADS_SIZE);
+    cap->steal_seed         = i + 1; // xorshift: must be non-zero
     cap->spark_stats.created    = 0;
     cap->spark_stats.dud        = 0;
     cap->spark_stats.overflowed = 0;
@@ -279,6 +311,7 @@ initCapability (Capability *cap, uint32_t i)
 #endif
 #endif
     cap->total_allocated        = 0;
+    initAllocSample(cap);
 
     cap->f.stgEagerBlackholeInfo = (W_)&__stg_EAGER_BLACKHOLE_info;
     cap->f.stgGCEnter1     = (StgFunPtr)__stg_gc_enter_1;
@@ -301,10 +334,17 @@ initCapability (Capability *cap, uint32_t i)
     cap->free_invariant_check_queues = END_INVARIANT_CHECK_QUEUE;
     cap->free_trec_chunks = END_STM_CHUNK_LIST;
     cap->free_trec_headers = NO_TREC;
+    cap->free_trec_indexes = NULL;
     cap->transaction_tokens = 0;
+    cap->stm_deferred_hd = END_STM_WATCH_QUEUE;
+    cap->stm_deferred_tl = END_STM_WATCH_QUEUE;
+    memset(&cap->stm_stats, 0, sizeof(cap->stm_stats));
     cap->context_switch = 0;
     cap->pinned_object_block = NULL;
     cap->pinned_object_blocks = NULL;
+    cap->block_cache = NULL;
+    cap->n_block_cache = 0;
+    cap->n_spt_cache = 0;
 
 #if defined(PROFILING)
     cap->r.rCCCS = CCS_SYSTEM;
@@ -514,6 +554,11 @@ releaseCapability_ (Capability* cap,
 
     cap->running_task = NULL;
 
+    // a Task sending us a message might not have seen running_task
+    // change, so we must see its message.  See Note [Lock-free inbox]
+    // in Messages.c.
+    store_load_barrier();
+
     // Check to see whether a worker thread can be given
     // the go-ahead to return the result of an external call..
     if (cap->n_returning_tasks != 0) {
@@ -567,6 +612,7 @@ releaseCapability_ (Capability* cap,
     // anything else to do, give the Capability to a worker thread.
     if (always_wakeup ||
         !emptyRunQueue(cap) || !emptyInbox(cap) ||
+        !emptyStealableThreads(cap) || !emptyStmDeferred(cap) ||
         (!cap->disabled && !emptySparkPoolCap(cap)) || globalWorkToDo()) {
         if (cap->spare_workers) {
             giveCapabilityToTask(cap, cap->spare_workers);
@@ -579,6 +625,9 @@ releaseCapability_ (Capability* cap,
     cap->r.rCCCS = CCS_IDLE;
 #endif
     last_free_capability[cap->node] = cap;
+    ASSERT(!cap->parked);
+    cap->parked = true;
+    atomic_inc(&n_parked_capabilities, 1);
     debugTrace(DEBUG_sched, "freeing capability %d", cap->no);
 }
 
@@ -683,7 +732,7 @@ static Capability * waitForWorkerCapability (Task *task)
             cap->n_spare_workers--;
         }
 
-        cap->running_task = task;
+        setRunningTask(cap, task);
         RELEASE_LOCK(&cap->lock);
         break;
     }
@@ -724,7 +773,7 @@ static Capability * waitForReturnCapability (Task *task)
                 RELEASE_LOCK(&cap->lock);
                 continue;
             }
-            cap->running_task = task;
+            setRunningTask(cap, task);
             popReturningTask(cap);
             RELEASE_LOCK(&cap->lock);
             break;
@@ -798,7 +847,7 @@ void waitForCapability (Capability **pCap, Task *task)
     ACQUIRE_LOCK(&cap->lock);
     if (!cap->running_task) {
         // It's free; just grab it
-        cap->running_task = task;
+        setRunningTask(cap, task);
         RELEASE_LOCK(&cap->lock);
     } else {
         newReturningTask(cap,task);
@@ -859,6 +908,7 @@ yieldCapability (Capability** pCap, Task *task, bool gcAllowed)
                 gcWorkerThread(cap);
                 traceEventGcEnd(cap);
                 traceSparkCounters(cap);
+                traceSTMCounters(cap);
                 // See Note [migrated bound threads 2]
                 if (task->cap == cap) {
                     return true;
@@ -953,7 +1003,7 @@ prodCapability (Capability *cap, Task *task)
 {
     ACQUIRE_LOCK(&cap->lock);
     if (!cap->running_task) {
-        cap->running_task = task;
+        setRunningTask(cap, task);
         releaseCapability_(cap,true);
     }
     RELEASE_LOCK(&cap->lock);
@@ -982,7 +1032,7 @@ tryGrabCapability (Capability *cap, Task *task)
         return false;
     }
     task->cap = cap;
-    cap->running_task = task;
+    setRunningTask(cap, task);
     RELEASE_LOCK(&cap->lock);
     return true;
 }
@@ -1033,7 +1083,7 @@ shutdownCapability (Capability *cap USED_IF_THREADS,
             yieldThread();
             continue;
         }
-        cap->running_task = task;
+        setRunningTask(cap, task);
 
         if (cap->spare_workers) {
             // Look for workers that have died without removing
@@ -1092,6 +1142,7 @@ shutdownCapability (Capability *cap USED_IF_THREADS,
         }
 
         traceSparkCounters(cap);
+        traceSTMCounters(cap);
         RELEASE_LOCK(&cap->lock);
         break;
     }
@@ -1125,6 +1176,7 @@ freeCapability (Capability *cap)
     stgFree(cap->saved_mut_lists);
 #if defined(THREADED_RTS)
     freeSparkPool(cap->sparks);
+    freeWSDeque(cap->stealable_threads);
 #endif
     traceCapsetRemoveCap(CAPSET_OSPROCESS_DEFAULT, cap->no);
     traceCapsetRemoveCap(CAPSET_CLOCKDOMAIN_DEFAULT, cap->no);
@@ -1175,8 +1227,12 @@ markCapability (evac_fn evac, void *user, Capability *cap,
          incall=incall->next) {
         evac(user, (StgClosure **)(void *)&incall->suspended_tso);
     }
+    evac(user, (StgClosure **)(void *)&cap->stm_deferred_hd);
+    evac(user, (StgClosure **)(void *)&cap->stm_deferred_tl);
 
 #if defined(THREADED_RTS)
+    traverseStealableThreads(evac, user, cap);
+
     if (!no_mark_sparks) {
         traverseSparkQueue (evac, user, cap);
     }
@@ -26,6 +26,20 @@
 
 #include "BeginPrivate.h"
 
+// Number of free stable pointer table entries a Capability can cache
+#define SPT_CACHE_SIZE 64
+
+// Stats on threads woken from STM retry, see Note [STM wakeup batching]
+// in STM.c
+typedef struct {
+    StgWord woken;       // threads woken by a commit
+    StgWord deferred;    // wakeups put off because of STM_WAKEUP_BATCH
+    StgWord skipped;     // deferred wakeups dropped: nothing read had changed
+    StgWord rewaited;    // woken threads whose transaction was still valid
+    StgWord reexecuted;  // woken threads that re-executed their transaction
+    StgWord committed;   // re-executions that committed
+} STMCounters;
+
 struct Capability_ {
     // State required by the STG virtual machine when running Haskell
     // code.  During STG execution, the BaseReg register always points
@@ -89,6 +103,15 @@ struct Capability_ {
     // full pinned object blocks allocated since the last GC
     bdescr *pinned_object_blocks;
 
+    // single free blocks taken in a batch from the free list of this
+    // Capability's NUMA node, see Note [Capability block cache]
+    bdescr *block_cache;
+    uint32_t n_block_cache; // count of above
+
+    // free stable pointer table entries, see Note [Stable pointer table]
+    StgWord spt_cache[SPT_CACHE_SIZE];
+    uint32_t n_spt_cache; // count of above
+
     // per-capability weak pointer list associated with nursery (older
     // lists stored in generation object)
     StgWeak *weak_ptr_list_hd;
@@ -112,16 +135,26 @@ struct Capability_ {
     // See [Note allocation accounting] in Storage.c
     W_ total_allocated;
 
+    // Take an allocation sample when total_allocated reaches
+    // alloc_sample_next; alloc_sample_last is total_allocated at the
+    // previous sample.  See Note [Allocation sampling] in AllocSample.c
+    W_ alloc_sample_next;
+    W_ alloc_sample_last;
+
 #if defined(THREADED_RTS)
     // Worker Tasks waiting in the wings.  Singly-linked.
     Task *spare_workers;
     uint32_t n_spare_workers; // count of above
 
+    // true if the Capability was left free with nothing to do, in which
+    // case it is counted in n_parked_capabilities.  Protected by lock.
+    bool parked;
+
     // This lock protects:
     //    running_task
+    //    parked
     //    returning_tasks_{hd,tl}
     //    wakeup_queue
-    //    inbox
     //    putMVars
     Mutex lock;
 
@@ -135,7 +168,7 @@ struct Capability_ {
     uint32_t n_returning_tasks;
 
     // Messages, or END_TSO_QUEUE.
-    // Locks required: cap->lock
+    // Locks required: none, see Note [Lock-free inbox] in Messages.c
     Message *inbox;
 
     // putMVars are really messages, but they're allocated with malloc() so they
@@ -144,6 +177,13 @@ struct Capability_ {
 
     SparkPool *sparks;
 
+    // New threads that idle capabilities may steal, see Note [Stealing
+    // threads] in Schedule.c.  Only the owner pushes.
+    WSDeque *stealable_threads;
+
+    // State of the random choice of victim in findSpark()
+    uint32_t steal_seed;
+
     // Stats on spark creation/conversion
     SparkCounters spark_stats;
 #if !defined(mingw32_HOST_OS)
@@ -157,7 +197,15 @@ struct Capability_ {
     StgInvariantCheckQueue *free_invariant_check_queues;
     StgTRecChunk *free_trec_chunks;
     StgTRecHeader *free_trec_headers;
+    StgArrBytes *free_trec_indexes;
     uint32_t transaction_tokens;
+
+    // Threads whose wakeup from STM retry has been put off, linked
+    // through next_queue_entry (END_STM_WATCH_QUEUE if empty).  See
+    // Note [STM wakeup batching] in STM.c
+    StgTVarWatchQueue *stm_deferred_hd;
+    StgTVarWatchQueue *stm_deferred_tl;
+    STMCounters stm_stats;
 } // typedef Capability is defined in RtsAPI.h
   // We never want a Capability to overlap a cache line with anything
   // else, so round it up to a cache line size:
@@ -251,6 +299,11 @@ INLINE_HEADER void releaseCapability_ (Capability* cap STG_UNUSED,
 // Array of all the capabilities
 extern Capability **capabilities;
 
+#if defined(THREADED_RTS)
+// The number of Capabilities that are parked (cap->parked)
+extern volatile StgWord n_parked_capabilities;
+#endif
+
 //
 // Types of global synchronisation
 //
@@ -391,6 +444,12 @@ typedef struct PutMVar_ {
 
 INLINE_HEADER bool emptyInbox(Capability *cap);
 
+// Add a message to cap's inbox; any Capability may do this
+INLINE_HEADER void pushInbox (Capability *cap, Message *msg);
+
+// Take all the messages in cap's inbox; only its owner may do this
+INLINE_HEADER Message *takeInbox (Capability *cap);
+
 #endif // THREADED_RTS
 
 /* -----------------------------------------------------------------------------
@@ -437,6 +496,18 @@ sparkPoolSizeCap (Capability *cap)
 INLINE_HEADER void
 discardSparksCap (Capability *cap)
 { discardSparks(cap->sparks); }
+
+INLINE_HEADER bool
+emptyStealableThreads (Capability *cap)
+{ return looksEmptyWSDeque(cap->stealable_threads); }
+
+// No STM wakeups are deferred, see Note [STM wakeup batching] in STM.c
+INLINE_HEADER bool
+emptyStmDeferred (Capability *cap)
+{
+    return (StgClosure *)cap->stm_deferred_hd
+        == &stg_END_STM_WATCH_QUEUE_closure;
+}
 #endif
 
 INLINE_HEADER void
@@ -472,6 +543,36 @@ INLINE_HEADER bool emptyInbox(Capability *cap)
             cap->putMVars == NULL);
 }
 
+// See Note [Lock-free inbox] in Messages.c
+INLINE_HEADER void pushInbox (Capability *cap, Message *msg)
+{
+    Message *old;
+
+    do {
+        old = (Message*)VOLATILE_LOAD(&cap->inbox);
+        msg->link = old;
+    } while (cas((StgVolatilePtr)&cap->inbox, (StgWord)old, (StgWord)msg)
+             != (StgWord)old);
+}
+
+INLINE_HEADER Message *takeInbox (Capability *cap)
+{
+    if (cap->inbox == (Message*)END_TSO_QUEUE) {
+        return (Message*)END_TSO_QUEUE;
+    }
+    return (Message*)xchg((StgPtr)&cap->inbox, (StgWord)END_TSO_QUEUE);
+}
+
+// Make task the owner of the free Capability cap.  Requires cap->lock.
+INLINE_HEADER void setRunningTask (Capability *cap, Task *task)
+{
+    cap->running_task = task;
+    if (cap->parked) {
+        cap->parked = false;
+        atomic_dec(&n_parked_capabilities);
+    }
+}
+
 #endif
 
 #include "EndPrivate.h"
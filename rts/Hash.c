@@ -1,11 +1,10 @@
 /*-----------------------------------------------------------------------------
  *
  * (c) The AQUA Project, Glasgow University, 1995-1998
- * (c) The GHC Team, 1999
+ * (c) The GHC Team, 1999-2017
  *
- * Dynamically expanding linear hash tables, as described in
- * Per-\AAke Larson, ``Dynamic Hash Tables,'' CACM 31(4), April 1988,
- * pp. 446 -- 457.
+ * Open-addressing hash tables with SIMD-friendly probing, in the style
+ * of Google's SwissTable.  See Note [Hash table layout].
  * -------------------------------------------------------------------------- */
 
 #include "PosixSource.h"
@@ -16,87 +15,100 @@
 
 #include <string.h>
 
-#define HSEGSIZE    1024    /* Size of a single hash table segment */
-                            /* Also the minimum size of a hash table */
-#define HDIRSIZE    1024    /* Size of the segment directory */
-                            /* Maximum hash table size is HSEGSIZE * HDIRSIZE */
-#define HLOAD       5       /* Maximum average load of a single hash bucket */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-#define HCHUNK      (1024 * sizeof(W_) / sizeof(HashList))
-                            /* Number of HashList cells to allocate in one go */
+/* Note [Hash table layout]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * A table of capacity C (a power of 2) is an array of C (key, data)
+ * slots and an array of C control bytes, one per slot:
+ *
+ *    HEMPTY     the slot has never been used since the last rehash
+ *    HDELETED   the slot held an entry that was removed (a tombstone)
+ *    0..127     the slot is full; the byte holds 7 bits of the key's
+ *               hash (h2), the other bits (h1) choose the first slot
+ *
+ * Looking up a key reads the control bytes HGROUP at a time, starting
+ * at slot (h1 & (C-1)), compares all of them with h2 at once (with SSE2
+ * if available), and only compares keys in the slots that match.  Each
+ * probe moves to the next group with triangular steps, which visit every
+ * group of a power-of-2 table, and stops at the first group containing
+ * an HEMPTY slot.  To let a group straddle the end of the table, the
+ * first HGROUP control bytes are mirrored after the last one.
+ *
+ * The table grows when more than 7/8 of the slots are full or deleted,
+ * so there is always an HEMPTY slot to end a probe.  Tables with
+ * user-supplied hash functions (string keys, StaticPtrTable, FileLock)
+ * also keep the full hash of each slot, so that rehashing never calls
+ * the hash function again, and keys are only compared when the full
+ * hashes are equal.
+ *
+ * As with the chained tables that this replaced, a key may be inserted
+ * more than once; lookupHashTable() returns the data most recently
+ * inserted under the key, and removeHashTable() with data == NULL
+ * removes that entry.  insertHashTable() keeps the duplicates of a key
+ * ordered from newest to oldest along the probe sequence.
+ */
+
+#define HGROUP      16      /* control bytes examined at once */
+#define HMINSIZE    32      /* minimum capacity of a table */
 
+#define HEMPTY      ((uint8_t)0x80)
+#define HDELETED    ((uint8_t)0xfe)
+#define IS_FULL(c)  (((c) & 0x80) == 0)
 
-/* Linked list of (key, data) pairs for separate chaining */
-typedef struct hashlist {
+typedef struct {
     StgWord key;
     const void *data;
-    struct hashlist *next;  /* Next cell in bucket chain (same hash value) */
-} HashList;
-
-typedef struct chunklist {
-  HashList *chunk;
-  struct chunklist *next;
-} HashListChunk;
+} HashEntry;
 
 struct hashtable {
-    int split;              /* Next bucket to split when expanding */
-    int max;                /* Max bucket of smaller table */
-    int mask1;              /* Mask for doing the mod of h_1 (smaller table) */
-    int mask2;              /* Mask for doing the mod of h_2 (larger table) */
-    int kcount;             /* Number of keys */
-    int bcount;             /* Number of buckets */
-    HashList **dir[HDIRSIZE];   /* Directory of segments */
-    HashList *freeList;         /* free list of HashLists */
-    HashListChunk *chunks;
+    uint8_t *ctrl;              /* capacity + HGROUP control bytes */
+    HashEntry *slots;           /* capacity slots */
+    uint32_t *hashes;           /* full hash of each slot, or NULL */
+    bool keep_hashes;           /* hashes != NULL */
+    bool dups;                  /* may hold a key more than once */
+    uint32_t mask;              /* capacity - 1 */
+    int kcount;                 /* Number of keys */
+    int dcount;                 /* Number of deleted slots */
     HashFunction *hash;         /* hash function */
     CompareFunction *compare;   /* key comparison function */
 };
 
+#define CAPACITY(t) ((t)->mask + 1)
+
 /* -----------------------------------------------------------------------------
- * Hash first using the smaller table.  If the bucket is less than the
- * next bucket to be split, re-hash using the larger table.
+ * Hash functions.  These return the full hash of the key; the table
+ * picks the bits it needs.
  * -------------------------------------------------------------------------- */
 
 int
-hashWord(const HashTable *table, StgWord key)
+hashWord(const HashTable *table STG_UNUSED, StgWord key)
 {
-    int bucket;
-
-    /* Strip the boring zero bits */
-    key /= sizeof(StgWord);
-
-    /* Mod the size of the hash table (a power of 2) */
-    bucket = key & table->mask1;
-
-    if (bucket < table->split) {
-        /* Mod the size of the expanded hash table (also a power of 2) */
-        bucket = key & table->mask2;
-    }
-    return bucket;
+    /* the finaliser of MurmurHash3, which mixes all the bits of the
+     * key, including the boring zero bits at the bottom */
+    StgWord64 h = (StgWord64)key;
+
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    return (int)(StgWord32)h;
 }
 
 int
-hashStr(const HashTable *table, char *key)
+hashStr(const HashTable *table STG_UNUSED, char *key)
 {
-    int h, bucket;
-    char *s;
-
-    s = key;
-    for (h=0; *s; s++) {
-        h *= 128;
-        h += *s;
-        h = h % 1048583;        /* some random large prime */
-    }
+    /* FNV-1a */
+    StgWord32 h = 2166136261U;
+    unsigned char *s;
 
-    /* Mod the size of the hash table (a power of 2) */
-    bucket = h & table->mask1;
-
-    if (bucket < table->split) {
-        /* Mod the size of the expanded hash table (also a power of 2) */
-        bucket = h & table->mask2;
+    for (s = (unsigned char *)key; *s; s++) {
+        h ^= *s;
+        h *= 16777619U;
     }
-
-    return bucket;
+    return (int)h;
 }
 
 static int
@@ -111,228 +123,338 @@ compareStr(StgWord key1, StgWord key2)
     return (strcmp((char *)key1, (char *)key2) == 0);
 }
 
+STATIC_INLINE uint32_t
+getHash(const HashTable *table, StgWord key)
+{
+    return (uint32_t)table->hash(table, key);
+}
+
+#define H1(h) ((h) >> 7)
+#define H2(h) ((uint8_t)((h) & 0x7f))
 
 /* -----------------------------------------------------------------------------
- * Allocate a new segment of the dynamically growing hash table.
+ * Groups of control bytes
  * -------------------------------------------------------------------------- */
 
-static void
-allocSegment(HashTable *table, int segment)
+/* Bit i of the result is set if ctrl[i] == b, for 0 <= i < HGROUP */
+STATIC_INLINE uint32_t
+matchGroup(const uint8_t *ctrl, uint8_t b)
 {
-    table->dir[segment] = stgMallocBytes(HSEGSIZE * sizeof(HashList *),
-                                         "allocSegment");
+#if defined(__SSE2__)
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+    return (uint32_t)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(group, _mm_set1_epi8((char)b)));
+#else
+    uint32_t bits = 0;
+    int i;
+    for (i = 0; i < HGROUP; i++) {
+        bits |= (uint32_t)(ctrl[i] == b) << i;
+    }
+    return bits;
+#endif
 }
 
+/* Bit i of the result is set if ctrl[i] is HEMPTY or HDELETED */
+STATIC_INLINE uint32_t
+matchFree(const uint8_t *ctrl)
+{
+#if defined(__SSE2__)
+    /* the free bytes are exactly those with the top bit set */
+    return (uint32_t)_mm_movemask_epi8(
+        _mm_loadu_si128((const __m128i *)ctrl));
+#else
+    uint32_t bits = 0;
+    int i;
+    for (i = 0; i < HGROUP; i++) {
+        bits |= (uint32_t)(!IS_FULL(ctrl[i])) << i;
+    }
+    return bits;
+#endif
+}
 
-/* -----------------------------------------------------------------------------
- * Expand the larger hash table by one bucket, and split one bucket
- * from the smaller table into two parts.  Only the bucket referenced
- * by @table->split@ is affected by the expansion.
- * -------------------------------------------------------------------------- */
+STATIC_INLINE int
+lowestBit(uint32_t bits)
+{
+    return __builtin_ctz(bits);
+}
 
-static void
-expand(HashTable *table)
+STATIC_INLINE void
+setCtrl(HashTable *table, uint32_t i, uint8_t c)
 {
-    int oldsegment;
-    int oldindex;
-    int newbucket;
-    int newsegment;
-    int newindex;
-    HashList *hl;
-    HashList *next;
-    HashList *old, *new;
-
-    if (table->split + table->max >= HDIRSIZE * HSEGSIZE)
-        /* Wow!  That's big.  Too big, so don't expand. */
-        return;
-
-    /* Calculate indices of bucket to split */
-    oldsegment = table->split / HSEGSIZE;
-    oldindex = table->split % HSEGSIZE;
-
-    newbucket = table->max + table->split;
-
-    /* And the indices of the new bucket */
-    newsegment = newbucket / HSEGSIZE;
-    newindex = newbucket % HSEGSIZE;
-
-    if (newindex == 0)
-        allocSegment(table, newsegment);
-
-    if (++table->split == table->max) {
-        table->split = 0;
-        table->max *= 2;
-        table->mask1 = table->mask2;
-        table->mask2 = table->mask2 << 1 | 1;
+    table->ctrl[i] = c;
+    if (i < HGROUP) {
+        table->ctrl[i + CAPACITY(table)] = c;
     }
-    table->bcount++;
+}
 
-    /* Split the bucket, paying no attention to the original order */
+STATIC_INLINE bool
+keyMatches(const HashTable *table, uint32_t i, StgWord key, uint32_t h)
+{
+    if (table->hashes != NULL && table->hashes[i] != h) {
+        return false;
+    }
+    return table->compare(table->slots[i].key, key);
+}
 
-    old = new = NULL;
-    for (hl = table->dir[oldsegment][oldindex]; hl != NULL; hl = next) {
-        next = hl->next;
-        if (table->hash(table, hl->key) == newbucket) {
-            hl->next = new;
-            new = hl;
-        } else {
-            hl->next = old;
-            old = hl;
+// The slot holding the newest entry for key with the given data (any
+// data if data == NULL), or -1
+static long
+findSlot(const HashTable *table, StgWord key, const void *data)
+{
+    uint32_t h = getHash(table, key);
+    uint32_t pos = H1(h) & table->mask;
+    uint32_t step = 0;
+    uint32_t bits, i;
+
+    for (;;) {
+        bits = matchGroup(&table->ctrl[pos], H2(h));
+        while (bits != 0) {
+            i = (pos + lowestBit(bits)) & table->mask;
+            if (keyMatches(table, i, key, h) &&
+                (data == NULL || table->slots[i].data == data)) {
+                return i;
+            }
+            bits &= bits - 1;
         }
+        if (matchGroup(&table->ctrl[pos], HEMPTY) != 0) {
+            return -1;
+        }
+        step += HGROUP;
+        pos = (pos + step) & table->mask;
     }
-    table->dir[oldsegment][oldindex] = old;
-    table->dir[newsegment][newindex] = new;
-
-    return;
 }
 
-void *
-lookupHashTable(const HashTable *table, StgWord key)
+/* -----------------------------------------------------------------------------
+ * Allocating and resizing
+ * -------------------------------------------------------------------------- */
+
+static void
+allocSlots(HashTable *table, uint32_t capacity)
 {
-    int bucket;
-    int segment;
-    int index;
-    HashList *hl;
-
-    bucket = table->hash(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
-
-    CompareFunction *cmp = table->compare;
-    for (hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-        if (cmp(hl->key, key))
-            return (void *) hl->data;
+    table->mask = capacity - 1;
+    table->ctrl = stgMallocBytes(capacity + HGROUP, "allocHashTable");
+    memset(table->ctrl, HEMPTY, capacity + HGROUP);
+    table->slots = stgMallocBytes(capacity * sizeof(HashEntry),
+                                  "allocHashTable");
+    table->hashes = NULL;
+    if (table->keep_hashes) {
+        table->hashes = stgMallocBytes(capacity * sizeof(uint32_t),
+                                       "allocHashTable");
     }
+    table->dcount = 0;
+}
 
-    /* It's not there */
-    return NULL;
+// Place an entry in the first free slot of its probe sequence.  Only
+// used when rehashing, when the table holds no duplicates of the key
+// that would have to come first.
+static void
+placeEntry(HashTable *table, StgWord key, const void *data, uint32_t h)
+{
+    uint32_t pos = H1(h) & table->mask;
+    uint32_t step = 0;
+    uint32_t bits, i;
+
+    for (;;) {
+        bits = matchFree(&table->ctrl[pos]);
+        if (bits != 0) {
+            i = (pos + lowestBit(bits)) & table->mask;
+            setCtrl(table, i, H2(h));
+            table->slots[i].key = key;
+            table->slots[i].data = data;
+            if (table->hashes != NULL) {
+                table->hashes[i] = h;
+            }
+            return;
+        }
+        step += HGROUP;
+        pos = (pos + step) & table->mask;
+    }
 }
 
-// Puts up to szKeys keys of the hash table into the given array. Returns the
-// actual amount of keys that have been retrieved.
-//
-// If the table is modified concurrently, the function behavior is undefined.
-//
-int keysHashTable(HashTable *table, StgWord keys[], int szKeys) {
-    int segment, index;
-    int k = 0;
-    HashList *hl;
+STATIC_INLINE uint32_t
+slotHash(const HashTable *table, uint32_t i)
+{
+    return table->hashes != NULL ? table->hashes[i]
+                                 : getHash(table, table->slots[i].key);
+}
 
+static void
+rehash(HashTable *table, uint32_t new_capacity)
+{
+    HashTable old = *table;
+    uint32_t i, j, h, pos, step, bits, n;
 
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    segment = (table->max + table->split - 1) / HSEGSIZE;
-    index = (table->max + table->split - 1) % HSEGSIZE;
+    allocSlots(table, new_capacity);
 
-    while (segment >= 0 && k < szKeys) {
-        while (index >= 0 && k < szKeys) {
-            hl = table->dir[segment][index];
-            while (hl && k < szKeys) {
-                keys[k] = hl->key;
-                k += 1;
-                hl = hl->next;
+    if (!old.dups) {
+        for (i = 0; i <= old.mask; i++) {
+            if (IS_FULL(old.ctrl[i])) {
+                placeEntry(table, old.slots[i].key, old.slots[i].data,
+                           slotHash(&old, i));
+            }
+        }
+    } else {
+        /* Keep the duplicates of each key in the same order: when we
+         * find the first (newest) entry of a key, place all the
+         * entries for that key in the order of its old probe
+         * sequence. */
+        table->dups = false;
+        for (i = 0; i <= old.mask; i++) {
+            if (!IS_FULL(old.ctrl[i])) continue;
+            if (findSlot(&old, old.slots[i].key, NULL) != (long)i) continue;
+
+            h = slotHash(&old, i);
+            pos = H1(h) & old.mask;
+            step = 0;
+            n = 0;
+            for (;;) {
+                bits = matchGroup(&old.ctrl[pos], H2(h));
+                while (bits != 0) {
+                    j = (pos + lowestBit(bits)) & old.mask;
+                    if (keyMatches(&old, j, old.slots[i].key, h)) {
+                        placeEntry(table, old.slots[j].key,
+                                   old.slots[j].data, h);
+                        n++;
+                    }
+                    bits &= bits - 1;
+                }
+                if (matchGroup(&old.ctrl[pos], HEMPTY) != 0) break;
+                step += HGROUP;
+                pos = (pos + step) & old.mask;
             }
-            index--;
+            if (n > 1) table->dups = true;
         }
-        segment--;
-        index = HSEGSIZE - 1;
     }
-    return k;
+
+    stgFree(old.ctrl);
+    stgFree(old.slots);
+    stgFree(old.hashes);
 }
 
 /* -----------------------------------------------------------------------------
- * We allocate the hashlist cells in large chunks to cut down on malloc
- * overhead.  Although we keep a free list of hashlist cells, we make
- * no effort to actually return the space to the malloc arena.
+ * The HashTable API
  * -------------------------------------------------------------------------- */
 
-static HashList *
-allocHashList (HashTable *table)
+void *
+lookupHashTable(const HashTable *table, StgWord key)
 {
-    HashList *hl, *p;
-    HashListChunk *cl;
+    long i = findSlot(table, key, NULL);
 
-    if ((hl = table->freeList) != NULL) {
-        table->freeList = hl->next;
-    } else {
-        hl = stgMallocBytes(HCHUNK * sizeof(HashList), "allocHashList");
-        cl = stgMallocBytes(sizeof (*cl), "allocHashList: chunkList");
-        cl->chunk = hl;
-        cl->next = table->chunks;
-        table->chunks = cl;
-
-        table->freeList = hl + 1;
-        for (p = table->freeList; p < hl + HCHUNK - 1; p++)
-            p->next = p + 1;
-        p->next = NULL;
+    if (i < 0) {
+        /* It's not there */
+        return NULL;
     }
-    return hl;
+    return (void *) table->slots[i].data;
 }
 
-static void
-freeHashList (HashTable *table, HashList *hl)
-{
-    hl->next = table->freeList;
-    table->freeList = hl;
+// Puts up to szKeys keys of the hash table into the given array. Returns the
+// actual amount of keys that have been retrieved.
+//
+// If the table is modified concurrently, the function behavior is undefined.
+//
+int keysHashTable(HashTable *table, StgWord keys[], int szKeys) {
+    uint32_t i;
+    int k = 0;
+
+    for (i = 0; i < CAPACITY(table) && k < szKeys; i++) {
+        if (IS_FULL(table->ctrl[i])) {
+            keys[k++] = table->slots[i].key;
+        }
+    }
+    return k;
 }
 
 void
 insertHashTable(HashTable *table, StgWord key, const void *data)
 {
-    int bucket;
-    int segment;
-    int index;
-    HashList *hl;
+    uint32_t h, pos, step, full, bits, i, b;
+    HashEntry carry;
 
     // Disable this assert; sometimes it's useful to be able to
     // overwrite entries in the hash table.
     // ASSERT(lookupHashTable(table, key) == NULL);
 
-    /* When the average load gets too high, we expand the table */
-    if (++table->kcount >= HLOAD * table->bcount)
-        expand(table);
-
-    bucket = table->hash(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
-
-    hl = allocHashList(table);
-
-    hl->key = key;
-    hl->data = data;
-    hl->next = table->dir[segment][index];
-    table->dir[segment][index] = hl;
+    /* When the load gets too high, we expand the table, or just clear
+     * out the deleted slots if there are many of them */
+    if ((uint32_t)(table->kcount + table->dcount + 1) >
+        CAPACITY(table) - CAPACITY(table) / 8) {
+        if ((uint32_t)table->kcount + 1 > CAPACITY(table) / 2) {
+            rehash(table, 2 * CAPACITY(table));
+        } else {
+            rehash(table, CAPACITY(table));
+        }
+    }
 
+    h = getHash(table, key);
+    pos = H1(h) & table->mask;
+    step = 0;
+
+    /* Walk the probe sequence to the first free slot.  If we meet an
+     * older entry with the same key first, the new entry takes its
+     * place and the older ones move one place further along; see Note
+     * [Hash table layout]. */
+    carry.key = key;
+    carry.data = data;
+
+    for (;;) {
+        full = matchGroup(&table->ctrl[pos], H2(h));
+        bits = matchFree(&table->ctrl[pos]) | full;
+        while (bits != 0) {
+            b = lowestBit(bits);
+            i = (pos + b) & table->mask;
+            if (!IS_FULL(table->ctrl[i])) {
+                if (table->ctrl[i] == HDELETED) table->dcount--;
+                setCtrl(table, i, H2(h));
+                table->slots[i] = carry;
+                if (table->hashes != NULL) {
+                    table->hashes[i] = h;
+                }
+                table->kcount++;
+                return;
+            }
+            if ((full & (1u << b)) && keyMatches(table, i, key, h)) {
+                HashEntry tmp = table->slots[i];
+                table->slots[i] = carry;
+                carry = tmp;
+                table->dups = true;
+            }
+            bits &= bits - 1;
+        }
+        step += HGROUP;
+        pos = (pos + step) & table->mask;
+    }
 }
 
 void *
 removeHashTable(HashTable *table, StgWord key, const void *data)
 {
-    int bucket;
-    int segment;
-    int index;
-    HashList *hl;
-    HashList *prev = NULL;
-
-    bucket = table->hash(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
-
-    for (hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-        if (table->compare(hl->key,key) && (data == NULL || hl->data == data)) {
-            if (prev == NULL)
-                table->dir[segment][index] = hl->next;
-            else
-                prev->next = hl->next;
-            freeHashList(table,hl);
-            table->kcount--;
-            return (void *) hl->data;
-        }
-        prev = hl;
+    long i = findSlot(table, key, data);
+    uint32_t before, after;
+    const void *ret;
+
+    if (i < 0) {
+        /* It's not there */
+        ASSERT(data == NULL);
+        return NULL;
     }
 
-    /* It's not there */
-    ASSERT(data == NULL);
-    return NULL;
+    ret = table->slots[i].data;
+
+    /* If every group of HGROUP slots that contains this one also
+     * contains an empty slot, no probe can have passed this slot
+     * looking for something further on, so it can be made empty rather
+     * than deleted. */
+    before = matchGroup(&table->ctrl[(i - HGROUP) & table->mask], HEMPTY);
+    after = matchGroup(&table->ctrl[i], HEMPTY);
+    if (before != 0 && after != 0 &&
+        (__builtin_clz(before) - (32 - HGROUP)) + lowestBit(after) < HGROUP) {
+        setCtrl(table, i, HEMPTY);
+    } else {
+        setCtrl(table, i, HDELETED);
+        table->dcount++;
+    }
+    table->kcount--;
+    return (void *) ret;
 }
 
 /* -----------------------------------------------------------------------------
@@ -344,34 +466,18 @@ removeHashTable(HashTable *table, StgWord key, const void *data)
 void
 freeHashTable(HashTable *table, void (*freeDataFun)(void *) )
 {
-    long segment;
-    long index;
-    HashList *hl;
-    HashList *next;
-    HashListChunk *cl, *cl_next;
-
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    segment = (table->max + table->split - 1) / HSEGSIZE;
-    index = (table->max + table->split - 1) % HSEGSIZE;
-
-    while (segment >= 0) {
-        while (index >= 0) {
-            for (hl = table->dir[segment][index]; hl != NULL; hl = next) {
-                next = hl->next;
-                if (freeDataFun != NULL)
-                    (*freeDataFun)((void *) hl->data);
+    uint32_t i;
+
+    if (freeDataFun != NULL) {
+        for (i = 0; i < CAPACITY(table); i++) {
+            if (IS_FULL(table->ctrl[i])) {
+                (*freeDataFun)((void *) table->slots[i].data);
             }
-            index--;
         }
-        stgFree(table->dir[segment]);
-        segment--;
-        index = HSEGSIZE - 1;
-    }
-    for (cl = table->chunks; cl != NULL; cl = cl_next) {
-        cl_next = cl->next;
-        stgFree(cl->chunk);
-        stgFree(cl);
     }
+    stgFree(table->ctrl);
+    stgFree(table->slots);
+    stgFree(table->hashes);
     stgFree(table);
 }
 
@@ -382,54 +488,34 @@ freeHashTable(HashTable *table, void (*freeDataFun)(void *) )
 void
 mapHashTable(HashTable *table, void *data, MapHashFn fn)
 {
-    long segment;
-    long index;
-    HashList *hl;
-
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    segment = (table->max + table->split - 1) / HSEGSIZE;
-    index = (table->max + table->split - 1) % HSEGSIZE;
-
-    while (segment >= 0) {
-        while (index >= 0) {
-            for (hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-                fn(data, hl->key, hl->data);
-            }
-            index--;
+    uint32_t i;
+
+    for (i = 0; i < CAPACITY(table); i++) {
+        if (IS_FULL(table->ctrl[i])) {
+            fn(data, table->slots[i].key, table->slots[i].data);
         }
-        segment--;
-        index = HSEGSIZE - 1;
     }
 }
 
 /* -----------------------------------------------------------------------------
- * When we initialize a hash table, we set up the first segment as well,
- * initializing all of the first segment's hash buckets to NULL.
+ * Allocating a hash table
  * -------------------------------------------------------------------------- */
 
 HashTable *
 allocHashTable_(HashFunction *hash, CompareFunction *compare)
 {
     HashTable *table;
-    HashList **hb;
 
     table = stgMallocBytes(sizeof(HashTable),"allocHashTable");
 
-    allocSegment(table, 0);
-
-    for (hb = table->dir[0]; hb < table->dir[0] + HSEGSIZE; hb++)
-        *hb = NULL;
-
-    table->split = 0;
-    table->max = HSEGSIZE;
-    table->mask1 = HSEGSIZE - 1;
-    table->mask2 = 2 * HSEGSIZE - 1;
     table->kcount = 0;
-    table->bcount = HSEGSIZE;
-    table->freeList = NULL;
-    table->chunks = NULL;
     table->hash = hash;
     table->compare = compare;
+    table->dups = false;
+    /* Remember the full hashes, unless they are as cheap to compute as
+     * comparing the keys; see Note [Hash table layout] */
+    table->keep_hashes = hash != hashWord;
+    allocSlots(table, HMINSIZE);
 
     return table;
 }
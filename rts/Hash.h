@@ -51,7 +51,10 @@ HashTable * allocStrHashTable ( void );
 #define removeStrHashTable(table, key, data) \
    (removeHashTable(table, (StgWord)key, data))
 
-/* Hash tables for arbitrary keys */
+/* Hash tables for arbitrary keys.  A HashFunction returns a hash of the
+ * whole key, which the table reduces to its own size; all its bits
+ * should depend on the key (hashWord and hashStr can be used to mix
+ * them). */
 typedef int HashFunction(const HashTable *table, StgWord key);
 typedef int CompareFunction(StgWord key1, StgWord key2);
 HashTable * allocHashTable_(HashFunction *hash, CompareFunction *compare);
@@ -21,10 +21,38 @@
 
 #if defined(THREADED_RTS)
 
+/* Note [Lock-free inbox]
+   ~~~~~~~~~~~~~~~~~~~~~~
+   Capabilities wake each other's threads (MSG_TRY_WAKEUP), throw to them
+   (MSG_THROWTO) and block on their black holes (MSG_BLACKHOLE) by
+   sending messages to the owner's inbox.  In a program whose threads on
+   different Capabilities keep waking each other up, through MVars say,
+   there is a message for almost every operation, so the inbox doesn't
+   use cap->lock: any number of Capabilities push onto it with a CAS
+   (pushInbox()), and the owner takes the whole list at once with an
+   atomic exchange (takeInbox()).  Since the owner never takes messages
+   off one at a time, there is no ABA problem.  The messages come out
+   newest first, as they always have.
+
+   The one thing the lock still does for the inbox is to make sure that
+   a Capability never goes idle with messages in its inbox.  A sender
+   pushes the message, and then looks at to_cap->running_task.  If there
+   is a running Task, we interrupt it, and it will look at its inbox at
+   its next trip round the scheduler loop.  Otherwise the sender takes
+   cap->lock to wake up a worker on to_cap, just as before.  A Task going
+   idle sets running_task to NULL in releaseCapability_(), and then looks
+   at the inbox to decide whether a worker should take over.  The CAS in
+   pushInbox() and a store_load_barrier() after clearing running_task in
+   releaseCapability_() mean that at least one of the two sees what the
+   other has done.
+
+   Foreign calls to hs_try_putmvar() still put their requests on
+   cap->putMVars under the lock; they are rare, and are malloc()ed, so
+   they can't go on the inbox.
+*/
+
 void sendMessage(Capability *from_cap, Capability *to_cap, Message *msg)
 {
-    ACQUIRE_LOCK(&to_cap->lock);
-
 #if defined(DEBUG)
     {
         const StgInfoTable *i = msg->header.info;
@@ -38,20 +66,24 @@ void sendMessage(Capability *from_cap, Capability *to_cap, Message *msg)
     }
 #endif
 
-    msg->link = to_cap->inbox;
-    to_cap->inbox = msg;
-
     recordClosureMutated(from_cap,(StgClosure*)msg);
 
+    pushInbox(to_cap, msg);
+
+    // See Note [Lock-free inbox]
     if (to_cap->running_task == NULL) {
-        to_cap->running_task = myTask();
-            // precond for releaseCapability_()
-        releaseCapability_(to_cap,false);
+        ACQUIRE_LOCK(&to_cap->lock);
+        if (to_cap->running_task == NULL) {
+            setRunningTask(to_cap, myTask());
+                // precond for releaseCapability_()
+            releaseCapability_(to_cap,false);
+        } else {
+            interruptCapability(to_cap);
+        }
+        RELEASE_LOCK(&to_cap->lock);
     } else {
         interruptCapability(to_cap);
     }
-
-    RELEASE_LOCK(&to_cap->lock);
 }
 
 #endif /* THREADED_RTS */
@@ -338,7 +338,7 @@ printClosure( const StgClosure *obj )
     case TVAR:
         {
           StgTVar* tv = (StgTVar*)obj;
-          debugBelch("TVAR(value=%p, wq=%p, num_updates=%" FMT_Word ")\n", tv->current_value, tv->first_watch_queue_entry, tv->num_updates);
+          debugBelch("TVAR(value=%p, watchers=%p, num_updates=%" FMT_Word ")\n", tv->current_value, tv->watchers, tv->num_updates);
           break;
         }
 
@@ -63,6 +63,9 @@ typedef struct _counter {
         } ldv;
     } c;
     struct _counter *next;
+    // where in the census this identity was first seen, see Note
+    // [Parallel heap census]
+    StgWord64 first;
 } counter;
 
 STATIC_INLINE void
@@ -87,6 +90,10 @@ typedef struct {
     ssize_t    used;
     ssize_t    void_total;
     ssize_t    drag_total;
+
+    // position of the current object in the census, see Note [Parallel
+    // heap census]
+    StgWord64  pos;
 } Census;
 
 static Census *censuses = NULL;
@@ -146,6 +153,11 @@ closureIdentity( const StgClosure *p )
         }
     }
 
+    case HEAP_BY_INFO_TABLE:
+        // the entry code of the info table, i.e. the address of the
+        // symbol (Foo_con_info etc.) that a tool can look up in the binary
+        return p->header.info;
+
 #endif
     default:
         barf("closureIdentity");
@@ -260,6 +272,7 @@ initEra(Census *census)
     census->prim       = 0;
     census->void_total = 0;
     census->drag_total = 0;
+    census->pos        = 0;
 }
 
 STATIC_INLINE void
@@ -821,6 +834,11 @@ dumpCensus( Census *census )
             traceHeapProfSampleString(0, (char *)ctr->identity,
                                       count * sizeof(W_));
             break;
+        case HEAP_BY_INFO_TABLE:
+            fprintf(hp_file, "%p", ctr->identity);
+            traceHeapProfSampleInfoTable(0, ctr->identity,
+                                         count * sizeof(W_));
+            break;
         }
 #endif
 
@@ -886,6 +904,7 @@ static void heapProfObject(Census *census, StgClosure *p, size_t size,
     counter *ctr;
 
             identity = NULL;
+            census->pos++;
 
 #if defined(PROFILING)
             // subtract the profiling overhead
@@ -930,6 +949,7 @@ static void heapProfObject(Census *census, StgClosure *p, size_t size,
                             insertHashTable( census->hash, (StgWord)identity, ctr );
                             ctr->identity = identity;
                             ctr->next = census->ctrs;
+                            ctr->first = census->pos;
                             census->ctrs = ctr;
 
 #if defined(PROFILING)
@@ -958,14 +978,20 @@ static void heapProfObject(Census *census, StgClosure *p, size_t size,
 // so we don't need the loop.
 //
 // See Note [Compact Normal Forms] for details.
+static void
+heapCensusCompactBlock(Census *census, bdescr *bd)
+{
+    StgCompactNFDataBlock *block = (StgCompactNFDataBlock*)bd->start;
+    StgCompactNFData *str = block->owner;
+    heapProfObject(census, (StgClosure*)str,
+                   compact_nfdata_full_sizeW(str), true);
+}
+
 static void
 heapCensusCompactList(Census *census, bdescr *bd)
 {
     for (; bd != NULL; bd = bd->link) {
-        StgCompactNFDataBlock *block = (StgCompactNFDataBlock*)bd->start;
-        StgCompactNFData *str = block->owner;
-        heapProfObject(census, (StgClosure*)str,
-                       compact_nfdata_full_sizeW(str), true);
+        heapCensusCompactBlock(census, bd);
     }
 }
 
@@ -973,199 +999,204 @@ heapCensusCompactList(Census *census, bdescr *bd)
  * Code to perform a heap census.
  * -------------------------------------------------------------------------- */
 static void
-heapCensusChain( Census *census, bdescr *bd )
+heapCensusBlock( Census *census, bdescr *bd )
 {
     StgPtr p;
     const StgInfoTable *info;
     size_t size;
     bool prim;
 
-    for (; bd != NULL; bd = bd->link) {
-
-        // HACK: pretend a pinned block is just one big ARR_WORDS
-        // owned by CCS_PINNED.  These blocks can be full of holes due
-        // to alignment constraints so we can't traverse the memory
-        // and do a proper census.
-        if (bd->flags & BF_PINNED) {
-            StgClosure arr;
-            SET_HDR(&arr, &stg_ARR_WORDS_info, CCS_PINNED);
-            heapProfObject(census, &arr, bd->blocks * BLOCK_SIZE_W, true);
-            continue;
-        }
-
-        p = bd->start;
+    // HACK: pretend a pinned block is just one big ARR_WORDS
+    // owned by CCS_PINNED.  These blocks can be full of holes due
+    // to alignment constraints so we can't traverse the memory
+    // and do a proper census.
+    if (bd->flags & BF_PINNED) {
+        StgClosure arr;
+        SET_HDR(&arr, &stg_ARR_WORDS_info, CCS_PINNED);
+        heapProfObject(census, &arr, bd->blocks * BLOCK_SIZE_W, true);
+        return;
+    }
 
-        // When we shrink a large ARR_WORDS, we do not adjust the free pointer
-        // of the associated block descriptor, thus introducing slop at the end
-        // of the object.  This slop remains after GC, violating the assumption
-        // of the loop below that all slop has been eliminated (#11627).
-        // Consequently, we handle large ARR_WORDS objects as a special case.
-        if (bd->flags & BF_LARGE
-            && get_itbl((StgClosure *)p)->type == ARR_WORDS) {
-            size = arr_words_sizeW((StgArrBytes *)p);
-            prim = true;
-            heapProfObject(census, (StgClosure *)p, size, prim);
-            continue;
-        }
+    p = bd->start;
+
+    // When we shrink a large ARR_WORDS, we do not adjust the free pointer
+    // of the associated block descriptor, thus introducing slop at the end
+    // of the object.  This slop remains after GC, violating the assumption
+    // of the loop below that all slop has been eliminated (#11627).
+    // Consequently, we handle large ARR_WORDS objects as a special case.
+    if (bd->flags & BF_LARGE
+        && get_itbl((StgClosure *)p)->type == ARR_WORDS) {
+        size = arr_words_sizeW((StgArrBytes *)p);
+        prim = true;
+        heapProfObject(census, (StgClosure *)p, size, prim);
+        return;
+    }
 
-        while (p < bd->free) {
-            info = get_itbl((const StgClosure *)p);
-            prim = false;
+    while (p < bd->free) {
+        info = get_itbl((const StgClosure *)p);
+        prim = false;
 
-            switch (info->type) {
+        switch (info->type) {
 
-            case THUNK:
-                size = thunk_sizeW_fromITBL(info);
-                break;
+        case THUNK:
+            size = thunk_sizeW_fromITBL(info);
+            break;
 
-            case THUNK_1_1:
-            case THUNK_0_2:
-            case THUNK_2_0:
-                size = sizeofW(StgThunkHeader) + 2;
-                break;
+        case THUNK_1_1:
+        case THUNK_0_2:
+        case THUNK_2_0:
+            size = sizeofW(StgThunkHeader) + 2;
+            break;
 
-            case THUNK_1_0:
-            case THUNK_0_1:
-            case THUNK_SELECTOR:
-                size = sizeofW(StgThunkHeader) + 1;
-                break;
+        case THUNK_1_0:
+        case THUNK_0_1:
+        case THUNK_SELECTOR:
+            size = sizeofW(StgThunkHeader) + 1;
+            break;
 
-            case FUN:
-            case BLACKHOLE:
-            case BLOCKING_QUEUE:
-            case FUN_1_0:
-            case FUN_0_1:
-            case FUN_1_1:
-            case FUN_0_2:
-            case FUN_2_0:
-            case CONSTR:
-            case CONSTR_NOCAF:
-            case CONSTR_1_0:
-            case CONSTR_0_1:
-            case CONSTR_1_1:
-            case CONSTR_0_2:
-            case CONSTR_2_0:
-                size = sizeW_fromITBL(info);
-                break;
+        case FUN:
+        case BLACKHOLE:
+        case BLOCKING_QUEUE:
+        case FUN_1_0:
+        case FUN_0_1:
+        case FUN_1_1:
+        case FUN_0_2:
+        case FUN_2_0:
+        case CONSTR:
+        case CONSTR_NOCAF:
+        case CONSTR_1_0:
+        case CONSTR_0_1:
+        case CONSTR_1_1:
+        case CONSTR_0_2:
+        case CONSTR_2_0:
+            size = sizeW_fromITBL(info);
+            break;
 
-            case IND:
-                // Special case/Delicate Hack: INDs don't normally
-                // appear, since we're doing this heap census right
-                // after GC.  However, GarbageCollect() also does
-                // resurrectThreads(), which can update some
-                // blackholes when it calls raiseAsync() on the
-                // resurrected threads.  So we know that any IND will
-                // be the size of a BLACKHOLE.
-                size = BLACKHOLE_sizeW();
-                break;
+        case IND:
+            // Special case/Delicate Hack: INDs don't normally
+            // appear, since we're doing this heap census right
+            // after GC.  However, GarbageCollect() also does
+            // resurrectThreads(), which can update some
+            // blackholes when it calls raiseAsync() on the
+            // resurrected threads.  So we know that any IND will
+            // be the size of a BLACKHOLE.
+            size = BLACKHOLE_sizeW();
+            break;
 
-            case BCO:
-                prim = true;
-                size = bco_sizeW((StgBCO *)p);
-                break;
+        case BCO:
+            prim = true;
+            size = bco_sizeW((StgBCO *)p);
+            break;
 
-            case MVAR_CLEAN:
-            case MVAR_DIRTY:
-            case TVAR:
-            case WEAK:
-            case PRIM:
-            case MUT_PRIM:
-            case MUT_VAR_CLEAN:
-            case MUT_VAR_DIRTY:
-                prim = true;
-                size = sizeW_fromITBL(info);
-                break;
+        case MVAR_CLEAN:
+        case MVAR_DIRTY:
+        case TVAR:
+        case WEAK:
+        case PRIM:
+        case MUT_PRIM:
+        case MUT_VAR_CLEAN:
+        case MUT_VAR_DIRTY:
+            prim = true;
+            size = sizeW_fromITBL(info);
+            break;
 
-            case AP:
-                size = ap_sizeW((StgAP *)p);
-                break;
+        case AP:
+            size = ap_sizeW((StgAP *)p);
+            break;
 
-            case PAP:
-                size = pap_sizeW((StgPAP *)p);
-                break;
+        case PAP:
+            size = pap_sizeW((StgPAP *)p);
+            break;
 
-            case AP_STACK:
-                size = ap_stack_sizeW((StgAP_STACK *)p);
-                break;
+        case AP_STACK:
+            size = ap_stack_sizeW((StgAP_STACK *)p);
+            break;
 
-            case ARR_WORDS:
-                prim = true;
-                size = arr_words_sizeW((StgArrBytes*)p);
-                break;
+        case ARR_WORDS:
+            prim = true;
+            size = arr_words_sizeW((StgArrBytes*)p);
+            break;
 
-            case MUT_ARR_PTRS_CLEAN:
-            case MUT_ARR_PTRS_DIRTY:
-            case MUT_ARR_PTRS_FROZEN:
-            case MUT_ARR_PTRS_FROZEN0:
-                prim = true;
-                size = mut_arr_ptrs_sizeW((StgMutArrPtrs *)p);
-                break;
+        case MUT_ARR_PTRS_CLEAN:
+        case MUT_ARR_PTRS_DIRTY:
+        case MUT_ARR_PTRS_FROZEN:
+        case MUT_ARR_PTRS_FROZEN0:
+            prim = true;
+            size = mut_arr_ptrs_sizeW((StgMutArrPtrs *)p);
+            break;
 
-            case SMALL_MUT_ARR_PTRS_CLEAN:
-            case SMALL_MUT_ARR_PTRS_DIRTY:
-            case SMALL_MUT_ARR_PTRS_FROZEN:
-            case SMALL_MUT_ARR_PTRS_FROZEN0:
-                prim = true;
-                size = small_mut_arr_ptrs_sizeW((StgSmallMutArrPtrs *)p);
-                break;
+        case SMALL_MUT_ARR_PTRS_CLEAN:
+        case SMALL_MUT_ARR_PTRS_DIRTY:
+        case SMALL_MUT_ARR_PTRS_FROZEN:
+        case SMALL_MUT_ARR_PTRS_FROZEN0:
+            prim = true;
+            size = small_mut_arr_ptrs_sizeW((StgSmallMutArrPtrs *)p);
+            break;
 
-            case TSO:
-                prim = true;
+        case TSO:
+            prim = true;
 #if defined(PROFILING)
-                if (RtsFlags.ProfFlags.includeTSOs) {
-                    size = sizeofW(StgTSO);
-                    break;
-                } else {
-                    // Skip this TSO and move on to the next object
-                    p += sizeofW(StgTSO);
-                    continue;
-                }
-#else
+            if (RtsFlags.ProfFlags.includeTSOs) {
                 size = sizeofW(StgTSO);
                 break;
+            } else {
+                // Skip this TSO and move on to the next object
+                p += sizeofW(StgTSO);
+                continue;
+            }
+#else
+            size = sizeofW(StgTSO);
+            break;
 #endif
 
-            case STACK:
-                prim = true;
+        case STACK:
+            prim = true;
 #if defined(PROFILING)
-                if (RtsFlags.ProfFlags.includeTSOs) {
-                    size = stack_sizeW((StgStack*)p);
-                    break;
-                } else {
-                    // Skip this TSO and move on to the next object
-                    p += stack_sizeW((StgStack*)p);
-                    continue;
-                }
-#else
+            if (RtsFlags.ProfFlags.includeTSOs) {
                 size = stack_sizeW((StgStack*)p);
                 break;
+            } else {
+                // Skip this TSO and move on to the next object
+                p += stack_sizeW((StgStack*)p);
+                continue;
+            }
+#else
+            size = stack_sizeW((StgStack*)p);
+            break;
 #endif
 
-            case TREC_CHUNK:
-                prim = true;
-                size = sizeofW(StgTRecChunk);
-                break;
+        case TREC_CHUNK:
+            prim = true;
+            size = sizeofW(StgTRecChunk);
+            break;
 
-            case COMPACT_NFDATA:
-                barf("heapCensus, found compact object in the wrong list");
-                break;
+        case COMPACT_NFDATA:
+            barf("heapCensus, found compact object in the wrong list");
+            break;
 
-            default:
-                barf("heapCensus, unknown object: %d", info->type);
-            }
+        default:
+            barf("heapCensus, unknown object: %d", info->type);
+        }
 
-            heapProfObject(census,(StgClosure*)p,size,prim);
+        heapProfObject(census,(StgClosure*)p,size,prim);
 
-            p += size;
-        }
+        p += size;
     }
 }
 
-void heapCensus (Time t)
+static void
+heapCensusChain( Census *census, bdescr *bd )
+{
+    for (; bd != NULL; bd = bd->link) {
+        heapCensusBlock(census, bd);
+    }
+}
+
+// Start a census: the part of heapCensus() before the traversal.
+static Census *
+startCensus (Time t)
 {
-  uint32_t g, n;
   Census *census;
-  gen_workspace *ws;
 
   census = &censuses[era];
   census->time  = mut_user_time_until(t);
@@ -1181,22 +1212,13 @@ void heapCensus (Time t)
   stat_startHeapCensus();
 #endif
 
-  // Traverse the heap, collecting the census info
-  for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
-      heapCensusChain( census, generations[g].blocks );
-      // Are we interested in large objects?  might be
-      // confusing to include the stack in a heap profile.
-      heapCensusChain( census, generations[g].large_objects );
-      heapCensusCompactList ( census, generations[g].compact_objects );
-
-      for (n = 0; n < n_capabilities; n++) {
-          ws = &gc_threads[n]->gens[g];
-          heapCensusChain(census, ws->todo_bd);
-          heapCensusChain(census, ws->part_list);
-          heapCensusChain(census, ws->scavd_list);
-      }
-  }
+  return census;
+}
 
+// Finish a census: the part of heapCensus() after the traversal.
+static void
+endCensus (Census *census)
+{
   // dump out the census info
 #if defined(PROFILING)
     // We can't generate any info for LDV profiling until
@@ -1226,3 +1248,267 @@ void heapCensus (Time t)
   stat_endHeapCensus();
 #endif
 }
+
+void heapCensus (Time t)
+{
+  uint32_t g, n;
+  Census *census;
+  gen_workspace *ws;
+
+  census = startCensus(t);
+
+  // Traverse the heap, collecting the census info
+  for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+      heapCensusChain( census, generations[g].blocks );
+      // Are we interested in large objects?  might be
+      // confusing to include the stack in a heap profile.
+      heapCensusChain( census, generations[g].large_objects );
+      heapCensusCompactList ( census, generations[g].compact_objects );
+
+      for (n = 0; n < n_capabilities; n++) {
+          ws = &gc_threads[n]->gens[g];
+          heapCensusChain(census, ws->todo_bd);
+          heapCensusChain(census, ws->part_list);
+          heapCensusChain(census, ws->scavd_list);
+      }
+  }
+
+  endCensus(census);
+}
+
+#if defined(THREADED_RTS)
+
+/* -----------------------------------------------------------------------------
+ * Parallel heap census
+ *
+ * Note [Parallel heap census]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * A census of a large heap takes a while, and it happens inside the GC
+ * with every capability stopped.  So after a parallel GC, the GC
+ * threads that took part in it help with the census too:
+ * GarbageCollect() calls heapCensusParPrepare() instead of heapCensus(),
+ * then every one of those threads calls heapCensusParWork(), and
+ * finally heapCensusParFinish() is called; see census_gc_threads() in
+ * GC.c.
+ *
+ * heapCensusParPrepare() cuts the block lists that heapCensus() would
+ * traverse into chunks of at most CENSUS_CHUNK_BLOCKS blocks, so that
+ * one big generation is shared out as well as many small lists, and the
+ * threads claim chunks by incrementing census_next_chunk.  Each thread
+ * counts into a Census of its own, so they share nothing else; then
+ * heapCensusParFinish() adds all the counters up in censuses[era] and
+ * dumps it as usual.  Everything that reads or changes other state
+ * (retainerProfile(), dumpCensus(), the era) happens in
+ * heapCensusParPrepare() and heapCensusParFinish(), on one thread.
+ *
+ * The .hp file must be the same as that of a serial census, which lists
+ * the bands in the reverse order of their first appearance in the heap
+ * (heapProfObject() pushes new counters on the front of census->ctrs).
+ * The chunks, taken in order, cover the heap in the same order as
+ * heapCensus() does, so heapCensusParWork() sets census->pos to the
+ * chunk number in the high 32 bits before each chunk, and
+ * heapProfObject() counts the objects in the low bits.  A counter
+ * records the position where it was created, in ctr->first, which is
+ * the first appearance of its identity among the chunks of that thread,
+ * because a thread claims chunks in increasing order.  The first
+ * appearance in the heap is the earliest of those of the threads, and
+ * heapCensusParFinish() sorts the counters by it.
+ *
+ * With -hb and a biography selector, the census of the current era may
+ * already have counters before the census, made by LDV_recordDead().  A
+ * serial census leaves those at the end of the list, and so do we.
+ *
+ * The retainer sets for -hr are still computed serially, in
+ * retainerProfile(): which retainer sets get made, and so the ids that
+ * name them in the .hp file, depend on the order of the traversal.
+ * -------------------------------------------------------------------------- */
+
+#define CENSUS_CHUNK_BLOCKS 256
+
+typedef struct {
+    bdescr   *bd;       // the first block
+    uint32_t  n_bds;    // the number of block descriptors from bd on
+    bool      compact;  // blocks of compact regions
+} CensusChunk;
+
+static CensusChunk *census_chunks = NULL;
+static uint32_t n_census_chunks = 0;
+static uint32_t census_chunks_size = 0;
+static volatile StgWord census_next_chunk;
+
+static Census *thread_censuses;
+static uint32_t n_thread_censuses;
+static volatile StgWord census_next_thread;
+
+static void
+addCensusChunks (bdescr *bd, bool compact)
+{
+    CensusChunk *chunk;
+    W_ blocks;
+
+    while (bd != NULL) {
+        if (n_census_chunks == census_chunks_size) {
+            census_chunks_size = stg_max(2 * census_chunks_size, 64);
+            census_chunks = stgReallocBytes(census_chunks,
+                                            census_chunks_size *
+                                              sizeof(CensusChunk),
+                                            "addCensusChunks");
+        }
+        chunk = &census_chunks[n_census_chunks++];
+        chunk->bd = bd;
+        chunk->n_bds = 0;
+        chunk->compact = compact;
+        for (blocks = 0; bd != NULL && blocks < CENSUS_CHUNK_BLOCKS;
+             bd = bd->link) {
+            blocks += bd->blocks;
+            chunk->n_bds++;
+        }
+    }
+}
+
+// Add the counters of one thread's census to another census.  The
+// counters that this creates are pushed on *new_ctrs, not census->ctrs.
+static void
+mergeCensus (Census *census, Census *from, counter **new_ctrs,
+             uint32_t *n_new_ctrs)
+{
+    counter *ctr, *from_ctr;
+
+    for (from_ctr = from->ctrs; from_ctr != NULL; from_ctr = from_ctr->next) {
+        ctr = lookupHashTable(census->hash, (StgWord)from_ctr->identity);
+        if (ctr == NULL) {
+            ctr = arenaAlloc(census->arena, sizeof(counter));
+            initLDVCtr(ctr);
+            insertHashTable(census->hash, (StgWord)from_ctr->identity, ctr);
+            ctr->identity = from_ctr->identity;
+            ctr->first = from_ctr->first;
+            ctr->next = *new_ctrs;
+            *new_ctrs = ctr;
+            (*n_new_ctrs)++;
+        } else if (from_ctr->first < ctr->first) {
+            ctr->first = from_ctr->first;
+        }
+        // c.resid is the same field as c.ldv.prim, and the others are
+        // zero in a residency counter, so this adds up either kind.
+        ctr->c.ldv.prim       += from_ctr->c.ldv.prim;
+        ctr->c.ldv.not_used   += from_ctr->c.ldv.not_used;
+        ctr->c.ldv.used       += from_ctr->c.ldv.used;
+        ctr->c.ldv.void_total += from_ctr->c.ldv.void_total;
+        ctr->c.ldv.drag_total += from_ctr->c.ldv.drag_total;
+    }
+
+    census->prim       += from->prim;
+    census->not_used   += from->not_used;
+    census->used       += from->used;
+    census->void_total += from->void_total;
+    census->drag_total += from->drag_total;
+}
+
+// Latest first, like the list of a serial census
+static int
+cmpCounterFirst (const void *a, const void *b)
+{
+    const counter *x = *(const counter * const *)a;
+    const counter *y = *(const counter * const *)b;
+    return x->first < y->first ? 1 : x->first > y->first ? -1 : 0;
+}
+
+void
+heapCensusParPrepare (Time t, uint32_t n_threads)
+{
+    uint32_t g, n;
+    gen_workspace *ws;
+
+    startCensus(t);
+
+    n_census_chunks = 0;
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        addCensusChunks(generations[g].blocks, false);
+        addCensusChunks(generations[g].large_objects, false);
+        addCensusChunks(generations[g].compact_objects, true);
+
+        for (n = 0; n < n_capabilities; n++) {
+            ws = &gc_threads[n]->gens[g];
+            addCensusChunks(ws->todo_bd, false);
+            addCensusChunks(ws->part_list, false);
+            addCensusChunks(ws->scavd_list, false);
+        }
+    }
+    census_next_chunk = 0;
+
+    thread_censuses = stgMallocBytes(n_threads * sizeof(Census),
+                                     "heapCensusParPrepare");
+    for (n = 0; n < n_threads; n++) {
+        initEra(&thread_censuses[n]);
+    }
+    n_thread_censuses = n_threads;
+    census_next_thread = 0;
+}
+
+void
+heapCensusParWork (void)
+{
+    Census *census;
+    CensusChunk *chunk;
+    bdescr *bd;
+    StgWord i;
+    uint32_t n;
+
+    i = atomic_inc(&census_next_thread, 1) - 1;
+    ASSERT(i < n_thread_censuses);
+    census = &thread_censuses[i];
+
+    while ((i = atomic_inc(&census_next_chunk, 1) - 1) < n_census_chunks) {
+        chunk = &census_chunks[i];
+        census->pos = (StgWord64)i << 32;
+        for (bd = chunk->bd, n = 0; n < chunk->n_bds; bd = bd->link, n++) {
+            if (chunk->compact) {
+                heapCensusCompactBlock(census, bd);
+            } else {
+                heapCensusBlock(census, bd);
+            }
+        }
+    }
+}
+
+void
+heapCensusParFinish (void)
+{
+    Census *census;
+    counter *ctr, *new_ctrs, **sorted;
+    uint32_t n, n_new_ctrs;
+
+    census = &censuses[era];
+    new_ctrs = NULL;
+    n_new_ctrs = 0;
+    for (n = 0; n < n_thread_censuses; n++) {
+        mergeCensus(census, &thread_censuses[n], &new_ctrs, &n_new_ctrs);
+        freeEra(&thread_censuses[n]);
+    }
+    stgFree(thread_censuses);
+    thread_censuses = NULL;
+    stgFree(census_chunks);
+    census_chunks = NULL;
+    census_chunks_size = 0;
+
+    // put the new counters in front of any old ones, in the order of a
+    // serial census; see Note [Parallel heap census]
+    if (n_new_ctrs != 0) {
+        sorted = stgMallocBytes(n_new_ctrs * sizeof(counter *),
+                                "heapCensusParFinish");
+        for (ctr = new_ctrs, n = 0; ctr != NULL; ctr = ctr->next, n++) {
+            sorted[n] = ctr;
+        }
+        qsort(sorted, n_new_ctrs, sizeof(counter *), cmpCounterFirst);
+        for (n = 0; n + 1 < n_new_ctrs; n++) {
+            sorted[n]->next = sorted[n + 1];
+        }
+        sorted[n_new_ctrs - 1]->next = census->ctrs;
+        census->ctrs = sorted[0];
+        stgFree(sorted);
+    }
+
+    endCensus(census);
+}
+
+#endif /* THREADED_RTS */
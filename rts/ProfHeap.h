@@ -11,6 +11,12 @@
 #include "BeginPrivate.h"
 
 void        heapCensus         (Time t);
+#if defined(THREADED_RTS)
+// Parallel census; see Note [Parallel heap census] in ProfHeap.c
+void        heapCensusParPrepare (Time t, uint32_t n_threads);
+void        heapCensusParWork    (void);
+void        heapCensusParFinish  (void);
+#endif
 uint32_t    initHeapProfiling  (void);
 void        endHeapProfiling   (void);
 bool        strMatchesSelector (const char* str, const char* sel);
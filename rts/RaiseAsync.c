@@ -267,6 +267,16 @@ check_target:
 
     status = target->why_blocked;
 
+#if defined(THREADED_RTS)
+    // A thief may have taken the thread from our stealable threads since
+    // we looked at target->cap (see Note [Stealing threads] in
+    // Schedule.c), in which case the status belongs to the thief.
+    load_load_barrier();
+    if (target->cap != cap) {
+        goto retry;
+    }
+#endif
+
     switch (status) {
     case NotBlocked:
     {
@@ -494,6 +504,13 @@ check_target:
         // and now retry, the thread should be runnable.
         goto retry;
 
+    case ThreadStealable:
+        // The thread is in our stealable threads.  Put it on our run
+        // queue and retry; if a thief takes it first, we will find it
+        // on the thief's capability instead.
+        takeStealableThread(cap, target);
+        goto retry;
+
     default:
         barf("throwTo: unrecognised why_blocked (%d)", target->why_blocked);
     }
@@ -677,6 +694,12 @@ removeFromQueues(Capability *cap, StgTSO *tso)
   case ThreadMigrating:
       return;
 
+  case ThreadStealable:
+      // We own all the capabilities here (see deleteAllThreads() and
+      // forkProcess()), so nobody else can be taking the thread.
+      takeStealableThread(cap, tso);
+      return;
+
   case BlockedOnSTM:
     // Be careful: nothing to do here!  We tell the scheduler that the
     // thread is runnable and we leave it to the stack-walking code to
@@ -709,23 +732,27 @@ removeFromQueues(Capability *cap, StgTSO *tso)
   }
 
 #if !defined(THREADED_RTS)
+#if defined(mingw32_HOST_OS)
   case BlockedOnRead:
   case BlockedOnWrite:
-#if defined(mingw32_HOST_OS)
   case BlockedOnDoProc:
-#endif
       removeThreadFromDeQueue(cap, &blocked_queue_hd, &blocked_queue_tl, tso);
-#if defined(mingw32_HOST_OS)
       /* (Cooperatively) signal that the worker thread should abort
        * the request.
        */
       abandonWorkRequest(tso->block_info.async_result->reqID);
-#endif
       goto done;
 
   case BlockedOnDelay:
         removeThreadFromQueue(cap, &sleeping_queue, tso);
         goto done;
+#else
+  case BlockedOnRead:
+  case BlockedOnWrite:
+  case BlockedOnDelay:
+      awaitEventRemoveThread(cap, tso);
+      goto done;
+#endif
 #endif
 
   default:
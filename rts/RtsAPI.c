@@ -701,7 +701,7 @@ void hs_try_putmvar (/* in */ int capability,
     ACQUIRE_LOCK(&cap->lock);
     // If the capability is free, we can perform the tryPutMVar immediately
     if (cap->running_task == NULL) {
-        cap->running_task = task;
+        setRunningTask(cap, task);
         task->cap = cap;
         RELEASE_LOCK(&cap->lock);
 
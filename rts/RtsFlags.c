@@ -152,6 +152,8 @@ void initRtsFlagsDefaults(void)
     RtsFlags.GcFlags.compact            = false;
     RtsFlags.GcFlags.compactThreshold   = 30.0;
     RtsFlags.GcFlags.sweep              = false;
+    RtsFlags.GcFlags.concurrentMark     = false;
+    RtsFlags.GcFlags.incrementalSlice   = 0;
     RtsFlags.GcFlags.idleGCDelayTime    = USToTime(300000); // 300ms
 #if defined(THREADED_RTS)
     RtsFlags.GcFlags.doIdleGC           = true;
@@ -162,6 +164,7 @@ void initRtsFlagsDefaults(void)
     RtsFlags.GcFlags.allocLimitGrace    = (100*1024) / BLOCK_SIZE;
     RtsFlags.GcFlags.numa               = false;
     RtsFlags.GcFlags.numaMask           = 1;
+    RtsFlags.GcFlags.hugePages          = HUGE_PAGES_NONE;
     RtsFlags.GcFlags.ringBell           = false;
 
     RtsFlags.DebugFlags.scheduler       = false;
@@ -211,6 +214,8 @@ void initRtsFlagsDefaults(void)
     RtsFlags.TraceFlags.sparks_sampled= false;
     RtsFlags.TraceFlags.sparks_full   = false;
     RtsFlags.TraceFlags.user          = false;
+    RtsFlags.TraceFlags.eventlogSocket = NULL;
+    RtsFlags.TraceFlags.allocSample   = 0;
 #endif
 
 #if defined(PROFILING)
@@ -286,6 +291,10 @@ usage_text[] = {
 "  -c       Use in-place compaction for all oldest generation collections",
 "           (the default is to use copying)",
 "  -w       Use mark-region for the oldest generation (experimental)",
+"  -xn      Mark the oldest generation concurrently with the program",
+"           (implies -w; experimental)",
+"  -xi<sec> Mark and sweep the oldest generation incrementally, in slices",
+"           of at most <sec> (e.g. -xi0.005 or -xi5ms; implies -xn)",
 #if defined(THREADED_RTS)
 "  -I<sec>  Perform full GC after <sec> idle time (default: 0.3, 0 == off)",
 #endif
@@ -336,6 +345,14 @@ usage_text[] = {
 #if defined(TRACING)
 "",
 "  -l[flags]  Log events in binary format to the file <program>.eventlog",
+#  if !defined(mingw32_HOST_OS)
+"  --eventlog-socket=<path>",
+"             Stream the events to the Unix socket or named pipe <path>",
+"             instead (implies -l unless -l[flags] is also given)",
+#  endif
+"  --alloc-sample=<size>",
+"             Log a sample of the allocation site and stack every <size>",
+"             bytes allocated (implies -l unless -l[flags] is also given)",
 #  if defined(DEBUG)
 "  -v[flags]  Log events to stderr",
 #  endif
@@ -356,6 +373,7 @@ usage_text[] = {
 #if !defined(PROFILING)
 "",
 "  -h       Heap residency profile (output file <program>.hp)",
+"  -hi      Heap residency profile by info table (output file <program>.hp)",
 #endif
 "  -i<sec>  Time between heap profile samples (seconds, default: 0.1)",
 "",
@@ -421,6 +439,9 @@ usage_text[] = {
 "",
 #endif
 #endif
+"  --huge-pages[=<transparent|explicit>]",
+"            Back the heap with 2MB pages, using transparent huge pages",
+"            (the default) or huge pages from hugetlbfs (default: off)",
 "  --install-signal-handlers=<yes|no>",
 "            Install signal handlers (default: yes)",
 #if defined(THREADED_RTS)
@@ -779,6 +800,56 @@ error = true;
                       printRtsInfo();
                       stg_exit(0);
                   }
+                  else if (strequal("huge-pages",
+                               &rts_argv[arg][2]) ||
+                           strequal("huge-pages=transparent",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      RtsFlags.GcFlags.hugePages = HUGE_PAGES_TRANSPARENT;
+                  }
+                  else if (strequal("huge-pages=explicit",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      RtsFlags.GcFlags.hugePages = HUGE_PAGES_EXPLICIT;
+                  }
+                  else if (!strncmp("alloc-sample=",
+                                    &rts_argv[arg][2], 13)) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.allocSample =
+                              decodeSize(rts_argv[arg], 15,
+                                         BLOCK_SIZE, HS_WORD_MAX);
+                          // implies -l, unless -l was given already
+                          if (RtsFlags.TraceFlags.tracing != TRACE_EVENTLOG) {
+                              RtsFlags.TraceFlags.tracing = TRACE_EVENTLOG;
+                              read_trace_flags("");
+                          }
+                          );
+                  }
+                  else if (!strncmp("eventlog-socket=",
+                                    &rts_argv[arg][2], 16)) {
+                      OPTION_UNSAFE;
+#if defined(mingw32_HOST_OS)
+                      errorBelch("%s: not supported on Windows",
+                                 rts_argv[arg]);
+                      error = true;
+#else
+                      TRACING_BUILD_ONLY(
+                          if (rts_argv[arg][18] == '\0') {
+                              errorBelch("%s: missing path", rts_argv[arg]);
+                              error = true;
+                          } else {
+                              RtsFlags.TraceFlags.eventlogSocket =
+                                  &rts_argv[arg][18];
+                          }
+                          // implies -l, unless -l was given already
+                          if (RtsFlags.TraceFlags.tracing != TRACE_EVENTLOG) {
+                              RtsFlags.TraceFlags.tracing = TRACE_EVENTLOG;
+                              read_trace_flags("");
+                          }
+                          );
+#endif
+                  }
 #if defined(THREADED_RTS)
                   else if (!strncmp("numa", &rts_argv[arg][2], 4)) {
                       OPTION_SAFE;
@@ -1107,6 +1178,10 @@ error = true;
                     OPTION_UNSAFE;
                     RtsFlags.ProfFlags.doHeapProfile = HEAP_BY_CLOSURE_TYPE;
                     break;
+                  case 'i':
+                    OPTION_UNSAFE;
+                    RtsFlags.ProfFlags.doHeapProfile = HEAP_BY_INFO_TABLE;
+                    break;
                   default:
                     OPTION_SAFE;
                     PROFILING_BUILD_ONLY();
@@ -1362,6 +1437,35 @@ error = true;
                     unchecked_arg_start++;
                     goto check_rest;
 
+                case 'n':
+                    OPTION_UNSAFE;
+                    RtsFlags.GcFlags.concurrentMark = true;
+                    RtsFlags.GcFlags.sweep = true;
+                    unchecked_arg_start++;
+                    goto check_rest;
+
+                case 'i': /* incremental mark/sweep slice */
+                    OPTION_UNSAFE;
+                    {
+                        char *end;
+                        double t = strtod(rts_argv[arg]+3, &end);
+                        if (strcmp(end, "ms") == 0) {
+                            t /= 1000;
+                        } else if (*end != '\0') {
+                            t = 0;
+                        }
+                        if (t <= 0) {
+                            errorBelch("-xi: bad slice time: %s",
+                                       rts_argv[arg]+3);
+                            error = true;
+                            break;
+                        }
+                        RtsFlags.GcFlags.incrementalSlice = fsecondsToTime(t);
+                        RtsFlags.GcFlags.concurrentMark = true;
+                        RtsFlags.GcFlags.sweep = true;
+                    }
+                    break;
+
                   /*
                    * The option prefix '-xx' is reserved for future
                    * extension.  KSW 1999-11.
@@ -1493,6 +1597,29 @@ static void normaliseRtsOpts (void)
         RtsFlags.GcFlags.minAllocAreaSize = RtsFlags.GcFlags.maxHeapSize;
     }
 
+    if (RtsFlags.GcFlags.concurrentMark) {
+#if defined(PROFILING)
+        errorBelch("-xn is not supported by the profiling RTS; ignoring it");
+        RtsFlags.GcFlags.concurrentMark = false;
+        RtsFlags.GcFlags.incrementalSlice = 0;
+#else
+        if (RtsFlags.GcFlags.compact) {
+            errorBelch("-xn cannot be combined with -c");
+            errorUsage();
+        }
+#endif
+    }
+
+    if (RtsFlags.GcFlags.hugePages == HUGE_PAGES_EXPLICIT &&
+        RtsFlags.GcFlags.numa) {
+        // Explicit huge pages are kept mapped when we free them (see
+        // Note [Huge pages] in MBlock.c), so we couldn't bind them to
+        // another node when we reuse them.
+        errorBelch("--huge-pages=explicit cannot be combined with --numa; "
+                   "using transparent huge pages");
+        RtsFlags.GcFlags.hugePages = HUGE_PAGES_TRANSPARENT;
+    }
+
     // If we have -A16m or larger, use -n4m.
     if (RtsFlags.GcFlags.minAllocAreaSize >= (16*1024*1024) / BLOCK_SIZE) {
         RtsFlags.GcFlags.nurseryChunkSize = (4*1024*1024) / BLOCK_SIZE;
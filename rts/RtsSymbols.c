@@ -570,6 +570,9 @@
       SymI_HasProto(stg_compactAllocateBlockzh)                         \
       SymI_HasProto(stg_compactFixupPointerszh)                         \
       SymI_HasProto(stg_compactSizzezh)                                 \
+      SymI_HasProto(compactSaveFile)                                    \
+      SymI_HasProto(compactLoadFile)                                    \
+      SymI_HasProto(compactAddParallel)                                 \
       SymI_HasProto(closure_flags)                                      \
       SymI_HasProto(cmp_thread)                                         \
       SymI_HasProto(createAdjustor)                                     \
@@ -689,6 +692,10 @@
       SymI_HasProto(stg_readTVarIOzh)                                   \
       SymI_HasProto(resumeThread)                                       \
       SymI_HasProto(setNumCapabilities)                                 \
+      SymI_HasProto(startEventLog)                                      \
+      SymI_HasProto(endEventLog)                                        \
+      SymI_HasProto(eventLogRunning)                                    \
+      SymI_HasProto(setEventLogClasses)                                 \
       SymI_HasProto(getNumberOfProcessors)                              \
       SymI_HasProto(resolveObjs)                                        \
       SymI_HasProto(stg_retryzh)                                        \
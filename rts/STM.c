@@ -75,8 +75,12 @@
  * values, (d) release the locks on the TVars, writing updates to them in the
  * case of a commit, (e) unlock the STM.
  *
- * Queues of waiting threads hang off the first_watch_queue_entry field of each
- * TVar.  This may only be manipulated when holding that TVar's lock.  In
+ * STM_TL2 is a variant of STM_FG_LOCKS that adds a global version clock, so
+ * that reads are validated as they are made and read-only transactions commit
+ * without locking anything: see Note [TL2 commit].
+ *
+ * The waiting threads hang off the watchers field of each TVar (see
+ * Note [TVar watchers]).  This may only be manipulated when holding that TVar's lock.  In
  * particular, when a thread is putting itself to sleep, it mustn't release the
  * TVar's lock until it has added itself to the wait queue and marked its TSO as
  * BlockedOnSTM -- this makes sure that other threads will know to wake it.
@@ -95,6 +99,7 @@
 #include "SMPClosureOps.h"
 
 #include <stdio.h>
+#include <string.h>
 
 // ACQ_ASSERT is used for assertions which are only required for
 // THREADED_RTS builds with fine-grained locking.
@@ -343,79 +348,109 @@ static void unlock_inv(StgAtomicInvariant *inv) {
 }
 #endif
 
-/*......................................................................*/
-
-static StgBool watcher_is_tso(StgTVarWatchQueue *q) {
-  StgClosure *c = q -> closure;
-  const StgInfoTable *info = get_itbl(c);
-  return (info -> type) == TSO;
-}
-
-static StgBool watcher_is_invariant(StgTVarWatchQueue *q) {
-  StgClosure *c = q -> closure;
-  return (c->header.info == &stg_ATOMIC_INVARIANT_info);
-}
-
-/*......................................................................*/
-
-// Helper functions for thread blocking and unblocking
-
-static void park_tso(StgTSO *tso) {
-  ASSERT(tso -> why_blocked == NotBlocked);
-  tso -> why_blocked = BlockedOnSTM;
-  tso -> block_info.closure = (StgClosure *) END_TSO_QUEUE;
-  TRACE("park_tso on tso=%p", tso);
-}
-
-static void unpark_tso(Capability *cap, StgTSO *tso) {
-    // We will continue unparking threads while they remain on one of the wait
-    // queues: it's up to the thread itself to remove it from the wait queues
-    // if it decides to do so when it is scheduled.
-
-    // Unblocking a TSO from BlockedOnSTM is done under the TSO lock,
-    // to avoid multiple CPUs unblocking the same TSO, and also to
-    // synchronise with throwTo(). The first time the TSO is unblocked
-    // we mark this fact by setting block_info.closure == STM_AWOKEN.
-    // This way we can avoid sending further wakeup messages in the
-    // future.
-    lockTSO(tso);
-    if (tso->why_blocked == BlockedOnSTM &&
-        tso->block_info.closure == &stg_STM_AWOKEN_closure) {
-      TRACE("unpark_tso already woken up tso=%p", tso);
-    } else if (tso -> why_blocked == BlockedOnSTM) {
-      TRACE("unpark_tso on tso=%p", tso);
-      tso->block_info.closure = &stg_STM_AWOKEN_closure;
-      tryWakeupThread(cap,tso);
-    } else {
-      TRACE("spurious unpark_tso on tso=%p", tso);
+/* Note [TL2 commit]
+   ~~~~~~~~~~~~~~~~~
+   With STM_FG_LOCKS a commit locks every TVar that it updates, and then
+   checks each TVar that it only read twice over (validate_and_acquire_
+   ownership and check_read_only), however many other transactions have
+   committed meanwhile; a transaction that has read inconsistent values only
+   finds out when it commits or when the scheduler validates it.  STM_TL2
+   uses the same per-TVar locks, but follows the TL2 algorithm (Dice, Shalev
+   and Shavit, "Transactional Locking II", DISC 2006):
+
+   - stm_clock is a global version clock, advanced by every commit that
+     updates a TVar.  The commit stamps each TVar it writes with its new
+     clock value (the write version) in num_updates, before storing the new
+     value and so unlocking the TVar.
+
+   - A transaction reads the clock when it starts (its read version, kept in
+     the TRec header and shared by the whole nest of TRecs).  Every TVar it
+     reads must have a version no later than the read version, so all its
+     reads come from the snapshot of memory at that time.  If a TVar is
+     newer, we try to move the snapshot forward: if nothing that the
+     transaction has read so far has changed, the read version becomes the
+     current clock.  Otherwise the transaction is condemned there and then,
+     and we make the thread return to the scheduler, which aborts and
+     restarts it (see schedulePostRunThread).
+
+   - A transaction that updates nothing needs no commit work at all: its
+     reads are a consistent snapshot, so it commits at its read version,
+     without touching any shared state.
+
+   - An updating transaction locks the TVars it updates, as before, and then
+     advances the clock.  If the clock moved only by our own increment, no
+     transaction has committed since we started and the read set is still
+     valid; otherwise we check that every TVar we read but did not update is
+     unlocked and has a version no later than our read version.
+
+   The clock is a word, and is never allowed to wrap around, which is why
+   STM_TL2 needs a 64-bit platform (see STM.h).  Waiting (retry), invariants
+   and the scheduler's validation of running transactions work exactly as
+   with STM_FG_LOCKS.
+*/
+
+#if defined(STM_TL2) /*........................................*/
+
+static const StgBool config_use_clock = true;
+static volatile StgWord stm_clock = 0;
+
+// Read a TVar's value together with its version: the TVar held the value,
+// unlocked, while it had that version.
+static StgClosure *read_versioned(StgTVar *s, StgWord *version) {
+  StgClosure *result;
+  StgWord v;
+  for (;;) {
+    v = (StgWord)ACQUIRE_LOAD(&s -> num_updates);
+    result = ACQUIRE_LOAD(&s -> current_value);
+    if (GET_INFO(UNTAG_CLOSURE(result)) != &stg_TREC_HEADER_info &&
+        (StgWord)ACQUIRE_LOAD(&s -> num_updates) == v) {
+      *version = v;
+      return result;
     }
-    unlockTSO(tso);
+  }
 }
 
-static void unpark_waiters_on(Capability *cap, StgTVar *s) {
-  StgTVarWatchQueue *q;
-  StgTVarWatchQueue *trail;
-  TRACE("unpark_waiters_on tvar=%p", s);
-  // unblock TSOs in reverse order, to be a bit fairer (#2319)
-  for (q = s -> first_watch_queue_entry, trail = q;
-       q != END_STM_WATCH_QUEUE;
-       q = q -> next_queue_entry) {
-    trail = q;
+// Move the read version of a nest of transactions up to the current clock,
+// which we may do if every TVar the nest has read still holds the value it
+// read.  Returns false if one has changed.
+static StgBool extend_read_version(StgTRecHeader *trec) {
+  StgTRecHeader *t;
+  StgWord now;
+  StgBool result = true;
+
+  now = ACQUIRE_LOAD(&stm_clock);
+  for (t = trec; result && t != NO_TREC; t = t -> enclosing_trec) {
+    FOR_EACH_ENTRY(t, e, {
+      StgTVar *s = e -> tvar;
+      if (s -> current_value != e -> expected_value ||
+          (StgWord)s -> num_updates > now) {
+        TRACE("%p : can't extend read version past %p", trec, s);
+        result = false;
+        BREAK_FOR_EACH;
+      }
+    });
   }
-  q = trail;
-  for (;
-       q != END_STM_WATCH_QUEUE;
-       q = q -> prev_queue_entry) {
-    if (watcher_is_tso(q)) {
-      unpark_tso(cap, (StgTSO *)(q -> closure));
+
+  if (result) {
+    TRACE("%p : read version %ld -> %ld", trec, trec -> read_version, now);
+    for (t = trec; t != NO_TREC; t = t -> enclosing_trec) {
+      t -> read_version = now;
     }
   }
+  return result;
 }
 
+#else
+static const StgBool config_use_clock = false;
+#endif
+
 /*......................................................................*/
 
 // Helper functions for downstream allocation and initialization
 
+// The entry_index of a TRec that has no index, see Note [TRec index]
+#define NO_TREC_INDEX ((StgArrBytes *)(void *)&stg_NO_TREC_closure)
+
 static StgInvariantCheckQueue *new_stg_invariant_check_queue(Capability *cap,
                                                              StgAtomicInvariant *invariant) {
   StgInvariantCheckQueue *result;
@@ -432,6 +467,9 @@ static StgTVarWatchQueue *new_stg_tvar_watch_queue(Capability *cap,
   result = (StgTVarWatchQueue *)allocate(cap, sizeofW(StgTVarWatchQueue));
   SET_HDR (result, &stg_TVAR_WATCH_QUEUE_info, CCS_SYSTEM);
   result -> closure = closure;
+  // Only the deferred wakeup list uses these now, and it doesn't set
+  // prev_queue_entry, but the GC follows it
+  result -> prev_queue_entry = END_STM_WATCH_QUEUE;
   return result;
 }
 
@@ -453,6 +491,7 @@ static StgTRecHeader *new_stg_trec_header(Capability *cap,
   result -> enclosing_trec = enclosing_trec;
   result -> current_chunk = new_stg_trec_chunk(cap);
   result -> invariants_to_check = END_INVARIANT_CHECK_QUEUE;
+  result -> entry_index = NO_TREC_INDEX;
 
   if (enclosing_trec == NO_TREC) {
     result -> state = TREC_ACTIVE;
@@ -526,6 +565,173 @@ static void free_stg_trec_chunk(Capability *cap,
 #endif
 }
 
+/* Note [TRec index]
+   ~~~~~~~~~~~~~~~~~~
+   Finding the entry for a TVar in a TRec (get_entry_for, merge_read_into,
+   merge_update_into) means scanning its chunks, which makes a transaction
+   that accesses thousands of TVars quadratic.  So once a TRec has
+   TREC_INDEX_CHUNKS chunks of entries we give it an index: an open-addressed
+   hash table, with linear probing, from TVar addresses to the TRec's
+   entries.  It is kept at most half full, and doubles in size when it
+   would be fuller.
+
+   The index is an ARR_WORDS object, so the GC copies it without looking
+   inside; freed indexes go on the capability's free_trec_indexes list to
+   be reused, like TRec headers and chunks.
+
+   The GC moves TVars and TRec chunks, which invalidates every index.
+   stmPreGCHook advances stm_gc_epoch, and an index whose epoch is out of
+   date is refilled from the TRec's entries the next time it is used.
+*/
+
+#define TREC_INDEX_CHUNKS   4
+#define TREC_INDEX_MIN_BITS 8
+
+typedef struct {
+  StgTVar   *tvar;    // NULL if the slot is empty
+  TRecEntry *entry;
+} TRecIndexSlot;
+
+typedef struct {
+  StgWord        epoch;      // stm_gc_epoch when the slots were filled
+  StgWord        bits;       // there are 2^bits slots
+  StgWord        n_entries;  // slots in use
+  StgArrBytes   *next_free;  // link in cap->free_trec_indexes
+  TRecIndexSlot  slots[];
+} TRecIndex;
+
+#define TREC_INDEX(arr) ((TRecIndex *)(arr) -> payload)
+
+static volatile StgWord stm_gc_epoch = 0;
+
+static StgWord hash_tvar(StgTVar *s, StgWord bits) {
+  // Fibonacci hashing: TVars are allocated at regular intervals, so we
+  // want the high bits of the product
+#if SIZEOF_VOID_P == 8
+  return ((StgWord)s * 0x9e3779b97f4a7c15) >> (WORD_SIZE_IN_BITS - bits);
+#else
+  return ((StgWord)s * 0x9e3779b9) >> (WORD_SIZE_IN_BITS - bits);
+#endif
+}
+
+static void index_insert(TRecIndex *ix, TRecEntry *e) {
+  StgWord mask = ((StgWord)1 << ix -> bits) - 1;
+  StgWord i = hash_tvar(e -> tvar, ix -> bits);
+  while (ix -> slots[i].tvar != NULL) {
+    i = (i + 1) & mask;
+  }
+  ix -> slots[i].tvar = e -> tvar;
+  ix -> slots[i].entry = e;
+  ix -> n_entries ++;
+}
+
+static void fill_trec_index(StgTRecHeader *t, TRecIndex *ix) {
+  TRACE("%p : filling index, 2^%ld slots", t, ix -> bits);
+  memset(ix -> slots, 0, sizeof(TRecIndexSlot) << ix -> bits);
+  ix -> n_entries = 0;
+  ix -> epoch = stm_gc_epoch;
+  FOR_EACH_ENTRY(t, e, {
+    index_insert(ix, e);
+  });
+}
+
+static StgArrBytes *alloc_trec_index(Capability *cap, StgWord bits) {
+  StgArrBytes *result;
+  StgArrBytes **prev;
+  StgWord bytes;
+
+  for (prev = &cap -> free_trec_indexes, result = *prev;
+       result != NULL;
+       prev = &TREC_INDEX(result) -> next_free, result = *prev) {
+    if (TREC_INDEX(result) -> bits == bits) {
+      *prev = TREC_INDEX(result) -> next_free;
+      return result;
+    }
+  }
+
+  bytes = sizeof(TRecIndex) + (sizeof(TRecIndexSlot) << bits);
+  result = (StgArrBytes *)allocate(cap, sizeofW(StgArrBytes) +
+                                        ROUNDUP_BYTES_TO_WDS(bytes));
+  SET_ARR_HDR(result, &stg_ARR_WORDS_info, CCS_SYSTEM, bytes);
+  TREC_INDEX(result) -> bits = bits;
+  return result;
+}
+
+static void free_trec_index(Capability *cap, StgArrBytes *arr) {
+#if defined(REUSE_MEMORY)
+  TREC_INDEX(arr) -> next_free = cap -> free_trec_indexes;
+  cap -> free_trec_indexes = arr;
+#endif
+}
+
+// index_new_entry : called when entry e has been added to t, to index it,
+// or to give t an index if it has grown big enough
+
+static void index_new_entry(Capability *cap, StgTRecHeader *t, TRecEntry *e) {
+  TRecIndex *ix;
+
+  if (t -> entry_index == NO_TREC_INDEX) {
+    StgTRecChunk *c = t -> current_chunk;
+    int n_chunks = 0;
+    if (c -> next_entry_idx != 1) {
+      // we only need to look when a chunk has just been started
+      return;
+    }
+    for (; c != END_STM_CHUNK_LIST && n_chunks <= TREC_INDEX_CHUNKS;
+         c = c -> prev_chunk) {
+      n_chunks ++;
+    }
+    if (n_chunks > TREC_INDEX_CHUNKS) {
+      t -> entry_index = alloc_trec_index(cap, TREC_INDEX_MIN_BITS);
+      fill_trec_index(t, TREC_INDEX(t -> entry_index));
+    }
+    return;
+  }
+
+  ix = TREC_INDEX(t -> entry_index);
+  if (ix -> epoch != stm_gc_epoch) {
+    fill_trec_index(t, ix); // picks up e
+  } else if (2 * (ix -> n_entries + 1) > ((StgWord)1 << ix -> bits)) {
+    StgArrBytes *old = t -> entry_index;
+    t -> entry_index = alloc_trec_index(cap, ix -> bits + 1);
+    free_trec_index(cap, old);
+    fill_trec_index(t, TREC_INDEX(t -> entry_index));
+  } else {
+    index_insert(ix, e);
+  }
+}
+
+// find_entry : the entry for tvar in t itself, or NULL
+
+static TRecEntry *find_entry(StgTRecHeader *t, StgTVar *tvar) {
+  TRecEntry *result = NULL;
+
+  if (t -> entry_index != NO_TREC_INDEX) {
+    TRecIndex *ix = TREC_INDEX(t -> entry_index);
+    StgWord mask = ((StgWord)1 << ix -> bits) - 1;
+    StgWord i;
+    if (ix -> epoch != stm_gc_epoch) {
+      fill_trec_index(t, ix);
+    }
+    for (i = hash_tvar(tvar, ix -> bits);
+         ix -> slots[i].tvar != NULL;
+         i = (i + 1) & mask) {
+      if (ix -> slots[i].tvar == tvar) {
+        return ix -> slots[i].entry;
+      }
+    }
+    return NULL;
+  }
+
+  FOR_EACH_ENTRY(t, e, {
+    if (e -> tvar == tvar) {
+      result = e;
+      BREAK_FOR_EACH;
+    }
+  });
+  return result;
+}
+
 static StgTRecHeader *alloc_stg_trec_header(Capability *cap,
                                             StgTRecHeader *enclosing_trec) {
   StgTRecHeader *result = NULL;
@@ -558,6 +764,10 @@ static void free_stg_trec_header(Capability *cap,
     chunk = prev_chunk;
   }
   trec -> current_chunk -> prev_chunk = END_STM_CHUNK_LIST;
+  if (trec -> entry_index != NO_TREC_INDEX) {
+    free_trec_index(cap, trec -> entry_index);
+    trec -> entry_index = NO_TREC_INDEX;
+  }
   trec -> enclosing_trec = cap -> free_trec_headers;
   cap -> free_trec_headers = trec;
 #endif
@@ -567,6 +777,120 @@ static void free_stg_trec_header(Capability *cap,
 
 // Helper functions for managing waiting lists
 
+/* Note [TVar watchers]
+   ~~~~~~~~~~~~~~~~~~~~
+   The watchers of a TVar -- the threads blocked in retry that have read
+   it, and the invariants that depend on it -- are kept in a
+   SMALL_MUT_ARR_PTRS in its watchers field, which is END_STM_WATCH_QUEUE
+   when there are none.  The watchers are packed at the start of the
+   array and the free slots after them hold END_STM_WATCH_QUEUE, so we
+   find the number of watchers by a binary search for the first free
+   slot.  The array doubles in size when it is full, and is dropped when
+   its last watcher goes.  Compared with a doubly-linked list of
+   StgTVarWatchQueue objects this saves an object of four words per
+   watcher, and waking the watchers of a TVar is a walk along an array.
+
+   A watcher remembers the slot it was put in, in the num_updates field
+   of the TRec entry for the TVar: in the waiting TRec of a thread, and
+   in the last_execution of an invariant.  To remove a watcher we move
+   the last one into its slot, so a watcher only ever moves towards the
+   start of the array, and we look for it from its remembered slot
+   downwards; usually it is still there.
+
+   The watchers of a TVar may only be changed with the TVar locked.  The
+   array is written only by the RTS, which marks it dirty as
+   stg_casSmallArrayzh does; like any mutable array it stays on the
+   mutable list.
+*/
+
+#define TVAR_WATCHERS_MIN 4
+
+static StgBool watcher_is_tso(StgClosure *w) {
+  const StgInfoTable *info = get_itbl(w);
+  return (info -> type) == TSO;
+}
+
+static StgBool watcher_is_invariant(StgClosure *w) {
+  return (w->header.info == &stg_ATOMIC_INVARIANT_info);
+}
+
+static StgSmallMutArrPtrs *new_watchers(Capability *cap, StgWord size) {
+  StgSmallMutArrPtrs *arr;
+  StgWord i;
+  arr = (StgSmallMutArrPtrs *)allocate(cap, sizeofW(StgSmallMutArrPtrs) + size);
+  SET_HDR (arr, &stg_SMALL_MUT_ARR_PTRS_DIRTY_info, CCS_SYSTEM);
+  arr -> ptrs = size;
+  for (i = 0; i < size; i ++) {
+    arr -> payload[i] = (StgClosure *)END_STM_WATCH_QUEUE;
+  }
+  return arr;
+}
+
+static StgWord num_watchers(StgSmallMutArrPtrs *arr) {
+  StgWord lo = 0;
+  StgWord hi = arr -> ptrs;
+  while (lo < hi) {
+    StgWord mid = lo + (hi - lo) / 2;
+    if (arr -> payload[mid] == (StgClosure *)END_STM_WATCH_QUEUE) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
+
+// Add w to the watchers of s, returning the slot it went into
+static StgWord add_watcher(Capability *cap, StgTVar *s, StgClosure *w) {
+  StgSmallMutArrPtrs *arr;
+  StgWord n;
+
+  if (s -> watchers == (StgClosure *)END_STM_WATCH_QUEUE) {
+    arr = new_watchers(cap, TVAR_WATCHERS_MIN);
+    n = 0;
+    s -> watchers = (StgClosure *)arr;
+    dirty_TVAR(cap,s); // we modified watchers
+  } else {
+    arr = (StgSmallMutArrPtrs *)(s -> watchers);
+    n = num_watchers(arr);
+    if (n == arr -> ptrs) {
+      StgSmallMutArrPtrs *bigger = new_watchers(cap, 2 * n);
+      memcpy(bigger -> payload, arr -> payload, n * sizeof(StgClosure *));
+      arr = bigger;
+      s -> watchers = (StgClosure *)arr;
+      dirty_TVAR(cap,s); // we modified watchers
+    }
+  }
+  arr -> payload[n] = w;
+  arr -> header.info = &stg_SMALL_MUT_ARR_PTRS_DIRTY_info;
+  return n;
+}
+
+// Remove w from the watchers of s, given the slot it was put in
+static void remove_watcher(Capability *cap, StgTVar *s, StgClosure *w,
+                           StgWord slot) {
+  StgSmallMutArrPtrs *arr;
+  StgWord n, i;
+
+  ASSERT(s -> watchers != (StgClosure *)END_STM_WATCH_QUEUE);
+  arr = (StgSmallMutArrPtrs *)(s -> watchers);
+  n = num_watchers(arr);
+  ASSERT(n > 0);
+  for (i = stg_min(slot, n - 1); arr -> payload[i] != w; i --) {
+    if (i == 0) {
+      barf("remove_watcher: %p is not watching tvar %p", w, s);
+    }
+  }
+  n --;
+  arr -> payload[i] = arr -> payload[n];
+  arr -> payload[n] = (StgClosure *)END_STM_WATCH_QUEUE;
+  arr -> header.info = &stg_SMALL_MUT_ARR_PTRS_DIRTY_info;
+  if (n == 0) {
+    s -> watchers = (StgClosure *)END_STM_WATCH_QUEUE;
+    dirty_TVAR(cap,s); // we modified watchers
+  }
+}
+
 static void build_watch_queue_entries_for_trec(Capability *cap,
                                                StgTSO *tso,
                                                StgTRecHeader *trec) {
@@ -578,22 +902,12 @@ static void build_watch_queue_entries_for_trec(Capability *cap,
 
   FOR_EACH_ENTRY(trec, e, {
     StgTVar *s;
-    StgTVarWatchQueue *q;
-    StgTVarWatchQueue *fq;
     s = e -> tvar;
     TRACE("%p : adding tso=%p to watch queue for tvar=%p", trec, tso, s);
     ACQ_ASSERT(s -> current_value == (StgClosure *)trec);
     NACQ_ASSERT(s -> current_value == e -> expected_value);
-    fq = s -> first_watch_queue_entry;
-    q = alloc_stg_tvar_watch_queue(cap, (StgClosure*) tso);
-    q -> next_queue_entry = fq;
-    q -> prev_queue_entry = END_STM_WATCH_QUEUE;
-    if (fq != END_STM_WATCH_QUEUE) {
-      fq -> prev_queue_entry = q;
-    }
-    s -> first_watch_queue_entry = q;
-    e -> new_value = (StgClosure *) q;
-    dirty_TVAR(cap,s); // we modified first_watch_queue_entry
+    e -> num_updates = add_watcher(cap, s, (StgClosure *) tso);
+    e -> new_value = (StgClosure *) tso;
   });
 }
 
@@ -608,39 +922,208 @@ static void remove_watch_queue_entries_for_trec(Capability *cap,
 
   FOR_EACH_ENTRY(trec, e, {
     StgTVar *s;
-    StgTVarWatchQueue *pq;
-    StgTVarWatchQueue *nq;
-    StgTVarWatchQueue *q;
     StgClosure *saw;
     s = e -> tvar;
     saw = lock_tvar(trec, s);
-    q = (StgTVarWatchQueue *) (e -> new_value);
     TRACE("%p : removing tso=%p from watch queue for tvar=%p",
           trec,
-          q -> closure,
+          e -> new_value,
           s);
     ACQ_ASSERT(s -> current_value == (StgClosure *)trec);
-    nq = q -> next_queue_entry;
-    pq = q -> prev_queue_entry;
-    if (nq != END_STM_WATCH_QUEUE) {
-      nq -> prev_queue_entry = pq;
-    }
-    if (pq != END_STM_WATCH_QUEUE) {
-      pq -> next_queue_entry = nq;
+    remove_watcher(cap, s, e -> new_value, e -> num_updates);
+    unlock_tvar(cap, trec, s, saw, false);
+  });
+}
+
+/*......................................................................*/
+
+// Helper functions for thread blocking and unblocking
+
+/* Note [STM wakeup batching]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~
+   A commit wakes every thread blocked in retry that has read one of the
+   TVars it updated.  When many threads wait on one TVar -- a pool of
+   workers waiting for a queue to become non-empty, say -- one commit
+   makes all of them runnable, although usually only one can make
+   progress, and by the time the others run the TVar often holds its old
+   value again.  Each of those pays for a context switch and for locking
+   its whole read set in stmReWait(), only to go back to sleep.
+
+   So a commit wakes at most STM_WAKEUP_BATCH threads, and puts off the
+   wakeup of the rest: it marks them STM_DEFERRED (in block_info) and
+   puts them on its capability's list of deferred wakeups, while they
+   stay on the TVars' watchers as before.  The scheduler works through
+   the list, STM_WAKEUP_BATCH wakeups at a time, whenever the capability
+   has fewer than STM_WAKEUP_BATCH threads to run, and completely at
+   each GC, when every capability is stopped, so a deferred thread is
+   never put off indefinitely.  A capability with deferred wakeups counts
+   as having work to do, so it doesn't go to sleep with them.  Before
+   waking a deferred thread we look at its read set.  If every TVar in it
+   still holds the value the transaction saw, the thread would only go
+   back to sleep, so we leave it asleep.  That is safe because it is
+   still watching the TVars: any commit that changes one of them will
+   wake it (or defer it) again.  A TVar that a commit has locked holds
+   the committing TRec rather than a value, so then we wake the thread.
+
+   The STM_DEFERRED mark tells a commit that the thread is on a list of
+   deferred wakeups already, so it is on at most one list while it
+   sleeps; the lists may also hold entries for threads that have been
+   woken since, which we skip.  All of this is done with the TSO locked,
+   as in unpark_tso().  The GC keeps the block_info of a BlockedOnSTM
+   thread (it is always a static closure), so that the mark survives
+   until another capability gets round to its list.
+
+   Each capability counts wakeups, deferrals and what became of the
+   woken threads in cap->stm_stats, which are written to the eventlog
+   as EVENT_STM_COUNTERS with the scheduler events.  A thread that
+   re-executes its transaction after a wakeup is flagged TSO_STM_REEXEC
+   until it commits or retries again, so that we can count the wakeups
+   that were worth it.
+*/
+
+static void park_tso(StgTSO *tso) {
+  ASSERT(tso -> why_blocked == NotBlocked);
+  tso -> why_blocked = BlockedOnSTM;
+  tso -> block_info.closure = (StgClosure *) END_TSO_QUEUE;
+  TRACE("park_tso on tso=%p", tso);
+}
+
+// Wake tso, with the TSO locked
+static void wake_tso(Capability *cap, StgTSO *tso) {
+  tso->block_info.closure = &stg_STM_AWOKEN_closure;
+  tryWakeupThread(cap,tso);
+  cap->stm_stats.woken ++;
+}
+
+// Put off the wakeup of tso, with the TSO locked
+static void defer_tso(Capability *cap, StgTSO *tso) {
+  StgTVarWatchQueue *q = alloc_stg_tvar_watch_queue(cap, (StgClosure *) tso);
+  tso->block_info.closure = &stg_STM_DEFERRED_closure;
+  q -> next_queue_entry = END_STM_WATCH_QUEUE;
+  if (cap -> stm_deferred_tl == END_STM_WATCH_QUEUE) {
+    cap -> stm_deferred_hd = q;
+  } else {
+    cap -> stm_deferred_tl -> next_queue_entry = q;
+  }
+  cap -> stm_deferred_tl = q;
+  cap->stm_stats.deferred ++;
+}
+
+// Wake tso or, if defer, put its wakeup off (see Note [STM wakeup
+// batching]).  Returns true if we woke it.
+static StgBool unpark_tso(Capability *cap, StgTSO *tso, StgBool defer) {
+    StgBool woken = false;
+
+    // We will continue unparking threads while they remain on one of the wait
+    // queues: it's up to the thread itself to remove it from the wait queues
+    // if it decides to do so when it is scheduled.
+
+    // Unblocking a TSO from BlockedOnSTM is done under the TSO lock,
+    // to avoid multiple CPUs unblocking the same TSO, and also to
+    // synchronise with throwTo(). The first time the TSO is unblocked
+    // we mark this fact by setting block_info.closure == STM_AWOKEN.
+    // This way we can avoid sending further wakeup messages in the
+    // future.
+    lockTSO(tso);
+    if (tso->why_blocked == BlockedOnSTM &&
+        tso->block_info.closure == &stg_STM_AWOKEN_closure) {
+      TRACE("unpark_tso already woken up tso=%p", tso);
+    } else if (tso -> why_blocked == BlockedOnSTM && defer) {
+      if (tso->block_info.closure != &stg_STM_DEFERRED_closure) {
+        TRACE("deferring unpark_tso on tso=%p", tso);
+        defer_tso(cap, tso);
+      }
+    } else if (tso -> why_blocked == BlockedOnSTM) {
+      TRACE("unpark_tso on tso=%p", tso);
+      wake_tso(cap, tso);
+      woken = true;
     } else {
-      ASSERT(s -> first_watch_queue_entry == q);
-      s -> first_watch_queue_entry = nq;
-      dirty_TVAR(cap,s); // we modified first_watch_queue_entry
+      TRACE("spurious unpark_tso on tso=%p", tso);
+    }
+    unlockTSO(tso);
+    return woken;
+}
+
+// *woken counts the threads that this commit has woken so far
+static void unpark_waiters_on(Capability *cap, StgTVar *s, uint32_t *woken) {
+  StgSmallMutArrPtrs *arr;
+  StgWord i, n;
+  TRACE("unpark_waiters_on tvar=%p", s);
+  if (s -> watchers == (StgClosure *)END_STM_WATCH_QUEUE) {
+    return;
+  }
+  arr = (StgSmallMutArrPtrs *)(s -> watchers);
+  n = num_watchers(arr);
+  // unblock TSOs roughly in the order they started waiting, to be a bit
+  // fairer (#2319)
+  for (i = 0; i < n; i ++) {
+    StgClosure *w = arr -> payload[i];
+    if (watcher_is_tso(w) &&
+        unpark_tso(cap, (StgTSO *)w, *woken >= STM_WAKEUP_BATCH)) {
+      (*woken) ++;
+    }
+  }
+}
+
+// Does every TVar read by the waiting transaction trec still hold the
+// value that it saw?  See Note [STM wakeup batching]
+static StgBool waiting_trec_unchanged(StgTRecHeader *trec) {
+  StgBool result = true;
+  if (trec -> state != TREC_WAITING) {
+    return false;
+  }
+  FOR_EACH_ENTRY(trec, e, {
+    if (e -> tvar -> current_value != e -> expected_value) {
+      result = false;
+      BREAK_FOR_EACH;
     }
-    free_stg_tvar_watch_queue(cap, q);
-    unlock_tvar(cap, trec, s, saw, false);
   });
+  return result;
+}
+
+void stmWakeDeferred(Capability *cap, bool all) {
+  uint32_t woken = 0;
+
+  if (cap -> stm_deferred_hd == END_STM_WATCH_QUEUE) {
+    return;
+  }
+
+  // With STM_CG_LOCK this keeps commits out while we look at the TVars
+  lock_stm(NO_TREC);
+  while (cap -> stm_deferred_hd != END_STM_WATCH_QUEUE &&
+         (all || woken < STM_WAKEUP_BATCH)) {
+    StgTVarWatchQueue *q = cap -> stm_deferred_hd;
+    StgTSO *tso = (StgTSO *)(q -> closure);
+
+    cap -> stm_deferred_hd = q -> next_queue_entry;
+    if (cap -> stm_deferred_hd == END_STM_WATCH_QUEUE) {
+      cap -> stm_deferred_tl = END_STM_WATCH_QUEUE;
+    }
+    free_stg_tvar_watch_queue(cap, q);
+
+    lockTSO(tso);
+    if (tso -> why_blocked == BlockedOnSTM &&
+        tso -> block_info.closure == &stg_STM_DEFERRED_closure) {
+      if (waiting_trec_unchanged(tso -> trec)) {
+        TRACE("dropping deferred wakeup of tso=%p", tso);
+        tso -> block_info.closure = (StgClosure *) END_TSO_QUEUE;
+        cap->stm_stats.skipped ++;
+      } else {
+        TRACE("deferred unpark_tso on tso=%p", tso);
+        wake_tso(cap, tso);
+        woken ++;
+      }
+    }
+    unlockTSO(tso);
+  }
+  unlock_stm(NO_TREC);
 }
 
 /*......................................................................*/
 
 static TRecEntry *get_new_entry(Capability *cap,
-                                StgTRecHeader *t) {
+                                StgTRecHeader *t,
+                                StgTVar *tvar) {
   TRecEntry *result;
   StgTRecChunk *c;
   int i;
@@ -663,6 +1146,8 @@ static TRecEntry *get_new_entry(Capability *cap,
     result = &(nc -> entries[0]);
   }
 
+  result -> tvar = tvar;
+  index_new_entry(cap, t, result);
   return result;
 }
 
@@ -675,28 +1160,19 @@ static void merge_update_into(Capability *cap,
                               StgClosure *new_value)
 {
   // Look for an entry in this trec
-  bool found = false;
-  FOR_EACH_ENTRY(t, e, {
-    StgTVar *s;
-    s = e -> tvar;
-    if (s == tvar) {
-      found = true;
-      if (e -> expected_value != expected_value) {
-        // Must abort if the two entries start from different values
-        TRACE("%p : update entries inconsistent at %p (%p vs %p)",
-              t, tvar, e -> expected_value, expected_value);
-        t -> state = TREC_CONDEMNED;
-      }
-      e -> new_value = new_value;
-      BREAK_FOR_EACH;
+  TRecEntry *e = find_entry(t, tvar);
+  if (e != NULL) {
+    if (e -> expected_value != expected_value) {
+      // Must abort if the two entries start from different values
+      TRACE("%p : update entries inconsistent at %p (%p vs %p)",
+            t, tvar, e -> expected_value, expected_value);
+      t -> state = TREC_CONDEMNED;
     }
-  });
-
-  if (!found) {
+    e -> new_value = new_value;
+  } else {
     // No entry so far in this trec
     TRecEntry *ne;
-    ne = get_new_entry(cap, t);
-    ne -> tvar = tvar;
+    ne = get_new_entry(cap, t, tvar);
     ne -> expected_value = expected_value;
     ne -> new_value = new_value;
   }
@@ -735,25 +1211,22 @@ static void merge_read_into(Capability *cap,
   //
   for (t = trec; !found && t != NO_TREC; t = t -> enclosing_trec)
   {
-    FOR_EACH_ENTRY(t, e, {
-      if (e -> tvar == tvar) {
-        found = true;
-        if (e -> expected_value != expected_value) {
-            // Must abort if the two entries start from different values
-            TRACE("%p : read entries inconsistent at %p (%p vs %p)",
-                  t, tvar, e -> expected_value, expected_value);
-            t -> state = TREC_CONDEMNED;
-        }
-        BREAK_FOR_EACH;
+    TRecEntry *e = find_entry(t, tvar);
+    if (e != NULL) {
+      found = true;
+      if (e -> expected_value != expected_value) {
+          // Must abort if the two entries start from different values
+          TRACE("%p : read entries inconsistent at %p (%p vs %p)",
+                t, tvar, e -> expected_value, expected_value);
+          t -> state = TREC_CONDEMNED;
       }
-    });
+    }
   }
 
   if (!found) {
     // No entry found
     TRecEntry *ne;
-    ne = get_new_entry(cap, trec);
-    ne -> tvar = tvar;
+    ne = get_new_entry(cap, trec, tvar);
     ne -> expected_value = expected_value;
     ne -> new_value = expected_value;
   }
@@ -767,6 +1240,19 @@ static StgBool entry_is_update(TRecEntry *e) {
   return result;
 }
 
+#if defined(STM_TL2)
+static StgBool trec_is_read_only(StgTRecHeader *trec) {
+  StgBool result = true;
+  FOR_EACH_ENTRY(trec, e, {
+    if (entry_is_update(e)) {
+      result = false;
+      BREAK_FOR_EACH;
+    }
+  });
+  return result;
+}
+#endif
+
 #if defined(STM_FG_LOCKS)
 static StgBool entry_is_read_only(TRecEntry *e) {
   StgBool result;
@@ -781,6 +1267,31 @@ static StgBool tvar_is_locked(StgTVar *s, StgTRecHeader *h) {
   result = (c == (StgClosure *) h);
   return result;
 }
+
+// tvar_updated_since : has the TVar of a read-only entry been updated since
+// validate_and_acquire_ownership stashed its version in the entry (or, with
+// STM_TL2, since the transaction's read version)?
+
+static StgBool tvar_updated_since(StgTRecHeader *trec STG_UNUSED, TRecEntry *e) {
+  StgTVar *s = e -> tvar;
+#if defined(STM_TL2)
+  return ((StgWord)s -> num_updates > trec -> read_version);
+#else
+  return (s -> num_updates != e -> num_updates);
+#endif
+}
+
+// stamp_tvar : record a committed update to a TVar that we have locked,
+// before unlock_tvar stores the new value.
+
+static void stamp_tvar(StgTVar *s, StgWord write_version STG_UNUSED) {
+#if defined(STM_TL2)
+  s -> num_updates = write_version;
+  write_barrier();
+#else
+  s -> num_updates ++;
+#endif
+}
 #endif
 
 // revert_ownership : release a lock on a TVar, storing back
@@ -846,7 +1357,9 @@ static StgBool validate_and_acquire_ownership (Capability *cap,
           result = false;
           BREAK_FOR_EACH;
         }
-      } else {
+      } else if (!config_use_clock) {
+        // With STM_TL2 the reads have been checked against the read
+        // version already; see Note [TL2 commit]
         ASSERT(config_use_read_phase);
         IF_STM_FG_LOCKS({
           TRACE("%p : will need to check %p", trec, s);
@@ -880,7 +1393,8 @@ static StgBool validate_and_acquire_ownership (Capability *cap,
 // commit an update to the TVar is unchanged since the value was stashed in
 // validate_and_acquire_ownership.  If no udpate is seen to any TVar than
 // all of them contained their expected values at the start of the call to
-// check_read_only.
+// check_read_only.  With STM_TL2 it checks instead that none of them has
+// been updated since the trec's read version, see Note [TL2 commit].
 //
 // The paper "Concurrent programming without locks" (under submission), or
 // Keir Fraser's PhD dissertation "Practical lock-free programming" discuss
@@ -901,7 +1415,7 @@ static StgBool check_read_only(StgTRecHeader *trec STG_UNUSED) {
         // locked by another transaction that is committing but has not yet
         // incremented `num_updates` (See #7815).
         if (s -> current_value != e -> expected_value ||
-            s -> num_updates != e -> num_updates) {
+            tvar_updated_since(trec, e)) {
           TRACE("%p : mismatch", trec);
           result = false;
           BREAK_FOR_EACH;
@@ -922,6 +1436,9 @@ void stmPreGCHook (Capability *cap) {
   cap->free_tvar_watch_queues = END_STM_WATCH_QUEUE;
   cap->free_trec_chunks = END_STM_CHUNK_LIST;
   cap->free_trec_headers = NO_TREC;
+  cap->free_trec_indexes = NULL;
+  // TVars are about to move: see Note [TRec index]
+  atomic_inc(&stm_gc_epoch, 1);
   unlock_stm(NO_TREC);
 }
 
@@ -974,6 +1491,13 @@ StgTRecHeader *stmStartTransaction(Capability *cap,
   getToken(cap);
 
   t = alloc_stg_trec_header(cap, outer);
+#if defined(STM_TL2)
+  // A nest of transactions reads from a single snapshot: see Note [TL2 commit]
+  t -> read_version = (outer == NO_TREC) ? ACQUIRE_LOAD(&stm_clock)
+                                         : outer -> read_version;
+#else
+  t -> read_version = 0;
+#endif
   TRACE("%p : stmStartTransaction()=%p", outer, t);
   return t;
 }
@@ -1094,15 +1618,10 @@ static TRecEntry *get_entry_for(StgTRecHeader *trec, StgTVar *tvar, StgTRecHeade
   ASSERT(trec != NO_TREC);
 
   do {
-    FOR_EACH_ENTRY(trec, e, {
-      if (e -> tvar == tvar) {
-        result = e;
-        if (in != NULL) {
-          *in = trec;
-        }
-        BREAK_FOR_EACH;
-      }
-    });
+    result = find_entry(trec, tvar);
+    if (result != NULL && in != NULL) {
+      *in = trec;
+    }
     trec = trec -> enclosing_trec;
   } while (result == NULL && trec != NO_TREC);
 
@@ -1124,34 +1643,8 @@ static void disconnect_invariant(Capability *cap,
 
   FOR_EACH_ENTRY(last_execution, e, {
     StgTVar *s = e -> tvar;
-    StgTVarWatchQueue *q = s -> first_watch_queue_entry;
-    DEBUG_ONLY( StgBool found = false );
-    TRACE("  looking for trec on tvar=%p", s);
-    for (q = s -> first_watch_queue_entry;
-         q != END_STM_WATCH_QUEUE;
-         q = q -> next_queue_entry) {
-      if (q -> closure == (StgClosure*)inv) {
-        StgTVarWatchQueue *pq;
-        StgTVarWatchQueue *nq;
-        nq = q -> next_queue_entry;
-        pq = q -> prev_queue_entry;
-        if (nq != END_STM_WATCH_QUEUE) {
-          nq -> prev_queue_entry = pq;
-        }
-        if (pq != END_STM_WATCH_QUEUE) {
-          pq -> next_queue_entry = nq;
-        } else {
-          ASSERT(s -> first_watch_queue_entry == q);
-          s -> first_watch_queue_entry = nq;
-          dirty_TVAR(cap,s); // we modified first_watch_queue_entry
-        }
-        TRACE("  found it in watch queue entry %p", q);
-        free_stg_tvar_watch_queue(cap, q);
-        DEBUG_ONLY( found = true );
-        break;
-      }
-    }
-    ASSERT(found);
+    TRACE("  unlinking trec on tvar=%p", s);
+    remove_watcher(cap, s, (StgClosure*)inv, e -> num_updates);
   });
   inv -> last_execution = NO_TREC;
 }
@@ -1165,8 +1658,6 @@ static void connect_invariant_to_trec(Capability *cap,
 
   FOR_EACH_ENTRY(my_execution, e, {
     StgTVar *s = e -> tvar;
-    StgTVarWatchQueue *q = alloc_stg_tvar_watch_queue(cap, (StgClosure*)inv);
-    StgTVarWatchQueue *fq = s -> first_watch_queue_entry;
 
     // We leave "last_execution" holding the values that will be
     // in the heap after the transaction we're in the process
@@ -1177,14 +1668,8 @@ static void connect_invariant_to_trec(Capability *cap,
       e -> new_value = entry -> new_value;
     }
 
-    TRACE("  linking trec on tvar=%p value=%p q=%p", s, e -> expected_value, q);
-    q -> next_queue_entry = fq;
-    q -> prev_queue_entry = END_STM_WATCH_QUEUE;
-    if (fq != END_STM_WATCH_QUEUE) {
-      fq -> prev_queue_entry = q;
-    }
-    s -> first_watch_queue_entry = q;
-    dirty_TVAR(cap,s); // we modified first_watch_queue_entry
+    TRACE("  linking trec on tvar=%p value=%p", s, e -> expected_value);
+    e -> num_updates = add_watcher(cap, s, (StgClosure*)inv);
   });
 
   inv -> last_execution = my_execution;
@@ -1256,32 +1741,34 @@ StgInvariantCheckQueue *stmGetInvariantsToCheck(Capability *cap, StgTRecHeader *
         // Pick up any invariants on the TVar being updated
         // by entry "e"
 
-        StgTVarWatchQueue *q;
         TRACE("%p : checking for invariants on %p", trec, s);
-        for (q = s -> first_watch_queue_entry;
-             q != END_STM_WATCH_QUEUE;
-             q = q -> next_queue_entry) {
-          if (watcher_is_invariant(q)) {
-            StgBool found = false;
-            StgInvariantCheckQueue *q2;
-            TRACE("%p : Touching invariant %p", trec, q -> closure);
-            for (q2 = trec -> invariants_to_check;
-                 q2 != END_INVARIANT_CHECK_QUEUE;
-                 q2 = q2 -> next_queue_entry) {
-              if (q2 -> invariant == (StgAtomicInvariant*)(q -> closure)) {
-                TRACE("%p : Already found %p", trec, q -> closure);
-                found = true;
-                break;
+        if (s -> watchers != (StgClosure *)END_STM_WATCH_QUEUE) {
+          StgSmallMutArrPtrs *arr = (StgSmallMutArrPtrs *)(s -> watchers);
+          StgWord j, n = num_watchers(arr);
+          for (j = 0; j < n; j ++) {
+            StgClosure *w = arr -> payload[j];
+            if (watcher_is_invariant(w)) {
+              StgBool found = false;
+              StgInvariantCheckQueue *q2;
+              TRACE("%p : Touching invariant %p", trec, w);
+              for (q2 = trec -> invariants_to_check;
+                   q2 != END_INVARIANT_CHECK_QUEUE;
+                   q2 = q2 -> next_queue_entry) {
+                if (q2 -> invariant == (StgAtomicInvariant*)w) {
+                  TRACE("%p : Already found %p", trec, w);
+                  found = true;
+                  break;
+                }
               }
-            }
 
-            if (!found) {
-              StgInvariantCheckQueue *q3;
-              TRACE("%p : Not already found %p", trec, q -> closure);
-              q3 = alloc_stg_invariant_check_queue(cap,
-                                                   (StgAtomicInvariant*) q -> closure);
-              q3 -> next_queue_entry = trec -> invariants_to_check;
-              trec -> invariants_to_check = q3;
+              if (!found) {
+                StgInvariantCheckQueue *q3;
+                TRACE("%p : Not already found %p", trec, w);
+                q3 = alloc_stg_invariant_check_queue(cap,
+                                                     (StgAtomicInvariant*) w);
+                q3 -> next_queue_entry = trec -> invariants_to_check;
+                trec -> invariants_to_check = q3;
+              }
             }
           }
         }
@@ -1304,9 +1791,15 @@ StgInvariantCheckQueue *stmGetInvariantsToCheck(Capability *cap, StgTRecHeader *
 /*......................................................................*/
 
 StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
+#if !defined(STM_TL2)
   StgInt64 max_commits_at_start = max_commits;
+#endif
+#if defined(STM_FG_LOCKS)
+  StgWord write_version = 0;
+#endif
   StgBool touched_invariants;
   StgBool use_read_phase;
+  uint32_t woken = 0;
 
   TRACE("%p : stmCommitTransaction()", trec);
   ASSERT(trec != NO_TREC);
@@ -1374,11 +1867,32 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
 
   use_read_phase = ((config_use_read_phase) && (!touched_invariants));
 
+#if defined(STM_TL2)
+  if (use_read_phase && trec_is_read_only(trec)) {
+    // Every read was from the snapshot at the read version, and there is
+    // nothing to write: we are done.  See Note [TL2 commit].
+    StgBool result = (trec -> state == TREC_ACTIVE) && !shake();
+    unlock_stm(trec);
+    free_stg_trec_header(cap, trec);
+    TRACE("%p : stmCommitTransaction() read-only=%d", trec, result);
+    return result;
+  }
+#endif
+
   bool result = validate_and_acquire_ownership(cap, trec, (!use_read_phase), true);
   if (result) {
     // We now know that all the updated locations hold their expected values.
     ASSERT(trec -> state == TREC_ACTIVE);
 
+#if defined(STM_TL2)
+    write_version = atomic_inc(&stm_clock, 1);
+    if (use_read_phase && write_version != trec -> read_version + 1) {
+      // Somebody else has committed since we took our read version
+      TRACE("%p : doing read check", trec);
+      result = check_read_only(trec);
+      TRACE("%p : read-check %s", trec, result ? "succeeded" : "failed");
+    }
+#else
     if (use_read_phase) {
       StgInt64 max_commits_at_end;
       StgInt64 max_concurrent_commits;
@@ -1393,6 +1907,7 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
         result = false;
       }
     }
+#endif
 
     if (result) {
       // We now know that all of the read-only locations held their expected values
@@ -1430,9 +1945,9 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
 
           ACQ_ASSERT(tvar_is_locked(s, trec));
           TRACE("%p : writing %p to %p, waking waiters", trec, e -> new_value, s);
-          unpark_waiters_on(cap,s);
+          unpark_waiters_on(cap, s, &woken);
           IF_STM_FG_LOCKS({
-            s -> num_updates ++;
+            stamp_tvar(s, write_version);
           });
           unlock_tvar(cap, trec, s, e -> new_value, true);
         }
@@ -1447,6 +1962,12 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
 
   free_stg_trec_header(cap, trec);
 
+  // See Note [STM wakeup batching]
+  if (result && (cap -> r.rCurrentTSO -> flags & TSO_STM_REEXEC)) {
+    cap -> r.rCurrentTSO -> flags &= ~TSO_STM_REEXEC;
+    cap->stm_stats.committed ++;
+  }
+
   TRACE("%p : stmCommitTransaction()=%d", trec, result);
 
   return result;
@@ -1512,6 +2033,10 @@ StgBool stmWait(Capability *cap, StgTSO *tso, StgTRecHeader *trec) {
   ASSERT((trec -> state == TREC_ACTIVE) ||
          (trec -> state == TREC_CONDEMNED));
 
+  // a re-execution that retries again did not pay off, see
+  // Note [STM wakeup batching]
+  tso -> flags &= ~TSO_STM_REEXEC;
+
   lock_stm(trec);
   bool result = validate_and_acquire_ownership(cap, trec, true, true);
   if (result) {
@@ -1570,6 +2095,7 @@ StgBool stmReWait(Capability *cap, StgTSO *tso) {
     ASSERT(trec -> state == TREC_WAITING);
     park_tso(tso);
     revert_ownership(cap, trec, true);
+    cap->stm_stats.rewaited ++;
   } else {
     // The transcation has become invalid.  We can now remove it from the wait
     // queues.
@@ -1577,6 +2103,8 @@ StgBool stmReWait(Capability *cap, StgTSO *tso) {
       remove_watch_queue_entries_for_trec (cap, trec);
     }
     free_stg_trec_header(cap, trec);
+    tso -> flags |= TSO_STM_REEXEC;
+    cap->stm_stats.reexecuted ++;
   }
   unlock_stm(trec);
 
@@ -1586,8 +2114,30 @@ StgBool stmReWait(Capability *cap, StgTSO *tso) {
 
 /*......................................................................*/
 
-static StgClosure *read_current_value(StgTRecHeader *trec STG_UNUSED, StgTVar *tvar) {
+static StgClosure *read_current_value(Capability *cap STG_UNUSED,
+                                      StgTRecHeader *trec STG_UNUSED,
+                                      StgTVar *tvar) {
   StgClosure *result;
+#if defined(STM_TL2)
+  StgWord version;
+
+  // See Note [TL2 commit]
+  result = read_versioned(tvar, &version);
+  if (version > trec -> read_version && trec -> state == TREC_ACTIVE) {
+    if (extend_read_version(trec)) {
+      result = read_versioned(tvar, &version);
+    }
+    if (version > trec -> read_version) {
+      StgTRecHeader *t;
+      TRACE("%p : read_current_value(%p) too new, condemning", trec, tvar);
+      for (t = trec; t != NO_TREC; t = t -> enclosing_trec) {
+        t -> state = TREC_CONDEMNED;
+      }
+      // return to the scheduler, which will restart the transaction
+      stopCapability(cap);
+    }
+  }
+#else
   result = tvar -> current_value;
 
 #if defined(STM_FG_LOCKS)
@@ -1595,6 +2145,7 @@ static StgClosure *read_current_value(StgTRecHeader *trec STG_UNUSED, StgTVar *t
     TRACE("%p : read_current_value(%p) saw %p", trec, tvar, result);
     result = tvar -> current_value;
   }
+#endif
 #endif
 
   TRACE("%p : read_current_value(%p)=%p", trec, tvar, result);
@@ -1622,17 +2173,15 @@ StgClosure *stmReadTVar(Capability *cap,
       result = entry -> new_value;
     } else {
       // Entry found in another trec
-      TRecEntry *new_entry = get_new_entry(cap, trec);
-      new_entry -> tvar = tvar;
+      TRecEntry *new_entry = get_new_entry(cap, trec, tvar);
       new_entry -> expected_value = entry -> expected_value;
       new_entry -> new_value = entry -> new_value;
       result = new_entry -> new_value;
     }
   } else {
     // No entry found
-    StgClosure *current_value = read_current_value(trec, tvar);
-    TRecEntry *new_entry = get_new_entry(cap, trec);
-    new_entry -> tvar = tvar;
+    StgClosure *current_value = read_current_value(cap, trec, tvar);
+    TRecEntry *new_entry = get_new_entry(cap, trec, tvar);
     new_entry -> expected_value = current_value;
     new_entry -> new_value = current_value;
     result = current_value;
@@ -1664,16 +2213,14 @@ void stmWriteTVar(Capability *cap,
       entry -> new_value = new_value;
     } else {
       // Entry found in another trec
-      TRecEntry *new_entry = get_new_entry(cap, trec);
-      new_entry -> tvar = tvar;
+      TRecEntry *new_entry = get_new_entry(cap, trec, tvar);
       new_entry -> expected_value = entry -> expected_value;
       new_entry -> new_value = new_value;
     }
   } else {
     // No entry found
-    StgClosure *current_value = read_current_value(trec, tvar);
-    TRecEntry *new_entry = get_new_entry(cap, trec);
-    new_entry -> tvar = tvar;
+    StgClosure *current_value = read_current_value(cap, trec, tvar);
+    TRecEntry *new_entry = get_new_entry(cap, trec, tvar);
     new_entry -> expected_value = current_value;
     new_entry -> new_value = new_value;
   }
@@ -26,6 +26,15 @@
                   saw_update_by field of the TVars so that they do not 
                   need to be locked for reading.
 
+  STM_TL2      -- STM_FG_LOCKS with a global version clock, as in the
+                  TL2 algorithm : each TVar is stamped with the clock
+                  value of the commit that last wrote it, so that reads
+                  are validated as they happen and read-only
+                  transactions commit without touching any shared
+                  state.  Select it by building the RTS with
+                  -DSTM_TL2 (e.g. GhcRtsHcOpts += -DSTM_TL2 in
+                  mk/build.mk).
+
   STM.C contains more details about the locking schemes used.
 
 */
@@ -33,9 +42,18 @@
 #pragma once
 
 #if defined(THREADED_RTS)
+#if defined(STM_TL2)
+// TL2 uses the per-TVar locks of STM_FG_LOCKS, see Note [TL2 commit]
+#if SIZEOF_VOID_P < 8
+#error "STM_TL2 needs a 64-bit version clock"
+#endif
+#define STM_FG_LOCKS
+#else
 //#define STM_CG_LOCK
 #define STM_FG_LOCKS
+#endif
 #else
+#undef STM_TL2
 #define STM_UNIPROC
 #endif
 
@@ -180,6 +198,18 @@ void stmWaitUnlock(Capability *cap, StgTRecHeader *trec);
 
 StgBool stmReWait(Capability *cap, StgTSO *tso);
 
+/*
+ * A commit wakes at most STM_WAKEUP_BATCH of the threads waiting on the
+ * tvars it updated, and puts off the wakeups of the rest.  stmWakeDeferred
+ * wakes those of the capability's deferred threads whose tvars have
+ * changed, STM_WAKEUP_BATCH of them at most unless all is true.  See
+ * Note [STM wakeup batching] in STM.c.
+ */
+
+#define STM_WAKEUP_BATCH 16
+
+void stmWakeDeferred(Capability *cap, bool all);
+
 /*----------------------------------------------------------------------
 
    Data access operations
@@ -28,8 +28,10 @@
 #include "Weak.h"
 #include "sm/GC.h" // waitForGcThreads, releaseGCThreads, N
 #include "sm/GCThread.h"
+#include "sm/NonMovingMark.h"
 #include "Sparks.h"
 #include "Capability.h"
+#include "AllocSample.h"
 #include "Task.h"
 #include "AwaitEvent.h"
 #if defined(mingw32_HOST_OS)
@@ -129,7 +131,6 @@ static void scheduleYield (Capability **pcap, Task *task);
 static bool requestSync (Capability **pcap, Task *task,
                          PendingSync *sync_type, SyncType *prev_sync_type);
 static void acquireAllCapabilities(Capability *cap, Task *task);
-static void releaseAllCapabilities(uint32_t n, Capability *cap, Task *task);
 static void startWorkerTasks (uint32_t from USED_IF_THREADS,
                               uint32_t to USED_IF_THREADS);
 #endif
@@ -140,6 +141,8 @@ static void scheduleDetectDeadlock (Capability **pcap, Task *task);
 static void schedulePushWork(Capability *cap, Task *task);
 #if defined(THREADED_RTS)
 static void scheduleActivateSpark(Capability *cap);
+static void scheduleTakeStealableThreads(Capability *cap);
+static void scheduleStealThreads(Capability *cap);
 #endif
 static void schedulePostRunThread(Capability *cap, StgTSO *t);
 static bool scheduleHandleHeapOverflow( Capability *cap, StgTSO *t );
@@ -313,6 +316,11 @@ schedule (Capability *initialCapability, Task *task)
     }
 #endif
 
+    // -xi: mark or sweep the oldest generation for a while
+    if (RtsFlags.GcFlags.incrementalSlice != 0) {
+        nonmovingIncrementalSlice();
+    }
+
     //
     // Get a thread to run
     //
@@ -486,6 +494,11 @@ run_thread:
     // don't want it set when not running a Haskell thread.
     cap->r.rCurrentTSO = NULL;
 
+    // See Note [Allocation sampling] in AllocSample.c
+    if (RTS_UNLIKELY(allocSampleDue(cap))) {
+        sampleAllocation(cap, t);
+    }
+
     // And save the current errno in this thread.
     // XXX: possibly bogus for SMP because this thread might already
     // be running again, see code below.
@@ -621,7 +634,16 @@ scheduleFindWork (Capability **pcap)
 
     scheduleCheckBlockedThreads(*pcap);
 
+    // See Note [STM wakeup batching] in STM.c
+    if ((*pcap)->n_run_queue < STM_WAKEUP_BATCH) {
+        stmWakeDeferred(*pcap, false);
+    }
+
 #if defined(THREADED_RTS)
+    // See Note [Stealing threads]
+    scheduleTakeStealableThreads(*pcap);
+    if (emptyRunQueue(*pcap)) { scheduleStealThreads(*pcap); }
+
     if (emptyRunQueue(*pcap)) { scheduleActivateSpark(*pcap); }
 #endif
 }
@@ -673,6 +695,7 @@ scheduleYield (Capability **pcap, Task *task)
     if (!shouldYieldCapability(cap,task,false) &&
         (!emptyRunQueue(cap) ||
          !emptyInbox(cap) ||
+         !emptyStmDeferred(cap) ||
          sched_state >= SCHED_INTERRUPTING)) {
         return;
     }
@@ -691,6 +714,171 @@ scheduleYield (Capability **pcap, Task *task)
 }
 #endif
 
+/* -----------------------------------------------------------------------------
+ * Stealing threads
+ * -------------------------------------------------------------------------- */
+
+/* Note [Stealing threads]
+   ~~~~~~~~~~~~~~~~~~~~~~~
+   schedulePushWork() shares out the run queue only when the Capability
+   runs its scheduler loop, so a thread that forks a burst of threads
+   keeps all of them on its own Capability until its time slice runs
+   out, however many Capabilities are idle.  So that idle Capabilities
+   can pull that work themselves, each Capability has a work-stealing
+   deque (WSDeque.c) of stealable threads, cap->stealable_threads, as
+   well as its run queue.
+
+   scheduleThread() puts a new thread there, rather than on the run
+   queue, if migration is enabled (+RTS -qm turns it off) and the thread
+   is neither bound nor locked to the Capability (forkOn), and wakes up
+   a worker on an idle Capability if there is one.  Capabilities that
+   releaseCapability_() leaves free with nothing to do are counted in
+   n_parked_capabilities, so when none is idle (the usual case) forking
+   a thread doesn't look at the other Capabilities.  A Capability woken
+   up this way steals about half of the threads in
+   scheduleStealThreads(), and each steal is written to the eventlog as
+   EVENT_STEAL_THREAD.  Only new threads go into the deque: they have
+   not built up a working set in the cache yet, and they can't be
+   involved in anything (black holes, MVars, STM) that another
+   Capability might be looking at.
+
+   The owner has to run the threads nobody steals, so at every
+   iteration of the scheduler loop it moves all of its stealable threads
+   onto the end of its run queue, in the order in which they were
+   created (scheduleTakeStealableThreads()).  Since that happens before
+   the owner picks the next thread to run, a thread that nobody steals
+   runs when it would have run had it gone straight onto the run queue.
+
+   A thread in the deque is ThreadStealable, and block_info.closure is
+   STEALABLE.  Any Capability may take it out with takeStealableThread(),
+   which claims the thread by a CAS of block_info.closure from STEALABLE
+   to END_TSO_QUEUE, and then moves it to its own run queue, updating
+   tso->cap before it sets why_blocked to NotBlocked.  The deque itself
+   only says where to look: the CAS decides who gets the thread, so a
+   thread can't be run twice when throwToMsg() takes one of its owner's
+   threads out of the deque without popping it.  Such an entry stays in
+   the deque until somebody pops it and fails the CAS.  A thread goes
+   into a deque only once, so block_info.closure never becomes STEALABLE
+   again after the thread has been claimed.
+
+   Until a thief has set why_blocked to NotBlocked, the thread still
+   looks like the owner's stealable thread, and throwToMsg() on the owner
+   keeps retrying (the thief is not doing anything else in the
+   meantime).  Since tso->cap is written first, throwToMsg() checks
+   tso->cap again after it has read why_blocked.
+*/
+
+#if defined(THREADED_RTS)
+
+// Wake up a worker on an idle Capability, if there is one, to steal
+// from cap.  Usually every Capability is busy, and we don't look.
+static void
+wakeupIdleCapability (Capability *cap)
+{
+    Task *task = cap->running_task;
+    Capability *cap0;
+    uint32_t i;
+
+    if (RELAXED_LOAD(&n_parked_capabilities) == 0) {
+        return;
+    }
+
+    for (i = (cap->no + 1) % n_capabilities; i != cap->no;
+         i = (i + 1) % n_capabilities) {
+        cap0 = capabilities[i];
+        if (cap0->disabled || cap0->running_task != NULL) {
+            continue;
+        }
+        if (tryGrabCapability(cap0,task)) {
+            task->cap = cap0;
+            releaseAndWakeupCapability(cap0);
+            task->cap = cap;
+            return;
+        }
+    }
+}
+
+static bool
+pushStealableThread (Capability *cap, StgTSO *tso)
+{
+    tso->why_blocked = ThreadStealable;
+    tso->block_info.closure = &stg_STEALABLE_closure;
+    if (!pushWSDeque(cap->stealable_threads, tso)) {
+        tso->why_blocked = NotBlocked;
+        tso->block_info.closure = (StgClosure *)END_TSO_QUEUE;
+        return false;
+    }
+    wakeupIdleCapability(cap);
+    return true;
+}
+
+static void
+scheduleTakeStealableThreads (Capability *cap)
+{
+    StgTSO *tso;
+
+    while ((tso = stealWSDeque(cap->stealable_threads)) != NULL) {
+        takeStealableThread(cap, tso);
+    }
+}
+
+static void
+scheduleStealThreads (Capability *cap)
+{
+    Capability *victim;
+    StgTSO *tso;
+    uint32_t i;
+    long n;
+
+    if (cap->disabled) {
+        return;
+    }
+
+    for (i = (cap->no + 1) % n_capabilities; i != cap->no;
+         i = (i + 1) % n_capabilities) {
+        victim = capabilities[i];
+        if (emptyStealableThreads(victim)) {
+            continue;
+        }
+
+        // leave half for the other idle Capabilities, and the owner
+        for (n = (dequeElements(victim->stealable_threads) + 1) / 2;
+             n > 0; n--) {
+            tso = stealWSDeque(victim->stealable_threads);
+            if (tso == NULL) {
+                break;
+            }
+            if (takeStealableThread(cap, tso)) {
+                traceEventStealThread(cap, tso, victim->no);
+            }
+        }
+
+        if (!emptyRunQueue(cap)) {
+            debugTrace(DEBUG_sched, "cap %d: stole %d threads from cap %d",
+                       cap->no, cap->n_run_queue, victim->no);
+            return;
+        }
+    }
+}
+
+/* GC for the stealable threads, called by markCapability().  Entries
+   for threads that have been taken already are followed too; they go
+   when somebody pops them. */
+void
+traverseStealableThreads (evac_fn evac, void *user, Capability *cap)
+{
+    WSDeque *q = cap->stealable_threads;
+    StgWord top;
+
+    ASSERT_WSDEQUE_INVARIANTS(q);
+
+    for (top = q->top; top < q->bottom; top++) {
+        evac(user, (StgClosure **)(q->elements + (top & q->moduloSize)));
+    }
+}
+
+#endif /* THREADED_RTS */
+
 /* -----------------------------------------------------------------------------
  * schedulePushWork()
  *
@@ -885,7 +1073,7 @@ scheduleCheckBlockedThreads(Capability *cap USED_IF_NOT_THREADS)
     // run queue is empty, and there are no other tasks running, we
     // can wait indefinitely for something to happen.
     //
-    if ( !emptyQueue(blocked_queue_hd) || !emptyQueue(sleeping_queue) )
+    if ( awaitEventPending() )
     {
         awaitEvent (emptyRunQueue(cap));
     }
@@ -999,25 +1187,25 @@ scheduleProcessInbox (Capability **pcap USED_IF_THREADS)
             cap = *pcap;
         }
 
-        // don't use a blocking acquire; if the lock is held by
-        // another thread then just carry on.  This seems to avoid
-        // getting stuck in a message ping-pong situation with other
-        // processors.  We'll check the inbox again later anyway.
-        //
-        // We should really use a more efficient queue data structure
-        // here.  The trickiness is that we must ensure a Capability
-        // never goes idle if the inbox is non-empty, which is why we
-        // use cap->lock (cap->lock is released as the last thing
-        // before going idle; see Capability.c:releaseCapability()).
-        r = TRY_ACQUIRE_LOCK(&cap->lock);
-        if (r != 0) return;
-
-        m = cap->inbox;
-        p = cap->putMVars;
-        cap->inbox = (Message*)END_TSO_QUEUE;
-        cap->putMVars = NULL;
-
-        RELEASE_LOCK(&cap->lock);
+        // The inbox doesn't need the lock, see Note [Lock-free inbox]
+        // in Messages.c
+        m = takeInbox(cap);
+
+        // but putMVars does.  Don't use a blocking acquire; if the lock
+        // is held by another thread then just carry on.  This seems to
+        // avoid getting stuck in a message ping-pong situation with
+        // other processors.  We'll check again later anyway.
+        p = NULL;
+        if (cap->putMVars != NULL) {
+            r = TRY_ACQUIRE_LOCK(&cap->lock);
+            if (r == 0) {
+                p = cap->putMVars;
+                cap->putMVars = NULL;
+                RELEASE_LOCK(&cap->lock);
+            } else if (m == (Message*)END_TSO_QUEUE) {
+                return;
+            }
+        }
 
         while (m != (Message*)END_TSO_QUEUE) {
             next = m->link;
@@ -1390,7 +1578,7 @@ scheduleNeedHeapProfile( bool ready_to_gc STG_UNUSED )
  * -------------------------------------------------------------------------- */
 
 #if defined(THREADED_RTS)
-static void stopAllCapabilities (Capability **pCap, Task *task)
+void stopAllCapabilities (Capability **pCap, Task *task)
 {
     bool was_syncing;
     SyncType prev_sync_type;
@@ -1507,7 +1695,7 @@ static void acquireAllCapabilities(Capability *cap, Task *task)
  * -------------------------------------------------------------------------- */
 
 #if defined(THREADED_RTS)
-static void releaseAllCapabilities(uint32_t n, Capability *cap, Task *task)
+void releaseAllCapabilities(uint32_t n, Capability *cap, Task *task)
 {
     uint32_t i;
 
@@ -1533,9 +1721,9 @@ scheduleDoGC (Capability **pcap, Task *task USED_IF_THREADS,
     bool heap_census;
     uint32_t collect_gen;
     bool major_gc;
+    uint32_t i;
 #if defined(THREADED_RTS)
     uint32_t gc_type;
-    uint32_t i;
     uint32_t need_idle;
     uint32_t n_gc_threads;
     uint32_t n_idle_caps = 0, n_failed_trygrab_idles = 0;
@@ -1558,13 +1746,22 @@ scheduleDoGC (Capability **pcap, Task *task USED_IF_THREADS,
     // Figure out which generation we are collecting, so that we can
     // decide whether this is a parallel GC or not.
     collect_gen = calcNeeded(force_major || heap_census, NULL);
+    if (RtsFlags.GcFlags.concurrentMark) {
+        collect_gen = nonmovingCollectGen(collect_gen,
+                                          force_major || heap_census);
+    }
     major_gc = (collect_gen == RtsFlags.GcFlags.generations-1);
 
 #if defined(THREADED_RTS)
+    // The mark stack of the mark/sweep collector is not parallel, but
+    // under -xn the minor GCs do not use it, and a compacting GC uses
+    // the other GC threads for the compaction (see GarbageCollect()).
     if (sched_state < SCHED_INTERRUPTING
         && RtsFlags.ParFlags.parGcEnabled
         && collect_gen >= RtsFlags.ParFlags.parGcGen
-        && ! oldest_gen->mark)
+        && (! oldest_gen->mark ||
+            (RtsFlags.GcFlags.concurrentMark && ! major_gc) ||
+            (major_gc && oldest_gen->compact)))
     {
         gc_type = SYNC_GC_PAR;
     } else {
@@ -1786,6 +1983,12 @@ delete_threads_and_gc:
         sched_state = SCHED_SHUTTING_DOWN;
     }
 
+    // Every Capability is stopped, so we can do all the deferred STM
+    // wakeups, see Note [STM wakeup batching] in STM.c
+    for (i = 0; i < n_capabilities; i++) {
+        stmWakeDeferred(capabilities[i], true);
+    }
+
     /*
      * When there are disabled capabilities, we want to migrate any
      * threads away from them.  Normally this happens in the
@@ -1800,6 +2003,7 @@ delete_threads_and_gc:
         ASSERT(tmp_cap->disabled);
         if (i != cap->no) {
             dest_cap = capabilities[i % enabled_capabilities];
+            scheduleTakeStealableThreads(tmp_cap);
             while (!emptyRunQueue(tmp_cap)) {
                 tso = popRunQueue(tmp_cap);
                 migrateThread(tmp_cap, tso, dest_cap);
@@ -1824,6 +2028,7 @@ delete_threads_and_gc:
 #endif
 
     traceSparkCounters(cap);
+    traceSTMCounters(cap);
 
     switch (recent_activity) {
     case ACTIVITY_INACTIVE:
@@ -1982,6 +2187,11 @@ forkProcess(HsStablePtr *entry
 
 #if defined(THREADED_RTS)
     stopAllCapabilities(&cap, task);
+
+    // the concurrent marker must not be in the middle of anything
+    if (RtsFlags.GcFlags.concurrentMark) {
+        nonmovingPauseMark();
+    }
 #endif
 
     // no funny business: hold locks while we fork, otherwise if some
@@ -2025,6 +2235,10 @@ forkProcess(HsStablePtr *entry
 
 #if defined(THREADED_RTS)
         RELEASE_LOCK(&all_tasks_mutex);
+
+        if (RtsFlags.GcFlags.concurrentMark) {
+            nonmovingResumeMark();
+        }
 #endif
 
         boundTaskExiting(task);
@@ -2045,6 +2259,10 @@ forkProcess(HsStablePtr *entry
         }
 
         initMutex(&all_tasks_mutex);
+
+        if (RtsFlags.GcFlags.concurrentMark) {
+            restartNonmovingMark();
+        }
 #endif
 
 #if defined(TRACING)
@@ -2076,6 +2294,13 @@ forkProcess(HsStablePtr *entry
 
         discardTasksExcept(task);
 
+#if !defined(THREADED_RTS) && !defined(mingw32_HOST_OS)
+        // The blocked threads are all gone now; start afresh rather
+        // than sharing the parent's epoll instance.
+        exitAwaitEvent();
+        initAwaitEvent();
+#endif
+
         for (i=0; i < n_capabilities; i++) {
             cap = capabilities[i];
 
@@ -2097,6 +2322,9 @@ forkProcess(HsStablePtr *entry
             // workers will be created if necessary.
             cap->spare_workers = NULL;
             cap->n_spare_workers = 0;
+
+            // The stealable threads have been deleted above
+            discardElements(cap->stealable_threads);
             cap->returning_tasks_hd = NULL;
             cap->returning_tasks_tl = NULL;
             cap->n_returning_tasks = 0;
@@ -2303,8 +2531,7 @@ deleteAllThreads ( Capability *cap )
     // being GC'd, and we don't want the "main thread has been GC'd" panic.
 
 #if !defined(THREADED_RTS)
-    ASSERT(blocked_queue_hd == END_TSO_QUEUE);
-    ASSERT(sleeping_queue == END_TSO_QUEUE);
+    ASSERT(!awaitEventPending());
 #endif
 }
 
@@ -2501,6 +2728,16 @@ resumeThread (void *task_)
 void
 scheduleThread(Capability *cap, StgTSO *tso)
 {
+#if defined(THREADED_RTS)
+    // Let an idle Capability steal it, see Note [Stealing threads]
+    if (RtsFlags.ParFlags.migrate && enabled_capabilities > 1 &&
+        !cap->disabled && sched_state == SCHED_RUNNING &&
+        tso->bound == NULL && !tsoLocked(tso) &&
+        pushStealableThread(cap, tso)) {
+        return;
+    }
+#endif
+
     // The thread goes at the *end* of the run-queue, to avoid possible
     // starvation of any threads already on the queue.
     appendToRunQueue(cap,tso);
@@ -2623,6 +2860,9 @@ initScheduler(void)
   blocked_queue_hd  = END_TSO_QUEUE;
   blocked_queue_tl  = END_TSO_QUEUE;
   sleeping_queue    = END_TSO_QUEUE;
+#if !defined(mingw32_HOST_OS)
+  initAwaitEvent();
+#endif
 #endif
 
   sched_state    = SCHED_RUNNING;
@@ -2704,6 +2944,8 @@ freeScheduler( void )
     RELEASE_LOCK(&sched_mutex);
 #if defined(THREADED_RTS)
     closeMutex(&sched_mutex);
+#elif !defined(mingw32_HOST_OS)
+    exitAwaitEvent();
 #endif
 }
 
@@ -2714,6 +2956,9 @@ void markScheduler (evac_fn evac USED_IF_NOT_THREADS,
     evac(user, (StgClosure **)(void *)&blocked_queue_hd);
     evac(user, (StgClosure **)(void *)&blocked_queue_tl);
     evac(user, (StgClosure **)(void *)&sleeping_queue);
+#if !defined(mingw32_HOST_OS)
+    markAwaitEvent(evac, user);
+#endif
 #endif
 }
 
@@ -11,6 +11,7 @@
 
 #include "rts/OSThreads.h"
 #include "Capability.h"
+#include "AwaitEvent.h"
 #include "Trace.h"
 
 #include "BeginPrivate.h"
@@ -32,6 +33,15 @@ void scheduleThread (Capability *cap, StgTSO *tso);
 // the desired Capability).
 void scheduleThreadOn(Capability *cap, StgWord cpu, StgTSO *tso);
 
+#if defined(THREADED_RTS)
+// The capacity of each Capability's stealable threads, see Note
+// [Stealing threads] in Schedule.c
+#define STEALABLE_THREADS_SIZE 1024
+
+// GC for the stealable threads of a Capability
+void traverseStealableThreads (evac_fn evac, void *user, Capability *cap);
+#endif
+
 /* wakeUpRts()
  *
  * Causes an OS thread to wake up and run the scheduler, if necessary.
@@ -40,6 +50,16 @@ void scheduleThreadOn(Capability *cap, StgWord cpu, StgTSO *tso);
 void wakeUpRts(void);
 #endif
 
+/* stopAllCapabilities(), releaseAllCapabilities()
+ *
+ * Stop all Haskell execution, to make a global change to the system,
+ * and resume it afterwards.
+ */
+#if defined(THREADED_RTS)
+void stopAllCapabilities (Capability **pCap, Task *task);
+void releaseAllCapabilities (uint32_t n, Capability *cap, Task *task);
+#endif
+
 /* raiseExceptionHelper */
 StgWord raiseExceptionHelper (StgRegTable *reg, StgTSO *tso, StgClosure *exception);
 
@@ -227,17 +247,12 @@ truncateRunQueue(Capability *cap)
     cap->n_run_queue = 0;
 }
 
-#if !defined(THREADED_RTS)
-#define EMPTY_BLOCKED_QUEUE()  (emptyQueue(blocked_queue_hd))
-#define EMPTY_SLEEPING_QUEUE() (emptyQueue(sleeping_queue))
-#endif
-
 INLINE_HEADER bool
 emptyThreadQueues(Capability *cap)
 {
     return emptyRunQueue(cap)
 #if !defined(THREADED_RTS)
-        && EMPTY_BLOCKED_QUEUE() && EMPTY_SLEEPING_QUEUE()
+        && !awaitEventPending()
 #endif
     ;
 }
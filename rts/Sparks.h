@@ -40,6 +40,7 @@ INLINE_HEADER StgClosure* reclaimSpark(SparkPool *pool);
 INLINE_HEADER bool looksEmpty(SparkPool* deque);
 
 INLINE_HEADER StgClosure * tryStealSpark (SparkPool *pool);
+INLINE_HEADER StgClosure * tryStealSparks (SparkPool *pool, SparkPool *into);
 INLINE_HEADER bool         fizzledSpark  (StgClosure *);
 
 void         freeSparkPool     (SparkPool *pool);
@@ -95,6 +96,19 @@ INLINE_HEADER StgClosure * tryStealSpark (SparkPool *pool)
     // other pools before trying again.
 }
 
+/* ----------------------------------------------------------------------------
+ *
+ * tryStealSparks: like tryStealSpark, but takes about half of the
+ * sparks in the pool at once.  One is returned, and the others are
+ * moved into "into", which must be the pool of the calling Capability.
+ *
+ -------------------------------------------------------------------------- */
+
+INLINE_HEADER StgClosure * tryStealSparks (SparkPool *pool, SparkPool *into)
+{
+    return stealHalfWSDeque(pool, into);
+}
+
 INLINE_HEADER bool fizzledSpark (StgClosure *spark)
 {
     return (GET_CLOSURE_TAG(spark) != 0 || !closure_SHOULD_SPARK(spark));
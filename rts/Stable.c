@@ -16,6 +16,8 @@
 #include "RtsUtils.h"
 #include "Trace.h"
 #include "Stable.h"
+#include "Capability.h"
+#include "Task.h"
 
 #include <string.h>
 
@@ -79,9 +81,9 @@
   application, etc of a stable pointer.
 
   Stable Pointers are exported to the outside world as indices and not
-  pointers, because the stable pointer table is allowed to be
-  reallocated for growth. The table is never shrunk for its space to
-  be reclaimed.
+  pointers, because the stable pointer table is allowed to grow (see
+  Note [Stable pointer table]). The table is never shrunk for its space
+  to be reclaimed.
 
   Future plans for stable ptrs include distinguishing them by the
   generation of the pointed object. See
@@ -93,16 +95,56 @@ static snEntry *stable_name_free = NULL;
 static unsigned int SNT_size = 0;
 #define INIT_SNT_SIZE 64
 
-spEntry *stable_ptr_table = NULL;
-static spEntry *stable_ptr_free = NULL;
-static unsigned int SPT_size = 0;
-#define INIT_SPT_SIZE 64
-
-/* Each time the stable pointer table is enlarged, we temporarily retain the old
- * version to ensure dereferences are thread-safe (see Note [Enlarging the
- * stable pointer table]).  Since we double the size of the table each time, we
- * can (theoretically) enlarge it at most N times on an N-bit machine.  Thus,
- * there will never be more than N old versions of the table.
+// A growable array of stable name table indices
+typedef struct {
+    StgWord *idx;
+    StgWord  n;
+    StgWord  size;
+} SnList;
+
+// sn_gen[g] lists the stable names whose entry points into generation g
+// (the younger of the object and the StableName object); see Note
+// [Stable names and the GC]
+static SnList *sn_gen = NULL;
+static uint32_t n_sn_gen = 0;
+
+// The state of the GC of the stable name table, see Note [Stable names
+// and the GC]
+#define SN_GC_CHUNK 256
+
+typedef struct {
+    SnList  freed;      // entries whose StableName object died
+    SnList  moved;      // entries whose object moved or died
+    SnList *gen;        // new generation lists, see sn_gen
+} SnGcThread;
+
+static SnGcThread *sn_gc_threads = NULL;
+static uint32_t    n_sn_gc_threads = 0;
+
+static bool        sn_gc_full;          // collecting all the entries
+static StgWord    *sn_gc_work = NULL;   // minor GC: entries to look at
+static StgWord     sn_gc_work_size = 0;
+static StgWord     sn_gc_n_work;        // number of entries to look at
+static volatile StgWord sn_gc_next;     // next work item to claim
+
+static void snListPush (SnList *l, StgWord sn);
+static void snListFree (SnList *l);
+
+spEntry **stable_ptr_table = NULL;
+static uint32_t SPT_n_segments = 0;     // segments in use
+static uint32_t SPT_max_segments = 0;   // size of stable_ptr_table[]
+#define INIT_SPT_SEGMENTS 4
+
+// The global pool of free entries, a stack of indices.  Its size never
+// exceeds the number of entries in the table.
+static StgWord *stable_ptr_free = NULL;
+static StgWord n_stable_ptr_free = 0;
+
+/* Each time the segment directory is enlarged, we temporarily retain the old
+ * version to ensure dereferences are thread-safe (see Note [Stable pointer
+ * table]).  Since we double the size of the directory each time, we can
+ * (theoretically) enlarge it at most N times on an N-bit machine.  Thus,
+ * there will never be more than N old versions of the directory.
  */
 #if SIZEOF_VOID_P == 4
 #define MAX_N_OLD_SPTS 32
@@ -112,7 +154,7 @@ static unsigned int SPT_size = 0;
 #error unknown SIZEOF_VOID_P
 #endif
 
-static spEntry *old_SPTs[MAX_N_OLD_SPTS];
+static spEntry **old_SPTs[MAX_N_OLD_SPTS];
 static uint32_t n_old_SPTs = 0;
 
 #if defined(THREADED_RTS)
@@ -165,17 +207,6 @@ initSnEntryFreeList(snEntry *table, uint32_t n, snEntry *free)
   stable_name_free = table;
 }
 
-STATIC_INLINE void
-initSpEntryFreeList(spEntry *table, uint32_t n, spEntry *free)
-{
-  spEntry *p;
-  for (p = table + n - 1; p >= table; p--) {
-      p->addr = (P_)free;
-      free = p;
-  }
-  stable_ptr_free = table;
-}
-
 void
 initStableTables(void)
 {
@@ -189,12 +220,14 @@ initStableTables(void)
      */
     initSnEntryFreeList(stable_name_table + 1,INIT_SNT_SIZE-1,NULL);
     addrToStableHash = allocHashTable();
+    n_sn_gen = RtsFlags.GcFlags.generations;
+    sn_gen = stgCallocBytes(n_sn_gen, sizeof(SnList), "initStableTables");
 
-    if (SPT_size > 0) return;
-    SPT_size = INIT_SPT_SIZE;
-    stable_ptr_table = stgMallocBytes(SPT_size * sizeof *stable_ptr_table,
+    if (SPT_n_segments > 0) return;
+    SPT_max_segments = INIT_SPT_SEGMENTS;
+    stable_ptr_table = stgMallocBytes(SPT_max_segments * sizeof(spEntry *),
                                       "initStablePtrTable");
-    initSpEntryFreeList(stable_ptr_table,INIT_SPT_SIZE,NULL);
+    enlargeStablePtrTable();
 
 #if defined(THREADED_RTS)
     initMutex(&stable_mutex);
@@ -220,52 +253,92 @@ enlargeStableNameTable(void)
     initSnEntryFreeList(stable_name_table + old_SNT_size, old_SNT_size, NULL);
 }
 
+// Add a segment to the table, and its entries to the global pool.
+// Must hold stable_mutex.
 static void
 enlargeStablePtrTable(void)
 {
-    uint32_t old_SPT_size = SPT_size;
-    spEntry *new_stable_ptr_table;
-
-    // 2nd and subsequent times
-    SPT_size *= 2;
+    spEntry **new_stable_ptr_table;
+    spEntry *seg;
+    StgWord base, i;
+
+    if (SPT_n_segments == SPT_max_segments) {
+        /* We temporarily retain the old version of the directory instead
+         * of freeing it; see Note [Stable pointer table].
+         */
+        new_stable_ptr_table =
+            stgMallocBytes(2 * SPT_max_segments * sizeof(spEntry *),
+                           "enlargeStablePtrTable");
+        memcpy(new_stable_ptr_table,
+               stable_ptr_table,
+               SPT_n_segments * sizeof(spEntry *));
+        ASSERT(n_old_SPTs < MAX_N_OLD_SPTS);
+        old_SPTs[n_old_SPTs++] = stable_ptr_table;
+        SPT_max_segments *= 2;
+
+        /* When using the threaded RTS, the update of stable_ptr_table is
+         * assumed to be atomic, so that another thread simultaneously
+         * dereferencing a stable pointer will always read a valid address.
+         */
+        stable_ptr_table = new_stable_ptr_table;
+    }
 
-    /* We temporarily retain the old version instead of freeing it; see Note
-     * [Enlarging the stable pointer table].
-     */
-    new_stable_ptr_table =
-        stgMallocBytes(SPT_size * sizeof *stable_ptr_table,
-                       "enlargeStablePtrTable");
-    memcpy(new_stable_ptr_table,
-           stable_ptr_table,
-           old_SPT_size * sizeof *stable_ptr_table);
-    ASSERT(n_old_SPTs < MAX_N_OLD_SPTS);
-    old_SPTs[n_old_SPTs++] = stable_ptr_table;
-
-    /* When using the threaded RTS, the update of stable_ptr_table is assumed to
-     * be atomic, so that another thread simultaneously dereferencing a stable
-     * pointer will always read a valid address.
-     */
-    stable_ptr_table = new_stable_ptr_table;
+    seg = stgMallocBytes(SPT_SEGMENT_SIZE * sizeof(spEntry),
+                         "enlargeStablePtrTable");
+    for (i = 0; i < SPT_SEGMENT_SIZE; i++) {
+        seg[i].addr = NULL;
+    }
 
-    initSpEntryFreeList(stable_ptr_table + old_SPT_size, old_SPT_size, NULL);
+    base = (StgWord)SPT_n_segments << SPT_SEGMENT_BITS;
+    stable_ptr_table[SPT_n_segments++] = seg;
+
+    stable_ptr_free =
+        stgReallocBytes(stable_ptr_free,
+                        ((StgWord)SPT_n_segments << SPT_SEGMENT_BITS)
+                          * sizeof(StgWord),
+                        "enlargeStablePtrTable");
+    // push in reverse, so that the lowest indices are used first
+    for (i = SPT_SEGMENT_SIZE; i > 0; i--) {
+        stable_ptr_free[n_stable_ptr_free++] = base + i - 1;
+    }
 }
 
-/* Note [Enlarging the stable pointer table]
+/* Note [Stable pointer table]
+ *
+ * The stable pointer table is a directory of fixed-size segments of
+ * SPT_SEGMENT_SIZE entries: stable pointer i lives in entry
+ * (i & SPT_SEGMENT_MASK) of segment (i >> SPT_SEGMENT_BITS).  Segments
+ * are never moved or freed (until exitStableTables), so the table can
+ * grow without copying its entries, and a thread dereferencing a
+ * stable pointer while another thread enlarges the table always reads a
+ * valid entry.
+ *
+ * Only the small directory is ever copied, when it runs out of room.
+ * The old version is retained in old_SPTs until the next GC, when no
+ * thread can be dereferencing a stable pointer, rather than growing
+ * the directory with realloc() (see Trac #10296).  Because the
+ * directory is doubled in size each time, the old versions together
+ * are never larger than the current one.
+ *
+ * Free entries have addr == NULL.  Rather than threading a free list
+ * through the entries, the indices of free entries are kept on
+ * stacks:
+ *
+ *  - each Capability caches up to SPT_CACHE_SIZE free indices
+ *    (cap->spt_cache).  getStablePtrCap() and freeStablePtr() on a
+ *    Capability that the calling Task owns use only this cache, and
+ *    take no lock.
  *
- * To enlarge the stable pointer table, we allocate a new table, copy the
- * existing entries, and then store the old version of the table in old_SPTs
- * until we free it during GC.  By not immediately freeing the old version
- * (or equivalently by not growing the table using realloc()), we ensure that
- * another thread simultaneously dereferencing a stable pointer using the old
- * version can safely access the table without causing a segfault (see Trac
- * #10296).
+ *  - the global pool (stable_ptr_free), protected by stable_mutex.  A
+ *    Capability refills its cache from the pool, or returns the
+ *    surplus to it, SPT_CACHE_SIZE/2 entries at a time, so the lock is
+ *    taken at most once per SPT_CACHE_SIZE/2 operations.  Threads that
+ *    don't own a Capability use the pool directly.
  *
- * Note that because the stable pointer table is doubled in size each time it is
- * enlarged, the total memory needed to store the old versions is always less
- * than that required to hold the current version.
+ * The GC holds stable_mutex, and no Capability is running, so it can
+ * scan all the segments, marking every entry whose addr is not NULL.
  */
 
-
 /* -----------------------------------------------------------------------------
  * Freeing entries and tables
  * -------------------------------------------------------------------------- */
@@ -281,6 +354,23 @@ freeOldSPTs(void)
     n_old_SPTs = 0;
 }
 
+// Must hold stable_mutex.
+static void
+refillStablePtrCache(Capability *cap)
+{
+    uint32_t n;
+
+    if (n_stable_ptr_free == 0) {
+        enlargeStablePtrTable();
+    }
+    n = stg_min(n_stable_ptr_free, SPT_CACHE_SIZE / 2);
+    n_stable_ptr_free -= n;
+    memcpy(&cap->spt_cache[cap->n_spt_cache],
+           &stable_ptr_free[n_stable_ptr_free],
+           n * sizeof(StgWord));
+    cap->n_spt_cache += n;
+}
+
 void
 exitStableTables(void)
 {
@@ -293,10 +383,51 @@ exitStableTables(void)
     stable_name_table = NULL;
     SNT_size = 0;
 
-    if (stable_ptr_table)
+    if (sn_gen) {
+        uint32_t g;
+        for (g = 0; g < n_sn_gen; g++) {
+            snListFree(&sn_gen[g]);
+        }
+        stgFree(sn_gen);
+    }
+    sn_gen = NULL;
+
+    if (sn_gc_threads) {
+        uint32_t i, g;
+        for (i = 0; i < n_sn_gc_threads; i++) {
+            snListFree(&sn_gc_threads[i].freed);
+            snListFree(&sn_gc_threads[i].moved);
+            for (g = 0; g < n_sn_gen; g++) {
+                snListFree(&sn_gc_threads[i].gen[g]);
+            }
+            stgFree(sn_gc_threads[i].gen);
+        }
+        stgFree(sn_gc_threads);
+    }
+    sn_gc_threads = NULL;
+    n_sn_gc_threads = 0;
+    n_sn_gen = 0;
+
+    if (sn_gc_work)
+        stgFree(sn_gc_work);
+    sn_gc_work = NULL;
+    sn_gc_work_size = 0;
+
+    if (stable_ptr_table) {
+        uint32_t i;
+        for (i = 0; i < SPT_n_segments; i++) {
+            stgFree(stable_ptr_table[i]);
+        }
         stgFree(stable_ptr_table);
+    }
     stable_ptr_table = NULL;
-    SPT_size = 0;
+    SPT_n_segments = 0;
+    SPT_max_segments = 0;
+
+    if (stable_ptr_free)
+        stgFree(stable_ptr_free);
+    stable_ptr_free = NULL;
+    n_stable_ptr_free = 0;
 
     freeOldSPTs();
 
@@ -314,26 +445,65 @@ freeSnEntry(snEntry *sn)
   stable_name_free = sn;
 }
 
-STATIC_INLINE void
-freeSpEntry(spEntry *sp)
+STATIC_INLINE spEntry *
+spEntryOf(StgWord sp)
+{
+    ASSERT(sp < ((StgWord)SPT_n_segments << SPT_SEGMENT_BITS));
+    return &stable_ptr_table[sp >> SPT_SEGMENT_BITS][sp & SPT_SEGMENT_MASK];
+}
+
+// The Capability owned by the current Task, if any
+STATIC_INLINE Capability *
+myOwnedCapability(void)
 {
-    sp->addr = (P_)stable_ptr_free;
-    stable_ptr_free = sp;
+#if defined(THREADED_RTS)
+    Task *task = myTask();
+    if (task != NULL && task->cap != NULL && task->cap->running_task == task) {
+        return task->cap;
+    }
+    return NULL;
+#else
+    return &MainCapability;
+#endif
 }
 
 void
 freeStablePtrUnsafe(StgStablePtr sp)
 {
-    ASSERT((StgWord)sp < SPT_size);
-    freeSpEntry(&stable_ptr_table[(StgWord)sp]);
+    spEntry *e = spEntryOf((StgWord)sp);
+    ASSERT(e->addr != NULL);
+    e->addr = NULL;
+    stable_ptr_free[n_stable_ptr_free++] = (StgWord)sp;
 }
 
 void
 freeStablePtr(StgStablePtr sp)
 {
-    stableLock();
-    freeStablePtrUnsafe(sp);
-    stableUnlock();
+    Capability *cap = myOwnedCapability();
+    spEntry *e;
+
+    if (cap == NULL) {
+        stableLock();
+        freeStablePtrUnsafe(sp);
+        stableUnlock();
+        return;
+    }
+
+    e = spEntryOf((StgWord)sp);
+    ASSERT(e->addr != NULL);
+    e->addr = NULL;
+
+    if (cap->n_spt_cache == SPT_CACHE_SIZE) {
+        // return half of the cache to the global pool
+        stableLock();
+        cap->n_spt_cache -= SPT_CACHE_SIZE / 2;
+        memcpy(&stable_ptr_free[n_stable_ptr_free],
+               &cap->spt_cache[cap->n_spt_cache],
+               (SPT_CACHE_SIZE / 2) * sizeof(StgWord));
+        n_stable_ptr_free += SPT_CACHE_SIZE / 2;
+        stableUnlock();
+    }
+    cap->spt_cache[cap->n_spt_cache++] = (StgWord)sp;
 }
 
 /* -----------------------------------------------------------------------------
@@ -406,9 +576,13 @@ lookupStableName (StgPtr p)
   sn = stable_name_free - stable_name_table;
   stable_name_free  = (snEntry*)(stable_name_free->addr);
   stable_name_table[sn].addr = p;
+  stable_name_table[sn].old = p;
   stable_name_table[sn].sn_obj = NULL;
   /* debugTrace(DEBUG_stable, "new stable name %d at %p\n",sn,p); */
 
+  /* the StableName object is about to be allocated in the nursery */
+  snListPush(&sn_gen[0], sn);
+
   /* add the new stable name to the hash table */
   insertHashTable(addrToStableHash, (W_)p, (void *)sn);
 
@@ -417,16 +591,38 @@ lookupStableName (StgPtr p)
   return sn;
 }
 
+StgStablePtr
+getStablePtrCap(Capability *cap, StgPtr p)
+{
+  StgWord sp;
+
+  ASSERT(p != NULL);
+  if (cap->n_spt_cache == 0) {
+      stableLock();
+      refillStablePtrCache(cap);
+      stableUnlock();
+  }
+  sp = cap->spt_cache[--cap->n_spt_cache];
+  ASSERT(spEntryOf(sp)->addr == NULL);
+  spEntryOf(sp)->addr = p;
+  return (StgStablePtr)(sp);
+}
+
 StgStablePtr
 getStablePtr(StgPtr p)
 {
+  Capability *cap = myOwnedCapability();
   StgWord sp;
 
+  if (cap != NULL) {
+      return getStablePtrCap(cap, p);
+  }
+
+  ASSERT(p != NULL);
   stableLock();
-  if (!stable_ptr_free) enlargeStablePtrTable();
-  sp = stable_ptr_free - stable_ptr_table;
-  stable_ptr_free  = (spEntry*)(stable_ptr_free->addr);
-  stable_ptr_table[sp].addr = p;
+  if (n_stable_ptr_free == 0) enlargeStablePtrTable();
+  sp = stable_ptr_free[--n_stable_ptr_free];
+  spEntryOf(sp)->addr = p;
   stableUnlock();
   return (StgStablePtr)(sp);
 }
@@ -438,14 +634,14 @@ getStablePtr(StgPtr p)
 #define FOR_EACH_STABLE_PTR(p, CODE)                                    \
     do {                                                                \
         spEntry *p;                                                     \
-        spEntry *__end_ptr = &stable_ptr_table[SPT_size];               \
-        for (p = stable_ptr_table; p < __end_ptr; p++) {                \
-            /* Internal pointers are free slots. NULL is last in free */ \
-            /* list. */                                                 \
-            if (p->addr &&                                              \
-                (p->addr < (P_)stable_ptr_table || p->addr >= (P_)__end_ptr)) \
-            {                                                           \
-                do { CODE } while(0);                                   \
+        uint32_t __seg;                                                 \
+        for (__seg = 0; __seg < SPT_n_segments; __seg++) {              \
+            spEntry *__end_ptr = stable_ptr_table[__seg] + SPT_SEGMENT_SIZE; \
+            for (p = stable_ptr_table[__seg]; p < __end_ptr; p++) {     \
+                /* NULL entries are free. */                            \
+                if (p->addr != NULL) {                                  \
+                    do { CODE } while(0);                               \
+                }                                                       \
             }                                                           \
         }                                                               \
     } while(0)
@@ -477,13 +673,6 @@ markStablePtrTable(evac_fn evac, void *user)
     FOR_EACH_STABLE_PTR(p, evac(user, (StgClosure **)&p->addr););
 }
 
-STATIC_INLINE void
-rememberOldStableNameAddresses(void)
-{
-    /* TODO: Only if !full GC */
-    FOR_EACH_STABLE_NAME(p, p->old = p->addr;);
-}
-
 void
 markStableTables(evac_fn evac, void *user)
 {
@@ -493,7 +682,6 @@ markStableTables(evac_fn evac, void *user)
     freeOldSPTs();
 
     markStablePtrTable(evac, user);
-    rememberOldStableNameAddresses();
 }
 
 /* -----------------------------------------------------------------------------
@@ -531,7 +719,7 @@ threadStableTables( evac_fn evac, void *user )
 }
 
 /* -----------------------------------------------------------------------------
- * Garbage collect any dead entries in the stable pointer table.
+ * Garbage collect any dead entries in the stable name table.
  *
  * A dead entry has:
  *
@@ -544,38 +732,239 @@ threadStableTables( evac_fn evac, void *user )
  * refer to the entry.
  * -------------------------------------------------------------------------- */
 
+/* Note [Stable names and the GC]
+ *
+ * Every GC has to find the stable names whose StableName object died,
+ * update the addresses of the objects that moved, and re-hash those in
+ * addrToStableHash.  To keep this from growing with the number of live
+ * stable names:
+ *
+ *  - The entries are kept in per-generation lists (sn_gen), by the
+ *    younger of the generations of addr and sn_obj.  A minor GC that
+ *    collects generations 0..N only looks at the lists 0..N, because
+ *    nothing in an older generation can move or die.  An entry without
+ *    an sn_obj yet (makeStableName# GC'd between creating the entry and
+ *    allocating the StableName object) always stays in list 0, as its
+ *    StableName object will be allocated in the nursery.
+ *
+ *  - The work is shared by the GC threads: once the main GC thread has
+ *    finished marking, gcStableNamesPrepare() collects the entries to
+ *    look at, and every GC thread calls gcStableNamesWork(), which
+ *    claims them in chunks of SN_GC_CHUNK.  Each thread records its
+ *    results in its own SnGcThread: the entries that died, moved, and
+ *    the new generation lists.
+ *
+ *  - addrToStableHash and the free list are not thread-safe, so
+ *    gcStableNamesFinish() applies the per-thread batches of freed
+ *    entries afterwards, and updateStableTables() those of moved
+ *    entries (or rebuilds the hash table in a major GC).
+ *
+ * The address of the object before the GC, which is the key in
+ * addrToStableHash, is saved in p->old by gcStableNamesWork() itself, so
+ * the GC no longer needs a separate pass to remember it.
+ */
+
+static void
+snListPush (SnList *l, StgWord sn)
+{
+    if (l->n == l->size) {
+        l->size = l->size == 0 ? 64 : l->size * 2;
+        l->idx = stgReallocBytes(l->idx, l->size * sizeof(StgWord),
+                                 "snListPush");
+    }
+    l->idx[l->n++] = sn;
+}
+
+static void
+snListAppend (SnList *to, SnList *from)
+{
+    if (to->n + from->n > to->size) {
+        to->size = stg_max(to->n + from->n, to->size * 2);
+        to->idx = stgReallocBytes(to->idx, to->size * sizeof(StgWord),
+                                  "snListAppend");
+    }
+    if (from->n > 0) {
+        memcpy(&to->idx[to->n], from->idx, from->n * sizeof(StgWord));
+    }
+    to->n += from->n;
+    from->n = 0;
+}
+
+static void
+snListFree (SnList *l)
+{
+    stgFree(l->idx);
+    l->idx = NULL;
+    l->n = l->size = 0;
+}
+
+STATIC_INLINE bool
+snEntryInUse (snEntry *p)
+{
+    /* Internal pointers are free slots.  If p->addr == NULL, it's
+     * either the last item in the free list, or a stable name whose
+     * pointee has died; sn_obj == NULL means the former. */
+    return (p->addr < (P_)stable_name_table ||
+            p->addr >= (P_)&stable_name_table[SNT_size])
+        && (p->addr != NULL || p->sn_obj != NULL);
+}
+
+STATIC_INLINE uint32_t
+snGenOf (StgPtr p)
+{
+    if (p == NULL || !HEAP_ALLOCED_GC(p)) {
+        return n_sn_gen - 1;
+    }
+    return Bdescr(p)->gen_no;
+}
+
+static void
+gcStableName (SnGcThread *t, StgWord sn)
+{
+    snEntry *p = &stable_name_table[sn];
+    uint32_t g;
+
+    p->old = p->addr;
+
+    // Update the pointer to the StableName object, if there is one
+    if (p->sn_obj != NULL) {
+        p->sn_obj = isAlive(p->sn_obj);
+        if (p->sn_obj == NULL) {
+            // StableName object died
+            debugTrace(DEBUG_stable, "GC'd StableName %ld (addr=%p)",
+                       (long)sn, p->addr);
+            snListPush(&t->freed, sn);
+            return;
+        }
+    }
+
+    /* If sn_obj became NULL, the object died, and addr is now
+     * invalid. But if sn_obj was null, then the StableName
+     * object may not have been created yet, while the pointee
+     * already exists and must be updated to new location. */
+    if (p->addr != NULL) {
+        p->addr = (StgPtr)isAlive((StgClosure *)p->addr);
+        if (p->addr == NULL) {
+            // StableName pointee died
+            debugTrace(DEBUG_stable, "GC'd pointee %ld", (long)sn);
+        }
+    }
+
+    if (p->addr != p->old) {
+        snListPush(&t->moved, sn);
+    }
+
+    if (p->sn_obj == NULL) {
+        g = 0;
+    } else {
+        g = stg_min(snGenOf(p->addr), snGenOf((StgPtr)p->sn_obj));
+    }
+    snListPush(&t->gen[g], sn);
+}
+
+// Called by the main GC thread once the heap is fully marked, before
+// the other GC threads call gcStableNamesWork().  'full' is true when
+// all the generations are being collected.
 void
-gcStableTables( void )
-{
-    FOR_EACH_STABLE_NAME(
-        p, {
-            // Update the pointer to the StableName object, if there is one
-            if (p->sn_obj != NULL) {
-                p->sn_obj = isAlive(p->sn_obj);
-                if(p->sn_obj == NULL) {
-                    // StableName object died
-                    debugTrace(DEBUG_stable, "GC'd StableName %ld (addr=%p)",
-                               (long)(p - stable_name_table), p->addr);
-                    freeSnEntry(p);
-                    /* Can't "continue", so use goto */
-                    goto next_stable_name;
-                }
+gcStableNamesPrepare (uint32_t collect_gen, bool full)
+{
+    uint32_t i, g;
+
+    if (n_sn_gc_threads < n_capabilities) {
+        sn_gc_threads = stgReallocBytes(sn_gc_threads,
+                                        n_capabilities * sizeof(SnGcThread),
+                                        "gcStableNamesPrepare");
+        for (i = n_sn_gc_threads; i < n_capabilities; i++) {
+            memset(&sn_gc_threads[i], 0, sizeof(SnGcThread));
+            sn_gc_threads[i].gen = stgCallocBytes(n_sn_gen, sizeof(SnList),
+                                                  "gcStableNamesPrepare");
+        }
+        n_sn_gc_threads = n_capabilities;
+    }
+
+    sn_gc_full = full;
+    if (full) {
+        for (g = 0; g < n_sn_gen; g++) {
+            sn_gen[g].n = 0;
+        }
+        // index 0 is unused, see initStableTables()
+        sn_gc_n_work = SNT_size - 1;
+    } else {
+        sn_gc_n_work = 0;
+        for (g = 0; g <= collect_gen; g++) {
+            sn_gc_n_work += sn_gen[g].n;
+        }
+        if (sn_gc_n_work > sn_gc_work_size) {
+            sn_gc_work_size = sn_gc_n_work;
+            stgFree(sn_gc_work);
+            sn_gc_work = stgMallocBytes(sn_gc_work_size * sizeof(StgWord),
+                                        "gcStableNamesPrepare");
+        }
+        sn_gc_n_work = 0;
+        for (g = 0; g <= collect_gen; g++) {
+            if (sn_gen[g].n > 0) {
+                memcpy(&sn_gc_work[sn_gc_n_work], sn_gen[g].idx,
+                       sn_gen[g].n * sizeof(StgWord));
             }
-            /* If sn_obj became NULL, the object died, and addr is now
-             * invalid. But if sn_obj was null, then the StableName
-             * object may not have been created yet, while the pointee
-             * already exists and must be updated to new location. */
-            if (p->addr != NULL) {
-                p->addr = (StgPtr)isAlive((StgClosure *)p->addr);
-                if(p->addr == NULL) {
-                    // StableName pointee died
-                    debugTrace(DEBUG_stable, "GC'd pointee %ld",
-                               (long)(p - stable_name_table));
+            sn_gc_n_work += sn_gen[g].n;
+            sn_gen[g].n = 0;
+        }
+    }
+    sn_gc_next = 0;
+    write_barrier();
+}
+
+// Called by every GC thread, see Note [Stable names and the GC]
+void
+gcStableNamesWork (uint32_t thread_index)
+{
+    SnGcThread *t = &sn_gc_threads[thread_index];
+    StgWord start, end, i;
+
+    for (;;) {
+#if defined(THREADED_RTS)
+        start = atomic_inc(&sn_gc_next, SN_GC_CHUNK) - SN_GC_CHUNK;
+#else
+        start = sn_gc_next;
+        sn_gc_next += SN_GC_CHUNK;
+#endif
+        if (start >= sn_gc_n_work) break;
+        end = stg_min(start + SN_GC_CHUNK, sn_gc_n_work);
+
+        if (sn_gc_full) {
+            for (i = start; i < end; i++) {
+                // the table starts at index 1
+                if (snEntryInUse(&stable_name_table[i+1])) {
+                    gcStableName(t, i+1);
                 }
             }
-    next_stable_name:
-            if (0) {}
-        });
+        } else {
+            for (i = start; i < end; i++) {
+                gcStableName(t, sn_gc_work[i]);
+            }
+        }
+    }
+}
+
+// Called by the main GC thread after all the GC threads have finished
+// gcStableNamesWork().
+void
+gcStableNamesFinish (void)
+{
+    uint32_t i, g;
+    StgWord j;
+    SnGcThread *t;
+
+    for (i = 0; i < n_sn_gc_threads; i++) {
+        t = &sn_gc_threads[i];
+        for (j = 0; j < t->freed.n; j++) {
+            freeSnEntry(&stable_name_table[t->freed.idx[j]]);
+        }
+        t->freed.n = 0;
+        for (g = 0; g < n_sn_gen; g++) {
+            snListAppend(&sn_gen[g], &t->gen[g]);
+        }
+    }
 }
 
 /* -----------------------------------------------------------------------------
@@ -584,12 +973,16 @@ gcStableTables( void )
  * The boolean argument 'full' indicates that a major collection is
  * being done, so we might as well throw away the hash table and build
  * a new one.  For a minor collection, we just re-hash the elements
- * that changed.
+ * that changed, which gcStableNamesWork() has recorded.
  * -------------------------------------------------------------------------- */
 
 void
 updateStableTables(bool full)
 {
+    uint32_t i;
+    StgWord j, sn;
+    snEntry *p;
+
     if (full && addrToStableHash != NULL && 0 != keyCountHashTable(addrToStableHash)) {
         freeHashTable(addrToStableHash,NULL);
         addrToStableHash = allocHashTable();
@@ -604,15 +997,20 @@ updateStableTables(bool full)
                 }
             });
     } else {
-        FOR_EACH_STABLE_NAME(
-            p, {
-                if (p->addr != p->old) {
-                    removeHashTable(addrToStableHash, (W_)p->old, NULL);
-                    /* Movement happened: */
-                    if (p->addr != NULL) {
-                        insertHashTable(addrToStableHash, (W_)p->addr, (void *)(p - stable_name_table));
-                    }
+        for (i = 0; i < n_sn_gc_threads; i++) {
+            for (j = 0; j < sn_gc_threads[i].moved.n; j++) {
+                sn = sn_gc_threads[i].moved.idx[j];
+                p = &stable_name_table[sn];
+                removeHashTable(addrToStableHash, (W_)p->old, NULL);
+                /* Movement happened: */
+                if (p->addr != NULL) {
+                    insertHashTable(addrToStableHash, (W_)p->addr, (void *)sn);
                 }
-            });
+            }
+        }
+    }
+
+    for (i = 0; i < n_sn_gc_threads; i++) {
+        sn_gc_threads[i].moved.n = 0;
     }
 }
@@ -20,6 +20,10 @@
 
 void    freeStablePtr         ( StgStablePtr sp );
 
+/* getStablePtr() for a Capability owned by the caller; takes no lock in
+ * the common case */
+StgStablePtr getStablePtrCap  ( Capability *cap, StgPtr p );
+
 /* Use the "Unsafe" one after manually locking with stableLock/stableUnlock */
 void    freeStablePtrUnsafe   ( StgStablePtr sp );
 
@@ -30,14 +34,16 @@ StgWord lookupStableName      ( StgPtr p );
 /* Call given function on every stable ptr. markStableTables depends
  * on the function updating its pointers in case the object is
  * moved. */
-/* TODO: This also remembers old stable name addresses, which isn't
- * necessary in some contexts markStableTables is called from.
- * Consider splitting it.
- */
 void    markStableTables      ( evac_fn evac, void *user );
 
 void    threadStableTables    ( evac_fn evac, void *user );
-void    gcStableTables        ( void );
+
+/* Collecting the stable name table, with all the GC threads; see
+ * Note [Stable names and the GC] in Stable.c */
+void    gcStableNamesPrepare  ( uint32_t collect_gen, bool full );
+void    gcStableNamesWork     ( uint32_t thread_index );
+void    gcStableNamesFinish   ( void );
+
 void    updateStableTables    ( bool full );
 
 void    stableLock            ( void );
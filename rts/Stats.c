@@ -153,6 +153,8 @@ initStats0(void)
         .mutator_elapsed_ns = 0,
         .gc_cpu_ns = 0,
         .gc_elapsed_ns = 0,
+        .gc_spin_ns = 0,
+        .gc_sleep_ns = 0,
         .cpu_ns = 0,
         .elapsed_ns = 0,
         .gc = {
@@ -168,7 +170,9 @@ initStats0(void)
             .par_max_copied_bytes = 0,
             .sync_elapsed_ns = 0,
             .cpu_ns = 0,
-            .elapsed_ns = 0
+            .elapsed_ns = 0,
+            .spin_ns = 0,
+            .sleep_ns = 0
         }
     };
 }
@@ -283,7 +287,8 @@ stat_startGC (Capability *cap, gc_thread *gct)
 void
 stat_endGC (Capability *cap, gc_thread *gct,
             W_ live, W_ copied, W_ slop, uint32_t gen,
-            uint32_t par_n_threads, W_ par_max_copied)
+            uint32_t par_n_threads, W_ par_max_copied,
+            Time par_spin, Time par_sleep)
 {
     if (RtsFlags.GcFlags.giveStats != NO_GC_STATS ||
         rtsConfig.gcDoneHook != NULL ||
@@ -317,6 +322,8 @@ stat_endGC (Capability *cap, gc_thread *gct,
           gct->gc_start_elapsed - gct->gc_sync_start_elapsed;
         stats.gc.elapsed_ns = current_elapsed - gct->gc_start_elapsed;
         stats.gc.cpu_ns = current_cpu - gct->gc_start_cpu;
+        stats.gc.spin_ns = par_spin;
+        stats.gc.sleep_ns = par_sleep;
 
         // -------------------------------------------------
         // Update the cumulative stats
@@ -339,6 +346,8 @@ stat_endGC (Capability *cap, gc_thread *gct,
         }
         stats.gc_cpu_ns += stats.gc.cpu_ns;
         stats.gc_elapsed_ns += stats.gc.elapsed_ns;
+        stats.gc_spin_ns += stats.gc.spin_ns;
+        stats.gc_sleep_ns += stats.gc.sleep_ns;
 
         if (gen == RtsFlags.GcFlags.generations-1) { // major GC?
             stats.major_gcs++;
@@ -649,6 +658,13 @@ stat_exit (void)
                         (size_t)(peak_mblocks_allocated * MBLOCK_SIZE_W) / (1024 * 1024 / sizeof(W_)),
                         (size_t)(peak_mblocks_allocated * BLOCKS_PER_MBLOCK * BLOCK_SIZE_W - hw_alloc_blocks * BLOCK_SIZE_W) / (1024 * 1024 / sizeof(W_)));
 
+            if (RtsFlags.GcFlags.hugePages != HUGE_PAGES_NONE) {
+                statsPrintf("%16" FMT_SizeT " MB backed by huge pages (%"
+                            FMT_SizeT " MB fell back to normal pages)\n\n",
+                            (size_t)(huge_page_mblocks * MBLOCK_SIZE_W) / (1024 * 1024 / sizeof(W_)),
+                            (size_t)(huge_page_fallback_mblocks * MBLOCK_SIZE_W) / (1024 * 1024 / sizeof(W_)));
+            }
+
             /* Print garbage collections in each gen */
             statsPrintf("                                     Tot time (elapsed)  Avg pause  Max pause\n");
             for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
@@ -669,6 +685,9 @@ stat_exit (void)
                             100 * (((double)stats.par_copied_bytes / (double)stats.cumulative_par_max_copied_bytes) - 1)
                                 / (n_capabilities - 1)
                     );
+                statsPrintf("  Parallel GC idle time:   %.3fs spinning, %.3fs sleeping\n",
+                            TimeToSecondsDbl(stats.gc_spin_ns),
+                            TimeToSecondsDbl(stats.gc_sleep_ns));
             }
 #endif
             statsPrintf("\n");
@@ -353,6 +353,33 @@ migrateThread (Capability *from, StgTSO *tso, Capability *to)
     tryWakeupThread(from, tso);
 }
 
+/* ----------------------------------------------------------------------------
+   takeStealableThread
+
+   Take a ThreadStealable thread out of the pool of stealable threads it
+   is in, and put it on cap's run queue.  Any capability may do this, but
+   only one succeeds: returns false if the thread has been taken
+   already.  See Note [Stealing threads] in Schedule.c.
+   ------------------------------------------------------------------------- */
+
+bool
+takeStealableThread (Capability *cap, StgTSO *tso)
+{
+    if (cas((StgVolatilePtr)&tso->block_info.closure,
+            (StgWord)&stg_STEALABLE_closure,
+            (StgWord)END_TSO_QUEUE) != (StgWord)&stg_STEALABLE_closure) {
+        return false;
+    }
+
+    // tso->cap first: throwToMsg() looks at why_blocked, and then
+    // checks that the thread is still on its capability.
+    tso->cap = cap;
+    write_barrier();
+    tso->why_blocked = NotBlocked;
+    appendToRunQueue(cap,tso);
+    return true;
+}
+
 /* ----------------------------------------------------------------------------
    awakenBlockedQueue
 
@@ -866,6 +893,10 @@ printThreadBlockage(StgTSO *tso)
   case ThreadMigrating:
     debugBelch("is runnable, but not on the run queue");
     break;
+  case ThreadStealable:
+    debugBelch("is runnable, in the stealable threads of cap %d",
+               tso->cap->no);
+    break;
   case BlockedOnCCall:
     debugBelch("is blocked on an external call");
     break;
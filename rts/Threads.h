@@ -18,6 +18,7 @@ StgTSO * unblockOne_ (Capability *cap, StgTSO *tso, bool allow_migrate);
 void checkBlockingQueues (Capability *cap, StgTSO *tso);
 void tryWakeupThread     (Capability *cap, StgTSO *tso);
 void migrateThread       (Capability *from, StgTSO *tso, Capability *to);
+bool takeStealableThread (Capability *cap, StgTSO *tso);
 
 // Wakes up a thread on a Capability (probably a different Capability
 // from the one held by the current Task).
@@ -22,6 +22,7 @@
 #include "Threads.h"
 #include "Printer.h"
 #include "RtsFlags.h"
+#include "Schedule.h"
 
 #if defined(HAVE_UNISTD_H)
 #include <unistd.h>
@@ -47,40 +48,78 @@ static bool eventlog_enabled;
 
 static const EventLogWriter *getEventLogWriter(void)
 {
+#if !defined(mingw32_HOST_OS)
+    // +RTS --eventlog-socket replaces the default writer, but not one
+    // that the program installed itself through its RtsConfig
+    if (RtsFlags.TraceFlags.eventlogSocket != NULL &&
+        rtsConfig.eventlog_writer == &FileEventLogWriter) {
+        return &SocketEventLogWriter;
+    }
+#endif
     return rtsConfig.eventlog_writer;
 }
 
-void initTracing (void)
-{
-    const EventLogWriter *eventlog_writer = getEventLogWriter();
+/* Note [Changing the eventlog at runtime]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   startEventLog() and endEventLog() start and stop the eventlog while
+   the program runs, and setEventLogClasses() switches classes of events
+   on and off (see includes/rts/EventLogWriter.h), so that we can take,
+   say, 30 seconds of scheduler and GC events from a live process.
+
+   This costs nothing on the hot path: every trace macro in Trace.h
+   already tests one of the TRACE_* flags and branches, and that stays
+   the only test.  Switching a class on or off is just a store to its
+   flag, which the other capabilities see on their next test; an event
+   racing with the store is either posted or not, which is fine.
+
+   The flags are derived from RtsFlags.TraceFlags (and -D) by
+   setTraceFlags(), and are all zero whenever the eventlog is not
+   running (unless we trace to stderr), so nothing posts to event buffers
+   that aren't there.  Starting and stopping the eventlog allocates and
+   frees the capabilities' buffers, so it stops all the capabilities
+   first, like setNumCapabilities() does.  Tasks without a Capability
+   post to the global eventBuf under its own lock, so that buffer stays
+   allocated until the RTS exits.
+
+   When the eventlog is started late we re-post the events that describe
+   the capabilities and the process, which are normally posted at
+   startup, so that the new eventlog is complete on its own.
+*/
 
 #if defined(THREADED_RTS)
-    initMutex(&trace_utx);
+// protects RtsFlags.TraceFlags and the TRACE_* flags against concurrent
+// setEventLogClasses()
+static Mutex trace_classes_mutex;
 #endif
 
+static void setTraceFlags (void)
+{
+    bool on = eventlog_enabled ||
+              RtsFlags.TraceFlags.tracing == TRACE_STDERR;
+
     // -Ds turns on scheduler tracing too
-    TRACE_sched =
-        RtsFlags.TraceFlags.scheduler ||
-        RtsFlags.DebugFlags.scheduler;
+    TRACE_sched = on &&
+        (RtsFlags.TraceFlags.scheduler ||
+         RtsFlags.DebugFlags.scheduler);
 
     // -Dg turns on gc tracing too
-    TRACE_gc =
-        RtsFlags.TraceFlags.gc ||
-        RtsFlags.DebugFlags.gc ||
-        RtsFlags.DebugFlags.scheduler;
+    TRACE_gc = on &&
+        (RtsFlags.TraceFlags.gc ||
+         RtsFlags.DebugFlags.gc ||
+         RtsFlags.DebugFlags.scheduler);
     if (TRACE_gc && RtsFlags.GcFlags.giveStats == NO_GC_STATS) {
         RtsFlags.GcFlags.giveStats = COLLECT_GC_STATS;
     }
 
-    TRACE_spark_sampled =
+    TRACE_spark_sampled = on &&
         RtsFlags.TraceFlags.sparks_sampled;
 
     // -Dr turns on full spark tracing
-    TRACE_spark_full =
-        RtsFlags.TraceFlags.sparks_full ||
-        RtsFlags.DebugFlags.sparks;
+    TRACE_spark_full = on &&
+        (RtsFlags.TraceFlags.sparks_full ||
+         RtsFlags.DebugFlags.sparks);
 
-    TRACE_user =
+    TRACE_user = on &&
         RtsFlags.TraceFlags.user;
 
     // We trace cap events if we're tracing anything else
@@ -90,6 +129,16 @@ void initTracing (void)
         TRACE_spark_sampled ||
         TRACE_spark_full ||
         TRACE_user;
+}
+
+void initTracing (void)
+{
+    const EventLogWriter *eventlog_writer = getEventLogWriter();
+
+#if defined(THREADED_RTS)
+    initMutex(&trace_utx);
+    initMutex(&trace_classes_mutex);
+#endif
 
     eventlog_enabled = RtsFlags.TraceFlags.tracing == TRACE_EVENTLOG &&
                         eventlog_writer != NULL;
@@ -97,6 +146,7 @@ void initTracing (void)
     /* Note: we can have any of the TRACE_* flags turned on even when
        eventlog_enabled is off. In the DEBUG way we may be tracing to stderr.
      */
+    setTraceFlags();
 
     if (eventlog_enabled) {
         initEventLogging(eventlog_writer);
@@ -137,6 +187,156 @@ void tracingAddCapapilities (uint32_t from, uint32_t to)
     }
 }
 
+/* ---------------------------------------------------------------------------
+   Changing the eventlog at runtime
+
+   See Note [Changing the eventlog at runtime]
+ --------------------------------------------------------------------------- */
+
+// The events that describe the process and its capabilities, which an
+// eventlog started by startEventLog() missed at startup
+static void traceStartupEvents (void)
+{
+    uint32_t i;
+
+    traceCapsetEvent_(EVENT_CAPSET_CREATE, CAPSET_OSPROCESS_DEFAULT,
+                      CapsetTypeOsProcess);
+    traceCapsetEvent_(EVENT_CAPSET_CREATE, CAPSET_CLOCKDOMAIN_DEFAULT,
+                      CapsetTypeClockdomain);
+    for (i = 0; i < n_capabilities; i++) {
+        traceCapEvent_(capabilities[i], EVENT_CAP_CREATE);
+        traceCapsetEvent_(EVENT_CAPSET_ASSIGN_CAP,
+                          CAPSET_OSPROCESS_DEFAULT, i);
+        traceCapsetEvent_(EVENT_CAPSET_ASSIGN_CAP,
+                          CAPSET_CLOCKDOMAIN_DEFAULT, i);
+        if (capabilities[i]->disabled) {
+            traceCapEvent_(capabilities[i], EVENT_CAP_DISABLE);
+        }
+    }
+    traceWallClockTime_();
+    traceOSProcessInfo_();
+    if (TRACE_gc) {
+        traceEventHeapInfo_(CAPSET_HEAP_DEFAULT,
+                            RtsFlags.GcFlags.generations,
+                            RtsFlags.GcFlags.maxHeapSize * BLOCK_SIZE,
+                            RtsFlags.GcFlags.minAllocAreaSize * BLOCK_SIZE,
+                            MBLOCK_SIZE,
+                            BLOCK_SIZE);
+    }
+}
+
+bool startEventLog (const EventLogWriter *writer)
+{
+    Capability *cap;
+    Task *task USED_IF_THREADS;
+    bool started = false;
+
+    if (writer == NULL) {
+        writer = getEventLogWriter();
+        if (writer == NULL) {
+            return false;
+        }
+    }
+
+    cap = rts_lock();
+    task = cap->running_task;
+#if defined(THREADED_RTS)
+    stopAllCapabilities(&cap, task);
+#endif
+
+    if (!eventlog_enabled && RtsFlags.TraceFlags.tracing != TRACE_STDERR) {
+        ACQUIRE_LOCK(&trace_classes_mutex);
+        // with no class chosen, record what a plain -l would
+        if (!RtsFlags.TraceFlags.scheduler &&
+            !RtsFlags.TraceFlags.gc &&
+            !RtsFlags.TraceFlags.sparks_sampled &&
+            !RtsFlags.TraceFlags.sparks_full &&
+            !RtsFlags.TraceFlags.user) {
+            RtsFlags.TraceFlags.scheduler      = true;
+            RtsFlags.TraceFlags.gc             = true;
+            RtsFlags.TraceFlags.sparks_sampled = true;
+            RtsFlags.TraceFlags.user           = true;
+        }
+        RtsFlags.TraceFlags.tracing = TRACE_EVENTLOG;
+        initEventLogging(writer);
+        eventlog_enabled = true;
+        setTraceFlags();
+        RELEASE_LOCK(&trace_classes_mutex);
+
+        traceStartupEvents();
+        started = true;
+    }
+
+#if defined(THREADED_RTS)
+    releaseAllCapabilities(n_capabilities, cap, task);
+#endif
+    rts_unlock(cap);
+    return started;
+}
+
+void endEventLog (void)
+{
+    Capability *cap;
+    Task *task USED_IF_THREADS;
+
+    cap = rts_lock();
+    task = cap->running_task;
+#if defined(THREADED_RTS)
+    stopAllCapabilities(&cap, task);
+#endif
+
+    if (eventlog_enabled) {
+        ACQUIRE_LOCK(&trace_classes_mutex);
+        eventlog_enabled = false;
+        RtsFlags.TraceFlags.tracing = TRACE_NONE;
+        setTraceFlags();
+        RELEASE_LOCK(&trace_classes_mutex);
+
+        endEventLogging();
+        freeEventLogging();
+    }
+
+#if defined(THREADED_RTS)
+    releaseAllCapabilities(n_capabilities, cap, task);
+#endif
+    rts_unlock(cap);
+}
+
+bool eventLogRunning (void)
+{
+    return eventlog_enabled;
+}
+
+uint32_t setEventLogClasses (uint32_t enable, uint32_t disable)
+{
+    TRACE_FLAGS *flags = &RtsFlags.TraceFlags;
+    uint32_t classes;
+
+#define SET_CLASS(class, field)                 \
+    if (enable & (class)) {                     \
+        flags->field = true;                    \
+    }                                           \
+    if (disable & (class)) {                    \
+        flags->field = false;                   \
+    }                                           \
+    if (flags->field) {                         \
+        classes |= (class);                     \
+    }
+
+    ACQUIRE_LOCK(&trace_classes_mutex);
+    classes = 0;
+    SET_CLASS(EVENTLOG_SCHEDULER, scheduler);
+    SET_CLASS(EVENTLOG_GC, gc);
+    SET_CLASS(EVENTLOG_SPARKS_SAMPLED, sparks_sampled);
+    SET_CLASS(EVENTLOG_SPARKS_FULL, sparks_full);
+    SET_CLASS(EVENTLOG_USER, user);
+    setTraceFlags();
+    RELEASE_LOCK(&trace_classes_mutex);
+
+#undef SET_CLASS
+    return classes;
+}
+
 /* ---------------------------------------------------------------------------
    Emitting trace messages/events
  --------------------------------------------------------------------------- */
@@ -172,7 +372,8 @@ static char *thread_stop_reasons[] = {
     [6 + BlockedOnCCall]        = "blocked on a foreign call",
     [6 + BlockedOnCCall_Interruptible] = "blocked on a foreign call (interruptible)",
     [6 + BlockedOnMsgThrowTo]   =  "blocked on throwTo",
-    [6 + ThreadMigrating]       =  "migrating"
+    [6 + ThreadMigrating]       =  "migrating",
+    [6 + ThreadStealable]       =  "stealable"
 };
 #endif
 
@@ -206,6 +407,10 @@ static void traceSchedEvent_stderr (Capability *cap, EventTypeNum tag,
         debugBelch("cap %d: waking up thread %" FMT_Word " on cap %d\n",
                    cap->no, (W_)tso->id, (int)info1);
         break;
+    case EVENT_STEAL_THREAD:    // (cap, thread, victim_cap)
+        debugBelch("cap %d: stole thread %" FMT_Word " from cap %d\n",
+                   cap->no, (W_)tso->id, (int)info1);
+        break;
 
     case EVENT_STOP_THREAD:     // (cap, thread, status)
         if (info1 == 6 + BlockedOnBlackHole) {
@@ -559,6 +764,23 @@ void traceSparkCounters_ (Capability *cap,
     }
 }
 
+void traceSTMCounters_ (Capability *cap, STMCounters counters)
+{
+#if defined(DEBUG)
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        debugBelch("cap %d: STM wakeups: %" FMT_Word " woken, %" FMT_Word
+                   " deferred, %" FMT_Word " skipped, %" FMT_Word
+                   " rewaited, %" FMT_Word " re-executed, %" FMT_Word
+                   " committed\n", cap->no, counters.woken,
+                   counters.deferred, counters.skipped, counters.rewaited,
+                   counters.reexecuted, counters.committed);
+    } else
+#endif
+    {
+        postSTMCountersEvent(cap, counters);
+    }
+}
+
 void traceTaskCreate_ (Task       *task,
                        Capability *cap)
 {
@@ -627,6 +849,14 @@ void traceHeapProfSampleString(StgWord8 profile_id,
     }
 }
 
+void traceHeapProfSampleInfoTable(StgWord8 profile_id,
+                                  const void *info, StgWord residency)
+{
+    if (eventlog_enabled) {
+        postHeapProfSampleInfoTable(profile_id, info, residency);
+    }
+}
+
 #if defined(PROFILING)
 void traceHeapProfCostCentre(StgWord32 ccID,
                              const char *label,
@@ -774,6 +1004,18 @@ void traceThreadLabel_(Capability *cap,
     }
 }
 
+void traceAllocSample_(Capability *cap,
+                       StgTSO     *tso,
+                       StgWord64   bytes,
+                       StgWord    *code_addrs,
+                       uint32_t    depth)
+{
+    // no stderr equivalent: the addresses mean nothing until symbolised
+    if (eventlog_enabled) {
+        postAllocSample(cap, tso->id, bytes, code_addrs, depth);
+    }
+}
+
 void traceThreadStatus_ (StgTSO *tso USED_IF_DEBUG)
 {
 #if defined(DEBUG)
@@ -806,6 +1048,31 @@ void traceEnd (void)
 }
 #endif /* DEBUG */
 
+#else /* !TRACING */
+
+// Without -eventlog the eventlog can't be started, but the API is still
+// here for the benefit of the base library.
+
+bool startEventLog (const EventLogWriter *writer STG_UNUSED)
+{
+    return false;
+}
+
+void endEventLog (void)
+{
+}
+
+bool eventLogRunning (void)
+{
+    return false;
+}
+
+uint32_t setEventLogClasses (uint32_t enable STG_UNUSED,
+                             uint32_t disable STG_UNUSED)
+{
+    return 0;
+}
+
 #endif /* TRACING */
 
 // If DTRACE is enabled, but neither DEBUG nor TRACING, we need a C land
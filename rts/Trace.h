@@ -212,6 +212,15 @@ void traceThreadLabel_(Capability *cap,
                        StgTSO     *tso,
                        char       *label);
 
+/*
+ * An allocation sample, see Note [Allocation sampling] in AllocSample.c
+ */
+void traceAllocSample_(Capability *cap,
+                       StgTSO     *tso,
+                       StgWord64   bytes,
+                       StgWord    *code_addrs,
+                       uint32_t    depth);
+
 /*
  * Emit a debug message (only when DEBUG is defined)
  */
@@ -271,6 +280,8 @@ void traceSparkCounters_ (Capability *cap,
                           SparkCounters counters,
                           StgWord remaining);
 
+void traceSTMCounters_ (Capability *cap, STMCounters counters);
+
 void traceTaskCreate_ (Task       *task,
                        Capability *cap);
 
@@ -284,6 +295,8 @@ void traceHeapProfBegin(StgWord8 profile_id);
 void traceHeapProfSampleBegin(StgInt era);
 void traceHeapProfSampleString(StgWord8 profile_id,
                                const char *label, StgWord residency);
+void traceHeapProfSampleInfoTable(StgWord8 profile_id,
+                                  const void *info, StgWord residency);
 #if defined(PROFILING)
 void traceHeapProfCostCentre(StgWord32 ccID,
                              const char *label,
@@ -315,11 +328,13 @@ void traceHeapProfSampleCostCentre(StgWord8 profile_id,
 #define debugTraceCap(class, cap, str, ...) /* nothing */
 #define traceThreadStatus(class, tso) /* nothing */
 #define traceThreadLabel_(cap, tso, label) /* nothing */
+#define traceAllocSample_(cap, tso, bytes, code_addrs, depth) /* nothing */
 #define traceCapEvent(cap, tag) /* nothing */
 #define traceCapsetEvent(tag, capset, info) /* nothing */
 #define traceWallClockTime_() /* nothing */
 #define traceOSProcessInfo_() /* nothing */
 #define traceSparkCounters_(cap, counters, remaining) /* nothing */
+#define traceSTMCounters_(cap, counters) /* nothing */
 #define traceTaskCreate_(taskID, cap) /* nothing */
 #define traceTaskMigrate_(taskID, cap, new_cap) /* nothing */
 #define traceTaskDelete_(taskID) /* nothing */
@@ -328,6 +343,7 @@ void traceHeapProfSampleCostCentre(StgWord8 profile_id,
 #define traceHeapProfSampleBegin(era) /* nothing */
 #define traceHeapProfSampleCostCentre(profile_id, stack, residency) /* nothing */
 #define traceHeapProfSampleString(profile_id, label, residency) /* nothing */
+#define traceHeapProfSampleInfoTable(profile_id, info, residency) /* nothing */
 
 #endif /* TRACING */
 
@@ -550,6 +566,15 @@ INLINE_HEADER void traceEventMigrateThread(Capability *cap     STG_UNUSED,
                         (EventCapNo)new_cap);
 }
 
+// cap took tso from the stealable threads of victim_cap, see Note
+// [Stealing threads] in Schedule.c
+INLINE_HEADER void traceEventStealThread(Capability *cap        STG_UNUSED,
+                                         StgTSO     *tso        STG_UNUSED,
+                                         uint32_t    victim_cap STG_UNUSED)
+{
+    traceSchedEvent(cap, EVENT_STEAL_THREAD, tso, victim_cap);
+}
+
 INLINE_HEADER void traceCapCreate(Capability *cap STG_UNUSED)
 {
     traceCapEvent(cap, EVENT_CAP_CREATE);
@@ -780,6 +805,14 @@ INLINE_HEADER void traceSparkCounters(Capability *cap STG_UNUSED)
 #endif
 }
 
+// See Note [STM wakeup batching] in STM.c
+INLINE_HEADER void traceSTMCounters(Capability *cap STG_UNUSED)
+{
+    if (RTS_UNLIKELY(TRACE_sched)) {
+        traceSTMCounters_(cap, cap->stm_stats);
+    }
+}
+
 INLINE_HEADER void traceEventSparkCreate(Capability *cap STG_UNUSED)
 {
     traceSparkEvent(cap, EVENT_SPARK_CREATE);
@@ -32,9 +32,16 @@
  *
  * Both popWSDeque and stealWSDeque also return NULL when the queue is empty.
  *
- * Testing: see testsuite/tests/rts/testwsdeque.c.  If
- * there's anything wrong with the deque implementation, this test
- * will probably catch it.
+ * The memory orderings follow the C11 version of the algorithm in
+ *
+ * N.M. Le, A. Pop, A. Cohen and F. Zappa Nardelli, Correct and
+ * Efficient Work-Stealing for Weak Memory Models. PPoPP'13.
+ *
+ * see Note [WSDeque memory ordering].
+ *
+ * Testing: see testsuite/tests/rts/testwsdeque.c and
+ * testwsdeque002.c.  If there's anything wrong with the deque
+ * implementation, these tests will probably catch it.
  *
  * ---------------------------------------------------------------------------*/
 
@@ -44,7 +51,47 @@
 #include "RtsUtils.h"
 #include "WSDeque.h"
 
-#define CASTOP(addr,old,new) ((old) == cas(((StgPtr)addr),(old),(new)))
+/* Note [WSDeque memory ordering]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   The deque used to be protected by full barriers: a store_load_barrier()
+   in popWSDeque(), a load_load_barrier() and a full cas in the thieves,
+   and volatile top/bottom fields.  On x86 the only expensive one is the
+   store/load barrier, but on ARM and POWER every one of them is a full
+   "dmb"/"sync", and at high -N the thieves spend most of their time in
+   them.  Following Le et al. (PPoPP'13) we now use the weakest orderings
+   that are still correct:
+
+   - pushWSDeque() writes the element with a relaxed store and publishes
+     it with a release store of bottom.  A thief that sees the new bottom
+     with an acquire load therefore also sees the element.
+
+   - popWSDeque() (owner) and the thieves race for the last element.  The
+     owner stores the decremented bottom and then reads top; a thief reads
+     top and then bottom.  Each side needs the other's store to be visible
+     before its own load, which is exactly what a seq_cst fence between
+     the two accesses provides (SEQ_CST_FENCE()).  This is the only full
+     fence on the fast path, and it is needed by the algorithm itself.
+
+   - Whoever takes an element by moving top does so with a seq_cst cas,
+     as before.
+
+   - Elements are read with relaxed loads: a thief may read an element
+     that is being overwritten by a concurrent push after wrap-around,
+     but then top has moved and its cas fails, so the value is discarded.
+
+   In the non-threaded RTS the macros are plain loads and stores.
+*/
+
+STATIC_INLINE bool
+casTop (WSDeque *q, StgWord old, StgWord new)
+{
+#if defined(THREADED_RTS)
+    return __atomic_compare_exchange_n(&q->top, &old, new, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+#else
+    return old == cas(&q->top, old, new);
+#endif
+}
 
 /* -----------------------------------------------------------------------------
  * newWSDeque
@@ -126,29 +173,29 @@ popWSDeque (WSDeque *q)
 
     ASSERT_WSDEQUE_INVARIANTS(q);
 
-    b = q->bottom;
+    b = RELAXED_LOAD(&q->bottom);
 
     // "decrement b as a test, see what happens"
     b--;
-    q->bottom = b;
+    RELAXED_STORE(&q->bottom, b);
 
     // very important that the following read of q->top does not occur
     // before the earlier write to q->bottom.
-    store_load_barrier();
+    SEQ_CST_FENCE();
 
-    t = q->top; /* using topBound would give an *upper* bound, we
-                   need a lower bound. We use the real top here, but
-                   can update the topBound value */
+    t = RELAXED_LOAD(&q->top); /* using topBound would give an *upper*
+                   bound, we need a lower bound. We use the real top
+                   here, but can update the topBound value */
     q->topBound = t;
     currSize = (long)b - (long)t;
     if (currSize < 0) { /* was empty before decrementing b, set b
                            consistently and abort */
-        q->bottom = t;
+        RELAXED_STORE(&q->bottom, t);
         return NULL;
     }
 
     // read the element at b
-    removed = q->elements[b & q->moduloSize];
+    removed = RELAXED_LOAD(&q->elements[b & q->moduloSize]);
 
     if (currSize > 0) { /* no danger, still elements in buffer after b-- */
         // debugBelch("popWSDeque: t=%ld b=%ld = %ld\n", t, b, removed);
@@ -156,10 +203,11 @@ popWSDeque (WSDeque *q)
     }
     /* otherwise, has someone meanwhile stolen the same (last) element?
        Check and increment top value to know  */
-    if ( !(CASTOP(&(q->top),t,t+1)) ) {
+    if ( !casTop(q,t,t+1) ) {
         removed = NULL; /* no success, but continue adjusting bottom */
     }
-    q->bottom = t+1; /* anyway, empty now. Adjust bottom consistently. */
+    RELAXED_STORE(&q->bottom, t+1); /* anyway, empty now. Adjust bottom
+                                       consistently. */
     q->topBound = t+1; /* ...and cached top value as well */
 
     ASSERT_WSDEQUE_INVARIANTS(q);
@@ -185,22 +233,22 @@ stealWSDeque_ (WSDeque *q)
 
     // NB. these loads must be ordered, otherwise there is a race
     // between steal and pop.
-    t = q->top;
-    load_load_barrier();
-    b = q->bottom;
+    t = ACQUIRE_LOAD(&q->top);
+    SEQ_CST_FENCE();
+    b = ACQUIRE_LOAD(&q->bottom);
 
     // NB. b and t are unsigned; we need a signed value for the test
     // below, because it is possible that t > b during a
     // concurrent popWSQueue() operation.
     if ((long)b - (long)t <= 0 ) {
         return NULL; /* already looks empty, abort */
-  }
+    }
 
     /* now access array, see pushBottom() */
-    stolen = q->elements[t & q->moduloSize];
+    stolen = RELAXED_LOAD(&q->elements[t & q->moduloSize]);
 
     /* now decide whether we have won */
-    if ( !(CASTOP(&(q->top),t,t+1)) ) {
+    if ( !casTop(q,t,t+1) ) {
         /* lost the race, someon else has changed top in the meantime */
         return NULL;
     }  /* else: OK, top has been incremented by the cas call */
@@ -225,6 +273,73 @@ stealWSDeque (WSDeque *q)
     return stolen;
 }
 
+/* -----------------------------------------------------------------------------
+ * stealHalfWSDeque
+ *
+ * Note [Stealing half of a deque]
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * With fine-grained parallelism an idle capability that steals one
+ * spark at a time comes straight back for the next one, and the
+ * victim's top becomes the most contended word in the program.
+ * stealHalfWSDeque() instead takes ceil(n/2) of the n elements the
+ * thief sees with a single cas on top, returns the first and moves the
+ * rest into the thief's own deque, from where it (and others) can take
+ * them without touching the victim again.
+ *
+ * The elements are copied into the free slots of the thief's deque
+ * before the cas, and only published (by a release store of its
+ * bottom) if the cas succeeds.  Those slots are beyond bottom, so no
+ * other thread looks at them until then, exactly as in pushWSDeque().
+ *
+ * This is only correct if nobody takes elements from the bottom of q
+ * concurrently: the owner's popWSDeque() only synchronises with the
+ * thieves for the last element, so it could take one of the elements
+ * covered by our cas.  That holds for spark pools, whose owner takes
+ * sparks from the top end (see findSpark()), but not for the GC's
+ * todo_q, which therefore still uses stealWSDeque().
+ * -------------------------------------------------------------------------- */
+
+void *
+stealHalfWSDeque (WSDeque *q, WSDeque *to)
+{
+    StgWord b, t, to_b, to_t, i;
+    long n, room;
+    void *stolen;
+
+    t = ACQUIRE_LOAD(&q->top);
+    SEQ_CST_FENCE();
+    b = ACQUIRE_LOAD(&q->bottom);
+
+    n = (long)b - (long)t;
+    if (n <= 0) {
+        return NULL;
+    }
+    n = (n + 1) / 2;
+
+    // we can move at most this many elements into our own deque
+    to_b = RELAXED_LOAD(&to->bottom);
+    to_t = ACQUIRE_LOAD(&to->top);
+    room = (long)to->moduloSize - ((long)to_b - (long)to_t);
+    if (n - 1 > room) {
+        n = room + 1;
+    }
+
+    stolen = RELAXED_LOAD(&q->elements[t & q->moduloSize]);
+    for (i = 1; i < (StgWord)n; i++) {
+        RELAXED_STORE(&to->elements[(to_b + i - 1) & to->moduloSize],
+                      RELAXED_LOAD(&q->elements[(t + i) & q->moduloSize]));
+    }
+
+    if ( !casTop(q,t,t+n) ) {
+        return NULL;
+    }
+
+    if (n > 1) {
+        RELEASE_STORE(&to->bottom, to_b + n - 1);
+    }
+    return stolen;
+}
+
 /* -----------------------------------------------------------------------------
  * pushWSQueue
  * -------------------------------------------------------------------------- */
@@ -246,14 +361,14 @@ pushWSDeque (WSDeque* q, void * elem)
        q->topBound (accessed only by writer) instead.
        This is why we do not just call empty(q) here.
     */
-    b = q->bottom;
+    b = RELAXED_LOAD(&q->bottom);
     t = q->topBound;
     if ( (StgInt)b - (StgInt)t >= (StgInt)sz ) {
         /* NB. 1. sz == q->size - 1, thus ">="
            2. signed comparison, it is possible that t > b
         */
         /* could be full, check the real top value in this case */
-        t = q->top;
+        t = ACQUIRE_LOAD(&q->top);
         q->topBound = t;
         if (b - t >= sz) { /* really no space left :-( */
             /* reallocate the array, copying the values. Concurrent steal()s
@@ -278,7 +393,7 @@ pushWSDeque (WSDeque* q, void * elem)
         }
     }
 
-    q->elements[b & sz] = elem;
+    RELAXED_STORE(&q->elements[b & sz], elem);
     /*
        KG: we need to put write barrier here since otherwise we might
        end with elem not added to q->elements, but q->bottom already
@@ -286,9 +401,10 @@ pushWSDeque (WSDeque* q, void * elem)
        later when invoked from another thread since it thinks elem is
        there (in case there is just added element in the queue). This
        issue concretely hit me on ARMv7 multi-core CPUs
+
+       The release store of bottom is that barrier.
      */
-    write_barrier();
-    q->bottom = b + 1;
+    RELEASE_STORE(&q->bottom, b + 1);
 
     ASSERT_WSDEQUE_INVARIANTS(q);
     return true;
@@ -15,19 +15,19 @@ typedef struct WSDeque_ {
     StgWord moduloSize; /* bitmask for modulo */
 
     // top, index where multiple readers steal() (protected by a cas)
-    volatile StgWord top;
+    StgWord top;
 
     // bottom, index of next free place where one writer can push
     // elements. This happens unsynchronised.
-    volatile StgWord bottom;
+    StgWord bottom;
 
     // both top and bottom are continuously incremented, and used as
     // an index modulo the current array size.
 
     // lower bound on the current top value. This is an internal
     // optimisation to avoid unnecessarily accessing the top field
-    // inside pushBottom
-    volatile StgWord topBound;
+    // inside pushBottom.  Only accessed by the owner.
+    StgWord topBound;
 
     // The elements array
     void ** elements;
@@ -61,7 +61,12 @@ typedef struct WSDeque_ {
  *
  * A WSDeque has an *owner* thread.  The owner can perform any operation;
  * other threads are only allowed to call stealWSDeque_(),
- * stealWSDeque(), looksEmptyWSDeque(), and dequeElements().
+ * stealWSDeque(), stealHalfWSDeque(), looksEmptyWSDeque(), and
+ * dequeElements().
+ *
+ * top and bottom are accessed with the C11-style atomics from SMP.h
+ * (RELAXED_LOAD, ACQUIRE_LOAD, ...); see Note [WSDeque memory ordering]
+ * in WSDeque.c.
  *
  * -------------------------------------------------------------------------- */
 
@@ -89,6 +94,15 @@ void * stealWSDeque_ (WSDeque *q);
 // NULL if the pool is empty.
 void * stealWSDeque (WSDeque *q);
 
+// Removes about half of the elements of q from the "read" end in a
+// single cas.  The first one is returned, and the rest are pushed onto
+// the deque "to", which must be owned by the caller.  Returns NULL if
+// q is empty or if there was a collision with another thief.
+//
+// NB. must not be used while the owner of q may call popWSDeque();
+// see Note [Stealing half of a deque] in WSDeque.c.
+void * stealHalfWSDeque (WSDeque *q, WSDeque *to);
+
 // "guesses" whether a deque is empty. Can return false negatives in
 //  presence of concurrent steal() calls, and false positives in
 //  presence of a concurrent pushBottom().
@@ -103,8 +117,8 @@ EXTERN_INLINE long dequeElements   (WSDeque *q);
 EXTERN_INLINE long
 dequeElements (WSDeque *q)
 {
-    StgWord t = q->top;
-    StgWord b = q->bottom;
+    StgWord t = ACQUIRE_LOAD(&q->top);
+    StgWord b = ACQUIRE_LOAD(&q->bottom);
     // try to prefer false negatives by reading top first
     return ((long)b - (long)t);
 }
@@ -118,6 +132,6 @@ looksEmptyWSDeque (WSDeque *q)
 EXTERN_INLINE void
 discardElements (WSDeque *q)
 {
-    q->top = q->bottom;
+    RELAXED_STORE(&q->top, RELAXED_LOAD(&q->bottom));
 //    pool->topBound = pool->top;
 }
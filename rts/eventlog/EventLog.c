@@ -105,6 +105,10 @@ char *EventDesc[] = {
   [EVENT_HEAP_PROF_SAMPLE_BEGIN]  = "Start of heap profile sample",
   [EVENT_HEAP_PROF_SAMPLE_STRING] = "Heap profile string sample",
   [EVENT_HEAP_PROF_SAMPLE_COST_CENTRE] = "Heap profile cost-centre sample",
+  [EVENT_HEAP_PROF_SAMPLE_INFO_TABLE] = "Heap profile info table sample",
+  [EVENT_ALLOC_SAMPLE]        = "Allocation sample",
+  [EVENT_STM_COUNTERS]        = "STM counters",
+  [EVENT_STEAL_THREAD]        = "Steal thread",
 };
 
 // Event type.
@@ -288,14 +292,26 @@ initEventLogging(const EventLogWriter *ev_writer)
      * the buffer so all buffers are empty for writing events.
      */
 #if defined(THREADED_RTS)
-    // XXX n_capabilities hasn't been initislised yet
-    n_caps = RtsFlags.ParFlags.nCapabilities;
+    // n_capabilities hasn't been initialised yet at startup, but it has
+    // if the eventlog is started later by startEventLog()
+    n_caps = n_capabilities != 0 ? n_capabilities
+                                 : RtsFlags.ParFlags.nCapabilities;
 #else
     n_caps = 1;
 #endif
     moreCapEventBufs(0,n_caps);
 
-    initEventsBuf(&eventBuf, EVENT_LOG_SIZE, (EventCapNo)(-1));
+    // eventBuf lives until the RTS exits, because tasks that don't hold a
+    // Capability may post to it at any time.  See Note [Changing the
+    // eventlog at runtime] in Trace.c.
+    if (eventBuf.begin == NULL) {
+        initEventsBuf(&eventBuf, EVENT_LOG_SIZE, (EventCapNo)(-1));
+#if defined(THREADED_RTS)
+        initMutex(&eventBufMutex);
+#endif
+    } else {
+        resetEventsBuf(&eventBuf);
+    }
 
     // Write in buffer: the header begin marker.
     postInt32(&eventBuf, EVENT_HEADER_BEGIN);
@@ -317,6 +333,7 @@ initEventLogging(const EventLogWriter *ev_writer)
 
         case EVENT_MIGRATE_THREAD:  // (cap, thread, new_cap)
         case EVENT_THREAD_WAKEUP:   // (cap, thread, other_cap)
+        case EVENT_STEAL_THREAD:    // (cap, thread, victim_cap)
             eventTypes[t].size =
                 sizeof(EventThreadID) + sizeof(EventCapNo);
             break;
@@ -465,6 +482,18 @@ initEventLogging(const EventLogWriter *ev_writer)
             eventTypes[t].size = EVENT_SIZE_DYNAMIC;
             break;
 
+        case EVENT_HEAP_PROF_SAMPLE_INFO_TABLE:
+            eventTypes[t].size = 1 + 8 + 8;
+            break;
+
+        case EVENT_ALLOC_SAMPLE:  // (thread, bytes, depth, code_addrs)
+            eventTypes[t].size = EVENT_SIZE_DYNAMIC;
+            break;
+
+        case EVENT_STM_COUNTERS:  // (cap, 6*counter)
+            eventTypes[t].size = 6 * sizeof(StgWord64);
+            break;
+
         default:
             continue; /* ignore deprecated events */
         }
@@ -492,10 +521,6 @@ initEventLogging(const EventLogWriter *ev_writer)
     for (c = 0; c < n_caps; ++c) {
         postBlockMarker(&capEventBuf[c]);
     }
-
-#if defined(THREADED_RTS)
-    initMutex(&eventBufMutex);
-#endif
 }
 
 void
@@ -559,6 +584,7 @@ freeEventLogging(void)
     }
     if (capEventBuf != NULL)  {
         stgFree(capEventBuf);
+        capEventBuf = NULL;
     }
 }
 
@@ -567,6 +593,10 @@ abortEventLogging(void)
 {
     freeEventLogging();
     stopEventLogWriter();
+#if defined(THREADED_RTS)
+    // a thread of the parent may have held the lock when we forked
+    initMutex(&eventBufMutex);
+#endif
 }
 
 /*
@@ -604,6 +634,7 @@ postSchedEvent (Capability *cap,
 
     case EVENT_MIGRATE_THREAD:  // (cap, thread, new_cap)
     case EVENT_THREAD_WAKEUP:   // (cap, thread, other_cap)
+    case EVENT_STEAL_THREAD:    // (cap, thread, victim_cap)
     {
         postThreadID(eb,thread);
         postCapNo(eb,info1 /* new_cap | victim_cap | other_cap */);
@@ -684,6 +715,25 @@ postSparkCountersEvent (Capability *cap,
     postWord64(eb,remaining);
 }
 
+void
+postSTMCountersEvent (Capability *cap, STMCounters counters)
+{
+    EventsBuf *eb;
+
+    eb = &capEventBuf[cap->no];
+    ensureRoomForEvent(eb, EVENT_STM_COUNTERS);
+
+    postEventHeader(eb, EVENT_STM_COUNTERS);
+    /* EVENT_STM_COUNTERS (woken,deferred,skipped,rewaited,reexecuted,
+                           committed) */
+    postWord64(eb,counters.woken);
+    postWord64(eb,counters.deferred);
+    postWord64(eb,counters.skipped);
+    postWord64(eb,counters.rewaited);
+    postWord64(eb,counters.reexecuted);
+    postWord64(eb,counters.committed);
+}
+
 void
 postCapEvent (EventTypeNum  tag,
               EventCapNo    capno)
@@ -1062,6 +1112,33 @@ void postUserEvent(Capability *cap, EventTypeNum type, char *msg)
     postBuf(eb, (StgWord8*) msg, size);
 }
 
+void postAllocSample(Capability    *cap,
+                     EventThreadID  thread,
+                     StgWord64      bytes,
+                     StgWord       *code_addrs,
+                     uint32_t       depth)
+{
+    EventsBuf *eb;
+    uint32_t i;
+    StgWord16 size = sizeof(EventThreadID) + sizeof(StgWord64)
+                   + sizeof(StgWord16) + depth * sizeof(StgWord64);
+
+    eb = &capEventBuf[cap->no];
+
+    if (ensureRoomForVariableEvent(eb, size)) {
+        return;
+    }
+
+    postEventHeader(eb, EVENT_ALLOC_SAMPLE);
+    postPayloadSize(eb, size);
+    postThreadID(eb, thread);
+    postWord64(eb, bytes);
+    postWord16(eb, (StgWord16)depth);
+    for (i = 0; i < depth; i++) {
+        postWord64(eb, (StgWord64)code_addrs[i]);
+    }
+}
+
 void postThreadLabel(Capability    *cap,
                      EventThreadID  id,
                      char          *label)
@@ -1126,6 +1203,8 @@ typedef enum {
     HEAP_PROF_BREAKDOWN_TYPE_DESCR,
     HEAP_PROF_BREAKDOWN_RETAINER,
     HEAP_PROF_BREAKDOWN_BIOGRAPHY,
+    HEAP_PROF_BREAKDOWN_CLOSURE_TYPE,
+    HEAP_PROF_BREAKDOWN_INFO_TABLE,
 } HeapProfBreakdown;
 
 static HeapProfBreakdown getHeapProfBreakdown(void)
@@ -1143,6 +1222,10 @@ static HeapProfBreakdown getHeapProfBreakdown(void)
         return HEAP_PROF_BREAKDOWN_RETAINER;
     case HEAP_BY_LDV:
         return HEAP_PROF_BREAKDOWN_BIOGRAPHY;
+    case HEAP_BY_CLOSURE_TYPE:
+        return HEAP_PROF_BREAKDOWN_CLOSURE_TYPE;
+    case HEAP_BY_INFO_TABLE:
+        return HEAP_PROF_BREAKDOWN_INFO_TABLE;
     default:
         barf("getHeapProfBreakdown: unknown heap profiling mode");
     }
@@ -1211,6 +1294,19 @@ void postHeapProfSampleString(StgWord8 profile_id,
     RELEASE_LOCK(&eventBufMutex);
 }
 
+void postHeapProfSampleInfoTable(StgWord8 profile_id,
+                                 const void *info,
+                                 StgWord64 residency)
+{
+    ACQUIRE_LOCK(&eventBufMutex);
+    ensureRoomForEvent(&eventBuf, EVENT_HEAP_PROF_SAMPLE_INFO_TABLE);
+    postEventHeader(&eventBuf, EVENT_HEAP_PROF_SAMPLE_INFO_TABLE);
+    postWord8(&eventBuf, profile_id);
+    postWord64(&eventBuf, residency);
+    postWord64(&eventBuf, (StgWord64)(W_)info);
+    RELEASE_LOCK(&eventBufMutex);
+}
+
 #if defined(PROFILING)
 void postHeapProfCostCentre(StgWord32 ccID,
                             const char *label,
@@ -91,6 +91,11 @@ void postSparkCountersEvent (Capability *cap,
                              SparkCounters counters,
                              StgWord remaining);
 
+/*
+ * Post an event with the counters of threads woken from STM retry.
+ */
+void postSTMCountersEvent (Capability *cap, STMCounters counters);
+
 /*
  * Post an event to annotate a thread with a label
  */
@@ -98,6 +103,17 @@ void postThreadLabel(Capability    *cap,
                      EventThreadID  id,
                      char          *label);
 
+/*
+ * Post an allocation sample: the thread that allocated, the bytes
+ * allocated since the previous sample, and the code addresses of the
+ * allocation site and the return frames above it
+ */
+void postAllocSample(Capability    *cap,
+                     EventThreadID  thread,
+                     StgWord64      bytes,
+                     StgWord       *code_addrs,
+                     uint32_t       depth);
+
 /*
  * Various GC and heap events
  */
@@ -141,6 +157,10 @@ void postHeapProfSampleString(StgWord8 profile_id,
                               const char *label,
                               StgWord64 residency);
 
+void postHeapProfSampleInfoTable(StgWord8 profile_id,
+                                 const void *info,
+                                 StgWord64 residency);
+
 #if defined(PROFILING)
 void postHeapProfCostCentre(StgWord32 ccID,
                             const char *label,
@@ -0,0 +1,396 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2017
+ *
+ * An EventLogWriter that streams the eventlog to a Unix domain socket or
+ * a named pipe (+RTS --eventlog-socket=<path>).
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#if !defined(mingw32_HOST_OS)
+
+#include "RtsUtils.h"
+#include "GetTime.h"
+#include "rts/EventLogWriter.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#if defined(HAVE_SYS_TYPES_H)
+#include <sys/types.h>
+#endif
+#if defined(HAVE_UNISTD_H)
+#include <unistd.h>
+#endif
+
+#if !defined(SOCK_CLOEXEC)
+#define SOCK_CLOEXEC 0
+#endif
+#if !defined(O_CLOEXEC)
+#define O_CLOEXEC 0
+#endif
+
+/* Note [Streaming the eventlog]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+   With +RTS --eventlog-socket=<path> the eventlog is sent to a monitoring
+   agent listening on the Unix domain socket <path> (or reading from the
+   named pipe <path>) while the program runs, instead of being written
+   to <prog>.eventlog.
+
+   The capabilities still fill their EventsBufs as usual, and call
+   writeEventLog() when one is full.  Writing to a file there is fine,
+   but a socket can block for as long as the agent is not reading, and
+   we must never stall the mutator (or the GC) for that.  So
+   writeEventLogSocket() only copies the block into a bounded queue
+   (QUEUE_SIZE bytes) and returns: the capability's buffer is free to be
+   refilled straight away, while a dedicated flusher thread sends the
+   queued blocks.  In effect every capability's buffer is double
+   buffered, with the queue holding the second buffers of all of them.
+
+   If the queue has no room for a block, because the agent is not
+   keeping up or is not connected, the whole block is dropped and
+   counted.  Blocks are self-contained (each starts with a block
+   marker), so dropping whole blocks leaves a stream that the eventlog
+   tools can still parse; only the events in the dropped blocks are lost.
+   The number of bytes dropped is reported when the program exits.
+
+   The first block written is the eventlog header (the event types).  We
+   keep a copy of it and send it first on every connection, so the agent
+   may connect after the program has started, or reconnect after a
+   failure: the flusher keeps trying to connect, and blocks produced in
+   the meantime wait in the queue for as long as there is room.
+
+   The flusher is an OS thread of its own in both the threaded and the
+   non-threaded RTS.  After a fork() it does not exist in the child, so
+   the child throws away the state inherited from the parent and starts
+   its own connection (see resetTracing()).
+*/
+
+#define QUEUE_SIZE (16 * 1024 * 1024)
+
+// how long (in ms) we wait for the agent to accept the rest of the
+// events when the program exits
+#define STOP_TIMEOUT 1000
+
+// how often (in ms) the flusher looks up from a blocked send to see
+// whether we are stopping
+#define POLL_INTERVAL 100
+
+static Mutex     queue_lock;
+static Condition queue_cond;     // signalled when the state below changes
+
+// The queue: a ring buffer of QUEUE_SIZE bytes.  head and tail are byte
+// offsets that only ever increase; the bytes in [head,tail) are waiting
+// to be sent, and tail is always at a block boundary.
+static StgWord8 *queue;
+static StgWord64 queue_head, queue_tail;
+
+static StgWord8 *header;         // copy of the first block
+static size_t    header_size;
+
+static StgWord64 dropped_bytes;
+
+static int  sock_fd = -1;
+static volatile bool stopping;
+static bool flusher_done;
+
+// The process that started the flusher thread, see Note [Streaming the
+// eventlog]
+static pid_t writer_pid = -1;
+
+static void initEventLogSocketWriter(void);
+static bool writeEventLogSocket(void *eventlog, size_t eventlog_size);
+static void flushEventLogSocket(void);
+static void stopEventLogSocketWriter(void);
+
+static int
+connectEventLogSocket (const char *path)
+{
+    struct stat st;
+    struct sockaddr_un addr;
+    int fd;
+
+    if (stat(path, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        // fails with ENXIO until somebody opens the pipe for reading
+        return open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    }
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Send as much of buf as the agent will take, waiting at most timeout
+// ms (or forever if timeout < 0) for it to make progress.  Returns the
+// number of bytes sent, 0 on a timeout, or -1 if the connection failed.
+static ssize_t
+sendEventLog (int fd, const StgWord8 *buf, size_t size, int timeout)
+{
+    struct pollfd pfd;
+    ssize_t r;
+
+    for (;;) {
+#if defined(MSG_NOSIGNAL)
+        r = send(fd, buf, size, MSG_NOSIGNAL);
+        if (r < 0 && errno == ENOTSOCK) {
+            r = write(fd, buf, size);
+        }
+#else
+        r = write(fd, buf, size);
+#endif
+        if (r >= 0) {
+            return r;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return -1;
+        }
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        r = poll(&pfd, 1, timeout);
+        if (r == 0) {
+            return 0;
+        }
+        if (r < 0 && errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+static bool
+sendAll (int fd, const StgWord8 *buf, size_t size)
+{
+    ssize_t r;
+
+    while (size > 0) {
+        r = sendEventLog(fd, buf, size, POLL_INTERVAL);
+        if (r < 0 || (r == 0 && stopping)) {
+            return false;
+        }
+        buf += r;
+        size -= r;
+    }
+    return true;
+}
+
+// Throw away the blocks in the queue, with queue_lock held
+static void
+dropQueue (void)
+{
+    dropped_bytes += queue_tail - queue_head;
+    queue_head = queue_tail;
+}
+
+static void OSThreadProcAttr
+eventLogFlusher (void *arg STG_UNUSED)
+{
+    const char *path = RtsFlags.TraceFlags.eventlogSocket;
+    StgWord64 offset, n;
+    Time deadline = 0;
+    ssize_t r;
+    int fd;
+    bool warned = false;
+
+    OS_ACQUIRE_LOCK(&queue_lock);
+    for (;;) {
+        if (sock_fd < 0) {
+            // wait for the header before connecting
+            if (header == NULL && !stopping) {
+                waitCondition(&queue_cond, &queue_lock);
+                continue;
+            }
+            if (stopping) {
+                dropQueue();
+                break;
+            }
+            OS_RELEASE_LOCK(&queue_lock);
+            fd = connectEventLogSocket(path);
+            if (fd >= 0 && !sendAll(fd, header, header_size)) {
+                close(fd);
+                fd = -1;
+            }
+            if (fd < 0) {
+                if (!warned) {
+                    sysErrorBelch("warning: can't connect to eventlog socket "
+                                  "%s; will keep trying", path);
+                    warned = true;
+                }
+                poll(NULL, 0, POLL_INTERVAL);
+            }
+            OS_ACQUIRE_LOCK(&queue_lock);
+            sock_fd = fd;
+            continue;
+        }
+
+        if (queue_head == queue_tail) {
+            if (stopping) {
+                break;
+            }
+            waitCondition(&queue_cond, &queue_lock);
+            continue;
+        }
+
+        // send the contiguous part of the queue from head
+        offset = queue_head % QUEUE_SIZE;
+        n = stg_min(queue_tail - queue_head, QUEUE_SIZE - offset);
+        fd = sock_fd;
+        OS_RELEASE_LOCK(&queue_lock);
+
+        r = sendEventLog(fd, queue + offset, n, POLL_INTERVAL);
+
+        OS_ACQUIRE_LOCK(&queue_lock);
+        if (r < 0) {
+            // the agent went away: drop what we have, and reconnect
+            close(sock_fd);
+            sock_fd = -1;
+            warned = false;
+            dropQueue();
+        } else {
+            queue_head += r;
+            // stopping may have been set during the send, so the time
+            // we allow for the rest starts here
+            if (stopping) {
+                if (deadline == 0) {
+                    deadline = getProcessElapsedTime()
+                        + USToTime(STOP_TIMEOUT * 1000);
+                } else if (getProcessElapsedTime() > deadline) {
+                    dropQueue();
+                    break;
+                }
+            }
+        }
+    }
+
+    flusher_done = true;
+    broadcastCondition(&queue_cond);
+    OS_RELEASE_LOCK(&queue_lock);
+}
+
+static void
+initEventLogSocketWriter(void)
+{
+    OSThreadId tid;
+
+    initMutex(&queue_lock);
+    initCondition(&queue_cond);
+    queue = stgMallocBytes(QUEUE_SIZE, "initEventLogSocketWriter");
+    queue_head = queue_tail = 0;
+    header = NULL;
+    header_size = 0;
+    dropped_bytes = 0;
+    sock_fd = -1;
+    stopping = false;
+    flusher_done = false;
+    writer_pid = getpid();
+
+    if (createOSThread(&tid, "ghc_eventlog",
+                       (OSThreadProc*)eventLogFlusher, NULL) != 0) {
+        sysErrorBelch("initEventLogSocketWriter: can't create thread");
+        stg_exit(EXIT_FAILURE);
+    }
+}
+
+static bool
+writeEventLogSocket(void *eventlog, size_t eventlog_size)
+{
+    StgWord64 offset, n;
+
+    OS_ACQUIRE_LOCK(&queue_lock);
+
+    if (header == NULL) {
+        // the first block is the header; see Note [Streaming the eventlog]
+        header = stgMallocBytes(eventlog_size, "writeEventLogSocket");
+        memcpy(header, eventlog, eventlog_size);
+        header_size = eventlog_size;
+    } else if (queue_tail - queue_head + eventlog_size > QUEUE_SIZE) {
+        dropped_bytes += eventlog_size;
+        OS_RELEASE_LOCK(&queue_lock);
+        return true; // not an error: dropping is what we want
+    } else {
+        offset = queue_tail % QUEUE_SIZE;
+        n = stg_min(eventlog_size, QUEUE_SIZE - offset);
+        memcpy(queue + offset, eventlog, n);
+        memcpy(queue, (StgWord8 *)eventlog + n, eventlog_size - n);
+        queue_tail += eventlog_size;
+    }
+
+    signalCondition(&queue_cond);
+    OS_RELEASE_LOCK(&queue_lock);
+    return true;
+}
+
+static void
+flushEventLogSocket(void)
+{
+    // Nothing to do: the flusher sends the queue as fast as it can, and
+    // a forked child never sends what it inherited.
+}
+
+static void
+stopEventLogSocketWriter(void)
+{
+    if (writer_pid == getpid()) {
+        OS_ACQUIRE_LOCK(&queue_lock);
+        stopping = true;
+        signalCondition(&queue_cond);
+        while (!flusher_done) {
+            waitCondition(&queue_cond, &queue_lock);
+        }
+        OS_RELEASE_LOCK(&queue_lock);
+
+        if (dropped_bytes != 0) {
+            errorBelch("warning: the eventlog socket writer dropped %"
+                       FMT_Word64 " bytes of events", dropped_bytes);
+        }
+    }
+    // otherwise we are a forked child, and the flusher thread belongs
+    // to the parent
+
+    if (sock_fd >= 0) {
+        close(sock_fd);
+        sock_fd = -1;
+    }
+    stgFree(queue);
+    queue = NULL;
+    if (header != NULL) {
+        stgFree(header);
+        header = NULL;
+    }
+    closeCondition(&queue_cond);
+    closeMutex(&queue_lock);
+}
+
+const EventLogWriter SocketEventLogWriter = {
+    .initEventLogWriter = initEventLogSocketWriter,
+    .writeEventLog = writeEventLogSocket,
+    .flushEventLog = flushEventLogSocket,
+    .stopEventLogWriter = stopEventLogSocketWriter
+};
+
+#endif /* !mingw32_HOST_OS */
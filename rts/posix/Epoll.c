@@ -0,0 +1,563 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2017
+ *
+ * The epoll()-based backend of awaitEvent() for the non-threaded RTS
+ * on Linux.  posix/Select.c is the portable fallback.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "Signals.h"
+#include "Schedule.h"
+#include "Prelude.h"
+#include "RaiseAsync.h"
+#include "RtsUtils.h"
+#include "Capability.h"
+#include "Select.h"
+#include "AwaitEvent.h"
+#include "GetTime.h"
+
+#if !defined(THREADED_RTS) && defined(AWAIT_EVENT_EPOLL)
+
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+/* -----------------------------------------------------------------------------
+   Note [epoll backend]
+   ~~~~~~~~~~~~~~~~~~~~
+
+   The select() backend rebuilds its fd_sets from blocked_queue_hd on
+   every call of awaitEvent(), so each wakeup costs O(blocked threads),
+   and it can't handle file descriptors >= FD_SETSIZE at all.  This
+   backend instead keeps:
+
+    - fds: a table indexed by file descriptor, holding the threads
+      blocked reading from and writing to each fd.  Each list is linked
+      through tso->_link.  The table grows as needed, so there is no
+      limit on fd numbers.
+
+    - timers: a binary min-heap of the threads blocked in threadDelay,
+      ordered by their target time, instead of the sorted
+      sleeping_queue (whose insertion is linear).
+
+   An fd is added to the epoll set the first time a thread blocks on it
+   and stays there; it is registered with EPOLLONESHOT, so that an
+   event disarms it until the next thread blocks on it (which re-arms it
+   with EPOLL_CTL_MOD).  So an event for an fd that nobody waits for any
+   more (e.g. because the waiting thread was killed) is seen at most
+   once, and removing a thread never needs a system call.  If the fd was
+   closed in the meantime, the kernel has dropped it from the set and
+   EPOLL_CTL_MOD fails with ENOENT, so we add it again.
+
+   Files that epoll can't watch (regular files, for which epoll_ctl()
+   fails with EPERM) are always ready, and invalid fds (EBADF) get a
+   blockedOnBadFD exception like with select() (Trac #4934).  Threads
+   blocked on such fds are put on the unpollable list, which awaitEvent()
+   handles without waiting.
+
+   blocked_queue_hd and sleeping_queue are unused with this backend.
+   All the threads are reachable from the structures above, which
+   markAwaitEvent() marks.
+   -------------------------------------------------------------------------- */
+
+typedef struct {
+    StgTSO *readers;      // threads blocked reading from the fd
+    StgTSO *writers;      // threads blocked writing to the fd
+    bool    registered;   // the fd is in the epoll set
+} FdWaiters;
+
+typedef struct {
+    LowResTime target;
+    StgTSO    *tso;
+} Timer;
+
+static int epoll_fd = -1;
+
+static FdWaiters *fds = NULL;
+static uint32_t   n_fds = 0;        // size of fds[]
+static uint32_t   n_io_waiters = 0; // threads in fds[]
+
+static Timer     *timers = NULL;
+static uint32_t   n_timers = 0;
+static uint32_t   max_timers = 0;
+
+static StgTSO    *unpollable = NULL;
+
+// See the comment on wakeUpSleepingThreads() in Select.c about
+// time wrapping around.
+#define TIMER_BEFORE(a,b) (((long)(a) - (long)(b)) < 0)
+
+#define MAX_EVENTS 64
+
+/* -----------------------------------------------------------------------------
+   The timer heap
+   -------------------------------------------------------------------------- */
+
+static void
+sift_up (uint32_t i)
+{
+    Timer t = timers[i];
+
+    while (i > 0 && TIMER_BEFORE(t.target, timers[(i-1)/2].target)) {
+        timers[i] = timers[(i-1)/2];
+        i = (i-1)/2;
+    }
+    timers[i] = t;
+}
+
+static void
+sift_down (uint32_t i)
+{
+    Timer t = timers[i];
+    uint32_t c;
+
+    for (;;) {
+        c = 2*i + 1;
+        if (c >= n_timers) break;
+        if (c+1 < n_timers &&
+            TIMER_BEFORE(timers[c+1].target, timers[c].target)) {
+            c++;
+        }
+        if (!TIMER_BEFORE(timers[c].target, t.target)) break;
+        timers[i] = timers[c];
+        i = c;
+    }
+    timers[i] = t;
+}
+
+static void
+insert_timer (StgTSO *tso)
+{
+    if (n_timers == max_timers) {
+        max_timers = max_timers == 0 ? 64 : max_timers * 2;
+        timers = stgReallocBytes(timers, max_timers * sizeof(Timer),
+                                 "insert_timer");
+    }
+    timers[n_timers].target = tso->block_info.target;
+    timers[n_timers].tso = tso;
+    sift_up(n_timers++);
+}
+
+static void
+remove_timer (uint32_t i)
+{
+    ASSERT(i < n_timers);
+    n_timers--;
+    if (i < n_timers) {
+        timers[i] = timers[n_timers];
+        sift_up(i);
+        sift_down(i);
+    }
+}
+
+static bool
+wakeUpSleepingThreads (LowResTime now)
+{
+    StgTSO *tso;
+    bool flag = false;
+
+    while (n_timers > 0 && !TIMER_BEFORE(now, timers[0].target)) {
+        tso = timers[0].tso;
+        remove_timer(0);
+        tso->why_blocked = NotBlocked;
+        tso->_link = END_TSO_QUEUE;
+        IF_DEBUG(scheduler, debugBelch("Waking up sleeping thread %lu\n",
+                                       (unsigned long)tso->id));
+        // MainCapability: this code is !THREADED_RTS
+        pushOnRunQueue(&MainCapability,tso);
+        flag = true;
+    }
+    return flag;
+}
+
+/* -----------------------------------------------------------------------------
+   The fd table
+   -------------------------------------------------------------------------- */
+
+static void
+grow_fds (int fd)
+{
+    uint32_t i, new_size;
+
+    new_size = stg_max(n_fds * 2, (uint32_t)fd + 1);
+    new_size = stg_max(new_size, 64);
+    fds = stgReallocBytes(fds, new_size * sizeof(FdWaiters), "grow_fds");
+    for (i = n_fds; i < new_size; i++) {
+        fds[i].readers = END_TSO_QUEUE;
+        fds[i].writers = END_TSO_QUEUE;
+        fds[i].registered = false;
+    }
+    n_fds = new_size;
+}
+
+static int
+get_epoll_fd (void)
+{
+    if (epoll_fd == -1) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd == -1) {
+            sysErrorBelch("epoll_create1");
+            stg_exit(EXIT_FAILURE);
+        }
+    }
+    return epoll_fd;
+}
+
+// (Re-)arm the fd for the events that its waiters need.  Returns 0 or
+// an errno value.
+static int
+arm_fd (int fd)
+{
+    struct epoll_event ev;
+    FdWaiters *w = &fds[fd];
+    int r;
+
+    ev.events = EPOLLONESHOT
+        | (w->readers != END_TSO_QUEUE ? EPOLLIN : 0)
+        | (w->writers != END_TSO_QUEUE ? EPOLLOUT : 0);
+    ev.data.u64 = 0;
+    ev.data.fd = fd;
+
+    if (w->registered) {
+        r = epoll_ctl(get_epoll_fd(), EPOLL_CTL_MOD, fd, &ev);
+        if (r == 0) return 0;
+        if (errno != ENOENT) return errno;
+        // the fd was closed since, and dropped from the epoll set
+        w->registered = false;
+    }
+
+    r = epoll_ctl(get_epoll_fd(), EPOLL_CTL_ADD, fd, &ev);
+    if (r == -1 && errno == EEXIST) {
+        // a dup() of a closed fd is still in the set
+        r = epoll_ctl(get_epoll_fd(), EPOLL_CTL_MOD, fd, &ev);
+    }
+    if (r == -1) return errno;
+    w->registered = true;
+    return 0;
+}
+
+static void
+remove_from_list (Capability *cap, StgTSO **list, StgTSO *tso)
+{
+    StgTSO *t, *prev = NULL;
+
+    for (t = *list; t != END_TSO_QUEUE; prev = t, t = t->_link) {
+        if (t == tso) {
+            if (prev == NULL) {
+                *list = t->_link;
+            } else {
+                setTSOLink(cap, prev, t->_link);
+            }
+            t->_link = END_TSO_QUEUE;
+            return;
+        }
+    }
+    barf("awaitEventRemoveThread: not found");
+}
+
+static void
+wake_list (StgTSO *tso)
+{
+    StgTSO *next;
+
+    for (; tso != END_TSO_QUEUE; tso = next) {
+        next = tso->_link;
+        IF_DEBUG(scheduler,
+                 debugBelch("Waking up blocked thread %lu\n",
+                            (unsigned long)tso->id));
+        tso->why_blocked = NotBlocked;
+        tso->_link = END_TSO_QUEUE;
+        pushOnRunQueue(&MainCapability,tso);
+        n_io_waiters--;
+    }
+}
+
+// Used when re-arming an fd fails
+static void
+move_to_unpollable (StgTSO **list)
+{
+    StgTSO *tso, *next;
+
+    for (tso = *list; tso != END_TSO_QUEUE; tso = next) {
+        next = tso->_link;
+        setTSOLink(&MainCapability, tso, unpollable);
+        unpollable = tso;
+        n_io_waiters--;
+    }
+    *list = END_TSO_QUEUE;
+}
+
+// Threads blocked on fds that epoll can't watch: regular files are
+// always ready, invalid fds raise blockedOnBadFD.
+static void
+wake_unpollable (void)
+{
+    StgTSO *tso, *next;
+    int fd;
+
+    for (tso = unpollable; tso != END_TSO_QUEUE; tso = next) {
+        next = tso->_link;
+        tso->_link = END_TSO_QUEUE;
+        fd = tso->block_info.fd;
+        if (fd < 0 || (fcntl(fd, F_GETFD) == -1 && errno == EBADF)) {
+            IF_DEBUG(scheduler,
+                debugBelch("Killing blocked thread %lu on bad fd=%i\n",
+                           (unsigned long)tso->id, fd));
+            raiseAsync(&MainCapability, tso,
+                       (StgClosure *)blockedOnBadFD_closure, false, NULL);
+        } else {
+            tso->why_blocked = NotBlocked;
+            pushOnRunQueue(&MainCapability,tso);
+        }
+    }
+    unpollable = END_TSO_QUEUE;
+}
+
+/* -----------------------------------------------------------------------------
+   The awaitEvent() interface
+   -------------------------------------------------------------------------- */
+
+void
+awaitEventBlockThread (Capability *cap, StgTSO *tso)
+{
+    int fd;
+    StgTSO **list;
+
+    switch (tso->why_blocked) {
+    case BlockedOnRead:
+    case BlockedOnWrite:
+        fd = tso->block_info.fd;
+        if (fd < 0) {
+            setTSOLink(cap, tso, unpollable);
+            unpollable = tso;
+            return;
+        }
+        if ((uint32_t)fd >= n_fds) {
+            grow_fds(fd);
+        }
+        list = tso->why_blocked == BlockedOnRead
+            ? &fds[fd].readers : &fds[fd].writers;
+        setTSOLink(cap, tso, *list);
+        *list = tso;
+        n_io_waiters++;
+
+        if (arm_fd(fd) != 0) {
+            // EPERM (e.g. a regular file), EBADF, ...
+            remove_from_list(cap, list, tso);
+            n_io_waiters--;
+            setTSOLink(cap, tso, unpollable);
+            unpollable = tso;
+        }
+        return;
+
+    case BlockedOnDelay:
+        insert_timer(tso);
+        return;
+
+    default:
+        barf("awaitEventBlockThread: %d", tso->why_blocked);
+    }
+}
+
+void
+awaitEventRemoveThread (Capability *cap, StgTSO *tso)
+{
+    uint32_t i;
+    int fd;
+
+    switch (tso->why_blocked) {
+    case BlockedOnRead:
+    case BlockedOnWrite:
+        fd = tso->block_info.fd;
+        // it may be on the unpollable list
+        for (StgTSO *t = unpollable; t != END_TSO_QUEUE; t = t->_link) {
+            if (t == tso) {
+                remove_from_list(cap, &unpollable, tso);
+                return;
+            }
+        }
+        ASSERT(fd >= 0 && (uint32_t)fd < n_fds);
+        // The fd stays armed, see Note [epoll backend]
+        remove_from_list(cap, tso->why_blocked == BlockedOnRead
+                              ? &fds[fd].readers : &fds[fd].writers, tso);
+        n_io_waiters--;
+        return;
+
+    case BlockedOnDelay:
+        for (i = 0; i < n_timers; i++) {
+            if (timers[i].tso == tso) {
+                remove_timer(i);
+                return;
+            }
+        }
+        barf("awaitEventRemoveThread: sleeping thread not found");
+
+    default:
+        barf("awaitEventRemoveThread: %d", tso->why_blocked);
+    }
+}
+
+bool
+awaitEventPending (void)
+{
+    return n_io_waiters > 0 || n_timers > 0 || unpollable != END_TSO_QUEUE;
+}
+
+void
+markAwaitEvent (evac_fn evac, void *user)
+{
+    uint32_t i;
+
+    for (i = 0; i < n_fds; i++) {
+        evac(user, (StgClosure **)(void *)&fds[i].readers);
+        evac(user, (StgClosure **)(void *)&fds[i].writers);
+    }
+    for (i = 0; i < n_timers; i++) {
+        evac(user, (StgClosure **)(void *)&timers[i].tso);
+    }
+    evac(user, (StgClosure **)(void *)&unpollable);
+}
+
+void
+initAwaitEvent (void)
+{
+    unpollable = END_TSO_QUEUE;
+}
+
+// Also used in the child of forkProcess(), which must not share the
+// parent's epoll instance.
+void
+exitAwaitEvent (void)
+{
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+    stgFree(fds);
+    fds = NULL;
+    n_fds = 0;
+    n_io_waiters = 0;
+    stgFree(timers);
+    timers = NULL;
+    n_timers = 0;
+    max_timers = 0;
+    unpollable = END_TSO_QUEUE;
+}
+
+void
+awaitEvent (bool wait)
+{
+    struct epoll_event events[MAX_EVENTS];
+    int n, i, fd, timeout;
+    uint32_t ev;
+    LowResTime now;
+
+    IF_DEBUG(scheduler,
+             debugBelch("scheduler: checking for threads blocked on I/O");
+             if (wait) {
+                 debugBelch(" (waiting)");
+             }
+             debugBelch("\n");
+             );
+
+    /* loop until we've woken up some threads.  This loop is needed
+     * because the epoll_wait timing isn't accurate, we sometimes sleep
+     * for a while but not long enough to wake up a thread in
+     * a threadDelay.
+     */
+    do {
+
+      now = getLowResTimeOfDay();
+      if (wakeUpSleepingThreads(now)) {
+          return;
+      }
+
+      if (unpollable != END_TSO_QUEUE) {
+          wake_unpollable();
+          return;
+      }
+
+      if (!wait) {
+          timeout = 0;
+      } else if (n_timers > 0) {
+          Time min = LowResTimeToTime(timers[0].target - now);
+          // round up, we never want to wake up too early
+          StgWord64 ms = (TimeToUS(min) + 999) / 1000;
+          timeout = ms > INT_MAX ? INT_MAX : (int)ms;
+      } else {
+          timeout = -1;
+      }
+
+      while ((n = epoll_wait(get_epoll_fd(), events, MAX_EVENTS,
+                             timeout)) < 0) {
+          if (errno != EINTR) {
+              sysErrorBelch("epoll_wait");
+              stg_exit(EXIT_FAILURE);
+          }
+
+          /* We got a signal; could be one of ours.  If so, we need
+           * to start up the signal handler straight away, otherwise
+           * we could block for a long time before the signal is
+           * serviced.
+           */
+#if defined(RTS_USER_SIGNALS)
+          if (RtsFlags.MiscFlags.install_signal_handlers && signals_pending()) {
+              startSignalHandlers(&MainCapability);
+              return; /* still hold the lock */
+          }
+#endif
+
+          /* we were interrupted, return to the scheduler immediately.
+           */
+          if (sched_state >= SCHED_INTERRUPTING) {
+              return; /* still hold the lock */
+          }
+
+          /* check for threads that need waking up
+           */
+          wakeUpSleepingThreads(getLowResTimeOfDay());
+
+          /* If new runnable threads have arrived, stop waiting for
+           * I/O and run them.
+           */
+          if (!emptyRunQueue(&MainCapability)) {
+              return; /* still hold the lock */
+          }
+      }
+
+      for (i = 0; i < n; i++) {
+          fd = events[i].data.fd;
+          ev = events[i].events;
+          ASSERT(fd >= 0 && (uint32_t)fd < n_fds);
+
+          // An error or hangup wakes up everybody; they will find out
+          // what happened when they retry the operation.
+          if (ev & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+              wake_list(fds[fd].readers);
+              fds[fd].readers = END_TSO_QUEUE;
+          }
+          if (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+              wake_list(fds[fd].writers);
+              fds[fd].writers = END_TSO_QUEUE;
+          }
+          // The event disarmed the fd; re-arm it for anyone still waiting
+          if (fds[fd].readers != END_TSO_QUEUE ||
+              fds[fd].writers != END_TSO_QUEUE) {
+              if (arm_fd(fd) != 0) {
+                  move_to_unpollable(&fds[fd].readers);
+                  move_to_unpollable(&fds[fd].writers);
+              }
+          }
+      }
+
+    } while (wait && sched_state == SCHED_RUNNING
+             && emptyRunQueue(&MainCapability));
+}
+
+#endif /* !THREADED_RTS && AWAIT_EVENT_EPOLL */
@@ -326,6 +326,35 @@ void osBindMBlocksToNode(
 }
 
 
+bool osAdviseHugePages(void *addr STG_UNUSED, W_ size STG_UNUSED)
+{
+#if defined(MADV_HUGEPAGE)
+    return madvise(addr, size, MADV_HUGEPAGE) == 0;
+#else
+    return false;
+#endif
+}
+
+bool osMapFile(void *at, W_ size, int fd, StgWord64 offset)
+{
+    void *ret;
+
+    ret = mmap(at, size, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_PRIVATE,
+               fd, (off_t)offset);
+    if (ret != MAP_FAILED) {
+        return true;
+    }
+
+    // A failed MAP_FIXED mmap() may have unmapped what was there
+    // before, so commit the memory again.
+    ret = mmap(at, size, PROT_READ | PROT_WRITE,
+               MAP_FIXED | MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (ret == MAP_FAILED) {
+        barf("osMapFile: can't restore memory at %p", at);
+    }
+    return false;
+}
+
 void osFreeMBlocks(void *addr, uint32_t n)
 {
     munmap(addr, n * MBLOCK_SIZE);
@@ -524,6 +553,35 @@ void osCommitMemory(void *at, W_ size)
     my_mmap(at, size, MEM_COMMIT);
 }
 
+bool osCommitHugeMemory(void *at STG_UNUSED, W_ size STG_UNUSED)
+{
+#if defined(MAP_HUGETLB)
+    void *ret;
+
+    ASSERT(((W_)at & (HUGE_PAGE_SIZE-1)) == 0);
+    ASSERT((size & (HUGE_PAGE_SIZE-1)) == 0);
+
+    // Without MAP_NORESERVE, the kernel reserves the huge pages now,
+    // so we find out here rather than with a SIGBUS later if there
+    // aren't enough of them.
+    ret = mmap(at, size, PROT_READ | PROT_WRITE,
+               MAP_FIXED | MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+    if (ret != MAP_FAILED) {
+        return true;
+    }
+
+    // A failed MAP_FIXED mmap() may have unmapped what was there
+    // before, so reserve the address space again.
+    ret = mmap(at, size, PROT_NONE,
+               MAP_FIXED | MAP_NORESERVE | MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (ret == MAP_FAILED) {
+        barf("osCommitHugeMemory: unable to reserve address space: %s",
+             strerror(errno));
+    }
+#endif
+    return false;
+}
+
 void osDecommitMemory(void *at, W_ size)
 {
     int r;
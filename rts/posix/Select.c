@@ -7,6 +7,10 @@
  * all, instead we use the IO manager thread implemented in Haskell in
  * the base package.
  *
+ * This is the portable backend of awaitEvent().  On Linux the epoll()
+ * backend in posix/Epoll.c is used instead, and only the LowResTime
+ * functions here are shared.
+ *
  * ---------------------------------------------------------------------------*/
 
 #include "PosixSource.h"
@@ -18,6 +22,7 @@
 #include "RaiseAsync.h"
 #include "RtsUtils.h"
 #include "Capability.h"
+#include "Threads.h"
 #include "Select.h"
 #include "AwaitEvent.h"
 #include "Stats.h"
@@ -38,27 +43,11 @@
 
 #if !defined(THREADED_RTS)
 
-// The target time for a threadDelay is stored in a one-word quantity
-// in the TSO (tso->block_info.target).  On a 32-bit machine we
-// therefore can't afford to use nanosecond resolution because it
-// would overflow too quickly, so instead we use millisecond
-// resolution.
-
-#if SIZEOF_VOID_P == 4
-#define LowResTimeToTime(t)          (USToTime((t) * 1000))
-#define TimeToLowResTimeRoundDown(t) ((LowResTime)(TimeToUS(t) / 1000))
-#define TimeToLowResTimeRoundUp(t)   ((TimeToUS(t) + 1000-1) / 1000)
-#else
-#define LowResTimeToTime(t) (t)
-#define TimeToLowResTimeRoundDown(t) (t)
-#define TimeToLowResTimeRoundUp(t)   (t)
-#endif
-
 /*
  * Return the time since the program started, in LowResTime,
  * rounded down.
  */
-static LowResTime getLowResTimeOfDay(void)
+LowResTime getLowResTimeOfDay(void)
 {
     return TimeToLowResTimeRoundDown(getProcessElapsedTime());
 }
@@ -82,6 +71,8 @@ LowResTime getDelayTarget (HsInt us)
     }
 }
 
+#if !defined(AWAIT_EVENT_EPOLL)
+
 /* There's a clever trick here to avoid problems when the time wraps
  * around.  Since our maximum delay is smaller than 31 bits of ticks
  * (it's actually 31 bits of microseconds), we can safely check
@@ -450,4 +441,86 @@ awaitEvent(bool wait)
              && emptyRunQueue(&MainCapability));
 }
 
+/* -----------------------------------------------------------------------------
+   Blocking threads
+
+   With select() the blocked threads are kept on blocked_queue_hd (I/O)
+   and sleeping_queue (delays, sorted by target time), which are marked
+   by markScheduler().
+   -------------------------------------------------------------------------- */
+
+void
+awaitEventBlockThread (Capability *cap, StgTSO *tso)
+{
+    StgTSO *t, *prev;
+
+    switch (tso->why_blocked) {
+    case BlockedOnRead:
+    case BlockedOnWrite:
+        appendToBlockedQueue(tso);
+        break;
+
+    case BlockedOnDelay:
+        /* Insert the new thread in the sleeping queue. */
+        prev = NULL;
+        t = sleeping_queue;
+        while (t != END_TSO_QUEUE &&
+               t->block_info.target < tso->block_info.target) {
+            prev = t;
+            t = t->_link;
+        }
+
+        tso->_link = t;
+        if (prev == NULL) {
+            sleeping_queue = tso;
+        } else {
+            setTSOLink(cap, prev, tso);
+        }
+        break;
+
+    default:
+        barf("awaitEventBlockThread: %d", tso->why_blocked);
+    }
+}
+
+void
+awaitEventRemoveThread (Capability *cap, StgTSO *tso)
+{
+    switch (tso->why_blocked) {
+    case BlockedOnRead:
+    case BlockedOnWrite:
+        removeThreadFromDeQueue(cap, &blocked_queue_hd, &blocked_queue_tl, tso);
+        break;
+    case BlockedOnDelay:
+        removeThreadFromQueue(cap, &sleeping_queue, tso);
+        break;
+    default:
+        barf("awaitEventRemoveThread: %d", tso->why_blocked);
+    }
+}
+
+bool
+awaitEventPending (void)
+{
+    return !emptyQueue(blocked_queue_hd) || !emptyQueue(sleeping_queue);
+}
+
+void
+markAwaitEvent (evac_fn evac STG_UNUSED, void *user STG_UNUSED)
+{
+    // the queues are marked by markScheduler()
+}
+
+void
+initAwaitEvent (void)
+{
+}
+
+void
+exitAwaitEvent (void)
+{
+}
+
+#endif /* !AWAIT_EVENT_EPOLL */
+
 #endif /* THREADED_RTS */
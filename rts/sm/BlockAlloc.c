@@ -21,7 +21,9 @@
 #include "Storage.h"
 #include "RtsUtils.h"
 #include "BlockAlloc.h"
+#include "Capability.h"
 #include "OSMem.h"
+#include "Trace.h"
 
 #include <string.h>
 
@@ -462,6 +464,41 @@ finish:
     return bd;
 }
 
+// Set up a group of n blocks starting at the given address, as if
+// allocGroup(n) had returned it, in mblocks that we got from
+// getMBlocks() or getMBlocksAt() and that the block allocator doesn't
+// know about.  The contents of the blocks are left alone.  The caller
+// must set up groups in address order, each mblock starting with a
+// group at its first block, and must fill the mblocks exactly, so that
+// freeing the groups gives back whole mblocks.  A group of
+// BLOCKS_PER_MBLOCK or more blocks is a megablock group.  Used to map a
+// compact region file, see Note [Compact region files] in CNF.c.
+bdescr *
+allocGroupAt (void *start, W_ n)
+{
+    bdescr *bd;
+    void *mblock = MBLOCK_ROUND_DOWN(start);
+
+    ASSERT(n > 0);
+    if (start == FIRST_BLOCK(mblock)) {
+        initMBlock(mblock, 0);
+    }
+
+    bd = Bdescr(start);
+    ASSERT(bd->start == start);
+    if (n >= BLOCKS_PER_MBLOCK) {
+        ASSERT(start == FIRST_BLOCK(mblock));
+        ASSERT(n == MBLOCK_GROUP_BLOCKS(BLOCKS_TO_MBLOCKS(n)));
+        recordAllocatedBlocks(0, BLOCKS_TO_MBLOCKS(n) * BLOCKS_PER_MBLOCK);
+    } else {
+        ASSERT(bd + n - 1 <= LAST_BDESCR(mblock));
+        recordAllocatedBlocks(0, n);
+    }
+    bd->blocks = n;
+    initGroup(bd);
+    return bd;
+}
+
 STATIC_INLINE
 uint32_t nodeWithLeastBlocks (void)
 {
@@ -582,6 +619,87 @@ allocBlockOnNode_lock(uint32_t node)
     return bd;
 }
 
+/* -----------------------------------------------------------------------------
+   Note [Capability block cache]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+   When the nursery runs out, allocate() and allocatePinned() need a
+   fresh block.  Taking sm_mutex for each of these blocks makes the
+   block allocator a point of contention with many capabilities, so
+   each Capability keeps a small cache of single free blocks
+   (cap->block_cache) that it owns and can take blocks from without a
+   lock.
+
+   When the cache is empty, allocBlockCap() refills it with a single
+   acquisition of sm_mutex: it takes a chunk of up to
+   CAP_BLOCK_CACHE_BATCH contiguous blocks from the free lists of the
+   Capability's NUMA node, which keeps the blocks node-local, and
+   splits it into single-block groups.  Preferring a small chunk
+   (allocLargeChunkOnNode) means that the refill uses up fragments of
+   the free list before splitting a larger group.
+
+   Cached blocks are allocated as far as the block allocator is
+   concerned: they are included in n_alloc_blocks, and memInventory()
+   counts them.  So that the caches don't hold on to memory that the
+   rest of the system could use, and so that their blocks can
+   coalesce with their neighbours again, the GC returns all the caches
+   to the free lists with flushCapBlockCaches().
+   -------------------------------------------------------------------------- */
+
+#define CAP_BLOCK_CACHE_BATCH 16
+
+static void
+refill_block_cache (Capability *cap)
+{
+    bdescr *bd;
+    W_ i, n;
+
+    ACQUIRE_SM_LOCK;
+    bd = allocLargeChunkOnNode(cap->node, 1, CAP_BLOCK_CACHE_BATCH);
+    RELEASE_SM_LOCK;
+
+    // split the chunk into single-block groups
+    n = bd->blocks;
+    for (i = 0; i < n; i++) {
+        bd[i].blocks = 1;
+        bd[i].free   = bd[i].start;
+        bd[i].link   = i + 1 < n ? &bd[i+1] : cap->block_cache;
+    }
+    cap->block_cache = bd;
+    cap->n_block_cache += n;
+}
+
+// Allocate a single block from the cache of the given Capability,
+// which must be owned by the caller.  Doesn't need sm_mutex.
+bdescr *
+allocBlockCap (Capability *cap)
+{
+    bdescr *bd;
+
+    if (cap->block_cache == NULL) {
+        refill_block_cache(cap);
+    }
+    bd = cap->block_cache;
+    cap->block_cache = bd->link;
+    cap->n_block_cache--;
+    bd->link = NULL;
+    return bd;
+}
+
+// Return the blocks cached by every Capability to the free lists.
+// Called by the GC with sm_mutex held.
+void
+flushCapBlockCaches (void)
+{
+    uint32_t i;
+
+    for (i = 0; i < n_capabilities; i++) {
+        freeChain(capabilities[i]->block_cache);
+        capabilities[i]->block_cache = NULL;
+        capabilities[i]->n_block_cache = 0;
+    }
+}
+
 /* -----------------------------------------------------------------------------
    De-Allocation
    -------------------------------------------------------------------------- */
@@ -805,34 +923,62 @@ countAllocdBlocks(bdescr *bd)
     return n;
 }
 
+// Return up to n free megablocks of the given node to the OS, and
+// the number of megablocks that we couldn't return.
+static uint32_t
+return_node_memory_to_os (uint32_t node, uint32_t n /* megablocks */)
+{
+    bdescr *bd;
+    StgWord size;
+
+    bd = free_mblock_list[node];
+    while ((n > 0) && (bd != NULL)) {
+        size = BLOCKS_TO_MBLOCKS(bd->blocks);
+        if (size > n) {
+            StgWord newSize = size - n;
+            char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
+            freeAddr += newSize * MBLOCK_SIZE;
+            bd->blocks = MBLOCK_GROUP_BLOCKS(newSize);
+            freeMBlocks(freeAddr, n);
+            n = 0;
+        }
+        else {
+            char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
+            n -= size;
+            bd = bd->link;
+            freeMBlocks(freeAddr, size);
+        }
+    }
+    free_mblock_list[node] = bd;
+    return n;
+}
+
 void returnMemoryToOS(uint32_t n /* megablocks */)
 {
     bdescr *bd;
     uint32_t node;
-    StgWord size;
+    W_ free_mblocks[MAX_NUMA_NODES];
+    W_ quota[MAX_NUMA_NODES];
+    uint32_t left = 0;
 
-    // ToDo: not fair, we free all the memory starting with node 0.
-    for (node = 0; n > 0 && node < n_numa_nodes; node++) {
-        bd = free_mblock_list[node];
-        while ((n > 0) && (bd != NULL)) {
-            size = BLOCKS_TO_MBLOCKS(bd->blocks);
-            if (size > n) {
-                StgWord newSize = size - n;
-                char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
-                freeAddr += newSize * MBLOCK_SIZE;
-                bd->blocks = MBLOCK_GROUP_BLOCKS(newSize);
-                freeMBlocks(freeAddr, n);
-                n = 0;
-            }
-            else {
-                char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
-                n -= size;
-                bd = bd->link;
-                freeMBlocks(freeAddr, size);
-            }
+    // Decide how much each node gives back, see decommitQuota()
+    for (node = 0; node < n_numa_nodes; node++) {
+        free_mblocks[node] = 0;
+        for (bd = free_mblock_list[node]; bd != NULL; bd = bd->link) {
+            free_mblocks[node] += BLOCKS_TO_MBLOCKS(bd->blocks);
+        }
+    }
+    decommitQuota(n, n_numa_nodes, free_mblocks, quota);
+
+    for (node = 0; node < n_numa_nodes; node++) {
+        if (quota[node] > 0) {
+            left += return_node_memory_to_os(node, quota[node]);
+            debugTrace(DEBUG_gc, "returned %" FMT_Word " megablock(s) "
+                       "of node %d to the OS", quota[node], node);
         }
-        free_mblock_list[node] = bd;
+        n -= quota[node];
     }
+    n += left;
 
     // Ask the OS to release any address space portion
     // that was associated with the just released MBlocks
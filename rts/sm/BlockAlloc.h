@@ -12,6 +12,20 @@
 
 bdescr *allocLargeChunk (W_ min, W_ max);
 bdescr *allocLargeChunkOnNode (uint32_t node, W_ min, W_ max);
+bdescr *allocGroupAt (void *start, W_ n);
+
+/* Per-Capability block cache ---------------------------------------------- */
+
+bdescr *allocBlockCap       (Capability *cap);
+void    flushCapBlockCaches (void);
+
+/* MBlock.c ----------------------------------------------------------------- */
+
+void decommitQuota (uint32_t n, uint32_t n_nodes,
+                    const W_ free_mblocks[], W_ quota[]);
+
+extern W_ huge_page_mblocks;          // see Note [Huge pages] in MBlock.c
+extern W_ huge_page_fallback_mblocks;
 
 /* Debugging  -------------------------------------------------------------- */
 
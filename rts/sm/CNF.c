@@ -23,8 +23,14 @@
 #include "BlockAlloc.h"
 #include "Trace.h"
 #include "sm/ShouldCompact.h"
+#include "sm/OSMem.h"
+#include "WSDeque.h"
 
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #if defined(HAVE_UNISTD_H)
 #include <unistd.h>
@@ -235,7 +241,11 @@ compactAllocateBlockInternal(Capability            *cap,
     }
     RELEASE_SM_LOCK;
 
-    cap->total_allocated += aligned_size / sizeof(StgWord);
+    // cap is NULL in the threads of a parallel compaction, which count
+    // their allocation when they're done (see compactAddParallel())
+    if (cap != NULL) {
+        cap->total_allocated += aligned_size / sizeof(StgWord);
+    }
 
     self = (StgCompactNFDataBlock*) block->start;
     self->self = self;
@@ -771,6 +781,548 @@ void verifyCompact (StgCompactNFData *str USED_IF_DEBUG)
 }
 #endif // DEBUG
 
+/* -----------------------------------------------------------------------------
+   Parallel compaction
+   -------------------------------------------------------------------------- */
+
+/*
+  Note [Parallel compaction]
+  ~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+  compactAddParallel() copies a data structure into a compact region with
+  several OS threads, much as the parallel GC would copy it.  It is called
+  by an unsafe foreign call (from GHC.Compact.compactAddParallel), so there
+  can be no GC until it returns and the objects that we copy stay where
+  they are.  The other capabilities carry on running Haskell code
+  meanwhile, but if one of them needs to GC it has to wait for us.
+
+  Unlike stg_compactAddWorkerzh, we can't evaluate thunks.  If we find
+  one, or a thunk that is being evaluated, or anything else that can't go
+  in a compact, we give up and free the blocks we have copied into; the
+  caller then falls back to compactAddWithSharing#, which evaluates the
+  thunks and reports errors in the usual way.  So compactAddParallel is
+  for data that is already fully evaluated, e.g. because it was just
+  deepseq'd.  The thunks that have been evaluated are indirections by now,
+  which we follow.
+
+  Each thread copies objects into compact blocks of its own, which it
+  gets with compactAllocateBlockInternal() and chains together; we append
+  the chains to the compact when all the threads have finished.  The work
+  to do is the pointer fields of the objects copied so far, which still
+  point to the originals.  Each thread keeps the fields that it has to
+  fill in on a WSDeque (and on an overflow stack of its own when that is
+  full), and threads that run out of work steal from the others.  We're
+  done when no thread has any work left, which we detect by counting the
+  busy threads, as in scavenge_until_all_done().
+
+  Sharing is always preserved, with a forwarding table from the objects
+  to their copies.  It is split into PAR_COMPACT_STRIPES hash tables, each
+  with its own lock.  The thread that adds an object to the table
+  reserves the space for its copy while it holds the lock, so that other
+  threads can use the address of the copy straight away, and then fills
+  in the copy.
+*/
+
+#define PAR_COMPACT_STRIPES 256
+#define PAR_COMPACT_DEQUE_SIZE 4096
+
+// the forwarding table for one stripe of addresses
+typedef struct {
+#if defined(THREADED_RTS)
+    Mutex lock;
+#endif
+    HashTable *table;
+} ParCompactStripe;
+
+typedef struct ParCompact_ ParCompact;
+
+typedef struct {
+    ParCompact *pc;
+    WSDeque *deque;              // fields to fill in, which can be stolen
+
+    StgClosure ***overflow;      // more fields, when the deque is full
+    StgWord n_overflow;
+    StgWord overflow_size;
+
+    StgCompactNFDataBlock *first, *last; // the blocks we have copied into
+    StgCompactNFDataBlock *nursery;      // the block we're copying into
+    StgPtr hp, hpLim;                    // the free space in nursery
+    StgWord totalW;                      // the size of our blocks
+} ParCompactThread;
+
+struct ParCompact_ {
+    StgCompactNFData *str;
+    uint32_t n_threads;
+    ParCompactThread *threads;
+    ParCompactStripe stripes[PAR_COMPACT_STRIPES];
+
+    StgWord busy;                // threads that may have work
+    StgWord failed;              // we found something we can't copy
+
+#if defined(THREADED_RTS)
+    Mutex lock;
+    Condition done;
+    uint32_t running;            // threads we started that haven't finished
+#endif
+};
+
+STATIC_INLINE ParCompactStripe *
+par_stripe (ParCompact *pc, StgClosure *p)
+{
+    StgWord w = (StgWord)p >> 3;
+    return &pc->stripes[(w ^ (w >> 8)) & (PAR_COMPACT_STRIPES - 1)];
+}
+
+// Allocate space for a copy, as allocateForCompact() does, but in the
+// thread's own blocks.
+static StgPtr
+par_allocate (ParCompactThread *t, StgWord sizeW)
+{
+    StgCompactNFData *str = t->pc->str;
+    StgCompactNFDataBlock *block;
+    StgWord size;
+    StgPtr to;
+    bdescr *bd;
+    bool large;
+
+    if (t->hp + sizeW <= t->hpLim) {
+        to = t->hp;
+        t->hp += sizeW;
+        return to;
+    }
+
+    // a large object gets a block of its own, otherwise we start a new
+    // nursery block
+    size = BLOCK_ROUND_UP(sizeW * sizeof(W_) + sizeof(StgCompactNFDataBlock));
+    large = sizeW > LARGE_OBJECT_THRESHOLD/sizeof(W_);
+    if (!large) {
+        size = stg_max(str->autoBlockW * sizeof(W_), size);
+    }
+
+    block = compactAllocateBlockInternal(NULL, size, compactGetFirstBlock(str),
+                                         ALLOCATE_APPEND);
+    block->owner = str;
+    block->next = NULL;
+    if (t->last == NULL) {
+        t->first = block;
+    } else {
+        t->last->next = block;
+    }
+    t->last = block;
+
+    bd = Bdescr((P_)block);
+    t->totalW += bd->blocks * BLOCK_SIZE_W;
+    to = (StgPtr)((W_)block + sizeof(StgCompactNFDataBlock));
+    bd->free = to + sizeW;
+
+    if (!large) {
+        if (t->nursery != NULL) {
+            Bdescr((P_)t->nursery)->free = t->hp;
+        }
+        t->nursery = block;
+        t->hp = bd->free;
+        t->hpLim = bd->start + bd->blocks * BLOCK_SIZE_W;
+    }
+    return to;
+}
+
+static void
+par_push (ParCompactThread *t, StgClosure **field)
+{
+    if (pushWSDeque(t->deque, field)) {
+        return;
+    }
+    if (t->n_overflow == t->overflow_size) {
+        t->overflow_size = stg_max(2 * t->overflow_size,
+                                   PAR_COMPACT_DEQUE_SIZE);
+        t->overflow = stgReallocBytes(t->overflow,
+                                      t->overflow_size * sizeof(StgClosure**),
+                                      "par_push");
+    }
+    t->overflow[t->n_overflow++] = field;
+}
+
+static StgClosure **
+par_pop (ParCompactThread *t)
+{
+    StgClosure **field;
+
+    field = popWSDeque(t->deque);
+    if (field == NULL && t->n_overflow > 0) {
+        field = t->overflow[--t->n_overflow];
+        // move what we can of the rest where other threads can steal it
+        while (t->n_overflow > 0 &&
+               pushWSDeque(t->deque, t->overflow[t->n_overflow - 1])) {
+            t->n_overflow--;
+        }
+    }
+    return field;
+}
+
+// Returns the copy of the object that q points to, copying the object if
+// no thread has done so yet, or NULL if the object can't be compacted
+// here.  Pushes the pointer fields of the copy, if we make one.
+static StgClosure *
+par_evacuate (ParCompactThread *t, StgClosure *q)
+{
+    ParCompact *pc = t->pc;
+    ParCompactStripe *stripe;
+    const StgInfoTable *info;
+    StgClosure *p, *to;
+    StgWord tag, sizeW, ptrs, i;
+    StgPtr fields;
+
+    tag = GET_CLOSURE_TAG(q);
+    p = UNTAG_CLOSURE(q);
+
+loop:
+    info = get_itbl(p);
+    switch (info->type) {
+
+    case IND:
+    case IND_STATIC:
+        q = ((StgInd*)p)->indirectee;
+        tag = GET_CLOSURE_TAG(q);
+        p = UNTAG_CLOSURE(q);
+        goto loop;
+
+    case BLACKHOLE:
+    {
+        // An evaluated thunk, unless it's still being evaluated (in
+        // which case the indirectee is the owner or a blocking queue)
+        const StgInfoTable *r;
+
+        load_load_barrier();
+        q = ((StgInd*)p)->indirectee;
+        if (GET_CLOSURE_TAG(q) == 0) {
+            r = q->header.info;
+            if (r == &stg_TSO_info ||
+                r == &stg_WHITEHOLE_info ||
+                r == &stg_BLOCKING_QUEUE_CLEAN_info ||
+                r == &stg_BLOCKING_QUEUE_DIRTY_info) {
+                return NULL;
+            }
+        }
+        tag = GET_CLOSURE_TAG(q);
+        p = UNTAG_CLOSURE(q);
+        goto loop;
+    }
+
+    // these might be static closures that we can avoid copying if they
+    // don't refer to CAFs, as in stg_compactAddWorkerzh
+    case CONSTR_0_1:
+    case CONSTR_0_2:
+    case CONSTR_NOCAF:
+        switch (shouldCompact(pc->str, p)) {
+        case SHOULDCOMPACT_IN_CNF:
+        case SHOULDCOMPACT_STATIC:
+            return TAG_CLOSURE(tag, p);
+        }
+        break;
+
+    case CONSTR:
+    case CONSTR_1_0:
+    case CONSTR_2_0:
+    case CONSTR_1_1:
+    case MUT_ARR_PTRS_FROZEN:
+    case MUT_ARR_PTRS_FROZEN0:
+    case SMALL_MUT_ARR_PTRS_FROZEN:
+    case SMALL_MUT_ARR_PTRS_FROZEN0:
+        if (shouldCompact(pc->str, p) == SHOULDCOMPACT_IN_CNF) {
+            return TAG_CLOSURE(tag, p);
+        }
+        break;
+
+    case ARR_WORDS:
+        switch (shouldCompact(pc->str, p)) {
+        case SHOULDCOMPACT_IN_CNF:
+            return TAG_CLOSURE(tag, p);
+        case SHOULDCOMPACT_PINNED:
+            return NULL;
+        }
+        break;
+
+    default:
+        // thunks, functions and mutable objects
+        return NULL;
+    }
+
+    sizeW = closure_sizeW_(p, info);
+
+    stripe = par_stripe(pc, p);
+    ACQUIRE_LOCK(&stripe->lock);
+    to = lookupHashTable(stripe->table, (StgWord)p);
+    if (to != NULL) {
+        RELEASE_LOCK(&stripe->lock);
+        return TAG_CLOSURE(tag, to);
+    }
+    to = (StgClosure*)par_allocate(t, sizeW);
+    insertHashTable(stripe->table, (StgWord)p, to);
+    RELEASE_LOCK(&stripe->lock);
+
+    memcpy(to, p, sizeW * sizeof(W_));
+
+    switch (info->type) {
+    case MUT_ARR_PTRS_FROZEN:
+    case MUT_ARR_PTRS_FROZEN0:
+        fields = (StgPtr)((StgMutArrPtrs*)to)->payload;
+        ptrs = ((StgMutArrPtrs*)to)->ptrs;
+        break;
+    case SMALL_MUT_ARR_PTRS_FROZEN:
+    case SMALL_MUT_ARR_PTRS_FROZEN0:
+        fields = (StgPtr)((StgSmallMutArrPtrs*)to)->payload;
+        ptrs = ((StgSmallMutArrPtrs*)to)->ptrs;
+        break;
+    case ARR_WORDS:
+        fields = NULL;
+        ptrs = 0;
+        break;
+    default:
+        fields = (StgPtr)to->payload;
+        ptrs = info->layout.payload.ptrs;
+        break;
+    }
+    for (i = 0; i < ptrs; i++) {
+        par_push(t, (StgClosure **)&fields[i]);
+    }
+
+    return TAG_CLOSURE(tag, to);
+}
+
+static void
+par_compact_field (ParCompactThread *t, StgClosure **field)
+{
+    StgClosure *to;
+
+    to = par_evacuate(t, *field);
+    if (to == NULL) {
+        RELAXED_STORE(&t->pc->failed, 1);
+        return;
+    }
+    *field = to;
+}
+
+static bool
+par_any_work (ParCompact *pc)
+{
+    uint32_t i;
+
+    for (i = 0; i < pc->n_threads; i++) {
+        if (!looksEmptyWSDeque(pc->threads[i].deque)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static StgClosure **
+par_steal (ParCompactThread *t)
+{
+    ParCompact *pc = t->pc;
+    uint32_t me, i;
+    StgClosure **field;
+
+    me = t - pc->threads;
+    for (i = 1; i < pc->n_threads; i++) {
+        field = stealWSDeque(pc->threads[(me + i) % pc->n_threads].deque);
+        if (field != NULL) {
+            return field;
+        }
+    }
+    return NULL;
+}
+
+static void
+par_compact_loop (ParCompactThread *t)
+{
+    ParCompact *pc = t->pc;
+    StgClosure **field;
+
+    for (;;) {
+        while ((field = par_pop(t)) != NULL) {
+            if (RELAXED_LOAD(&pc->failed)) return;
+            par_compact_field(t, field);
+        }
+
+        // Out of work: steal some, or finish when nobody has any left
+        atomic_dec(&pc->busy);
+        for (;;) {
+            if (RELAXED_LOAD(&pc->failed)) return;
+            if (par_any_work(pc)) {
+                atomic_inc(&pc->busy, 1);
+                field = par_steal(t);
+                if (field != NULL) {
+                    par_compact_field(t, field);
+                    break;
+                }
+                atomic_dec(&pc->busy);
+            }
+            if (ACQUIRE_LOAD(&pc->busy) == 0) return;
+#if defined(THREADED_RTS)
+            yieldThread();
+#endif
+        }
+    }
+}
+
+#if defined(THREADED_RTS)
+static void OSThreadProcAttr
+par_compact_thread (void *arg)
+{
+    ParCompactThread *t = arg;
+    ParCompact *pc = t->pc;
+
+    par_compact_loop(t);
+
+    ACQUIRE_LOCK(&pc->lock);
+    pc->running--;
+    signalCondition(&pc->done);
+    RELEASE_LOCK(&pc->lock);
+}
+#endif
+
+// Copy the object that sp points to into the compact whose first block
+// is first, with n_threads threads, preserving sharing; see Note
+// [Parallel compaction].  Returns a stable pointer to the copy, or NULL
+// if the object must be compacted with compactAddWithSharing#.  Called
+// with an unsafe foreign call, holding the lock on the compact.
+StgStablePtr
+compactAddParallel (StgCompactNFDataBlock *first, StgStablePtr sp,
+                    uint32_t n_threads)
+{
+    Capability *cap = rts_unsafeGetMyCapability();
+    StgCompactNFData *str;
+    StgCompactNFDataBlock *block, *next;
+    ParCompactThread *t;
+    ParCompact *pc;
+    StgClosure *root;
+    bdescr *bd;
+    StgWord totalW;
+    uint32_t i;
+
+    str = firstBlockGetCompact(first);
+    ASSERT(str->hash == NULL);
+
+#if defined(THREADED_RTS)
+    n_threads = stg_max(1, stg_min(n_threads, getNumberOfProcessors()));
+#else
+    n_threads = 1;
+#endif
+
+    pc = stgMallocBytes(sizeof(ParCompact), "compactAddParallel");
+    pc->str = str;
+    pc->n_threads = n_threads;
+    pc->threads = stgCallocBytes(n_threads, sizeof(ParCompactThread),
+                                 "compactAddParallel");
+    for (i = 0; i < PAR_COMPACT_STRIPES; i++) {
+#if defined(THREADED_RTS)
+        initMutex(&pc->stripes[i].lock);
+#endif
+        pc->stripes[i].table = allocHashTable();
+    }
+    for (i = 0; i < n_threads; i++) {
+        pc->threads[i].pc = pc;
+        pc->threads[i].deque = newWSDeque(PAR_COMPACT_DEQUE_SIZE);
+    }
+    pc->busy = 1;
+    pc->failed = 0;
+
+    debugTrace(DEBUG_compact, "compactAddParallel: %d threads", n_threads);
+
+    // The root is copied by this thread, which is threads[0]; the others
+    // start by stealing its fields
+    root = par_evacuate(&pc->threads[0], (StgClosure*)deRefStablePtr(sp));
+    if (root == NULL) {
+        pc->failed = 1;
+    } else {
+#if defined(THREADED_RTS)
+        OSThreadId tid;
+
+        initMutex(&pc->lock);
+        initCondition(&pc->done);
+        pc->running = 0;
+        for (i = 1; i < n_threads; i++) {
+            atomic_inc(&pc->busy, 1);
+            ACQUIRE_LOCK(&pc->lock);
+            pc->running++;
+            RELEASE_LOCK(&pc->lock);
+            if (createOSThread(&tid, "ghc_compact",
+                               (OSThreadProc*)par_compact_thread,
+                               &pc->threads[i]) != 0) {
+                // carry on with the threads we have
+                atomic_dec(&pc->busy);
+                ACQUIRE_LOCK(&pc->lock);
+                pc->running--;
+                RELEASE_LOCK(&pc->lock);
+                break;
+            }
+        }
+#endif
+
+        par_compact_loop(&pc->threads[0]);
+
+#if defined(THREADED_RTS)
+        ACQUIRE_LOCK(&pc->lock);
+        while (pc->running > 0) {
+            waitCondition(&pc->done, &pc->lock);
+        }
+        RELEASE_LOCK(&pc->lock);
+        closeCondition(&pc->done);
+        closeMutex(&pc->lock);
+#endif
+    }
+
+    // Append the threads' blocks to the compact, or free them if we
+    // failed
+    totalW = 0;
+    for (i = 0; i < n_threads; i++) {
+        t = &pc->threads[i];
+        totalW += t->totalW;
+        if (t->first == NULL) {
+            // nothing copied
+        } else if (pc->failed) {
+            ACQUIRE_SM_LOCK;
+            for (block = t->first; block != NULL; block = next) {
+                next = block->next;
+                bd = Bdescr((P_)block);
+                bd->gen->n_compact_blocks -= bd->blocks;
+                freeGroup(bd);
+            }
+            RELEASE_SM_LOCK;
+        } else {
+            if (t->nursery != NULL) {
+                Bdescr((P_)t->nursery)->free = t->hp;
+            }
+            str->last->next = t->first;
+            str->last = t->last;
+            str->totalW += t->totalW;
+        }
+        freeWSDeque(t->deque);
+        stgFree(t->overflow);
+    }
+    cap->total_allocated += totalW;
+
+    for (i = 0; i < PAR_COMPACT_STRIPES; i++) {
+        freeHashTable(pc->stripes[i].table, NULL);
+#if defined(THREADED_RTS)
+        closeMutex(&pc->stripes[i].lock);
+#endif
+    }
+    stgFree(pc->threads);
+
+    if (pc->failed) {
+        debugTrace(DEBUG_compact, "compactAddParallel: falling back");
+        stgFree(pc);
+        return NULL;
+    }
+    stgFree(pc);
+
+#if defined(DEBUG)
+    verifyCompact(str);
+#endif
+    return getStablePtr((StgPtr)root);
+}
+
 /* -----------------------------------------------------------------------------
    Fixing up pointers
    -------------------------------------------------------------------------- */
@@ -896,40 +1448,26 @@ fixup_one_pointer(StgWord *fixup_table, uint32_t count, StgClosure **p)
     return true;
 }
 
-static bool
-fixup_mut_arr_ptrs (StgWord          *fixup_table,
-                    uint32_t               count,
-                    StgMutArrPtrs    *a)
-{
-    StgPtr p, q;
+// Calls fix on each pointer field of the objects in [start, end), the
+// contents of a compact block (or of a copy of one), stopping at the
+// first that it fails on.  Returns false if fix failed, or if there was
+// an object that can't be in a compact.
+typedef bool (*FixupPointerFn)(void *env, StgClosure **p);
 
-    p = (StgPtr)&a->payload[0];
-    q = (StgPtr)&a->payload[a->ptrs];
-    for (; p < q; p++) {
-        if (!fixup_one_pointer(fixup_table, count, (StgClosure**)p))
-            return false;
-    }
-
-    return true;
-}
-
-static bool
-fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
+STATIC_INLINE bool
+walk_block(StgPtr start, StgPtr end, FixupPointerFn fix, void *env)
 {
     const StgInfoTable *info;
-    bdescr *bd;
     StgPtr p;
 
-    bd = Bdescr((P_)block);
-    p = bd->start + sizeofW(StgCompactNFDataBlock);
-    while (p < bd->free) {
+    p = start + sizeofW(StgCompactNFDataBlock);
+    while (p < end) {
         ASSERT(LOOKS_LIKE_CLOSURE_PTR(p));
         info = get_itbl((StgClosure*)p);
 
         switch (info->type) {
         case CONSTR_1_0:
-            if (!fixup_one_pointer(fixup_table, count,
-                                   &((StgClosure*)p)->payload[0]))
+            if (!fix(env, &((StgClosure*)p)->payload[0]))
                 return false;
             /* fallthrough */
         case CONSTR_0_1:
@@ -937,13 +1475,11 @@ fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
             break;
 
         case CONSTR_2_0:
-            if (!fixup_one_pointer(fixup_table, count,
-                                   &((StgClosure*)p)->payload[1]))
+            if (!fix(env, &((StgClosure*)p)->payload[1]))
                 return false;
             /* fallthrough */
         case CONSTR_1_1:
-            if (!fixup_one_pointer(fixup_table, count,
-                                   &((StgClosure*)p)->payload[0]))
+            if (!fix(env, &((StgClosure*)p)->payload[0]))
                 return false;
             /* fallthrough */
         case CONSTR_0_2:
@@ -954,11 +1490,11 @@ fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
         case PRIM:
         case CONSTR_NOCAF:
         {
-            StgPtr end;
+            StgPtr q;
 
-            end = (P_)((StgClosure *)p)->payload + info->layout.payload.ptrs;
-            for (p = (P_)((StgClosure *)p)->payload; p < end; p++) {
-                if (!fixup_one_pointer(fixup_table, count, (StgClosure **)p))
+            q = (P_)((StgClosure *)p)->payload + info->layout.payload.ptrs;
+            for (p = (P_)((StgClosure *)p)->payload; p < q; p++) {
+                if (!fix(env, (StgClosure **)p))
                     return false;
             }
             p += info->layout.payload.nptrs;
@@ -971,9 +1507,18 @@ fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
 
         case MUT_ARR_PTRS_FROZEN:
         case MUT_ARR_PTRS_FROZEN0:
-            fixup_mut_arr_ptrs(fixup_table, count, (StgMutArrPtrs*)p);
-            p += mut_arr_ptrs_sizeW((StgMutArrPtrs*)p);
+        {
+            StgPtr q;
+            StgMutArrPtrs *arr = (StgMutArrPtrs*)p;
+
+            q = (StgPtr)&arr->payload[arr->ptrs];
+            for (p = (StgPtr)&arr->payload[0]; p < q; p++) {
+                if (!fix(env, (StgClosure**)p))
+                    return false;
+            }
+            p = (StgPtr)arr + mut_arr_ptrs_sizeW(arr);
             break;
+        }
 
         case SMALL_MUT_ARR_PTRS_FROZEN:
         case SMALL_MUT_ARR_PTRS_FROZEN0:
@@ -982,8 +1527,7 @@ fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
             StgSmallMutArrPtrs *arr = (StgSmallMutArrPtrs*)p;
 
             for (i = 0; i < arr->ptrs; i++) {
-                if (!fixup_one_pointer(fixup_table, count,
-                                       &arr->payload[i]))
+                if (!fix(env, &arr->payload[i]))
                     return false;
             }
 
@@ -992,7 +1536,7 @@ fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
         }
 
         case COMPACT_NFDATA:
-            if (p == (bd->start + sizeofW(StgCompactNFDataBlock))) {
+            if (p == (start + sizeofW(StgCompactNFDataBlock))) {
                 // Ignore the COMPACT_NFDATA header
                 // (it will be fixed up later)
                 p += sizeofW(StgCompactNFData);
@@ -1011,6 +1555,29 @@ fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
     return true;
 }
 
+typedef struct {
+    StgWord *table;
+    uint32_t count;
+} FixupTable;
+
+static bool
+fixup_table_pointer(void *env, StgClosure **p)
+{
+    FixupTable *t = env;
+
+    return fixup_one_pointer(t->table, t->count, p);
+}
+
+static bool
+fixup_block(StgCompactNFDataBlock *block, StgWord *fixup_table, uint32_t count)
+{
+    FixupTable t = { fixup_table, count };
+    bdescr *bd;
+
+    bd = Bdescr((P_)block);
+    return walk_block(bd->start, bd->free, fixup_table_pointer, &t);
+}
+
 static int
 cmp_fixup_table_item (const void *e1, const void *e2)
 {
@@ -1184,3 +1751,604 @@ compactFixupPointers(StgCompactNFData *str,
 
     return (StgPtr)root;
 }
+
+/* -----------------------------------------------------------------------------
+   Compact region files
+   -------------------------------------------------------------------------- */
+
+/*
+  Note [Compact region files]
+  ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+  compactSaveFile() writes a compact region to a file that
+  compactLoadFile() can map straight into the heap, instead of copying
+  it in block by block as importCompact does.  The file holds an image
+  of the megablocks that the blocks of the compact would occupy at an
+  address chosen when the file is written (the base), after a header
+  and a table of the blocks:
+
+     CompactFileHeader
+     CompactFileBlock[n_blocks]     offset from base, size, bytes used
+     padding to COMPACT_FILE_ALIGN
+     image of n_mblocks megablocks
+
+  The image starts at a multiple of COMPACT_FILE_ALIGN, so that we can
+  map it whatever the page size.
+
+  To write the image, we pack the blocks into megablocks in chain order,
+  each block taking as many block allocator blocks as it does in memory,
+  except that the last block in each megablock is grown to fill it; a
+  block of a megablock or more gets megablocks of its own.  The pointers
+  in the objects and in the block headers are rewritten to where their
+  targets are in the image, so the image is a compact region that needs
+  no fixing up if it is loaded at the base.  The block descriptors,
+  which are in the image too, are not saved.
+
+  To load the file, we ask for the megablocks at the base with
+  getMBlocksAt().  That only works with USE_LARGE_ADDRESS_SPACE, where
+  we know which addresses are ours, so in that case the base is chosen
+  in the upper half of our address space, which the heap reaches last,
+  and at a random place in each process that writes files, so that
+  files written by different processes are unlikely to want the same
+  addresses.  If we can't have the base we take any megablocks.  Then
+  we replace the megablocks with a private mapping of the image
+  (osMapFile()), so that loading takes the same time however big the
+  compact is, and pages are only read when they are touched; if the OS
+  can't do that (or we're using explicit huge pages) we read the image.
+
+  Finally we set up the block descriptors and put the blocks on
+  g0->compact_blocks_in_import, just as if importCompact had allocated
+  and filled them, and compactFixupPointers() does the rest.  The
+  block headers say where each block was meant to be (block->self), so
+  if we didn't get the base compactFixupPointers() relocates the
+  pointers in the usual way, and otherwise it has nothing to do.
+
+  The file must not be truncated while the program runs, because pages
+  of the mapping that haven't been touched yet are read from it.  As
+  with importCompact, only the binary that wrote a file can load it:
+  the header records the address of an info table to check for that,
+  but this can't catch everything.
+*/
+
+#if !defined(O_BINARY)
+#define O_BINARY 0
+#endif
+
+#define COMPACT_FILE_MAGIC "GHCCNF01"
+#define COMPACT_FILE_ALIGN (64*1024)
+
+// read() and write() at most this many bytes at a time (a count is an
+// unsigned int on Windows)
+#define COMPACT_FILE_CHUNK (1024*1024*1024)
+
+typedef struct {
+    char      magic[8];      // COMPACT_FILE_MAGIC
+    StgWord64 info;          // &stg_COMPACT_NFDATA_CLEAN_info in the writer
+    StgWord64 word_size;
+    StgWord64 mblock_size;
+    StgWord64 base;          // the address of the image
+    StgWord64 root;          // the root closure, in the image
+    StgWord64 n_mblocks;     // the size of the image
+    StgWord64 n_blocks;      // entries in the block table
+    StgWord64 image_offset;  // of the image in the file
+} CompactFileHeader;
+
+typedef struct {
+    StgWord64 offset;        // of the block from the base
+    StgWord64 blocks;        // block allocator blocks in the block
+    StgWord64 used;          // bytes in use, including the block header
+} CompactFileBlock;
+
+static StgWord64
+compactFileImageOffset (StgWord64 n_blocks)
+{
+    StgWord64 off;
+
+    off = sizeof(CompactFileHeader) + n_blocks * sizeof(CompactFileBlock);
+    return (off + COMPACT_FILE_ALIGN - 1) & ~(StgWord64)(COMPACT_FILE_ALIGN - 1);
+}
+
+static bool
+write_fully (int fd, const void *buf, W_ size)
+{
+    const char *p = buf;
+    ssize_t r;
+
+    while (size > 0) {
+        r = write(fd, p, stg_min(size, COMPACT_FILE_CHUNK));
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += r;
+        size -= r;
+    }
+    return true;
+}
+
+// Returns false with errno set on error, or with errno == 0 at the end
+// of the file.
+static bool
+read_fully (int fd, void *buf, W_ size)
+{
+    char *p = buf;
+    ssize_t r;
+
+    while (size > 0) {
+        r = read(fd, p, stg_min(size, COMPACT_FILE_CHUNK));
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (r == 0) {
+            errno = 0;
+            return false;
+        }
+        p += r;
+        size -= r;
+    }
+    return true;
+}
+
+#if defined(USE_LARGE_ADDRESS_SPACE)
+// The end of the image of the file we wrote last, see
+// chooseFileBase().  Protected by sm_mutex.
+static W_ next_file_base = 0;
+#endif
+
+// Choose the base of a compact region file, with an image of size
+// bytes; see Note [Compact region files].  We allocate the images
+// downwards from a random point in the upper half of the address space,
+// wrapping around at the half-way mark.
+static W_
+chooseFileBase (StgCompactNFDataBlock *first STG_UNUSED, W_ size STG_UNUSED)
+{
+#if defined(USE_LARGE_ADDRESS_SPACE)
+    W_ low, high, base;
+
+    low = (W_)MBLOCK_ROUND_UP(mblock_address_space.begin +
+                  (mblock_address_space.end - mblock_address_space.begin) / 2);
+    high = (W_)MBLOCK_ROUND_DOWN(mblock_address_space.end);
+    if (high - low < size) {
+        // can't be loaded at its base, but the base doesn't matter
+        return low;
+    }
+
+    ACQUIRE_SM_LOCK;
+    if (next_file_base == 0) {
+        W_ seed = (W_)getMonotonicNSec() ^ (W_)&base;
+        seed *= (W_)0x9e3779b97f4a7c15ULL;
+        next_file_base = high -
+            ((seed >> 16) % ((high - low) / MBLOCK_SIZE)) * MBLOCK_SIZE;
+    }
+    if (next_file_base - low < size) {
+        next_file_base = high;
+    }
+    base = next_file_base - size;
+    next_file_base = base;
+    RELEASE_SM_LOCK;
+
+    return base;
+#else
+    // We can't ask for addresses, so whatever we choose we will have to
+    // relocate the compact when we load it
+    return (W_)MBLOCK_ROUND_DOWN(first);
+#endif
+}
+
+// Where a block of the compact goes in the image
+typedef struct {
+    W_ src;                  // the block
+    W_ size;                 // bytes in the block allocator group
+    W_ dst;                  // the address of the block at the base
+} ExportBlock;
+
+typedef struct {
+    ExportBlock *blocks;     // sorted by src
+    StgWord count;
+} ExportTable;
+
+static int
+cmp_export_block (const void *e1, const void *e2)
+{
+    const ExportBlock *b1 = e1;
+    const ExportBlock *b2 = e2;
+
+    return b1->src < b2->src ? -1 : b1->src > b2->src;
+}
+
+// Rewrite a pointer to its address in the image
+static bool
+export_pointer (void *env, StgClosure **p)
+{
+    ExportTable *t = env;
+    StgWord tag, a, b, c;
+    StgClosure *q;
+
+    q = *p;
+    tag = GET_CLOSURE_TAG(q);
+    q = UNTAG_CLOSURE(q);
+
+    // static constructors stay where they are, see Note [Compact Normal
+    // Forms]
+    if (!HEAP_ALLOCED(q))
+        return true;
+
+    a = 0;
+    b = t->count;
+    while (a < b-1) {
+        c = (a+b)/2;
+        if (t->blocks[c].src > (W_)q)
+            b = c;
+        else
+            a = c;
+    }
+    if (t->blocks[a].src > (W_)q ||
+        t->blocks[a].src + t->blocks[a].size <= (W_)q) {
+        return false;
+    }
+
+    q = (StgClosure*)((W_)q - t->blocks[a].src + t->blocks[a].dst);
+    *p = TAG_CLOSURE(tag, q);
+    return true;
+}
+
+// Write the image, see Note [Compact region files]
+static bool
+write_image (int fd, StgCompactNFDataBlock *first, CompactFileBlock *fblocks,
+             StgWord n_blocks, W_ base, ExportTable *t)
+{
+    StgCompactNFDataBlock *block, *hdr;
+    StgCompactNFData *str;
+    StgWord i;
+    W_ unit = 0, unit_size = 0, off;
+    char *buf = NULL;
+
+    for (i = 0, block = first; i < n_blocks; i++, block = block->next) {
+        off = fblocks[i].offset;
+
+        // start a new unit: a megablock, or the megablocks of a big block
+        if (buf == NULL || off >= unit + unit_size) {
+            if (buf != NULL) {
+                if (!write_fully(fd, buf, unit_size)) goto fail;
+                stgFree(buf);
+            }
+            unit = off - FIRST_BLOCK_OFF;
+            unit_size = fblocks[i].blocks >= BLOCKS_PER_MBLOCK
+                ? BLOCKS_TO_MBLOCKS(fblocks[i].blocks) * MBLOCK_SIZE
+                : MBLOCK_SIZE;
+            buf = stgCallocBytes(unit_size, 1, "compactSaveFile");
+        }
+
+        hdr = (StgCompactNFDataBlock*)(buf + (off - unit));
+        memcpy(hdr, block, fblocks[i].used);
+
+        hdr->self = (StgCompactNFDataBlock*)(base + off);
+        hdr->owner = (StgCompactNFData*)
+            (base + fblocks[0].offset + sizeof(StgCompactNFDataBlock));
+        hdr->next = i + 1 < n_blocks
+            ? (StgCompactNFDataBlock*)(base + fblocks[i+1].offset)
+            : NULL;
+
+        if (i == 0) {
+            // nursery, last, hp and hpLim are set by compactFixupPointers
+            str = (StgCompactNFData*)(hdr + 1);
+            SET_INFO((StgClosure*)str, &stg_COMPACT_NFDATA_CLEAN_info);
+            str->hp = NULL;
+            str->hpLim = NULL;
+            str->nursery = NULL;
+            str->last = NULL;
+            str->hash = NULL;
+            str->result = NULL;
+        }
+
+        if (!walk_block((StgPtr)hdr, (StgPtr)((W_)hdr + fblocks[i].used),
+                        export_pointer, t)) {
+            errno = EINVAL;
+            goto fail;
+        }
+    }
+
+    if (!write_fully(fd, buf, unit_size)) goto fail;
+    stgFree(buf);
+    return true;
+
+fail:
+    stgFree(buf);
+    return false;
+}
+
+// Write the compact region with the given first block and root to a
+// file at path, see Note [Compact region files].  Returns 0, or -1 with
+// errno set on error.  The caller must stop anyone adding to the
+// compact meanwhile.
+int
+compactSaveFile (StgCompactNFDataBlock *first, StgClosure *root,
+                 const char *path)
+{
+    CompactFileHeader hdr;
+    CompactFileBlock *fblocks;
+    ExportTable t;
+    StgCompactNFDataBlock *block;
+    StgClosure *image_root;
+    bdescr *bd;
+    StgWord n_blocks, i;
+    W_ n_mblocks, used, base;
+    int fd, saved_errno;
+    bool ok;
+
+    n_blocks = 0;
+    for (block = first; block != NULL; block = block->next) {
+        n_blocks++;
+    }
+
+    fblocks = stgMallocBytes(n_blocks * sizeof(CompactFileBlock),
+                             "compactSaveFile");
+    t.blocks = stgMallocBytes(n_blocks * sizeof(ExportBlock),
+                              "compactSaveFile");
+    t.count = n_blocks;
+
+    // Lay out the image.  used is the number of blocks taken in the
+    // current megablock.
+    n_mblocks = 0;
+    used = BLOCKS_PER_MBLOCK;
+    for (i = 0, block = first; i < n_blocks; i++, block = block->next) {
+        bd = Bdescr((StgPtr)block);
+        if (bd->blocks >= BLOCKS_PER_MBLOCK ||
+            used + bd->blocks > BLOCKS_PER_MBLOCK) {
+            // start a new megablock, growing the last block in the
+            // current one to fill it
+            if (used < BLOCKS_PER_MBLOCK) {
+                fblocks[i-1].blocks += BLOCKS_PER_MBLOCK - used;
+            }
+            fblocks[i].offset = n_mblocks * MBLOCK_SIZE + FIRST_BLOCK_OFF;
+            used = 0;
+        } else {
+            fblocks[i].offset = (n_mblocks - 1) * MBLOCK_SIZE
+                + FIRST_BLOCK_OFF + used * BLOCK_SIZE;
+        }
+        if (bd->blocks >= BLOCKS_PER_MBLOCK) {
+            fblocks[i].blocks =
+                MBLOCK_GROUP_BLOCKS(BLOCKS_TO_MBLOCKS(bd->blocks));
+            n_mblocks += BLOCKS_TO_MBLOCKS(bd->blocks);
+            used = BLOCKS_PER_MBLOCK;
+        } else {
+            if (used == 0) {
+                n_mblocks++;
+            }
+            fblocks[i].blocks = bd->blocks;
+            used += bd->blocks;
+        }
+        fblocks[i].used = (W_)bd->free - (W_)bd->start;
+        t.blocks[i].src = (W_)block;
+        t.blocks[i].size = bd->blocks * BLOCK_SIZE;
+    }
+    if (used < BLOCKS_PER_MBLOCK) {
+        fblocks[n_blocks-1].blocks += BLOCKS_PER_MBLOCK - used;
+    }
+
+    base = chooseFileBase(first, n_mblocks * MBLOCK_SIZE);
+    for (i = 0; i < n_blocks; i++) {
+        t.blocks[i].dst = base + fblocks[i].offset;
+    }
+    qsort(t.blocks, n_blocks, sizeof(ExportBlock), cmp_export_block);
+
+    image_root = root;
+    if (!export_pointer(&t, &image_root)) {
+        stgFree(fblocks);
+        stgFree(t.blocks);
+        errno = EINVAL;
+        return -1;
+    }
+
+    memcpy(hdr.magic, COMPACT_FILE_MAGIC, sizeof(hdr.magic));
+    hdr.info = (W_)&stg_COMPACT_NFDATA_CLEAN_info;
+    hdr.word_size = sizeof(W_);
+    hdr.mblock_size = MBLOCK_SIZE;
+    hdr.base = base;
+    hdr.root = (W_)image_root;
+    hdr.n_mblocks = n_mblocks;
+    hdr.n_blocks = n_blocks;
+    hdr.image_offset = compactFileImageOffset(n_blocks);
+
+    ok = false;
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    if (fd >= 0) {
+        W_ pad = hdr.image_offset - sizeof(hdr)
+            - n_blocks * sizeof(CompactFileBlock);
+        char *zeros = stgCallocBytes(pad > 0 ? pad : 1, 1, "compactSaveFile");
+        ok = write_fully(fd, &hdr, sizeof(hdr))
+            && write_fully(fd, fblocks, n_blocks * sizeof(CompactFileBlock))
+            && write_fully(fd, zeros, pad)
+            && write_image(fd, first, fblocks, n_blocks, base, &t);
+        stgFree(zeros);
+        saved_errno = errno;
+        if (close(fd) != 0 && ok) {
+            saved_errno = errno;
+            ok = false;
+        }
+        errno = saved_errno;
+    }
+
+    saved_errno = errno;
+    stgFree(fblocks);
+    stgFree(t.blocks);
+    errno = saved_errno;
+
+    IF_DEBUG(compact, debugBelch("Saved compact region of %" FMT_Word
+                                 " blocks to %s at %p\n",
+                                 n_blocks, path, (void*)base));
+    return ok ? 0 : -1;
+}
+
+// Check the block table against the header: the blocks must fill the
+// image exactly, in the way that allocGroupAt() needs.
+static bool
+valid_block_table (CompactFileHeader *hdr, CompactFileBlock *fblocks)
+{
+    StgWord64 i, next, m;
+    CompactFileBlock *b;
+
+    next = FIRST_BLOCK_OFF;
+    for (i = 0; i < hdr->n_blocks; i++) {
+        b = &fblocks[i];
+        if (b->offset != next || b->blocks == 0 ||
+            b->blocks > hdr->n_mblocks * (MBLOCK_SIZE / BLOCK_SIZE) ||
+            b->used < sizeof(StgCompactNFDataBlock) ||
+            b->used > b->blocks * BLOCK_SIZE) {
+            return false;
+        }
+        if (b->blocks >= BLOCKS_PER_MBLOCK) {
+            if (b->offset % MBLOCK_SIZE != FIRST_BLOCK_OFF) return false;
+            m = BLOCKS_TO_MBLOCKS(b->blocks);
+            if (m > hdr->n_mblocks || b->blocks != MBLOCK_GROUP_BLOCKS(m)) {
+                return false;
+            }
+            next = b->offset - FIRST_BLOCK_OFF + m * MBLOCK_SIZE
+                + FIRST_BLOCK_OFF;
+        } else {
+            next = b->offset + b->blocks * BLOCK_SIZE;
+            if (next % MBLOCK_SIZE == 0) {
+                next += FIRST_BLOCK_OFF;
+            } else if (next / MBLOCK_SIZE != b->offset / MBLOCK_SIZE) {
+                return false;
+            }
+        }
+    }
+
+    return fblocks[0].used >=
+               sizeof(StgCompactNFDataBlock) + sizeof(StgCompactNFData) &&
+           next == hdr->n_mblocks * MBLOCK_SIZE + FIRST_BLOCK_OFF;
+}
+
+// Load a compact region file written by compactSaveFile(), see Note
+// [Compact region files].  Returns the first block of the compact, with
+// the root in *root, ready for compactFixupPointers().  Returns NULL with
+// errno set on error, or with errno == 0 if the file is not a compact
+// region file that we can load.
+StgCompactNFDataBlock *
+compactLoadFile (const char *path, StgClosure **root)
+{
+    CompactFileHeader hdr;
+    CompactFileBlock *fblocks = NULL;
+    struct stat st;
+    StgCompactNFDataBlock *block, *first;
+    StgCompactNFData *str;
+    bdescr *bd, *head;
+    void *mem = NULL;
+    W_ size, i, n;
+    int fd, saved_errno;
+
+    fd = open(path, O_RDONLY | O_BINARY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) != 0 || !read_fully(fd, &hdr, sizeof(hdr))) {
+        goto fail;
+    }
+    // Check that this is a file we can load.  The image must all be
+    // there: touching a page of the mapping beyond the end of the file
+    // would be fatal.
+    if (memcmp(hdr.magic, COMPACT_FILE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.info != (W_)&stg_COMPACT_NFDATA_CLEAN_info ||
+        hdr.word_size != sizeof(W_) ||
+        hdr.mblock_size != MBLOCK_SIZE ||
+        hdr.base % MBLOCK_SIZE != 0 ||
+        hdr.n_mblocks == 0 || hdr.n_mblocks > HS_INT32_MAX ||
+        hdr.n_blocks == 0 ||
+        hdr.n_blocks > hdr.n_mblocks * BLOCKS_PER_MBLOCK ||
+        hdr.image_offset != compactFileImageOffset(hdr.n_blocks) ||
+        (StgWord64)st.st_size <
+            hdr.image_offset + hdr.n_mblocks * MBLOCK_SIZE) {
+        errno = 0;
+        goto fail;
+    }
+
+    fblocks = stgMallocBytes(hdr.n_blocks * sizeof(CompactFileBlock),
+                             "compactLoadFile");
+    if (!read_fully(fd, fblocks, hdr.n_blocks * sizeof(CompactFileBlock))) {
+        goto fail;
+    }
+    if (!valid_block_table(&hdr, fblocks)) {
+        errno = 0;
+        goto fail;
+    }
+
+    size = hdr.n_mblocks * MBLOCK_SIZE;
+    ACQUIRE_SM_LOCK;
+    mem = getMBlocksAt((void*)(W_)hdr.base, hdr.n_mblocks);
+    if (mem == NULL) {
+        mem = getMBlocks(hdr.n_mblocks);
+    }
+    RELEASE_SM_LOCK;
+
+    if (RtsFlags.GcFlags.hugePages == HUGE_PAGES_EXPLICIT ||
+        !osMapFile(mem, size, fd, hdr.image_offset)) {
+        if (lseek(fd, hdr.image_offset, SEEK_SET) == (off_t)-1 ||
+            !read_fully(fd, mem, size)) {
+            goto fail;
+        }
+    }
+    close(fd);
+
+    IF_DEBUG(compact, debugBelch("Loaded compact region from %s at %p "
+                                 "(saved at %p)\n", path, mem,
+                                 (void*)(W_)hdr.base));
+
+    // Set up the block headers, and the block descriptors as
+    // compactAllocateBlock() would.  The blocks keep their self
+    // pointers, which say where they were meant to be.
+    first = (StgCompactNFDataBlock*)((W_)mem + fblocks[0].offset);
+    str = (StgCompactNFData*)(first + 1);
+    SET_INFO((StgClosure*)str, &stg_COMPACT_NFDATA_CLEAN_info);
+    str->hash = NULL;
+    str->result = NULL;
+
+    ACQUIRE_SM_LOCK;
+    for (i = 0; i < hdr.n_blocks; i++) {
+        block = (StgCompactNFDataBlock*)((W_)mem + fblocks[i].offset);
+        block->self = (StgCompactNFDataBlock*)(W_)(hdr.base + fblocks[i].offset);
+        block->owner = (StgCompactNFData*)((W_)first->self +
+                                           sizeof(StgCompactNFDataBlock));
+        block->next = i + 1 < hdr.n_blocks
+            ? (StgCompactNFDataBlock*)((W_)mem + fblocks[i+1].offset)
+            : NULL;
+
+        head = allocGroupAt(block, fblocks[i].blocks);
+        initBdescr(head, g0, g0);
+        head->flags = BF_COMPACT;
+        head->free = (StgPtr)((W_)block + fblocks[i].used);
+        n = stg_min(fblocks[i].blocks, BLOCKS_PER_MBLOCK);
+        for (bd = head + 1, n--; n > 0; bd++, n--) {
+            bd->link = head;
+            bd->blocks = 0;
+            bd->flags = BF_COMPACT;
+        }
+
+        if (i == 0) {
+            dbl_link_onto(head, &g0->compact_blocks_in_import);
+        }
+        g0->n_compact_blocks_in_import += head->blocks;
+        g0->n_new_large_words += head->blocks * BLOCK_SIZE_W;
+    }
+    RELEASE_SM_LOCK;
+
+    stgFree(fblocks);
+    *root = (StgClosure*)(W_)hdr.root;
+    return first;
+
+fail:
+    saved_errno = errno;
+    if (mem != NULL) {
+        ACQUIRE_SM_LOCK;
+        freeMBlocks(mem, hdr.n_mblocks);
+        RELEASE_SM_LOCK;
+    }
+    if (fblocks != NULL) {
+        stgFree(fblocks);
+    }
+    close(fd);
+    errno = saved_errno;
+    return NULL;
+}
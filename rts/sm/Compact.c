@@ -26,6 +26,7 @@
 #include "Weak.h"
 #include "MarkWeak.h"
 #include "Stable.h"
+#include "Sanity.h"
 
 // Turn off inlining when debugging - it obfuscates things
 #if defined(DEBUG)
@@ -69,6 +70,32 @@
    if we throw away some of the tags).
    ------------------------------------------------------------------------- */
 
+#if defined(THREADED_RTS)
+// true while several GC threads are threading pointers at the same
+// time; see Note [Parallel compaction]
+static bool compact_par = false;
+
+// Add p to the chain of q, when another thread may be doing the same.
+// The field is written before it is linked in, so that a thread
+// walking the chain (get_threaded_info()) never sees it half-done.
+static void
+thread_par (StgClosure **p, StgPtr q, StgClosure *q0)
+{
+    StgWord iptr, new;
+
+    do {
+        iptr = VOLATILE_LOAD(q);
+        if (GET_CLOSURE_TAG((StgClosure *)iptr) == 0) {
+            *p = (StgClosure *)((StgWord)iptr + GET_CLOSURE_TAG(q0));
+            new = (StgWord)p + 1;
+        } else {
+            *p = (StgClosure *)iptr;
+            new = (StgWord)p + 2;
+        }
+    } while (cas((StgVolatilePtr)q, iptr, new) != iptr);
+}
+#endif
+
 STATIC_INLINE void
 thread (StgClosure **p)
 {
@@ -89,6 +116,12 @@ thread (StgClosure **p)
 
         if (bd->flags & BF_MARKED)
         {
+#if defined(THREADED_RTS)
+            if (compact_par) {
+                thread_par(p, q, q0);
+                return;
+            }
+#endif
             iptr = *q;
             switch (GET_CLOSURE_TAG((StgClosure *)iptr))
             {
@@ -444,6 +477,8 @@ thread_TSO (StgTSO *tso)
         || tso->why_blocked == BlockedOnMVarRead
         || tso->why_blocked == BlockedOnBlackHole
         || tso->why_blocked == BlockedOnMsgThrowTo
+        || tso->why_blocked == BlockedOnSTM
+        || tso->why_blocked == ThreadStealable
         || tso->why_blocked == NotBlocked
         ) {
         thread_(&tso->block_info.closure);
@@ -459,16 +494,14 @@ thread_TSO (StgTSO *tso)
 
 
 static void
-update_fwd_large( bdescr *bd )
+update_fwd_large_obj( bdescr *bd )
 {
-  StgPtr p;
-  const StgInfoTable* info;
-
-  for (; bd != NULL; bd = bd->link) {
+    StgPtr p;
+    const StgInfoTable* info;
 
     // nothing to do in a pinned block; it might not even have an object
     // at the beginning.
-    if (bd->flags & BF_PINNED) continue;
+    if (bd->flags & BF_PINNED) return;
 
     p = bd->start;
     info  = get_itbl((StgClosure *)p);
@@ -477,53 +510,53 @@ update_fwd_large( bdescr *bd )
 
     case ARR_WORDS:
     case COMPACT_NFDATA:
-      // nothing to follow
-      continue;
+        // nothing to follow
+        return;
 
     case MUT_ARR_PTRS_CLEAN:
     case MUT_ARR_PTRS_DIRTY:
     case MUT_ARR_PTRS_FROZEN:
     case MUT_ARR_PTRS_FROZEN0:
-      // follow everything
-      {
-          StgMutArrPtrs *a;
+        // follow everything
+    {
+        StgMutArrPtrs *a;
 
-          a = (StgMutArrPtrs*)p;
-          for (p = (P_)a->payload; p < (P_)&a->payload[a->ptrs]; p++) {
-              thread((StgClosure **)p);
-          }
-          continue;
-      }
+        a = (StgMutArrPtrs*)p;
+        for (p = (P_)a->payload; p < (P_)&a->payload[a->ptrs]; p++) {
+            thread((StgClosure **)p);
+        }
+        return;
+    }
 
     case SMALL_MUT_ARR_PTRS_CLEAN:
     case SMALL_MUT_ARR_PTRS_DIRTY:
     case SMALL_MUT_ARR_PTRS_FROZEN:
     case SMALL_MUT_ARR_PTRS_FROZEN0:
-      // follow everything
-      {
-          StgSmallMutArrPtrs *a;
+        // follow everything
+    {
+        StgSmallMutArrPtrs *a;
 
-          a = (StgSmallMutArrPtrs*)p;
-          for (p = (P_)a->payload; p < (P_)&a->payload[a->ptrs]; p++) {
-              thread((StgClosure **)p);
-          }
-          continue;
-      }
+        a = (StgSmallMutArrPtrs*)p;
+        for (p = (P_)a->payload; p < (P_)&a->payload[a->ptrs]; p++) {
+            thread((StgClosure **)p);
+        }
+        return;
+    }
 
     case STACK:
     {
         StgStack *stack = (StgStack*)p;
         thread_stack(stack->sp, stack->stack + stack->stack_size);
-        continue;
+        return;
     }
 
     case AP_STACK:
         thread_AP_STACK((StgAP_STACK *)p);
-        continue;
+        return;
 
     case PAP:
         thread_PAP((StgPAP *)p);
-        continue;
+        return;
 
     case TREC_CHUNK:
     {
@@ -532,17 +565,24 @@ update_fwd_large( bdescr *bd )
         TRecEntry *e = &(tc -> entries[0]);
         thread_(&tc->prev_chunk);
         for (i = 0; i < tc -> next_entry_idx; i ++, e++ ) {
-          thread_(&e->tvar);
-          thread(&e->expected_value);
-          thread(&e->new_value);
+            thread_(&e->tvar);
+            thread(&e->expected_value);
+            thread(&e->new_value);
         }
-        continue;
+        return;
     }
 
     default:
-      barf("update_fwd_large: unknown/strange object  %d", (int)(info->type));
+        barf("update_fwd_large: unknown/strange object  %d", (int)(info->type));
+    }
+}
+
+static void
+update_fwd_large( bdescr *bd )
+{
+    for (; bd != NULL; bd = bd->link) {
+        update_fwd_large_obj(bd);
     }
-  }
 }
 
 // ToDo: too big to inline
@@ -743,24 +783,29 @@ thread_obj (const StgInfoTable *info, StgPtr p)
 }
 
 static void
-update_fwd( bdescr *blocks )
+update_fwd_block( bdescr *bd )
 {
     StgPtr p;
-    bdescr *bd;
     const StgInfoTable *info;
 
-    bd = blocks;
+    p = bd->start;
 
-    // cycle through all the blocks in the step
-    for (; bd != NULL; bd = bd->link) {
-        p = bd->start;
+    // linearly scan the objects in this block
+    while (p < bd->free) {
+        ASSERT(LOOKS_LIKE_CLOSURE_PTR(p));
+        info = get_itbl((StgClosure *)p);
+        p = thread_obj(info, p);
+    }
+}
 
-        // linearly scan the objects in this block
-        while (p < bd->free) {
-            ASSERT(LOOKS_LIKE_CLOSURE_PTR(p));
-            info = get_itbl((StgClosure *)p);
-            p = thread_obj(info, p);
-        }
+static void
+update_fwd( bdescr *blocks )
+{
+    bdescr *bd;
+
+    // cycle through all the blocks in the step
+    for (bd = blocks; bd != NULL; bd = bd->link) {
+        update_fwd_block(bd);
     }
 }
 
@@ -938,13 +983,11 @@ update_bkwd_compact( generation *gen )
     return free_blocks;
 }
 
-void
-compact(StgClosure *static_objects)
+static void
+thread_roots (StgClosure *static_objects)
 {
-    W_ n, g, blocks;
-    generation *gen;
+    W_ n, g;
 
-    // 1. thread the roots
     markCapabilities((evac_fn)thread_root, NULL);
 
     markScheduler((evac_fn)thread_root, NULL);
@@ -1004,6 +1047,16 @@ compact(StgClosure *static_objects)
 
     // the CAF list (used by GHCi)
     markCAFs((evac_fn)thread_root, NULL);
+}
+
+void
+compact(StgClosure *static_objects)
+{
+    W_ n, g, blocks;
+    generation *gen;
+
+    // 1. thread the roots
+    thread_roots(static_objects);
 
     // 2. update forward ptrs
     for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
@@ -1030,5 +1083,384 @@ compact(StgClosure *static_objects)
                    "update_bkwd: %d (compact, old: %d blocks, now %d blocks)",
                    gen->no, gen->n_old_blocks, blocks);
         gen->n_old_blocks = blocks;
+        IF_DEBUG(sanity, checkCompactedGen(gen, 0, 1));
+    }
+}
+
+#if defined(THREADED_RTS)
+
+/* Note [Parallel compaction]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+   In a parallel GC, the marking is still done by one thread (the mark
+   stack is not parallel), but all the GC threads take part in the
+   compaction.  compactParPrepare() threads the roots, and then every GC
+   thread runs compactParWork(), which has three phases separated by
+   barriers:
+
+   1. Thread the pointer fields of all the live objects: those in the
+      other generations and the large objects, one block at a time, and
+      those in the compacted blocks.  Two threads may add a field to
+      the chain of the same object at once, so thread() uses cas() on
+      the info word (thread_par()).
+
+   2. Work out where each object in the compacted blocks is going, and
+      unthread its chain with the new address.  The compacted blocks
+      are divided into regions of COMPACT_REGION_BLOCKS blocks, and the
+      objects of a region slide down to the start of that region, so
+      the destinations in a region depend on nothing outside it.  The
+      "next block" bit of update_fwd_compact() is used in the same way.
+
+   3. Move the objects of each region.  This has to wait until every
+      chain has been unthreaded, because unthreading writes to fields of
+      objects in any region.
+
+   Unlike the serial version (update_fwd_compact() and
+   update_bkwd_compact()), which interleaves the threading and the
+   unthreading in address order, this needs an extra pass over the
+   compacted blocks, and may leave one partly-filled block at the end
+   of each region.  compactParFinish() frees the empty blocks, and
+   under -DS checks the result against what the serial version would
+   have produced (checkCompactedGen()).
+*/
+
+#define COMPACT_REGION_BLOCKS 64
+
+typedef struct {
+    bdescr *first;      // first block of the region
+    bdescr *last;       // last block of the region
+    bdescr *free_bd;    // after phase 3: the last block in use...
+    StgPtr  free;       // ... and its free pointer
+    W_      live;       // words of live data
+} CompactRegion;
+
+static CompactRegion *regions;
+static uint32_t       n_regions;
+
+// the blocks and large objects outside the compacted generation
+static bdescr       **fwd_blocks;
+static W_             n_fwd_blocks;
+
+static uint32_t       n_compact_threads;
+
+// the next piece of work in each phase
+static volatile StgWord next_fwd_block;
+static volatile StgWord next_region[3];
+
+static volatile StgWord barrier_count;
+static volatile StgWord barrier_epoch;
+
+static void
+compact_barrier (void)
+{
+    StgWord epoch = barrier_epoch;
+
+    if (atomic_inc(&barrier_count, 1) == n_compact_threads) {
+        barrier_count = 0;
+        write_barrier();
+        barrier_epoch = epoch + 1;
+    } else {
+        while (barrier_epoch == epoch) {
+            busy_wait_nop();
+        }
+        load_load_barrier();
+    }
+}
+
+// Returns the index of the next piece of work, or n if there is none.
+STATIC_INLINE StgWord
+grab (volatile StgWord *next, StgWord n)
+{
+    StgWord i;
+
+    if (*next >= n) return n;
+    i = atomic_inc(next, 1) - 1;
+    return i < n ? i : n;
+}
+
+#define FOR_REGION_BLOCKS(bd, r) \
+    for (bd = (r)->first; bd != (r)->last->link; bd = bd->link)
+
+// phase 1
+static void
+thread_region (CompactRegion *r)
+{
+    bdescr *bd;
+    StgPtr p;
+    StgWord iptr;
+    const StgInfoTable *info;
+
+    FOR_REGION_BLOCKS(bd, r) {
+        p = bd->start;
+        while (p < bd->free) {
+            while (p < bd->free && !is_marked(p,bd)) {
+                p++;
+            }
+            if (p >= bd->free) {
+                break;
+            }
+            iptr = get_threaded_info(p);
+            info = INFO_PTR_TO_STRUCT((StgInfoTable *)UNTAG_CLOSURE((StgClosure *)iptr));
+            p = thread_obj(info, p);
+        }
     }
 }
+
+// phase 2: as update_fwd_compact(), without the threading
+static void
+plan_region (CompactRegion *r)
+{
+    bdescr *bd, *free_bd;
+    StgPtr p, free;
+    StgWord iptr, size;
+    const StgInfoTable *info;
+
+    free_bd = r->first;
+    free = free_bd->start;
+    r->live = 0;
+
+    FOR_REGION_BLOCKS(bd, r) {
+        p = bd->start;
+        while (p < bd->free) {
+            while (p < bd->free && !is_marked(p,bd)) {
+                p++;
+            }
+            if (p >= bd->free) {
+                break;
+            }
+
+            iptr = get_threaded_info(p);
+            info = INFO_PTR_TO_STRUCT((StgInfoTable *)UNTAG_CLOSURE((StgClosure *)iptr));
+            size = closure_sizeW_((StgClosure *)p, info);
+
+            if (free + size > free_bd->start + BLOCK_SIZE_W) {
+                mark(p+1,bd);
+                free_bd = free_bd->link;
+                free = free_bd->start;
+            } else {
+                ASSERT(!is_marked(p+1,bd));
+            }
+
+            unthread(p,(StgWord)free + GET_CLOSURE_TAG((StgClosure *)iptr));
+            free += size;
+            r->live += size;
+            p += size;
+        }
+    }
+}
+
+// phase 3: as update_bkwd_compact(), without the unthreading
+static void
+move_region (CompactRegion *r)
+{
+    bdescr *bd, *free_bd;
+    StgPtr p, free;
+    StgWord size;
+    const StgInfoTable *info;
+
+    free_bd = r->first;
+    free = free_bd->start;
+
+    FOR_REGION_BLOCKS(bd, r) {
+        p = bd->start;
+        while (p < bd->free) {
+            while (p < bd->free && !is_marked(p,bd)) {
+                p++;
+            }
+            if (p >= bd->free) {
+                break;
+            }
+
+            if (is_marked(p+1,bd)) {
+                free_bd->free = free;
+                free_bd = free_bd->link;
+                free = free_bd->start;
+            }
+
+            ASSERT(LOOKS_LIKE_INFO_PTR((StgWord)((StgClosure *)p)->header.info));
+            info = get_itbl((StgClosure *)p);
+            size = closure_sizeW_((StgClosure *)p,info);
+
+            if (free != p) {
+                move(free,p,size);
+            }
+
+            // relocate TSOs
+            if (info->type == STACK) {
+                move_STACK((StgStack *)p, (StgStack *)free);
+            }
+
+            free += size;
+            p += size;
+        }
+    }
+
+    r->free_bd = free_bd;
+    r->free = free;
+}
+
+static void
+add_fwd_blocks (bdescr *bd)
+{
+    for (; bd != NULL; bd = bd->link) {
+        fwd_blocks[n_fwd_blocks++] = bd;
+    }
+}
+
+void
+compactParPrepare (StgClosure *static_objects, uint32_t n_threads)
+{
+    generation *gen;
+    bdescr *bd;
+    W_ n_fwd;
+    uint32_t g, n, i;
+
+    // the roots are few enough to thread with one thread
+    thread_roots(static_objects);
+
+    n_fwd = 0;
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        gen = &generations[g];
+        n_fwd += countBlocks(gen->blocks) +
+            countBlocks(gen->scavenged_large_objects);
+        for (n = 0; n < n_capabilities; n++) {
+            n_fwd += countBlocks(gc_threads[n]->gens[g].todo_bd) +
+                countBlocks(gc_threads[n]->gens[g].part_list);
+        }
+    }
+
+    fwd_blocks = stgMallocBytes((n_fwd + 1) * sizeof(bdescr *),
+                                "compactParPrepare");
+    n_fwd_blocks = 0;
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        gen = &generations[g];
+        add_fwd_blocks(gen->blocks);
+        for (n = 0; n < n_capabilities; n++) {
+            add_fwd_blocks(gc_threads[n]->gens[g].todo_bd);
+            add_fwd_blocks(gc_threads[n]->gens[g].part_list);
+        }
+        add_fwd_blocks(gen->scavenged_large_objects);
+    }
+    ASSERT(n_fwd_blocks == n_fwd);
+
+    gen = oldest_gen;
+    i = countBlocks(gen->old_blocks) / COMPACT_REGION_BLOCKS + 1;
+    regions = stgMallocBytes(i * sizeof(CompactRegion), "compactParPrepare");
+    bd = gen->old_blocks;
+    for (i = 0; bd != NULL; i++) {
+        regions[i].first = bd;
+        for (n = 1; n < COMPACT_REGION_BLOCKS && bd->link != NULL; n++) {
+            bd = bd->link;
+        }
+        regions[i].last = bd;
+        bd = bd->link;
+    }
+    n_regions = i;
+
+    next_fwd_block = 0;
+    for (i = 0; i < 3; i++) {
+        next_region[i] = 0;
+    }
+    barrier_count = 0;
+    n_compact_threads = n_threads;
+    compact_par = true;
+
+    debugTrace(DEBUG_gc, "compact: %d threads, %d regions, %" FMT_Word " other blocks",
+               n_threads, n_regions, n_fwd_blocks);
+}
+
+// Run by every GC thread taking part; see Note [Parallel compaction]
+void
+compactParWork (void)
+{
+    StgWord i;
+    bdescr *bd;
+
+    // 1. thread the pointers to the compacted objects
+    while ((i = grab(&next_fwd_block, n_fwd_blocks)) < n_fwd_blocks) {
+        bd = fwd_blocks[i];
+        if (bd->flags & BF_LARGE) {
+            update_fwd_large_obj(bd);
+        } else {
+            update_fwd_block(bd);
+        }
+    }
+    while ((i = grab(&next_region[0], n_regions)) < n_regions) {
+        thread_region(&regions[i]);
+    }
+
+    compact_barrier();
+
+    // 2. unthread them, with the new addresses
+    while ((i = grab(&next_region[1], n_regions)) < n_regions) {
+        plan_region(&regions[i]);
+    }
+
+    compact_barrier();
+
+    // 3. move the objects
+    while ((i = grab(&next_region[2], n_regions)) < n_regions) {
+        move_region(&regions[i]);
+    }
+}
+
+// Called by the main GC thread once all the others are done.
+void
+compactParFinish (void)
+{
+    generation *gen = oldest_gen;
+    CompactRegion *r;
+    bdescr *bd, **tail;
+    W_ blocks;
+    uint32_t i;
+
+    compact_par = false;
+
+    // link the regions back together, freeing the blocks they no
+    // longer need
+    gen->old_blocks = NULL;
+    tail = &gen->old_blocks;
+    blocks = 0;
+    for (i = 0; i < n_regions; i++) {
+        r = &regions[i];
+        r->last->link = NULL;
+        r->free_bd->free = r->free;
+        if (r->free_bd->link != NULL) {
+            freeChain(r->free_bd->link);
+            r->free_bd->link = NULL;
+        }
+        if (r->free == r->first->start) {
+            // nothing live in this region
+            ASSERT(r->free_bd == r->first);
+            freeGroup(r->first);
+            continue;
+        }
+        *tail = r->first;
+        for (bd = r->first; bd != NULL; bd = bd->link) {
+            blocks++;
+            tail = &bd->link;
+        }
+    }
+
+    debugTrace(DEBUG_gc,
+               "compact: %d regions (old: %d blocks, now %d blocks)",
+               n_regions, gen->n_old_blocks, blocks);
+    gen->n_old_blocks = blocks;
+
+#if defined(DEBUG)
+    if (RtsFlags.DebugFlags.sanity) {
+        W_ live = 0;
+        for (i = 0; i < n_regions; i++) {
+            live += regions[i].live;
+        }
+        checkCompactedGen(gen, live, n_regions);
+    }
+#endif
+
+    stgFree(fwd_blocks);
+    stgFree(regions);
+    fwd_blocks = NULL;
+    regions = NULL;
+}
+
+#endif /* THREADED_RTS */
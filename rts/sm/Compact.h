@@ -47,4 +47,11 @@ is_marked(StgPtr p, bdescr *bd)
 
 void compact (StgClosure *static_objects);
 
+#if defined(THREADED_RTS)
+// Parallel compaction; see Note [Parallel compaction] in Compact.c
+void compactParPrepare (StgClosure *static_objects, uint32_t n_threads);
+void compactParWork    (void);
+void compactParFinish  (void);
+#endif
+
 #include "EndPrivate.h"
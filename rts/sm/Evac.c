@@ -27,6 +27,7 @@
 #include "LdvProfile.h"
 #include "CNF.h"
 #include "Scav.h"
+#include "NonMovingMark.h"
 
 #if defined(PROF_SPIN) && defined(THREADED_RTS) && defined(PARALLEL_GC)
 StgWord64 whitehole_spin = 0;
@@ -395,6 +396,9 @@ evacuate_compact (StgPtr p)
             gct->failed_to_evac = true;
             TICK_GC_FAILED_PROMOTION();
         }
+        if (bd->flags & BF_NONMOVING) {
+            nonmovingShade((StgClosure *)str);
+        }
         return;
     }
 
@@ -595,6 +599,10 @@ loop:
               gct->failed_to_evac = true;
               TICK_GC_FAILED_PROMOTION();
           }
+          // a concurrent mark must not miss this object
+          if (bd->flags & BF_NONMOVING) {
+              nonmovingShade(q);
+          }
           return;
       }
 
@@ -970,6 +978,9 @@ selector_chain:
                 gct->failed_to_evac = true;
                 TICK_GC_FAILED_PROMOTION();
             }
+            if (evac && (bd->flags & BF_NONMOVING)) {
+                nonmovingShade((StgClosure *)p);
+            }
             return;
         }
         // we don't update THUNK_SELECTORS in the compacted
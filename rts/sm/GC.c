@@ -27,6 +27,7 @@
 #include "MarkWeak.h"
 #include "Sparks.h"
 #include "Sweep.h"
+#include "NonMovingMark.h"
 
 #include "Storage.h"
 #include "RtsUtils.h"
@@ -48,6 +49,7 @@
 #include "Stable.h"
 #include "CheckUnload.h"
 #include "CNF.h"
+#include "GetTime.h"
 
 #include <string.h> // for memset()
 #include <unistd.h>
@@ -134,6 +136,31 @@ static long copied;        // *words* copied & scavenged during this GC
 
 bool work_stealing;
 
+#if defined(THREADED_RTS)
+// A parallel GC that compacts the oldest generation marks with one
+// thread, and uses the others only for compact(): see GarbageCollect().
+static bool par_compact;
+
+// Set by the main GC thread when the heap is fully marked, to tell the
+// other GC threads to start collecting the stable name table.
+static volatile StgWord gc_stable_names_ready;
+
+// A heap census after this GC is done by all its GC threads; see
+// census_gc_threads().  The main GC thread sets gc_census_ready when the
+// census starts, and the last of the others to finish its part wakes it
+// up through gc_census_leader.
+static bool par_census;
+static volatile StgWord gc_census_ready;
+static volatile StgWord gc_census_running;
+static gc_thread *gc_census_leader;
+
+// Idle GC threads park here when there is nothing to steal; see
+// Note [Parking GC threads].
+static Mutex gc_idle_lock;
+static Condition gc_idle_cond;
+volatile StgWord n_parked_gc_threads;
+#endif
+
 uint32_t static_flag = STATIC_FLAG_B;
 uint32_t prev_static_flag = STATIC_FLAG_A;
 
@@ -146,6 +173,7 @@ DECLARE_GCT
 static void mark_root               (void *user, StgClosure **root);
 static void prepare_collected_gen   (generation *gen);
 static void prepare_uncollected_gen (generation *gen);
+static void stash_mut_list          (Capability *cap, uint32_t gen_no);
 static void init_gc_thread          (gc_thread *t);
 static void resize_generations      (void);
 static void resize_nursery          (void);
@@ -155,6 +183,16 @@ static StgWord inc_running          (void);
 static StgWord dec_running          (void);
 static void wakeup_gc_threads       (uint32_t me, bool idle_cap[]);
 static void shutdown_gc_threads     (uint32_t me, bool idle_cap[]);
+#if defined(THREADED_RTS)
+static void census_gc_threads       (uint32_t me, bool idle_cap[]);
+#endif
+#if defined(THREADED_RTS)
+static void compact_gc_threads      (uint32_t me, bool idle_cap[]);
+static void gc_wait                 (gc_thread *t, volatile StgWord *p,
+                                     StgWord val);
+static void gc_wake                 (gc_thread *t);
+static void set_wakeup              (gc_thread *t, StgWord state);
+#endif
 static void collect_gct_blocks      (void);
 static void collect_pinned_object_blocks (void);
 static void heapOverflow            (void);
@@ -189,6 +227,7 @@ GarbageCollect (uint32_t collect_gen,
   bdescr *bd;
   generation *gen;
   StgWord live_blocks, live_words, par_max_copied;
+  Time par_spin, par_sleep;
 #if defined(THREADED_RTS)
   gc_thread *saved_gct;
 #endif
@@ -205,6 +244,11 @@ GarbageCollect (uint32_t collect_gen,
 
   ACQUIRE_SM_LOCK;
 
+  // stop the concurrent marker, if there is one
+  if (RtsFlags.GcFlags.concurrentMark) {
+      nonmovingPauseMark();
+  }
+
 #if defined(RTS_USER_SIGNALS)
   if (RtsFlags.MiscFlags.install_signal_handlers) {
     // block signals
@@ -277,13 +321,23 @@ GarbageCollect (uint32_t collect_gen,
 #if defined(THREADED_RTS)
   /* How many threads will be participating in this GC?
    * We don't try to parallelise minor GCs (unless the user asks for
-   * it with +RTS -gn0), or mark/compact/sweep GC.
+   * it with +RTS -gn0), or the marking of mark/compact/sweep GC.
    */
   if (gc_type == SYNC_GC_PAR) {
       n_gc_threads = n_capabilities;
   } else {
       n_gc_threads = 1;
   }
+
+  // The mark stack is not parallel, so a compacting GC marks with one
+  // thread; the others stand by until compact_gc_threads().
+  par_compact = n_gc_threads > 1 && major_gc && oldest_gen->compact;
+  gc_stable_names_ready = false;
+  par_census = n_gc_threads > 1 && do_heap_census;
+  gc_census_ready = false;
+  if (par_compact) {
+      n_gc_threads = 1;
+  }
 #else
   n_gc_threads = 1;
 #endif
@@ -306,6 +360,10 @@ GarbageCollect (uint32_t collect_gen,
   // and put them on the g0->large_object list.
   collect_pinned_object_blocks();
 
+  // give the blocks cached by the capabilities back to the block
+  // allocator (see Note [Capability block cache] in BlockAlloc.c)
+  flushCapBlockCaches();
+
   // Initialise all the generations that we're collecting.
   for (g = 0; g <= N; g++) {
       prepare_collected_gen(&generations[g]);
@@ -315,6 +373,12 @@ GarbageCollect (uint32_t collect_gen,
       prepare_uncollected_gen(&generations[g]);
   }
 
+  // Snapshot the oldest generation for a concurrent mark, if one is due.
+  // This must happen before we trace anything; see Note [Concurrent mark].
+  if (RtsFlags.GcFlags.concurrentMark) {
+      nonmovingMaybeStartMark();
+  }
+
   // Prepare this gc_thread
   init_gc_thread(gct);
 
@@ -372,6 +436,9 @@ GarbageCollect (uint32_t collect_gen,
   gct->evac_gen_no = 0;
   markCAFs(mark_root, gct);
 
+  // objects the concurrent marker did not get round to scanning
+  nonmovingMarkRoots(mark_root, gct);
+
   // follow all the roots that the application knows about.
   gct->evac_gen_no = 0;
   if (n_gc_threads == 1) {
@@ -418,10 +485,28 @@ GarbageCollect (uint32_t collect_gen,
       break;
   }
 
+  // Now see which stable names are still alive.  The other GC threads
+  // help, and shutdown_gc_threads() waits for them to finish.
+  gcStableNamesPrepare(N, major_gc);
+#if defined(THREADED_RTS)
+  RELEASE_STORE(&gc_stable_names_ready, 1);
+  if (n_gc_threads > 1) {
+      for (n = 0; n < n_capabilities; n++) {
+          if (n == cap->no || idle_cap[n]) continue;
+          gc_wake(gc_threads[n]);
+      }
+  }
+#endif
+  gcStableNamesWork(gct->thread_index);
+
   shutdown_gc_threads(gct->thread_index, idle_cap);
 
-  // Now see which stable names are still alive.
-  gcStableTables();
+  // hand the objects shaded during this GC to the concurrent marker
+  if (RtsFlags.GcFlags.concurrentMark) {
+      nonmovingFlushShades();
+  }
+
+  gcStableNamesFinish();
 
 #if defined(THREADED_RTS)
   if (n_gc_threads == 1) {
@@ -452,16 +537,42 @@ GarbageCollect (uint32_t collect_gen,
 
   // Finally: compact or sweep the oldest generation.
   if (major_gc && oldest_gen->mark) {
-      if (oldest_gen->compact)
+      if (oldest_gen->compact) {
+#if defined(THREADED_RTS)
+          if (par_compact) {
+              compact_gc_threads(gct->thread_index, idle_cap);
+          } else
+#endif
           compact(gct->scavenged_static_objects);
-      else
+      } else if (nonmoving_state == NONMOVING_FINAL &&
+                 RtsFlags.GcFlags.incrementalSlice != 0) {
+          // -xi: sweep incrementally, after the GC
+          nonmovingDeferSweep(oldest_gen);
+      } else {
           sweep(oldest_gen);
+          // blocks filled during a concurrent mark were not swept
+          if (nonmoving_state == NONMOVING_FINAL) {
+              oldest_gen->live_estimate += oldest_gen->n_words;
+          }
+      }
   }
 
   copied = 0;
   par_max_copied = 0;
+  par_spin = 0;
+  par_sleep = 0;
   {
       uint32_t i;
+#if defined(THREADED_RTS)
+      // the time the GC threads spent waiting, for the stats.  Those that
+      // did not take part in this GC have nothing to add.
+      for (i=0; i < n_capabilities; i++) {
+          par_spin  += gc_threads[i]->spin_ns;
+          par_sleep += gc_threads[i]->sleep_ns;
+          gc_threads[i]->spin_ns  = 0;
+          gc_threads[i]->sleep_ns = 0;
+      }
+#endif
       for (i=0; i < n_gc_threads; i++) {
           if (n_gc_threads > 1) {
               debugTrace(DEBUG_gc,"thread %d:", i);
@@ -658,6 +769,11 @@ GarbageCollect (uint32_t collect_gen,
     }
   } // for all generations
 
+  // finish the concurrent mark cycle, if this was its final pause
+  if (major_gc && RtsFlags.GcFlags.concurrentMark) {
+      nonmovingEndMajor();
+  }
+
   // update the max size of older generations after a major GC
   resize_generations();
 
@@ -668,9 +784,12 @@ GarbageCollect (uint32_t collect_gen,
       freeChain(mark_stack_top_bd);
   }
 
-  // Free any bitmaps.
+  // Free any bitmaps, except one that an incremental sweep still needs.
   for (g = 0; g <= N; g++) {
       gen = &generations[g];
+      if (gen == oldest_gen && nonmoving_state == NONMOVING_SWEEPING) {
+          continue;
+      }
       if (gen->bitmap != NULL) {
           freeGroup(gen->bitmap);
           gen->bitmap = NULL;
@@ -695,7 +814,8 @@ GarbageCollect (uint32_t collect_gen,
   stableUnlock();
 
   // Must be after stableUnlock(), because it might free stable ptrs.
-  if (major_gc) {
+  // Object code is never unloaded under -xn, which retains all CAFs.
+  if (major_gc && !RtsFlags.GcFlags.concurrentMark) {
       checkUnload (gct->scavenged_static_objects);
   }
 
@@ -726,6 +846,11 @@ GarbageCollect (uint32_t collect_gen,
   if (do_heap_census) {
       debugTrace(DEBUG_sched, "performing heap census");
       RELEASE_SM_LOCK;
+#if defined(THREADED_RTS)
+      if (par_census) {
+          census_gc_threads(gct->thread_index, idle_cap);
+      } else
+#endif
       heapCensus(gct->gc_start_cpu);
       ACQUIRE_SM_LOCK;
   }
@@ -779,10 +904,16 @@ GarbageCollect (uint32_t collect_gen,
   memInventory(DEBUG_gc);
 #endif
 
+  // let the concurrent marker carry on (in the non-threaded RTS this
+  // does the marking, so it is part of the GC time)
+  if (RtsFlags.GcFlags.concurrentMark) {
+      nonmovingResumeMark();
+  }
+
   // ok, GC over: tell the stats department what happened.
   stat_endGC(cap, gct, live_words, copied,
              live_blocks * BLOCK_SIZE_W - live_words /* slop */,
-             N, n_gc_threads, par_max_copied);
+             N, n_gc_threads, par_max_copied, par_spin, par_sleep);
 
 #if defined(RTS_USER_SIGNALS)
   if (RtsFlags.MiscFlags.install_signal_handlers) {
@@ -815,6 +946,11 @@ static void heapOverflow(void)
 #define GC_THREAD_RUNNING              2
 #define GC_THREAD_WAITING_TO_CONTINUE  3
 
+// Bounds of gct->spin_budget, in iterations of busy_wait_nop(); see
+// Note [Parking GC threads]
+#define GC_SPIN_MIN   64
+#define GC_SPIN_MAX   (16*1024)
+
 static void
 new_gc_thread (uint32_t n, gc_thread *t)
 {
@@ -825,17 +961,26 @@ new_gc_thread (uint32_t n, gc_thread *t)
 
 #if defined(THREADED_RTS)
     t->id = 0;
-    initSpinLock(&t->gc_spin);
-    initSpinLock(&t->mut_spin);
-    ACQUIRE_SPIN_LOCK(&t->gc_spin);
-    ACQUIRE_SPIN_LOCK(&t->mut_spin);
     t->wakeup = GC_THREAD_INACTIVE;  // starts true, so we can wait for the
                           // thread to start up, see wakeup_gc_threads
+    initMutex(&t->park_lock);
+    initCondition(&t->park_cond);
+    t->parked = 0;
+    // Spinning only helps if the thread we are waiting for is running.
+    // If there are more capabilities than processors, it may not be.
+    if (n_capabilities > getNumberOfProcessors()) {
+        t->spin_budget = GC_SPIN_MIN;
+    } else {
+        t->spin_budget = GC_SPIN_MAX;
+    }
+    t->spin_ns = 0;
+    t->sleep_ns = 0;
 #endif
 
     t->thread_index = n;
     t->free_blocks = NULL;
     t->gc_count = 0;
+    t->nonmoving_shade = NULL;
 
     init_gc_thread(t);
 
@@ -890,6 +1035,9 @@ initGcThreads (uint32_t from USED_IF_THREADS, uint32_t to USED_IF_THREADS)
     } else {
         gc_threads = stgMallocBytes (to * sizeof(gc_thread*),
                                      "initGcThreads");
+        initMutex(&gc_idle_lock);
+        initCondition(&gc_idle_cond);
+        n_parked_gc_threads = 0;
     }
 
     for (i = from; i < to; i++) {
@@ -920,9 +1068,13 @@ freeGcThreads (void)
             {
                 freeWSDeque(gc_threads[i]->gens[g].todo_q);
             }
+            closeCondition(&gc_threads[i]->park_cond);
+            closeMutex(&gc_threads[i]->park_lock);
             stgFree (gc_threads[i]);
         }
         stgFree (gc_threads);
+        closeCondition(&gc_idle_cond);
+        closeMutex(&gc_idle_lock);
 #else
         for (g = 0; g < RtsFlags.GcFlags.generations; g++)
         {
@@ -996,17 +1148,195 @@ any_work (void)
 #endif
 
     gct->no_work++;
-#if defined(THREADED_RTS)
-    yieldThread();
-#endif
 
     return false;
 }
 
+#if defined(THREADED_RTS)
+/* Note [Parking GC threads]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~
+   GC threads wait for each other at several points: a worker waits to
+   be woken up at the start of the GC (GC_THREAD_STANDING_BY), waits for
+   the main thread to finish traversing the weak pointers before helping
+   with the stable name table, and waits to be released at the end
+   (GC_THREAD_WAITING_TO_CONTINUE); the main thread waits for the workers
+   to finish in shutdown_gc_threads(); and an idle thread in
+   scavenge_until_all_done() waits for work to steal.
+
+   These used to be spin locks handed between the threads, and a loop
+   around any_work() and yieldThread().  That is the fastest way to wake
+   up a thread that is running, but when the thread we are waiting for
+   is descheduled (more capabilities than cores, or other processes
+   competing for them) the waiters burn whole cores for nothing and make
+   things worse.
+
+   Instead every wait now spins for a while, and then blocks on a
+   condition variable:
+
+   - A thread waiting for a word (t->wakeup, gc_stable_names_ready,
+     gc_census_ready, gc_census_running) to
+     take a value calls gc_wait(t, p, val), which spins for up to
+     gct->spin_budget iterations, then increments t->parked and sleeps
+     on t->park_cond.  The thread that changes the word calls gc_wake(t),
+     which only takes t->park_lock if t->parked is non-zero.  Both sides
+     issue a seq_cst fence between their store and their load, so either
+     the waiter sees the new value or the waker sees the waiter, and no
+     wakeup is lost.
+
+   - An idle thread parks on gc_idle_cond, counted by
+     n_parked_gc_threads.  Whenever a GC thread pushes a block onto its
+     todo_q it calls notifyParkedGcThreads(), which wakes one parked
+     thread; the last running thread wakes them all when it runs out of
+     work, so that they can all leave the GC.
+
+   The spin budget adapts, like an adaptive mutex: it doubles when a wait
+   is satisfied while spinning and halves when we had to block, between
+   GC_SPIN_MIN and GC_SPIN_MAX.  It starts at GC_SPIN_MIN if there are
+   more capabilities than processors.
+
+   The time each GC thread spends spinning and sleeping is accumulated in
+   gct->spin_ns and gct->sleep_ns and reported in the GC statistics
+   (GCDetails.spin_ns and sleep_ns).
+*/
+
+static void
+adapt_spin_budget (bool slept)
+{
+    if (slept) {
+        gct->spin_budget = stg_max(gct->spin_budget / 2, GC_SPIN_MIN);
+    } else {
+        gct->spin_budget = stg_min(gct->spin_budget * 2, GC_SPIN_MAX);
+    }
+}
+
+// Wait until *p == val, sleeping on t's condition variable if it takes
+// too long.
+static void
+gc_wait (gc_thread *t, volatile StgWord *p, StgWord val)
+{
+    uint32_t i;
+    Time start, parked;
+
+    if (ACQUIRE_LOAD(p) == val) return;
+
+    start = getProcessElapsedTime();
+    for (i = 0; i < gct->spin_budget; i++) {
+        busy_wait_nop();
+        if (ACQUIRE_LOAD(p) == val) {
+            gct->spin_ns += getProcessElapsedTime() - start;
+            adapt_spin_budget(false);
+            return;
+        }
+    }
+
+    parked = getProcessElapsedTime();
+    gct->spin_ns += parked - start;
+
+    ACQUIRE_LOCK(&t->park_lock);
+    t->parked++;
+    SEQ_CST_FENCE();
+    while (ACQUIRE_LOAD(p) != val) {
+        waitCondition(&t->park_cond, &t->park_lock);
+    }
+    t->parked--;
+    RELEASE_LOCK(&t->park_lock);
+
+    gct->sleep_ns += getProcessElapsedTime() - parked;
+    adapt_spin_budget(true);
+}
+
+// Wake up the threads sleeping in gc_wait(t, ...), after changing the
+// word they are waiting for.
+static void
+gc_wake (gc_thread *t)
+{
+    SEQ_CST_FENCE();
+    if (RELAXED_LOAD(&t->parked) != 0) {
+        ACQUIRE_LOCK(&t->park_lock);
+        broadcastCondition(&t->park_cond);
+        RELEASE_LOCK(&t->park_lock);
+    }
+}
+
+static void
+set_wakeup (gc_thread *t, StgWord state)
+{
+    RELEASE_STORE(&t->wakeup, state);
+    gc_wake(t);
+}
+
+void
+wakeupParkedGcThread (void)
+{
+    ACQUIRE_LOCK(&gc_idle_lock);
+    signalCondition(&gc_idle_cond);
+    RELEASE_LOCK(&gc_idle_lock);
+}
+
+static void
+wakeup_all_parked_gc_threads (void)
+{
+    SEQ_CST_FENCE();
+    if (RELAXED_LOAD(&n_parked_gc_threads) != 0) {
+        ACQUIRE_LOCK(&gc_idle_lock);
+        broadcastCondition(&gc_idle_cond);
+        RELEASE_LOCK(&gc_idle_lock);
+    }
+}
+
+// Wait until there is some work to steal, or all the GC threads are
+// idle.  Returns true if there is work.
+static bool
+wait_for_work (void)
+{
+    uint32_t i;
+    Time start, parked;
+    bool found;
+
+    start = getProcessElapsedTime();
+    for (i = 0; i < gct->spin_budget; i++) {
+        if (gc_running_threads == 0) {
+            gct->spin_ns += getProcessElapsedTime() - start;
+            return false;
+        }
+        if (any_work()) {
+            gct->spin_ns += getProcessElapsedTime() - start;
+            adapt_spin_budget(false);
+            return true;
+        }
+        busy_wait_nop();
+    }
+
+    parked = getProcessElapsedTime();
+    gct->spin_ns += parked - start;
+
+    ACQUIRE_LOCK(&gc_idle_lock);
+    n_parked_gc_threads++;
+    SEQ_CST_FENCE();
+    for (;;) {
+        if (gc_running_threads == 0) { found = false; break; }
+        if (any_work()) { found = true; break; }
+        waitCondition(&gc_idle_cond, &gc_idle_lock);
+    }
+    n_parked_gc_threads--;
+    RELEASE_LOCK(&gc_idle_lock);
+
+    gct->sleep_ns += getProcessElapsedTime() - parked;
+    adapt_spin_budget(true);
+    return found;
+}
+#else
+static bool
+wait_for_work (void)
+{
+    return any_work();
+}
+#endif
+
 static void
 scavenge_until_all_done (void)
 {
-    DEBUG_ONLY( uint32_t r );
+    uint32_t r USED_IF_THREADS;
 
 
 loop:
@@ -1024,19 +1354,21 @@ loop:
 
     // scavenge_loop() only exits when there's no work to do
 
-#if defined(DEBUG)
     r = dec_running();
-#else
-    dec_running();
-#endif
 
     traceEventGcIdle(gct->cap);
 
     debugTrace(DEBUG_gc, "%d GC threads still running", r);
 
+#if defined(THREADED_RTS)
+    if (r == 0) {
+        // we were the last: let the parked threads leave
+        wakeup_all_parked_gc_threads();
+    }
+#endif
+
     while (gc_running_threads != 0) {
-        // usleep(1);
-        if (any_work()) {
+        if (wait_for_work()) {
             inc_running();
             traceEventGcWork(gct->cap);
             goto loop;
@@ -1064,43 +1396,58 @@ gcWorkerThread (Capability *cap)
     gct->id = osThreadId();
 
     // Wait until we're told to wake up
-    RELEASE_SPIN_LOCK(&gct->mut_spin);
-    // yieldThread();
-    //    Strangely, adding a yieldThread() here makes the CPU time
-    //    measurements more accurate on Linux, perhaps because it syncs
-    //    the CPU time across the multiple cores.  Without this, CPU time
-    //    is heavily skewed towards GC rather than MUT.
-    gct->wakeup = GC_THREAD_STANDING_BY;
+    set_wakeup(gct, GC_THREAD_STANDING_BY);
     debugTrace(DEBUG_gc, "GC thread %d standing by...", gct->thread_index);
-    ACQUIRE_SPIN_LOCK(&gct->gc_spin);
-
-    init_gc_thread(gct);
-
-    traceEventGcWork(gct->cap);
-
-    // Every thread evacuates some roots.
-    gct->evac_gen_no = 0;
-    markCapability(mark_root, gct, cap, true/*prune sparks*/);
-    scavenge_capability_mut_lists(cap);
-
-    scavenge_until_all_done();
-
-#if defined(THREADED_RTS)
-    // Now that the whole heap is marked, we discard any sparks that
-    // were found to be unreachable.  The main GC thread is currently
-    // marking heap reachable via weak pointers, so it is
-    // non-deterministic whether a spark will be retained if it is
-    // only reachable via weak pointers.  To fix this problem would
-    // require another GC barrier, which is too high a price.
-    pruneSparkQueue(cap);
-#endif
+    gc_wait(gct, &gct->wakeup, GC_THREAD_RUNNING);
+
+    if (par_compact) {
+        // the main GC thread has done the marking on its own, and
+        // woken us up to help with the compaction
+        traceEventGcWork(gct->cap);
+        compactParWork();
+        traceEventGcDone(gct->cap);
+    } else {
+        init_gc_thread(gct);
+
+        traceEventGcWork(gct->cap);
+
+        // Every thread evacuates some roots.
+        gct->evac_gen_no = 0;
+        markCapability(mark_root, gct, cap, true/*prune sparks*/);
+        scavenge_capability_mut_lists(cap);
+
+        scavenge_until_all_done();
+
+        // Now that the whole heap is marked, we discard any sparks that
+        // were found to be unreachable.  The main GC thread is currently
+        // marking heap reachable via weak pointers, so it is
+        // non-deterministic whether a spark will be retained if it is
+        // only reachable via weak pointers.  To fix this problem would
+        // require another GC barrier, which is too high a price.
+        pruneSparkQueue(cap);
+
+        // Wait for the main GC thread to finish marking (it may still
+        // be traversing weak pointers), then help with the stable name
+        // table.
+        gc_wait(gct, &gc_stable_names_ready, 1);
+        gcStableNamesWork(gct->thread_index);
+    }
 
     // Wait until we're told to continue
-    RELEASE_SPIN_LOCK(&gct->gc_spin);
-    gct->wakeup = GC_THREAD_WAITING_TO_CONTINUE;
+    set_wakeup(gct, GC_THREAD_WAITING_TO_CONTINUE);
+
+    if (par_census) {
+        // but first help with the heap census, see census_gc_threads()
+        gc_wait(gct, &gc_census_ready, 1);
+        heapCensusParWork();
+        if (atomic_dec(&gc_census_running) == 0) {
+            gc_wake(gc_census_leader);
+        }
+    }
+
     debugTrace(DEBUG_gc, "GC thread %d waiting to continue...",
                gct->thread_index);
-    ACQUIRE_SPIN_LOCK(&gct->mut_spin);
+    gc_wait(gct, &gct->wakeup, GC_THREAD_INACTIVE);
     debugTrace(DEBUG_gc, "GC thread %d on my way...", gct->thread_index);
 
     SET_GCT(saved_gct);
@@ -1167,9 +1514,7 @@ wakeup_gc_threads (uint32_t me USED_IF_THREADS,
         if (gc_threads[i]->wakeup != GC_THREAD_STANDING_BY)
             barf("wakeup_gc_threads");
 
-        gc_threads[i]->wakeup = GC_THREAD_RUNNING;
-        ACQUIRE_SPIN_LOCK(&gc_threads[i]->mut_spin);
-        RELEASE_SPIN_LOCK(&gc_threads[i]->gc_spin);
+        set_wakeup(gc_threads[i], GC_THREAD_RUNNING);
     }
 #endif
 }
@@ -1188,15 +1533,83 @@ shutdown_gc_threads (uint32_t me USED_IF_THREADS,
 
     for (i=0; i < n_gc_threads; i++) {
         if (i == me || idle_cap[i]) continue;
-        while (gc_threads[i]->wakeup != GC_THREAD_WAITING_TO_CONTINUE) {
-            busy_wait_nop();
-            write_barrier();
-        }
+        gc_wait(gc_threads[i], &gc_threads[i]->wakeup,
+                GC_THREAD_WAITING_TO_CONTINUE);
     }
 #endif
 }
 
 #if defined(THREADED_RTS)
+// Compact the oldest generation with all the GC threads that are not
+// idle.  They have been standing by since the start of the GC, which
+// only the main GC thread has done; see Note [Parallel compaction] in
+// Compact.c.
+static void
+compact_gc_threads (uint32_t me, bool idle_cap[])
+{
+    uint32_t i, n_threads;
+
+    n_threads = 1;
+    for (i=0; i < n_capabilities; i++) {
+        if (i == me || idle_cap[i]) continue;
+        n_threads++;
+    }
+
+    compactParPrepare(gct->scavenged_static_objects, n_threads);
+
+    for (i=0; i < n_capabilities; i++) {
+        if (i == me || idle_cap[i]) continue;
+        debugTrace(DEBUG_gc, "waking up gc thread %d to compact", i);
+        if (gc_threads[i]->wakeup != GC_THREAD_STANDING_BY)
+            barf("compact_gc_threads");
+
+        set_wakeup(gc_threads[i], GC_THREAD_RUNNING);
+    }
+
+    compactParWork();
+
+    for (i=0; i < n_capabilities; i++) {
+        if (i == me || idle_cap[i]) continue;
+        gc_wait(gc_threads[i], &gc_threads[i]->wakeup,
+                GC_THREAD_WAITING_TO_CONTINUE);
+    }
+
+    compactParFinish();
+}
+
+// Do the heap census with all the GC threads that are not idle.  They
+// have been waiting for gc_census_ready since they finished their part
+// of the GC (so the main thread can go on with the rest of it on its
+// own); see Note [Parallel heap census] in ProfHeap.c.
+static void
+census_gc_threads (uint32_t me, bool idle_cap[])
+{
+    uint32_t i, n_threads;
+
+    n_threads = 1;
+    for (i=0; i < n_capabilities; i++) {
+        if (i == me || idle_cap[i]) continue;
+        n_threads++;
+    }
+
+    heapCensusParPrepare(gct->gc_start_cpu, n_threads);
+
+    gc_census_leader = gct;
+    gc_census_running = n_threads - 1;
+    RELEASE_STORE(&gc_census_ready, 1);
+    for (i=0; i < n_capabilities; i++) {
+        if (i == me || idle_cap[i]) continue;
+        debugTrace(DEBUG_gc, "waking up gc thread %d for the census", i);
+        gc_wake(gc_threads[i]);
+    }
+
+    heapCensusParWork();
+
+    gc_wait(gct, &gc_census_running, 0);
+
+    heapCensusParFinish();
+}
+
 void
 releaseGCThreads (Capability *cap USED_IF_THREADS, bool idle_cap[])
 {
@@ -1208,9 +1621,7 @@ releaseGCThreads (Capability *cap USED_IF_THREADS, bool idle_cap[])
         if (gc_threads[i]->wakeup != GC_THREAD_WAITING_TO_CONTINUE)
             barf("releaseGCThreads");
 
-        gc_threads[i]->wakeup = GC_THREAD_INACTIVE;
-        ACQUIRE_SPIN_LOCK(&gc_threads[i]->gc_spin);
-        RELEASE_SPIN_LOCK(&gc_threads[i]->mut_spin);
+        set_wakeup(gc_threads[i], GC_THREAD_INACTIVE);
     }
 }
 #endif
@@ -1226,12 +1637,22 @@ prepare_collected_gen (generation *gen)
     gen_workspace *ws;
     bdescr *bd, *next;
 
+    // an incremental sweep (-xi) of this generation must be finished
+    if (gen == oldest_gen) {
+        nonmovingFinishSweep();
+    }
+
     // Throw away the current mutable list.  Invariant: the mutable
     // list always has at least one block; this means we can avoid a
     // check for NULL in recordMutable().
     g = gen->no;
     if (g != 0) {
         for (i = 0; i < n_capabilities; i++) {
+            if (nonmoving_state == NONMOVING_MARKING && gen == oldest_gen) {
+                // the final pause of a concurrent mark rescans it
+                stash_mut_list(capabilities[i], g);
+                continue;
+            }
             freeChain(capabilities[i]->mut_lists[g]);
             capabilities[i]->mut_lists[g] =
                 allocBlockOnNode(capNoToNumaNode(i));
@@ -1246,6 +1667,13 @@ prepare_collected_gen (generation *gen)
     gen->old_threads = gen->threads;
     gen->threads = END_TSO_QUEUE;
 
+    // the final pause of a concurrent mark: only the snapshot, with the
+    // marks made so far, is from-space.  See Note [Concurrent mark].
+    if (nonmoving_state == NONMOVING_MARKING && gen == oldest_gen) {
+        nonmovingPrepareFinal(gen);
+        return;
+    }
+
     // deprecate the existing blocks
     gen->old_blocks   = gen->blocks;
     gen->n_old_blocks = gen->n_blocks;
@@ -1551,8 +1979,10 @@ resize_generations (void)
 
         // Auto-enable compaction when the residency reaches a
         // certain percentage of the maximum heap size (default: 30%).
+        // Not with -xn: the concurrent marker relies on objects in the
+        // oldest generation staying put.
         if (RtsFlags.GcFlags.compact ||
-            (max > 0 &&
+            (max > 0 && !RtsFlags.GcFlags.concurrentMark &&
              oldest_gen->n_blocks >
              (RtsFlags.GcFlags.compactThreshold * max) / 100)) {
             oldest_gen->mark = 1;
@@ -56,6 +56,21 @@ void freeGcThreads (void);
 #if defined(THREADED_RTS)
 void waitForGcThreads (Capability *cap, bool idle_cap[]);
 void releaseGCThreads (Capability *cap, bool idle_cap[]);
+
+// Idle GC threads waiting for work to steal; see Note [Parking GC
+// threads] in GC.c.  Call notifyParkedGcThreads() after making work
+// available to other GC threads.
+extern volatile StgWord n_parked_gc_threads;
+void wakeupParkedGcThread (void);
+
+INLINE_HEADER void
+notifyParkedGcThreads (void)
+{
+    SEQ_CST_FENCE();
+    if (RELAXED_LOAD(&n_parked_gc_threads) != 0) {
+        wakeupParkedGcThread();
+    }
+}
 #endif
 
 #define WORK_UNIT_WORDS 128
@@ -121,9 +121,11 @@ typedef struct gc_thread_ {
 
 #if defined(THREADED_RTS)
     OSThreadId id;                 // The OS thread that this struct belongs to
-    SpinLock   gc_spin;
-    SpinLock   mut_spin;
     volatile StgWord wakeup;       // NB not StgWord8; only StgWord is guaranteed atomic
+    Mutex      park_lock;          // threads waiting for a change of
+    Condition  park_cond;          //   wakeup sleep here; see
+    volatile StgWord parked;       //   Note [Parking GC threads] in GC.c
+    uint32_t   spin_budget;        // how long we spin before parking
 #endif
     uint32_t thread_index;         // a zero based index identifying the thread
 
@@ -172,6 +174,10 @@ typedef struct gc_thread_ {
     W_ thunk_selector_depth;       // used to avoid unbounded recursion in
                                    // evacuate() for THUNK_SELECTOR
 
+    struct NonmovingChunk_ *nonmoving_shade;
+                                   // objects shaded by this thread for
+                                   // the concurrent mark (NonMovingMark.c)
+
     // -------------------
     // stats
 
@@ -180,6 +186,10 @@ typedef struct gc_thread_ {
     W_ any_work;
     W_ no_work;
     W_ scav_find_work;
+#if defined(THREADED_RTS)
+    Time spin_ns;        // time spent spinning while waiting ...
+    Time sleep_ns;       // ... and parked, since the last GC
+#endif
 
     Time gc_start_cpu;   // process CPU time
     Time gc_sync_start_elapsed;  // start of GC sync
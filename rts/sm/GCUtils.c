@@ -280,6 +280,11 @@ todo_block_full (uint32_t size, gen_workspace *ws)
                 ws->todo_overflow = bd;
                 ws->n_todo_overflow++;
             }
+#if defined(THREADED_RTS)
+            else if (work_stealing) {
+                notifyParkedGcThreads();
+            }
+#endif
         }
     }
 
@@ -22,6 +22,66 @@ W_ peak_mblocks_allocated = 0;
 W_ mblocks_allocated = 0;
 W_ mpc_misses = 0;
 
+// With +RTS --huge-pages: the number of mblocks that we handed out
+// backed by huge pages, and the number for which we couldn't get huge
+// pages and fell back to normal pages.  See Note [Huge pages].
+W_ huge_page_mblocks = 0;
+W_ huge_page_fallback_mblocks = 0;
+
+/* -----------------------------------------------------------------------------
+   Note [Huge pages]
+   ~~~~~~~~~~~~~~~~~
+
+   A large heap walked through 1MB mblocks spread over the address space
+   causes a lot of dTLB misses.  With +RTS --huge-pages we back the heap
+   (and hence the nurseries, which allocNursery() takes from whole
+   mblocks in this mode) with 2MB pages.  There are two ways to do that:
+
+   --huge-pages=transparent (the default):
+      after committing memory we ask for transparent huge pages with
+      madvise(MADV_HUGEPAGE).  The kernel uses huge pages where it
+      can, and falls back to normal pages otherwise; we count the
+      mblocks for which madvise() failed as fallbacks.
+
+   --huge-pages=explicit:
+      we commit fresh memory at the high watermark with
+      mmap(MAP_HUGETLB), in 2MB-aligned units, from the pool of huge
+      pages reserved by the administrator (vm.nr_hugepages).  If there
+      aren't enough huge pages left (or we're not 2MB aligned), we
+      fall back to normal pages.
+
+      Huge pages can't be decommitted one mblock at a time, so when an
+      mblock that is backed by a huge page is freed we leave it mapped,
+      and don't commit it again when we reuse it.  huge_mblock_map
+      records which mblocks are backed by huge pages; since huge pages
+      are never unmapped, its bits are never cleared.  The memory
+      accounting (mblocks_allocated) treats these mblocks like any other
+      freed mblock.  Explicit huge pages are only supported with
+      USE_LARGE_ADDRESS_SPACE; elsewhere every mblock counts as a
+      fallback.
+   -------------------------------------------------------------------------- */
+
+// Commit hook for memory that we have just committed with normal
+// pages: ask for transparent huge pages if required, and count the
+// result.
+static void
+adviseHugePages (void *addr, W_ size)
+{
+    switch (RtsFlags.GcFlags.hugePages) {
+    case HUGE_PAGES_NONE:
+        return;
+    case HUGE_PAGES_TRANSPARENT:
+        if (osAdviseHugePages(addr, size)) {
+            huge_page_mblocks += size / MBLOCK_SIZE;
+            return;
+        }
+        break;
+    default:
+        break;
+    }
+    huge_page_fallback_mblocks += size / MBLOCK_SIZE;
+}
+
 /* -----------------------------------------------------------------------------
    The MBlock Map: provides our implementation of HEAP_ALLOCED() and the
    utilities to walk the really allocated (thus accessible without risk of
@@ -152,6 +212,107 @@ void * getNextMBlock(void **state STG_UNUSED, void *mblock)
     return getAllocatedMBlock(casted_state, (W_)mblock + MBLOCK_SIZE);
 }
 
+// One bit per mblock of the reserved address space, set when the mblock
+// is backed by an explicit huge page.  Only allocated with
+// --huge-pages=explicit; see Note [Huge pages].
+static StgWord8 *huge_mblock_map = NULL;
+
+static bool isHugeMBlock(W_ address)
+{
+    W_ i;
+
+    if (huge_mblock_map == NULL) {
+        return false;
+    }
+    i = (address - mblock_address_space.begin) >> MBLOCK_SHIFT;
+    return (huge_mblock_map[i / 8] >> (i % 8)) & 1;
+}
+
+static void setHugeMBlocks(W_ address, W_ size)
+{
+    W_ i, n;
+
+    i = (address - mblock_address_space.begin) >> MBLOCK_SHIFT;
+    for (n = size / MBLOCK_SIZE; n > 0; n--, i++) {
+        huge_mblock_map[i / 8] |= 1 << (i % 8);
+    }
+}
+
+// Commit a range of mblocks, except those that are still backed by
+// explicit huge pages, which were never decommitted.
+static void commitMBlocks(W_ address, W_ size)
+{
+    W_ p, start, end;
+
+    end = address + size;
+    p = address;
+    while (p < end) {
+        if (isHugeMBlock(p)) {
+            huge_page_mblocks++;
+            p += MBLOCK_SIZE;
+            continue;
+        }
+        start = p;
+        while (p < end && !isHugeMBlock(p)) {
+            p += MBLOCK_SIZE;
+        }
+        osCommitMemory((void*)start, p - start);
+        adviseHugePages((void*)start, p - start);
+    }
+}
+
+// Try to commit size bytes of fresh memory at address with explicit
+// huge pages.  The whole huge page that contains the end of the range
+// is committed, so the next fresh allocation may find its first mblock
+// already committed.
+static bool commitHugeMBlocks(W_ address, W_ size)
+{
+    W_ p, huge_size;
+
+    ASSERT((address & (HUGE_PAGE_SIZE-1)) == 0);
+
+    huge_size = (size + HUGE_PAGE_SIZE - 1) & ~(W_)(HUGE_PAGE_SIZE-1);
+    if (address + huge_size > mblock_address_space.end) {
+        return false;
+    }
+    // don't map over a huge page that we have kept
+    for (p = address; p < address + huge_size; p += MBLOCK_SIZE) {
+        if (isHugeMBlock(p)) return false;
+    }
+    if (!osCommitHugeMemory((void*)address, huge_size)) {
+        return false;
+    }
+    setHugeMBlocks(address, huge_size);
+    huge_page_mblocks += size / MBLOCK_SIZE;
+    return true;
+}
+
+// Decommit a range of mblocks, except those that are backed by
+// explicit huge pages.
+static void decommitMBlockRange(W_ address, W_ size)
+{
+    W_ p, start, end;
+
+    if (huge_mblock_map == NULL) {
+        osDecommitMemory((void*)address, size);
+        return;
+    }
+
+    end = address + size;
+    p = address;
+    while (p < end) {
+        if (isHugeMBlock(p)) {
+            p += MBLOCK_SIZE;
+            continue;
+        }
+        start = p;
+        while (p < end && !isHugeMBlock(p)) {
+            p += MBLOCK_SIZE;
+        }
+        osDecommitMemory((void*)start, p - start);
+    }
+}
+
 static void *getReusableMBlocks(uint32_t n)
 {
     struct free_list *iter;
@@ -183,7 +344,7 @@ static void *getReusableMBlocks(uint32_t n)
             stgFree(iter);
         }
 
-        osCommitMemory(addr, size);
+        commitMBlocks((W_)addr, size);
         return addr;
     }
 
@@ -202,7 +363,23 @@ static void *getFreshMBlocks(uint32_t n)
         stg_exit(EXIT_HEAPOVERFLOW);
     }
 
-    osCommitMemory(addr, size);
+    if (huge_mblock_map != NULL) {
+        // commit up to the next huge page boundary with normal pages,
+        // and the rest with huge pages if we can
+        W_ pre = stg_min(size, (HUGE_PAGE_SIZE - (mblock_high_watermark
+                                                  & (HUGE_PAGE_SIZE-1)))
+                                & (HUGE_PAGE_SIZE-1));
+        if (pre > 0) {
+            commitMBlocks(mblock_high_watermark, pre);
+        }
+        if (pre < size &&
+            !commitHugeMBlocks(mblock_high_watermark + pre, size - pre)) {
+            commitMBlocks(mblock_high_watermark + pre, size - pre);
+        }
+    } else {
+        osCommitMemory(addr, size);
+        adviseHugePages(addr, size);
+    }
     mblock_high_watermark += size;
     return addr;
 }
@@ -220,13 +397,95 @@ static void *getCommittedMBlocks(uint32_t n)
     return p;
 }
 
+// Take the mblocks [address, address+size) if they are all free, and
+// commit them.  Used by getMBlocksAt().
+static bool getMBlocksAtAddress(W_ address, W_ size)
+{
+    struct free_list *iter, *new_iter;
+    W_ p;
+
+    if (address < mblock_address_space.begin ||
+        address + size > mblock_address_space.end ||
+        address + size < address) {
+        return false;
+    }
+
+    for (p = address; p < address + size; p += MBLOCK_SIZE) {
+        if (isHugeMBlock(p)) return false;
+    }
+
+    if (address >= mblock_high_watermark) {
+        // the mblocks between the high watermark and address have never
+        // been committed, so they go on the free list as they are
+        if (address > mblock_high_watermark) {
+            new_iter = stgMallocBytes(sizeof(struct free_list),
+                                      "getMBlocksAt");
+            new_iter->address = mblock_high_watermark;
+            new_iter->size = address - mblock_high_watermark;
+            new_iter->next = NULL;
+            new_iter->prev = NULL;
+            for (iter = free_list_head; iter != NULL && iter->next != NULL;
+                 iter = iter->next) {}
+            if (iter == NULL) {
+                free_list_head = new_iter;
+            } else {
+                new_iter->prev = iter;
+                iter->next = new_iter;
+            }
+        }
+        osCommitMemory((void*)address, size);
+        mblock_high_watermark = address + size;
+        return true;
+    }
+
+    // Below the high watermark, the range must be part of a single
+    // entry of the free list (entries never reach the watermark).
+    for (iter = free_list_head; iter != NULL; iter = iter->next) {
+        if (iter->address + iter->size <= address) {
+            continue;
+        }
+        if (iter->address > address ||
+            iter->address + iter->size < address + size) {
+            return false;
+        }
+        if (iter->address + iter->size > address + size) {
+            // keep the part after the range in an entry of its own
+            new_iter = stgMallocBytes(sizeof(struct free_list),
+                                      "getMBlocksAt");
+            new_iter->address = address + size;
+            new_iter->size = iter->address + iter->size - (address + size);
+            new_iter->prev = iter;
+            new_iter->next = iter->next;
+            if (iter->next != NULL) {
+                iter->next->prev = new_iter;
+            }
+            iter->next = new_iter;
+        }
+        iter->size = address - iter->address;
+        if (iter->size == 0) {
+            if (iter->prev == NULL) {
+                free_list_head = iter->next;
+            } else {
+                iter->prev->next = iter->next;
+            }
+            if (iter->next != NULL) {
+                iter->next->prev = iter->prev;
+            }
+            stgFree(iter);
+        }
+        commitMBlocks(address, size);
+        return true;
+    }
+    return false;
+}
+
 static void decommitMBlocks(char *addr, uint32_t n)
 {
     struct free_list *iter, *prev;
     W_ size = MBLOCK_SIZE * (W_)n;
     W_ address = (W_)addr;
 
-    osDecommitMemory(addr, size);
+    decommitMBlockRange(address, size);
 
     prev = NULL;
     for (iter = free_list_head; iter != NULL; iter = iter->next)
@@ -534,6 +793,10 @@ static void *getCommittedMBlocks(uint32_t n)
     void *ret = osGetMBlocks(n);
     uint32_t i;
 
+    // explicit huge pages need USE_LARGE_ADDRESS_SPACE, so they count
+    // as a fallback here, see Note [Huge pages]
+    adviseHugePages(ret, (W_)n * MBLOCK_SIZE);
+
     // fill in the table
     for (i = 0; i < n; i++) {
         markHeapAlloced( (StgWord8*)ret + i * MBLOCK_SIZE );
@@ -587,6 +850,33 @@ getMBlocks(uint32_t n)
     return ret;
 }
 
+// Allocate 'n' mblocks at the given address if they are free, and
+// return NULL otherwise.  This is only possible with
+// USE_LARGE_ADDRESS_SPACE, where we know which parts of the address
+// space are ours; elsewhere it always returns NULL.  Used to map a
+// compact region file at the address it was laid out for, see Note
+// [Compact region files] in CNF.c.
+
+void *
+getMBlocksAt(void *addr STG_UNUSED, uint32_t n STG_UNUSED)
+{
+#if defined(USE_LARGE_ADDRESS_SPACE)
+    if (((W_)addr & MBLOCK_MASK) != 0 ||
+        !getMBlocksAtAddress((W_)addr, MBLOCK_SIZE * (W_)n)) {
+        return NULL;
+    }
+
+    debugTrace(DEBUG_gc, "allocated %d megablock(s) at %p",n,addr);
+
+    mblocks_allocated += n;
+    peak_mblocks_allocated = stg_max(peak_mblocks_allocated, mblocks_allocated);
+
+    return addr;
+#else
+    return NULL;
+#endif
+}
+
 void *
 getMBlocksOnNode(uint32_t node, uint32_t n)
 {
@@ -614,6 +904,63 @@ freeMBlocks(void *addr, uint32_t n)
     decommitMBlocks(addr, n);
 }
 
+/* -----------------------------------------------------------------------------
+   Decommit policy
+
+   When the GC decides that we are holding n more free megablocks than
+   we need, decommitQuota() decides how many of them each NUMA node
+   gives back to the OS.  free_mblocks[i] is the number of free
+   megablocks of node i; quota[i] is set to the number of megablocks
+   that node i should release.
+
+   Each node releases a share of n proportional to its free megablocks,
+   so that a node that has just released a lot of memory doesn't hang
+   on to it while the other nodes give up all of theirs (previously we
+   always started with node 0, which could leave node 0 with no free
+   memory while the others kept plenty).  Rounding leftovers go to the
+   nodes with the most free megablocks.  A node never releases more
+   than it has free.
+   -------------------------------------------------------------------------- */
+
+void
+decommitQuota (uint32_t n, uint32_t n_nodes,
+               const W_ free_mblocks[], W_ quota[])
+{
+    uint32_t i, best;
+    W_ total = 0, given = 0;
+
+    for (i = 0; i < n_nodes; i++) {
+        total += free_mblocks[i];
+    }
+
+    if (total <= n) {
+        // can't keep anything
+        for (i = 0; i < n_nodes; i++) {
+            quota[i] = free_mblocks[i];
+        }
+        return;
+    }
+
+    for (i = 0; i < n_nodes; i++) {
+        quota[i] = (W_)n * free_mblocks[i] / total;
+        given += quota[i];
+    }
+
+    // hand out what was lost to rounding, one megablock at a time, to
+    // the node that has the most free megablocks left over
+    while (given < n) {
+        best = 0;
+        for (i = 1; i < n_nodes; i++) {
+            if (free_mblocks[i] - quota[i] >
+                free_mblocks[best] - quota[best]) {
+                best = i;
+            }
+        }
+        quota[best]++;
+        given++;
+    }
+}
+
 void
 freeAllMBlocks(void)
 {
@@ -630,6 +977,11 @@ freeAllMBlocks(void)
         }
     }
 
+    if (huge_mblock_map != NULL) {
+        stgFree(huge_mblock_map);
+        huge_mblock_map = NULL;
+    }
+
     osReleaseHeapMemory();
 
     mblock_address_space.begin = (W_)-1;
@@ -671,6 +1023,12 @@ initMBlocks(void)
         mblock_address_space.begin = (W_)addr;
         mblock_address_space.end = (W_)addr + size;
         mblock_high_watermark = (W_)addr;
+
+        if (RtsFlags.GcFlags.hugePages == HUGE_PAGES_EXPLICIT) {
+            huge_mblock_map =
+                stgCallocBytes((size / MBLOCK_SIZE + 7) / 8, 1,
+                               "initMBlocks");
+        }
     }
 #elif SIZEOF_VOID_P == 8
     memset(mblock_cache,0xff,sizeof(mblock_cache));
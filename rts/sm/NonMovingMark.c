@@ -0,0 +1,1257 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2017
+ *
+ * Concurrent marking of the oldest generation (+RTS -xn)
+ *
+ * Documentation on the architecture of the Garbage Collector can be
+ * found in the online commentary:
+ *
+ *   http://ghc.haskell.org/trac/ghc/wiki/Commentary/Rts/Storage/GC
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "NonMovingMark.h"
+#include "GC.h"
+#include "GCThread.h"
+#include "GCTDecl.h"
+#include "GCUtils.h"
+#include "Compact.h"
+#include "Storage.h"
+#include "BlockAlloc.h"
+#include "CNF.h"
+#include "RtsUtils.h"
+#include "Trace.h"
+#include "GetTime.h"
+
+#include <string.h> // for memset()
+
+/* Note [Concurrent mark]
+   ~~~~~~~~~~~~~~~~~~~~~~
+
+   With +RTS -xn the oldest generation is collected by the mark/sweep
+   collector (-w), but the marking is done by a separate OS thread
+   while the program runs.  A cycle looks like this:
+
+   - The *start pause* is an ordinary collection of all the younger
+     generations (nonmovingCollectGen() demotes the major GC that
+     calcNeeded() asked for).  Before the roots are traced,
+     nonmovingMaybeStartMark() takes a snapshot of the oldest
+     generation: its blocks, large objects and compact regions get
+     BF_NONMOVING, and a mark bitmap is allocated exactly as
+     prepare_collected_gen() does for -w.  The partly-filled GC blocks
+     are retired into the snapshot, so that anything promoted from now
+     on lands in fresh blocks, which are implicitly live.
+
+   - Whenever the GC finds a pointer into the snapshot (the
+     BF_EVACUATED case of evacuate()), it *shades* the object with
+     nonmovingShade(): the object is marked and recorded in a
+     per-gc_thread list of grey objects.  During the start pause this
+     catches every snapshot object reachable from the roots, the
+     younger generations and the remembered set.
+
+   - Between collections the marker thread traces from the grey
+     objects, marking the snapshot.  It never allocates from the
+     block allocator, and it stops before every GC
+     (nonmovingPauseMark()), so the mark bitmap and the grey lists
+     only ever have one writer.  TSOs, STACKs and AP_STACKs are
+     marked but left for the final pause to scan, since their
+     contents change under our feet.
+
+   - The mutator needs no new write barrier.  The existing
+     generational barrier puts every mutated object of the oldest
+     generation on a mutable list, and the next GC rescans it, shading
+     whatever it now points to.  That makes the generational barrier
+     an incremental-update barrier for free: a pointer can only hide
+     from the marker by being written into an object that has already
+     been scanned, and then that object is on a mutable list.
+
+   - When the marker runs out of work, the next GC becomes the *final
+     pause*: a major GC in which nonmovingPrepareFinal() turns the
+     snapshot into from-space, with the marks the thread has already
+     made.  Everything allocated since the start is in to-space.  The
+     mutable list of the oldest generation is kept and rescanned (see
+     scavenge_capability_mut_lists()), objects the marker had greyed
+     but not scanned yet are traced as roots (nonmovingMarkRoots()),
+     and sweep() then frees the empty blocks as usual.
+
+   Nothing in the snapshot moves during a cycle, so compaction (-c)
+   cannot be combined with -xn.  Fragmented blocks are only copied by
+   stop-the-world collections: when more than half of the oldest
+   generation is fragmented after a cycle, the next major GC is an
+   ordinary -w collection instead of a concurrent one.
+
+   CAFs are not on the mutable list when keepCAFs is set, but are then
+   roots of every GC (markCAFs()), so their values are shaded
+   every time.  We therefore retain all CAFs under -xn.
+
+   The non-threaded RTS has no thread to mark with, so the marking is
+   done at the end of the start pause; the cycle is still finished by
+   a separate final pause.
+*/
+
+/* Note [Incremental mark]
+   ~~~~~~~~~~~~~~~~~~~~~~~
+
+   With +RTS -xi<time> the cycle is the same as for -xn, but there is
+   no marker thread.  Instead the scheduler calls
+   nonmovingIncrementalSlice() between running Haskell threads, and it
+   marks for at most <time> before returning.  Slices never overlap a
+   GC: the capability running a slice holds on to it, so the GC cannot
+   start until the slice is over.  In the threaded RTS only one
+   capability runs a slice at a time.
+
+   The final pause does not sweep either.  nonmovingDeferSweep() leaves
+   the blocks of the snapshot, with their mark bitmap, at the front of
+   the oldest generation's block list, and later slices sweep them one
+   block at a time (sweep_some()), freeing the empty ones.  Blocks
+   promoted in the meantime are pushed on the front of the list, so a
+   slice finds its place again by looking for the next unswept block.
+   Any GC that wants to collect the oldest generation, or to start a
+   new cycle, finishes the sweep first (nonmovingFinishSweep()).
+
+   After a slice the program gets to run for at least as long as the
+   slice took, so a cycle never takes more than half the CPU.
+*/
+
+NonmovingState nonmoving_state = NONMOVING_IDLE;
+
+// number of grey objects in a chunk (a chunk is just under 16k)
+#define MARK_CHUNK_ENTRIES 1022
+
+// array elements marked in one step, to bound the work per object
+#define MARK_ARRAY_CHUNK 128
+
+// objects marked by the thread between checks for a pending GC
+#define MARK_BATCH 4096
+
+// objects marked or blocks swept by -xi between looks at the clock
+#define SLICE_BATCH 256
+
+typedef struct {
+    StgClosure *p;
+    StgWord     start;    // first array element still to be marked
+} MarkEntry;
+
+typedef struct NonmovingChunk_ {
+    struct NonmovingChunk_ *link;
+    uint32_t                n;
+    MarkEntry               entries[MARK_CHUNK_ENTRIES];
+} NonmovingChunk;
+
+static NonmovingChunk *mark_stack;    // grey objects, owned by the marker
+static NonmovingChunk *deferred;      // TSOs etc. left for the final pause
+static NonmovingChunk *shade_queue;   // grey objects handed over by the GC
+
+static bool mark_done;       // the marker has run out of grey objects
+static bool start_pending;   // the next GC should start a cycle
+static bool defrag_needed;   // the next major GC should be stop-the-world
+
+static uint32_t nonmoving_cycles;
+
+// incremental sweeping: see Note [Incremental mark]
+static bdescr  *sweep_next;    // next block to sweep
+static bdescr  *sweep_prev;    // the block before it, NULL if unknown
+static uint32_t sweep_left;    // block groups still to sweep
+static W_       sweep_freed;   // blocks freed so far
+static W_       sweep_fragd;   // fragmented blocks found so far
+
+// incremental slices
+static Time     last_slice_end;
+static Time     last_slice_len;
+static Time     max_slice_len;
+static uint32_t n_slices;
+#if defined(THREADED_RTS)
+static StgWord  slice_running;
+#endif
+
+#if defined(THREADED_RTS)
+static Mutex     nonmoving_mutex;
+static Condition marker_wakeup;   // signalled when there is marking to do
+static Condition marker_idle;     // signalled when the marker stops
+static bool      marker_started;
+static bool      marker_exit;
+static bool      marker_busy;     // the marker is tracing
+static bool      gc_running;      // the marker must not start tracing
+#endif
+
+/* -----------------------------------------------------------------------------
+   Chunked stacks of grey objects
+
+   These are malloc()'d rather than taken from the block allocator:
+   the marker must not take sm_mutex, since the GC holds it while
+   waiting for the marker to stop.
+   -------------------------------------------------------------------------- */
+
+static void
+push_entry (NonmovingChunk **stack, StgClosure *p, StgWord start)
+{
+    NonmovingChunk *c = *stack;
+
+    if (c == NULL || c->n == MARK_CHUNK_ENTRIES) {
+        c = stgMallocBytes(sizeof(NonmovingChunk), "push_entry");
+        c->link = *stack;
+        c->n = 0;
+        *stack = c;
+    }
+    c->entries[c->n].p = p;
+    c->entries[c->n].start = start;
+    c->n++;
+}
+
+static bool
+pop_entry (NonmovingChunk **stack, MarkEntry *e)
+{
+    NonmovingChunk *c;
+
+    while ((c = *stack) != NULL && c->n == 0) {
+        *stack = c->link;
+        stgFree(c);
+    }
+    if (c == NULL) return false;
+    *e = c->entries[--c->n];
+    return true;
+}
+
+static void
+append_chunks (NonmovingChunk **stack, NonmovingChunk *cs)
+{
+    NonmovingChunk *c;
+
+    if (cs == NULL) return;
+    for (c = cs; c->link != NULL; c = c->link) {}
+    c->link = *stack;
+    *stack = cs;
+}
+
+static void
+free_chunks (NonmovingChunk **stack)
+{
+    NonmovingChunk *c, *next;
+
+    for (c = *stack; c != NULL; c = next) {
+        next = c->link;
+        stgFree(c);
+    }
+    *stack = NULL;
+}
+
+/* -----------------------------------------------------------------------------
+   Marking
+   -------------------------------------------------------------------------- */
+
+// Set the mark bit of p, returning false if it was set already.  Several
+// GC threads may be shading objects in the same block, hence the cas().
+static bool
+try_mark (StgPtr p, bdescr *bd)
+{
+    uint32_t offset_within_block = p - bd->start; // in words
+    StgVolatilePtr bitmap_word = (StgVolatilePtr)bd->u.bitmap +
+        (offset_within_block / BITS_IN(W_));
+    StgWord bit_mask = (StgWord)1 << (offset_within_block & (BITS_IN(W_) - 1));
+    StgWord old;
+
+    do {
+        old = *bitmap_word;
+        if (old & bit_mask) return false;
+    } while (cas(bitmap_word, old, old | bit_mask) != old);
+
+    return true;
+}
+
+// A closure may be locked by the mutator (see lockClosure()), in which
+// case we wait for it to be unlocked before looking at its fields.
+static const StgInfoTable *
+get_itbl_concurrent (StgClosure *p)
+{
+    const StgInfoTable *info;
+
+    for (;;) {
+        info = (const StgInfoTable *)VOLATILE_LOAD(&p->header.info);
+        if (info != &stg_WHITEHOLE_info) break;
+#if defined(THREADED_RTS)
+        yieldThread();
+#endif
+    }
+    load_load_barrier();
+    return INFO_PTR_TO_STRUCT(info);
+}
+
+// Grey q if it is an unmarked object in the snapshot.  Called by the
+// marker only.
+static void
+mark_ref (StgClosure *q)
+{
+    bdescr *bd;
+
+    q = UNTAG_CLOSURE(q);
+    if (q == NULL || !HEAP_ALLOCED_GC(q)) return;
+
+    bd = Bdescr((StgPtr)q);
+
+    // a compact region is live as a whole, and has no pointers out of it
+    if (bd->flags & BF_COMPACT) {
+        bd = Bdescr((StgPtr)objectGetCompact(q));
+        if (bd->flags & BF_NONMOVING) {
+            bd->flags |= BF_NONMOVING_MARKED;
+        }
+        return;
+    }
+
+    if (!(bd->flags & BF_NONMOVING)) return;
+
+    if (bd->flags & BF_LARGE) {
+        if (bd->flags & BF_NONMOVING_MARKED) return;
+        bd->flags |= BF_NONMOVING_MARKED;
+        // pinned blocks only hold byte arrays
+        if (bd->flags & BF_PINNED) return;
+    } else {
+        if (is_marked((StgPtr)q, bd)) return;
+        mark((StgPtr)q, bd);
+    }
+
+    push_entry(&mark_stack, q, 0);
+}
+
+static void
+mark_small_bitmap (StgPtr p, StgWord size, StgWord bitmap)
+{
+    while (size > 0) {
+        if ((bitmap & 1) == 0) {
+            mark_ref((StgClosure *)*p);
+        }
+        p++;
+        bitmap = bitmap >> 1;
+        size--;
+    }
+}
+
+static void
+mark_large_bitmap (StgPtr p, StgLargeBitmap *large_bitmap, StgWord size)
+{
+    uint32_t i, j, b;
+    StgWord bitmap;
+
+    b = 0;
+
+    for (i = 0; i < size; b++) {
+        bitmap = large_bitmap->bitmap[b];
+        j = stg_min(size-i, BITS_IN(W_));
+        i += j;
+        for (; j > 0; j--, p++) {
+            if ((bitmap & 1) == 0) {
+                mark_ref((StgClosure *)*p);
+            }
+            bitmap = bitmap >> 1;
+        }
+    }
+}
+
+// cf. scavenge_PAP_payload()
+static void
+mark_PAP_payload (StgClosure *fun, StgClosure **payload, StgWord size)
+{
+    const StgFunInfoTable *fun_info;
+
+    mark_ref(fun);
+    fun_info = get_fun_itbl(UNTAG_CONST_CLOSURE(fun));
+
+    switch (fun_info->f.fun_type) {
+    case ARG_GEN:
+        mark_small_bitmap((StgPtr)payload, size,
+                          BITMAP_BITS(fun_info->f.b.bitmap));
+        break;
+    case ARG_GEN_BIG:
+        mark_large_bitmap((StgPtr)payload, GET_FUN_LARGE_BITMAP(fun_info),
+                          size);
+        break;
+    case ARG_BCO:
+        mark_large_bitmap((StgPtr)payload, BCO_BITMAP(UNTAG_CLOSURE(fun)),
+                          size);
+        break;
+    default:
+        mark_small_bitmap((StgPtr)payload, size,
+                          BITMAP_BITS(stg_arg_bitmaps[fun_info->f.fun_type]));
+        break;
+    }
+}
+
+// Scan a grey object.  Only the marker calls this, while the mutator
+// may be running, so every field is read exactly once.
+static void
+mark_object (StgClosure *p, StgWord start)
+{
+    const StgInfoTable *info;
+    StgWord i, end;
+
+    info = get_itbl_concurrent(p);
+
+    switch (info->type) {
+
+    case MVAR_CLEAN:
+    case MVAR_DIRTY:
+    {
+        StgMVar *mvar = (StgMVar *)p;
+        mark_ref((StgClosure *)mvar->head);
+        mark_ref((StgClosure *)mvar->tail);
+        mark_ref(mvar->value);
+        break;
+    }
+
+    case TVAR:
+    {
+        StgTVar *tvar = (StgTVar *)p;
+        mark_ref(tvar->current_value);
+        mark_ref(tvar->watchers);
+        break;
+    }
+
+    case MUT_VAR_CLEAN:
+    case MUT_VAR_DIRTY:
+        mark_ref(((StgMutVar *)p)->var);
+        break;
+
+    case BLOCKING_QUEUE:
+    {
+        StgBlockingQueue *bq = (StgBlockingQueue *)p;
+        mark_ref(bq->bh);
+        mark_ref((StgClosure *)bq->owner);
+        mark_ref((StgClosure *)bq->queue);
+        mark_ref((StgClosure *)bq->link);
+        break;
+    }
+
+    case IND:
+    case BLACKHOLE:
+        mark_ref(((StgInd *)p)->indirectee);
+        break;
+
+    case THUNK:
+    case THUNK_1_0:
+    case THUNK_0_1:
+    case THUNK_2_0:
+    case THUNK_1_1:
+    case THUNK_0_2:
+        for (i = 0; i < info->layout.payload.ptrs; i++) {
+            mark_ref(((StgThunk *)p)->payload[i]);
+        }
+        break;
+
+    case FUN:
+    case FUN_1_0:
+    case FUN_0_1:
+    case FUN_2_0:
+    case FUN_1_1:
+    case FUN_0_2:
+    case CONSTR:
+    case CONSTR_1_0:
+    case CONSTR_0_1:
+    case CONSTR_2_0:
+    case CONSTR_1_1:
+    case CONSTR_0_2:
+    case CONSTR_NOCAF:
+    case WEAK:
+    case PRIM:
+    case MUT_PRIM:
+        for (i = 0; i < info->layout.payload.ptrs; i++) {
+            mark_ref(p->payload[i]);
+        }
+        break;
+
+    case THUNK_SELECTOR:
+        mark_ref(((StgSelector *)p)->selectee);
+        break;
+
+    case AP:
+    {
+        StgAP *ap = (StgAP *)p;
+        mark_PAP_payload(ap->fun, ap->payload, ap->n_args);
+        break;
+    }
+
+    case PAP:
+    {
+        StgPAP *pap = (StgPAP *)p;
+        mark_PAP_payload(pap->fun, pap->payload, pap->n_args);
+        break;
+    }
+
+    case BCO:
+    {
+        StgBCO *bco = (StgBCO *)p;
+        mark_ref((StgClosure *)bco->instrs);
+        mark_ref((StgClosure *)bco->literals);
+        mark_ref((StgClosure *)bco->ptrs);
+        break;
+    }
+
+    case ARR_WORDS:
+        break;
+
+    case MUT_ARR_PTRS_CLEAN:
+    case MUT_ARR_PTRS_DIRTY:
+    case MUT_ARR_PTRS_FROZEN:
+    case MUT_ARR_PTRS_FROZEN0:
+    {
+        StgMutArrPtrs *a = (StgMutArrPtrs *)p;
+        end = stg_min(start + MARK_ARRAY_CHUNK, a->ptrs);
+        if (end < a->ptrs) {
+            push_entry(&mark_stack, p, end);
+        }
+        for (i = start; i < end; i++) {
+            mark_ref(a->payload[i]);
+        }
+        break;
+    }
+
+    case SMALL_MUT_ARR_PTRS_CLEAN:
+    case SMALL_MUT_ARR_PTRS_DIRTY:
+    case SMALL_MUT_ARR_PTRS_FROZEN:
+    case SMALL_MUT_ARR_PTRS_FROZEN0:
+    {
+        StgSmallMutArrPtrs *a = (StgSmallMutArrPtrs *)p;
+        for (i = 0; i < a->ptrs; i++) {
+            mark_ref(a->payload[i]);
+        }
+        break;
+    }
+
+    case TREC_CHUNK:
+    {
+        StgTRecChunk *tc = (StgTRecChunk *)p;
+        mark_ref((StgClosure *)tc->prev_chunk);
+        end = stg_min(tc->next_entry_idx, TREC_CHUNK_NUM_ENTRIES);
+        for (i = 0; i < end; i++) {
+            mark_ref((StgClosure *)tc->entries[i].tvar);
+            mark_ref(tc->entries[i].expected_value);
+            mark_ref(tc->entries[i].new_value);
+        }
+        break;
+    }
+
+    case TSO:
+    case STACK:
+    case AP_STACK:
+        push_entry(&deferred, p, 0);
+        break;
+
+    default:
+        barf("mark_object: strange closure type %d @ %p",
+             (int)info->type, p);
+    }
+}
+
+// Mark at most limit objects.  Returns false if there is nothing left
+// to mark.
+static bool
+mark_some (uint32_t limit)
+{
+    MarkEntry e;
+    uint32_t n;
+
+    for (n = 0; n < limit; n++) {
+        if (!pop_entry(&mark_stack, &e)) {
+            if (shade_queue == NULL) return false;
+            append_chunks(&mark_stack, shade_queue);
+            shade_queue = NULL;
+            continue;
+        }
+        mark_object(e.p, e.start);
+    }
+    return true;
+}
+
+/* -----------------------------------------------------------------------------
+   The marker thread
+   -------------------------------------------------------------------------- */
+
+#if defined(THREADED_RTS)
+
+static void OSThreadProcAttr
+nonmovingMarkThread (void *arg STG_UNUSED)
+{
+    bool more;
+
+    ACQUIRE_LOCK(&nonmoving_mutex);
+    while (!marker_exit) {
+        if (gc_running || nonmoving_state != NONMOVING_MARKING || mark_done) {
+            waitCondition(&marker_wakeup, &nonmoving_mutex);
+            continue;
+        }
+        marker_busy = true;
+        RELEASE_LOCK(&nonmoving_mutex);
+
+        more = mark_some(MARK_BATCH);
+
+        ACQUIRE_LOCK(&nonmoving_mutex);
+        marker_busy = false;
+        if (!more) {
+            mark_done = true;
+            debugTrace(DEBUG_gc, "concurrent mark: marker out of work");
+        }
+        if (gc_running) {
+            signalCondition(&marker_idle);
+        }
+    }
+    marker_started = false;
+    broadcastCondition(&marker_idle);
+    RELEASE_LOCK(&nonmoving_mutex);
+}
+
+static void
+start_marker (void)
+{
+    OSThreadId tid;
+
+    initMutex(&nonmoving_mutex);
+    initCondition(&marker_wakeup);
+    initCondition(&marker_idle);
+    marker_exit = false;
+    marker_busy = false;
+    gc_running = false;
+    marker_started = true;
+
+    if (createOSThread(&tid, "ghc_marker",
+                       (OSThreadProc*)nonmovingMarkThread, NULL) != 0) {
+        sysErrorBelch("failed to create the concurrent marker thread");
+        stg_exit(EXIT_FAILURE);
+    }
+}
+
+#endif
+
+static bool
+marker_finished (void)
+{
+    bool done;
+
+#if defined(THREADED_RTS)
+    ACQUIRE_LOCK(&nonmoving_mutex);
+    done = mark_done;
+    RELEASE_LOCK(&nonmoving_mutex);
+#else
+    done = mark_done;
+#endif
+    return done;
+}
+
+void
+initNonmovingMark (void)
+{
+    // See Note [Concurrent mark]
+    keepCAFs = true;
+
+#if defined(THREADED_RTS)
+    if (RtsFlags.GcFlags.incrementalSlice == 0) {
+        start_marker();
+    } else {
+        // no marker thread; see Note [Incremental mark]
+        initMutex(&nonmoving_mutex);
+    }
+#endif
+}
+
+void
+exitNonmovingMark (void)
+{
+#if defined(THREADED_RTS)
+    if (marker_started) {
+        ACQUIRE_LOCK(&nonmoving_mutex);
+        marker_exit = true;
+        signalCondition(&marker_wakeup);
+        while (marker_started) {
+            waitCondition(&marker_idle, &nonmoving_mutex);
+        }
+        RELEASE_LOCK(&nonmoving_mutex);
+        closeCondition(&marker_wakeup);
+        closeCondition(&marker_idle);
+        closeMutex(&nonmoving_mutex);
+    } else if (RtsFlags.GcFlags.incrementalSlice != 0) {
+        closeMutex(&nonmoving_mutex);
+    }
+#endif
+
+    free_chunks(&mark_stack);
+    free_chunks(&deferred);
+    free_chunks(&shade_queue);
+
+    debugTrace(DEBUG_gc, "concurrent mark: %d cycles", nonmoving_cycles);
+    if (n_slices != 0) {
+        debugTrace(DEBUG_gc, "incremental mark: %d slices, longest %" FMT_Word64 "us",
+                   n_slices, (StgWord64)TimeToUS(max_slice_len));
+    }
+}
+
+#if defined(THREADED_RTS)
+// The marker thread does not survive forkProcess(); start a new one in
+// the child, which carries on with the cycle in progress.
+void
+restartNonmovingMark (void)
+{
+    if (marker_started) {
+        start_marker();
+    }
+}
+#endif
+
+void
+nonmovingPauseMark (void)
+{
+#if defined(THREADED_RTS)
+    if (!marker_started) return;
+
+    ACQUIRE_LOCK(&nonmoving_mutex);
+    gc_running = true;
+    while (marker_busy) {
+        waitCondition(&marker_idle, &nonmoving_mutex);
+    }
+    RELEASE_LOCK(&nonmoving_mutex);
+#endif
+}
+
+void
+nonmovingResumeMark (void)
+{
+#if defined(THREADED_RTS)
+    if (!marker_started) return;
+
+    ACQUIRE_LOCK(&nonmoving_mutex);
+    gc_running = false;
+    if (nonmoving_state == NONMOVING_MARKING && !mark_done) {
+        signalCondition(&marker_wakeup);
+    }
+    RELEASE_LOCK(&nonmoving_mutex);
+#else
+    // under -xi the scheduler does the marking
+    if (nonmoving_state == NONMOVING_MARKING && !mark_done &&
+        RtsFlags.GcFlags.incrementalSlice == 0) {
+        while (mark_some(MARK_BATCH)) {}
+        mark_done = true;
+    }
+#endif
+}
+
+/* -----------------------------------------------------------------------------
+   Incremental marking and sweeping (-xi)
+
+   See Note [Incremental mark].
+   -------------------------------------------------------------------------- */
+
+// Sweep at most limit block groups of the snapshot.  Returns false if
+// the sweep is finished.  The caller holds sm_mutex.
+static bool
+sweep_some (uint32_t limit)
+{
+    generation *gen = oldest_gen;
+    bdescr *bd, *prev, *next;
+    W_ resid;
+    uint32_t i, n;
+
+    // blocks promoted since the last slice were pushed on the front
+    prev = sweep_prev;
+    if (prev == NULL && gen->blocks != sweep_next) {
+        for (prev = gen->blocks; prev->link != sweep_next; prev = prev->link) {
+            ASSERT(prev->link != NULL);
+        }
+    }
+
+    for (n = 0; n < limit && sweep_left > 0; n++, sweep_left--) {
+        bd = sweep_next;
+        next = bd->link;
+
+        // the same as sweep()
+        resid = 0;
+        for (i = 0; i < BLOCK_SIZE_W / BITS_IN(W_); i++) {
+            if (bd->u.bitmap[i] != 0) resid++;
+        }
+
+        if (resid == 0) {
+            if (prev == NULL) {
+                gen->blocks = next;
+            } else {
+                prev->link = next;
+            }
+            gen->n_blocks -= bd->blocks;
+            gen->n_words  -= bd->free - bd->start;
+            sweep_freed   += bd->blocks;
+            freeGroup(bd);
+        } else {
+            if (resid < (BLOCK_SIZE_W * 3) / (BITS_IN(W_) * 4)) {
+                bd->flags |= BF_FRAGMENTED;
+            }
+            if (bd->flags & BF_FRAGMENTED) {
+                sweep_fragd += bd->blocks;
+            }
+            prev = bd;
+        }
+        sweep_next = next;
+    }
+
+    sweep_prev = prev;
+    return sweep_left > 0;
+}
+
+// The caller holds sm_mutex.
+static void
+sweep_done (void)
+{
+    generation *gen = oldest_gen;
+
+    if (gen->bitmap != NULL) {
+        freeGroup(gen->bitmap);
+        gen->bitmap = NULL;
+    }
+
+    defrag_needed = sweep_fragd * 2 > gen->n_blocks;
+    nonmoving_state = NONMOVING_IDLE;
+
+    debugTrace(DEBUG_gc, "incremental sweep: %" FMT_Word " blocks freed, "
+               "%" FMT_Word " of %" FMT_Word " blocks fragmented",
+               sweep_freed, sweep_fragd, (W_)gen->n_blocks);
+}
+
+// Called during GC, before the oldest generation is collected or
+// snapshotted, to finish an incremental sweep in one go.
+void
+nonmovingFinishSweep (void)
+{
+    if (nonmoving_state != NONMOVING_SWEEPING) return;
+
+    while (sweep_some(UINT32_MAX)) {}
+    sweep_done();
+}
+
+// Called by the final pause instead of sweep(): the snapshot is put back
+// in the oldest generation unswept, in front of the blocks filled during
+// the cycle (see the tidy loop in GarbageCollect()).
+void
+nonmovingDeferSweep (generation *gen)
+{
+    bdescr *bd;
+
+    ASSERT(nonmoving_state == NONMOVING_FINAL);
+
+    sweep_left = 0;
+    for (bd = gen->old_blocks; bd != NULL; bd = bd->link) {
+        sweep_left++;
+    }
+    sweep_freed = 0;
+    sweep_fragd = 0;
+
+    // the live data is not known until the sweep is done
+    gen->live_estimate = 0;
+}
+
+void
+nonmovingIncrementalSlice (void)
+{
+    Time start, now;
+    bool more;
+
+    if (nonmoving_state == NONMOVING_IDLE ||
+        (nonmoving_state == NONMOVING_MARKING && mark_done)) {
+        return;
+    }
+
+    // let the program run for at least as long as the last slice
+    start = getProcessElapsedTime();
+    if (start < last_slice_end + last_slice_len) return;
+
+#if defined(THREADED_RTS)
+    if (cas(&slice_running, 0, 1) != 0) return;
+#endif
+
+    do {
+        if (nonmoving_state == NONMOVING_MARKING) {
+            more = mark_some(SLICE_BATCH);
+            if (!more) {
+                ACQUIRE_LOCK(&nonmoving_mutex);
+                mark_done = true;
+                RELEASE_LOCK(&nonmoving_mutex);
+                debugTrace(DEBUG_gc, "incremental mark: out of work");
+            }
+        } else if (nonmoving_state == NONMOVING_SWEEPING) {
+            ACQUIRE_SM_LOCK;
+            more = sweep_some(SLICE_BATCH);
+            if (!more) {
+                sweep_done();
+            }
+            RELEASE_SM_LOCK;
+        } else {
+            more = false;
+        }
+        now = getProcessElapsedTime();
+    } while (more && now - start < RtsFlags.GcFlags.incrementalSlice);
+
+    last_slice_end = now;
+    last_slice_len = now - start;
+    if (last_slice_len > max_slice_len) {
+        max_slice_len = last_slice_len;
+    }
+    n_slices++;
+
+#if defined(THREADED_RTS)
+    write_barrier();
+    slice_running = 0;
+#endif
+}
+
+/* -----------------------------------------------------------------------------
+   Scheduling a cycle
+   -------------------------------------------------------------------------- */
+
+uint32_t
+nonmovingCollectGen (uint32_t collect_gen, bool force_major)
+{
+    const uint32_t oldest = oldest_gen->no;
+
+    if (nonmoving_state == NONMOVING_MARKING) {
+        // Finish the cycle when the marker has run out of work, or when
+        // the program is promoting data faster than we can mark it.
+        if (force_major || marker_finished() ||
+            (oldest_gen->max_blocks != 0 &&
+             genLiveBlocks(oldest_gen) > 2 * oldest_gen->max_blocks)) {
+            return oldest;
+        }
+        return stg_min(collect_gen, oldest - 1);
+    }
+
+    if (collect_gen == oldest && !force_major && !defrag_needed) {
+        start_pending = true;
+        return oldest - 1;
+    }
+
+    return collect_gen;
+}
+
+/* -----------------------------------------------------------------------------
+   The start pause
+
+   Called after the generations have been prepared for GC, and before
+   any roots are traced, so that every pointer into the snapshot the GC
+   finds gets shaded.
+   -------------------------------------------------------------------------- */
+
+void
+nonmovingMaybeStartMark (void)
+{
+    generation *gen = oldest_gen;
+    gen_workspace *ws;
+    bdescr *bd, *next;
+    StgWord bitmap_size; // in bytes
+    StgWord *bitmap;
+    uint32_t n;
+
+    if (!start_pending) return;
+    start_pending = false;
+
+    // the previous cycle must be swept before the next one starts
+    nonmovingFinishSweep();
+
+    // all the younger generations must be collected by this GC
+    if (nonmoving_state != NONMOVING_IDLE || N + 1 != gen->no) return;
+
+    // Retire the partly-filled blocks in the gc_thread workspaces, so
+    // that objects promoted from now on are not in the snapshot.
+    for (n = 0; n < n_capabilities; n++) {
+        ws = &gc_threads[n]->gens[gen->no];
+
+        for (bd = ws->part_list; bd != NULL; bd = next) {
+            next = bd->link;
+            bd->link = gen->blocks;
+            gen->blocks = bd;
+            gen->n_blocks += bd->blocks;
+            gen->n_words += bd->free - bd->start;
+        }
+        ws->part_list = NULL;
+        ws->n_part_blocks = 0;
+        ws->n_part_words = 0;
+
+        if (ws->todo_free != ws->todo_bd->start) {
+            bd = ws->todo_bd;
+            bd->free = ws->todo_free;
+            bd->link = gen->blocks;
+            gen->blocks = bd;
+            gen->n_blocks += bd->blocks;
+            gen->n_words += bd->free - bd->start;
+            alloc_todo_block(ws,0); // always has one block.
+        }
+    }
+
+    ASSERT(gen->bitmap == NULL);
+
+    bitmap_size = gen->n_blocks * BLOCK_SIZE / BITS_IN(W_);
+
+    if (bitmap_size > 0) {
+        gen->bitmap = allocGroup((StgWord)BLOCK_ROUND_UP(bitmap_size)
+                                 / BLOCK_SIZE);
+        bitmap = gen->bitmap->start;
+        memset(bitmap, 0, bitmap_size);
+
+        // BF_EVACUATED stays set, so the GC treats the snapshot as
+        // to-space until the final pause.
+        for (bd = gen->blocks; bd != NULL; bd = bd->link) {
+            bd->u.bitmap = bitmap;
+            bitmap += BLOCK_SIZE_W / BITS_IN(W_);
+            bd->flags |= BF_NONMOVING | BF_MARKED;
+        }
+    }
+
+    for (bd = gen->large_objects; bd != NULL; bd = bd->link) {
+        bd->flags |= BF_NONMOVING;
+        bd->flags &= ~BF_NONMOVING_MARKED;
+    }
+
+    for (bd = gen->compact_objects; bd != NULL; bd = bd->link) {
+        bd->flags |= BF_NONMOVING;
+        bd->flags &= ~BF_NONMOVING_MARKED;
+    }
+
+    mark_done = false;
+    nonmoving_state = NONMOVING_MARKING;
+    nonmoving_cycles++;
+
+    debugTrace(DEBUG_gc, "concurrent mark: snapshot of %" FMT_Word " blocks",
+               gen->n_blocks + gen->n_large_blocks + gen->n_compact_blocks);
+}
+
+/* -----------------------------------------------------------------------------
+   Shading
+
+   Called by evacuate() on a pointer into the snapshot.  The marker is
+   stopped, so the mark state can only change under us by other GC
+   threads shading the same objects.
+   -------------------------------------------------------------------------- */
+
+void
+nonmovingShade (StgClosure *q)
+{
+    bdescr *bd;
+
+    bd = Bdescr((StgPtr)q);
+
+    if (bd->flags & BF_COMPACT) {
+        bd = Bdescr((StgPtr)objectGetCompact(q));
+    }
+
+    if (bd->flags & (BF_LARGE | BF_COMPACT)) {
+        bool grey;
+
+        if (bd->flags & BF_NONMOVING_MARKED) return;
+
+        ACQUIRE_SPIN_LOCK(&bd->gen->sync);
+        grey = !(bd->flags & BF_NONMOVING_MARKED);
+        bd->flags |= BF_NONMOVING_MARKED;
+        RELEASE_SPIN_LOCK(&bd->gen->sync);
+
+        if (!grey || (bd->flags & (BF_PINNED | BF_COMPACT))) return;
+    } else {
+        if (is_marked((StgPtr)q, bd)) return;
+        if (!try_mark((StgPtr)q, bd)) return;
+    }
+
+    push_entry(&gct->nonmoving_shade, q, 0);
+}
+
+// Called at the end of every GC: hand the objects shaded by the GC
+// threads over to the marker.  The marker is stopped.
+void
+nonmovingFlushShades (void)
+{
+    uint32_t n;
+
+    for (n = 0; n < n_capabilities; n++) {
+        if (gc_threads[n]->nonmoving_shade != NULL) {
+            append_chunks(&shade_queue, gc_threads[n]->nonmoving_shade);
+            gc_threads[n]->nonmoving_shade = NULL;
+            mark_done = false;
+        }
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   The final pause
+   -------------------------------------------------------------------------- */
+
+// Clear the marks of objects that are grey but not scanned, so that the
+// GC traces them when nonmovingMarkRoots() evacuates them.
+static void
+ungrey_chunks (NonmovingChunk *c)
+{
+    bdescr *bd;
+    uint32_t i;
+
+    for (; c != NULL; c = c->link) {
+        for (i = 0; i < c->n; i++) {
+            bd = Bdescr((StgPtr)c->entries[i].p);
+            if (bd->flags & BF_LARGE) {
+                bd->flags &= ~BF_NONMOVING_MARKED;
+            } else {
+                unmark((StgPtr)c->entries[i].p, bd);
+            }
+        }
+    }
+}
+
+// Called by prepare_collected_gen() for the oldest generation, instead
+// of the usual preparation, when a concurrent mark is in progress.  The
+// mutable lists have been stashed already.
+void
+nonmovingPrepareFinal (generation *gen)
+{
+    bdescr *bd, *next, *kept;
+    StgCompactNFData *str;
+
+    ASSERT(gen == oldest_gen);
+    ASSERT(nonmoving_state == NONMOVING_MARKING);
+
+    ungrey_chunks(mark_stack);
+    ungrey_chunks(deferred);
+    ungrey_chunks(shade_queue);
+
+    // The snapshot becomes from-space, keeping its mark bitmap.  Blocks
+    // filled since the start of the cycle stay in to-space.
+    gen->old_blocks   = NULL;
+    gen->n_old_blocks = 0;
+    kept = NULL;
+    gen->n_blocks = 0;
+    gen->n_words  = 0;
+    gen->live_estimate = 0;
+
+    for (bd = gen->blocks; bd != NULL; bd = next) {
+        next = bd->link;
+        if (bd->flags & BF_NONMOVING) {
+            bd->flags &= ~(BF_NONMOVING | BF_EVACUATED | BF_SWEPT);
+            bd->link = gen->old_blocks;
+            gen->old_blocks = bd;
+            gen->n_old_blocks += bd->blocks;
+        } else {
+            bd->link = kept;
+            kept = bd;
+            gen->n_blocks += bd->blocks;
+            gen->n_words  += bd->free - bd->start;
+        }
+    }
+    gen->blocks = kept;
+
+    // Large objects reached by the mark, or promoted since the start of
+    // the cycle, are live; the others are from-space.
+    for (bd = gen->large_objects; bd != NULL; bd = next) {
+        next = bd->link;
+        if (!(bd->flags & BF_NONMOVING) || (bd->flags & BF_NONMOVING_MARKED)) {
+            dbl_link_remove(bd, &gen->large_objects);
+            dbl_link_onto(bd, &gen->scavenged_large_objects);
+            gen->n_scavenged_large_blocks += bd->blocks;
+            // a large object allocated during the cycle may be dead, and
+            // point to objects we are about to free; see checkLargeObjects()
+            if (bd->flags & BF_NONMOVING) {
+                bd->flags &= ~BF_SWEPT;
+            } else {
+                bd->flags |= BF_SWEPT;
+            }
+        } else {
+            bd->flags &= ~BF_EVACUATED;
+        }
+        bd->flags &= ~(BF_NONMOVING | BF_NONMOVING_MARKED);
+    }
+
+    // Same for compact regions (see evacuate_compact())
+    for (bd = gen->compact_objects; bd != NULL; bd = next) {
+        next = bd->link;
+        if (!(bd->flags & BF_NONMOVING) || (bd->flags & BF_NONMOVING_MARKED)) {
+            str = ((StgCompactNFDataBlock *)bd->start)->owner;
+            dbl_link_remove(bd, &gen->compact_objects);
+            if (str->hash) {
+                gen_workspace *ws = &gct->gens[gen->no];
+                bd->link = ws->todo_large_objects;
+                ws->todo_large_objects = bd;
+            } else {
+                dbl_link_onto(bd, &gen->live_compact_objects);
+                gen->n_live_compact_blocks += str->totalW / BLOCK_SIZE_W;
+            }
+        } else {
+            bd->flags &= ~BF_EVACUATED;
+        }
+        bd->flags &= ~(BF_NONMOVING | BF_NONMOVING_MARKED);
+    }
+
+    nonmoving_state = NONMOVING_FINAL;
+}
+
+static void
+evac_chunks (NonmovingChunk **stack, evac_fn evac, void *user)
+{
+    MarkEntry e;
+    StgClosure *q;
+
+    while (pop_entry(stack, &e)) {
+        q = e.p;
+        evac(user, &q);
+    }
+}
+
+// The objects the marker had not scanned are roots of the final pause.
+void
+nonmovingMarkRoots (evac_fn evac, void *user)
+{
+    if (nonmoving_state != NONMOVING_FINAL) return;
+
+    evac_chunks(&mark_stack, evac, user);
+    evac_chunks(&deferred, evac, user);
+    evac_chunks(&shade_queue, evac, user);
+}
+
+// Called at the end of every major GC under -xn.
+void
+nonmovingEndMajor (void)
+{
+    gen_workspace *ws;
+    bdescr *bd;
+    W_ fragd = 0;
+    uint32_t n;
+
+    if (nonmoving_state != NONMOVING_FINAL) {
+        // a stop-the-world collection has copied the live data out of
+        // the fragmented blocks
+        defrag_needed = false;
+        return;
+    }
+
+    // Blocks filled during the cycle were not swept: they may hold dead
+    // objects that point to objects we have just freed.  BF_SWEPT tells
+    // the sanity checker not to look inside them, nor inside the blocks
+    // of an incremental sweep, which are still to be swept.
+    for (bd = oldest_gen->blocks; bd != NULL; bd = bd->link) {
+        if (bd->flags & BF_FRAGMENTED) {
+            fragd += bd->blocks;
+        }
+        bd->flags |= BF_SWEPT;
+    }
+    for (n = 0; n < n_capabilities; n++) {
+        ws = &gc_threads[n]->gens[oldest_gen->no];
+        for (bd = ws->part_list; bd != NULL; bd = bd->link) {
+            bd->flags |= BF_SWEPT;
+        }
+        ws->todo_bd->flags |= BF_SWEPT;
+    }
+
+    if (RtsFlags.GcFlags.incrementalSlice != 0 && sweep_left > 0) {
+        // see nonmovingDeferSweep(); the bitmap is kept for the sweep
+        sweep_next = oldest_gen->blocks;
+        sweep_prev = NULL;
+        nonmoving_state = NONMOVING_SWEEPING;
+        debugTrace(DEBUG_gc, "concurrent mark: cycle %d marked, "
+                   "%d block groups to sweep", nonmoving_cycles, sweep_left);
+        return;
+    }
+
+    defrag_needed = fragd * 2 > oldest_gen->n_blocks;
+    nonmoving_state = NONMOVING_IDLE;
+
+    debugTrace(DEBUG_gc, "concurrent mark: cycle %d done, "
+               "%" FMT_Word " of %" FMT_Word " blocks fragmented",
+               nonmoving_cycles, fragd, (W_)oldest_gen->n_blocks);
+}
@@ -0,0 +1,55 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2017
+ *
+ * Concurrent marking of the oldest generation (+RTS -xn)
+ *
+ * Documentation on the architecture of the Garbage Collector can be
+ * found in the online commentary:
+ *
+ *   http://ghc.haskell.org/trac/ghc/wiki/Commentary/Rts/Storage/GC
+ *
+ * ---------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "GC.h"
+
+#include "BeginPrivate.h"
+
+typedef enum {
+    NONMOVING_IDLE,      // no concurrent mark in progress
+    NONMOVING_MARKING,   // the snapshot is being marked
+    NONMOVING_FINAL,     // the final pause is running (during GC only)
+    NONMOVING_SWEEPING   // the snapshot is being swept (-xi only)
+} NonmovingState;
+
+extern NonmovingState nonmoving_state;
+
+void     initNonmovingMark     ( void );
+void     exitNonmovingMark     ( void );
+#if defined(THREADED_RTS)
+void     restartNonmovingMark  ( void );
+#endif
+
+// Called by the scheduler to decide which generation to collect
+uint32_t nonmovingCollectGen   ( uint32_t collect_gen, bool force_major );
+
+// Stop/restart the marker around a GC
+void     nonmovingPauseMark    ( void );
+void     nonmovingResumeMark   ( void );
+
+// Called by the scheduler under -xi
+void     nonmovingIncrementalSlice ( void );
+
+// Called by the GC
+void     nonmovingMaybeStartMark ( void );
+void     nonmovingFinishSweep  ( void );
+void     nonmovingShade        ( StgClosure *q );
+void     nonmovingFlushShades  ( void );
+void     nonmovingPrepareFinal ( generation *gen );
+void     nonmovingDeferSweep   ( generation *gen );
+void     nonmovingMarkRoots    ( evac_fn evac, void *user );
+void     nonmovingEndMajor     ( void );
+
+#include "EndPrivate.h"
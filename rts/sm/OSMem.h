@@ -23,6 +23,20 @@ uint32_t osNumaNodes(void);
 uint64_t osNumaMask(void);
 void osBindMBlocksToNode(void *addr, StgWord size, uint32_t node);
 
+// Huge pages (+RTS --huge-pages), see Note [Huge pages] in MBlock.c
+#define HUGE_PAGE_SIZE (2*1024*1024)
+
+// Ask the OS to back the given committed memory with transparent huge
+// pages.  Returns false if the OS can't do that.
+bool osAdviseHugePages(void *p, W_ len);
+
+// Replace the committed memory [p, p+len) with a private (copy-on-write)
+// mapping of len bytes of the file fd, from offset, which must be a
+// multiple of the page size.  Returns false, leaving the memory committed
+// but with undefined contents, if the OS can't do that.  Otherwise the
+// memory can be used, decommitted and freed like any other.
+bool osMapFile(void *p, W_ len, int fd, StgWord64 offset);
+
 INLINE_HEADER size_t
 roundDownToPage (size_t x)
 {
@@ -78,6 +92,14 @@ void osCommitMemory(void *p, W_ len);
 // from top are concerned).
 void osDecommitMemory(void *p, W_ len);
 
+// Commit a piece of reserved address space, like osCommitMemory, but
+// back it with explicit (hugetlbfs) huge pages.  @p and @len must be
+// multiples of HUGE_PAGE_SIZE.  Returns false, leaving the address
+// space reserved but not committed, if the OS cannot give us enough
+// huge pages.  Memory committed this way cannot be decommitted with
+// osDecommitMemory, only released with osReleaseHeapMemory.
+bool osCommitHugeMemory(void *p, W_ len);
+
 // Release the address space previously obtained and undo the effects of
 // osReserveHeapMemory
 //
@@ -466,13 +466,61 @@ void
 checkLargeObjects(bdescr *bd)
 {
   while (bd != NULL) {
-    if (!(bd->flags & BF_PINNED)) {
+    // BF_SWEPT large objects were allocated during a concurrent mark
+    // (-xn) and retained without being traced, so they may be dead and
+    // refer to objects that have since been freed.
+    if (!(bd->flags & (BF_PINNED | BF_SWEPT))) {
       checkClosure((StgClosure *)bd->start);
     }
     bd = bd->link;
   }
 }
 
+/* -----------------------------------------------------------------------------
+   Check the result of compacting the oldest generation.
+
+   Called by compact() on gen->old_blocks, when the objects have been
+   moved but the rest of the heap has not been tidied up yet.  The
+   objects must tile the blocks, with no threaded info pointers left.
+   The parallel compaction (compactParFinish()) slides the objects of
+   each of n_regions regions separately: it must have kept the live_words
+   it counted, and used at most one more block per region than the serial
+   algorithm, which we work out from the sizes of the objects.
+   -------------------------------------------------------------------------- */
+
+void
+checkCompactedGen (generation *gen, W_ live_words, uint32_t n_regions)
+{
+    bdescr *bd;
+    StgPtr p;
+    W_ live, size, blocks, serial_blocks, serial_free;
+
+    live = 0;
+    blocks = 0;
+    serial_blocks = 1;
+    serial_free = 0;
+
+    for (bd = gen->old_blocks; bd != NULL; bd = bd->link) {
+        ASSERT(bd->free >= bd->start && bd->free <= bd->start + BLOCK_SIZE_W);
+        blocks++;
+        for (p = bd->start; p < bd->free; p += size) {
+            ASSERT(LOOKS_LIKE_INFO_PTR((StgWord)((StgClosure *)p)->header.info));
+            size = closure_sizeW((StgClosure *)p);
+            if (serial_free + size > BLOCK_SIZE_W) {
+                serial_blocks++;
+                serial_free = 0;
+            }
+            serial_free += size;
+            live += size;
+        }
+        ASSERT(p == bd->free);
+    }
+
+    ASSERT(blocks == gen->n_old_blocks);
+    ASSERT(live_words == 0 || live == live_words);
+    ASSERT(blocks <= serial_blocks + n_regions - 1);
+}
+
 static void
 checkCompactObjects(bdescr *bd)
 {
@@ -541,6 +589,8 @@ checkTSO(StgTSO *tso)
         || tso->why_blocked == BlockedOnMVarRead
         || tso->why_blocked == BlockedOnBlackHole
         || tso->why_blocked == BlockedOnMsgThrowTo
+        || tso->why_blocked == BlockedOnSTM
+        || tso->why_blocked == ThreadStealable
         || tso->why_blocked == NotBlocked
         ) {
         ASSERT(LOOKS_LIKE_CLOSURE_PTR(tso->block_info.closure));
@@ -798,6 +848,9 @@ findMemoryLeak (void)
         markBlocks(generations[g].blocks);
         markBlocks(generations[g].large_objects);
         markCompactBlocks(generations[g].compact_objects);
+        if (generations[g].bitmap != NULL) {
+            markBlocks(generations[g].bitmap);
+        }
     }
 
     for (i = 0; i < n_nurseries; i++) {
@@ -807,6 +860,7 @@ findMemoryLeak (void)
     for (i = 0; i < n_capabilities; i++) {
         markBlocks(gc_threads[i]->free_blocks);
         markBlocks(capabilities[i]->pinned_object_block);
+        markBlocks(capabilities[i]->block_cache);
     }
 
 #if defined(PROFILING)
@@ -872,6 +926,8 @@ genBlocks (generation *gen)
     ASSERT(countCompactBlocks(gen->compact_objects) == gen->n_compact_blocks);
     ASSERT(countCompactBlocks(gen->compact_blocks_in_import) == gen->n_compact_blocks_in_import);
     return gen->n_blocks + gen->n_old_blocks +
+        // the mark bitmap survives between GCs during a concurrent mark
+        (gen->bitmap != NULL ? gen->bitmap->blocks : 0) +
         countAllocdBlocks(gen->large_objects) +
         countAllocdCompactBlocks(gen->compact_objects) +
         countAllocdCompactBlocks(gen->compact_blocks_in_import);
@@ -907,6 +963,7 @@ memInventory (bool show)
   }
   for (i = 0; i < n_capabilities; i++) {
       gc_free_blocks += countBlocks(gc_threads[i]->free_blocks);
+      gc_free_blocks += capabilities[i]->n_block_cache;
       if (capabilities[i]->pinned_object_block != NULL) {
           nursery_blocks += capabilities[i]->pinned_object_block->blocks;
       }
@@ -25,6 +25,7 @@ void checkNurserySanity ( nursery *nursery );
 void checkHeapChain     ( bdescr *bd );
 void checkHeapChunk     ( StgPtr start, StgPtr end );
 void checkLargeObjects  ( bdescr *bd );
+void checkCompactedGen  ( generation *gen, W_ live_words, uint32_t n_regions );
 void checkTSO           ( StgTSO* tso );
 void checkGlobalTSOList ( bool checkTSOs );
 void checkStaticObjects ( StgClosure* static_objects );
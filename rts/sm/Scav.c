@@ -28,6 +28,7 @@
 #include "Capability.h"
 #include "LdvProfile.h"
 #include "Hash.h"
+#include "NonMovingMark.h"
 
 #include "sm/MarkWeak.h"
 
@@ -82,6 +83,8 @@ scavengeTSO (StgTSO *tso)
         || tso->why_blocked == BlockedOnMVarRead
         || tso->why_blocked == BlockedOnBlackHole
         || tso->why_blocked == BlockedOnMsgThrowTo
+        || tso->why_blocked == BlockedOnSTM // see Note [STM wakeup batching]
+        || tso->why_blocked == ThreadStealable
         || tso->why_blocked == NotBlocked
         ) {
         evacuate(&tso->block_info.closure);
@@ -517,7 +520,7 @@ scavenge_block (bdescr *bd)
         StgTVar *tvar = ((StgTVar *)p);
         gct->eager_promotion = false;
         evacuate((StgClosure **)&tvar->current_value);
-        evacuate((StgClosure **)&tvar->first_watch_queue_entry);
+        evacuate((StgClosure **)&tvar->watchers);
         gct->eager_promotion = saved_eager_promotion;
 
         if (gct->failed_to_evac) {
@@ -945,7 +948,7 @@ scavenge_mark_stack(void)
             StgTVar *tvar = ((StgTVar *)p);
             gct->eager_promotion = false;
             evacuate((StgClosure **)&tvar->current_value);
-            evacuate((StgClosure **)&tvar->first_watch_queue_entry);
+            evacuate((StgClosure **)&tvar->watchers);
             gct->eager_promotion = saved_eager_promotion;
 
             if (gct->failed_to_evac) {
@@ -1311,7 +1314,7 @@ scavenge_one(StgPtr p)
         StgTVar *tvar = ((StgTVar *)p);
         gct->eager_promotion = false;
         evacuate((StgClosure **)&tvar->current_value);
-        evacuate((StgClosure **)&tvar->first_watch_queue_entry);
+        evacuate((StgClosure **)&tvar->watchers);
         gct->eager_promotion = saved_eager_promotion;
 
         if (gct->failed_to_evac) {
@@ -1680,6 +1683,20 @@ scavenge_mutable_list(bdescr *bd, generation *gen)
             }
 #endif
 
+            // In the final pause of a concurrent mark, an object in the
+            // snapshot that the marker has not reached may still be
+            // live: treat it as a root (see Note [Concurrent mark]).
+            if (nonmoving_state == NONMOVING_FINAL && gen == oldest_gen &&
+                HEAP_ALLOCED_GC(p)) {
+                bdescr *pbd = Bdescr(p);
+                if (!(pbd->flags & BF_EVACUATED) &&
+                    !((pbd->flags & BF_MARKED) && is_marked(p, pbd))) {
+                    StgClosure *c = (StgClosure *)p;
+                    evacuate(&c);
+                    continue;
+                }
+            }
+
             // Check whether this object is "clean", that is it
             // definitely doesn't point into a young generation.
             // Clean objects don't need to be scavenged.  Some clean
@@ -1739,6 +1756,16 @@ scavenge_capability_mut_lists (Capability *cap)
         freeChain_sync(cap->saved_mut_lists[g]);
         cap->saved_mut_lists[g] = NULL;
     }
+
+    // In the final pause of a concurrent mark, the objects mutated since
+    // the last GC must be rescanned, as the marker may have missed their
+    // new contents.
+    if (nonmoving_state == NONMOVING_FINAL) {
+        g = oldest_gen->no;
+        scavenge_mutable_list(cap->saved_mut_lists[g], oldest_gen);
+        freeChain_sync(cap->saved_mut_lists[g]);
+        cap->saved_mut_lists[g] = NULL;
+    }
 }
 
 /* -----------------------------------------------------------------------------
@@ -23,12 +23,14 @@
 #include "Sanity.h"
 #include "Arena.h"
 #include "Capability.h"
+#include "AllocSample.h"
 #include "Schedule.h"
 #include "RetainerProfile.h"        // for counting memory blocks (memInventory)
 #include "OSMem.h"
 #include "Trace.h"
 #include "GC.h"
 #include "Evac.h"
+#include "NonMovingMark.h"
 #if defined(ios_HOST_OS)
 #include "Hash.h"
 #endif
@@ -181,6 +183,14 @@ initStorage (void)
       }
   }
 
+  if (RtsFlags.GcFlags.concurrentMark) {
+      if (oldest_gen->mark) {
+          initNonmovingMark();
+      } else {
+          RtsFlags.GcFlags.concurrentMark = false;
+      }
+  }
+
   generations[0].max_blocks = 0;
 
   dyn_caf_list = (StgIndStatic*)END_OF_CAF_LIST;
@@ -283,6 +293,9 @@ void storageAddCapabilities (uint32_t from, uint32_t to)
 void
 exitStorage (void)
 {
+    if (RtsFlags.GcFlags.concurrentMark) {
+        exitNonmovingMark();
+    }
     updateNurseriesStats();
     stat_exit();
 }
@@ -552,8 +565,16 @@ allocNursery (uint32_t node, bdescr *tail, W_ blocks)
         n = stg_min(BLOCKS_PER_MBLOCK, blocks);
         // allocLargeChunk will prefer large chunks, but will pick up
         // small chunks if there are any available.  We must allow
-        // single blocks here to avoid fragmentation (#7257)
-        bd = allocLargeChunkOnNode(node, 1, n);
+        // single blocks here to avoid fragmentation (#7257).  With
+        // huge pages we take whole mblocks where we can, so that the
+        // nursery is covered by as few huge pages as possible (see
+        // Note [Huge pages] in MBlock.c).
+        if (RtsFlags.GcFlags.hugePages != HUGE_PAGES_NONE &&
+            n == BLOCKS_PER_MBLOCK) {
+            bd = allocGroupOnNode(node, n);
+        } else {
+            bd = allocLargeChunkOnNode(node, 1, n);
+        }
         n = bd->blocks;
         blocks -= n;
 
@@ -865,6 +886,7 @@ allocate (Capability *cap, W_ n)
         bd->flags = BF_LARGE;
         bd->free = bd->start + n;
         cap->total_allocated += n;
+        checkAllocSample(cap);
         return bd->start;
     }
 
@@ -873,7 +895,10 @@ allocate (Capability *cap, W_ n)
     bd = cap->r.rCurrentAlloc;
     if (bd == NULL || bd->free + n > bd->start + BLOCK_SIZE_W) {
 
-        if (bd) finishedNurseryBlock(cap,bd);
+        if (bd) {
+            finishedNurseryBlock(cap,bd);
+            checkAllocSample(cap);
+        }
 
         // The CurrentAlloc block is full, we need to find another
         // one.  First, we try taking the next block from the
@@ -882,11 +907,10 @@ allocate (Capability *cap, W_ n)
 
         if (bd == NULL) {
             // The nursery is empty: allocate a fresh block (we can't
-            // fail here).
-            ACQUIRE_SM_LOCK;
-            bd = allocBlockOnNode(cap->node);
+            // fail here).  This usually doesn't need sm_mutex, see
+            // Note [Capability block cache] in BlockAlloc.c
+            bd = allocBlockCap(cap);
             cap->r.rNursery->n_blocks++;
-            RELEASE_SM_LOCK;
             initBdescr(bd, g0, g0);
             bd->flags = 0;
             // If we had to allocate a new block, then we'll GC
@@ -1006,10 +1030,9 @@ allocatePinned (Capability *cap, W_ n)
         bd = cap->r.rCurrentNursery->link;
         if (bd == NULL) {
             // The nursery is empty: allocate a fresh block (we can't fail
-            // here).
-            ACQUIRE_SM_LOCK;
-            bd = allocBlockOnNode(cap->node);
-            RELEASE_SM_LOCK;
+            // here).  Like allocate(), this takes the block from the
+            // Capability's block cache rather than taking sm_mutex.
+            bd = allocBlockCap(cap);
             initBdescr(bd, g0, g0);
         } else {
             newNurseryBlock(bd);
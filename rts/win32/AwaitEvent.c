@@ -54,4 +54,10 @@ awaitEvent(bool wait)
            && emptyRunQueue(&MainCapability)
       );
 }
+
+bool
+awaitEventPending(void)
+{
+    return !emptyQueue(blocked_queue_hd) || !emptyQueue(sleeping_queue);
+}
 #endif
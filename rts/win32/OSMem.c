@@ -492,6 +492,13 @@ void osDecommitMemory (void *at, W_ size)
     }
 }
 
+bool osCommitHugeMemory (void *at STG_UNUSED, W_ size STG_UNUSED)
+{
+    // Large pages on Windows need SeLockMemoryPrivilege, and can't be
+    // committed inside an existing reservation.
+    return false;
+}
+
 void osReleaseHeapMemory (void)
 {
     VirtualFree(heap_base, 0, MEM_RELEASE);
@@ -570,3 +577,14 @@ void osBindMBlocksToNode(
         }
     }
 }
+
+bool osAdviseHugePages(void *addr STG_UNUSED, W_ size STG_UNUSED)
+{
+    return false;
+}
+
+bool osMapFile(void *at STG_UNUSED, W_ size STG_UNUSED, int fd STG_UNUSED,
+               StgWord64 offset STG_UNUSED)
+{
+    return false;
+}
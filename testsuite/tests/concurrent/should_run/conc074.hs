@@ -0,0 +1,36 @@
+module Main where
+
+import Control.Monad
+import GHC.Conc
+
+-- Transactions that access enough TVars for their transaction records to
+-- be indexed (see Note [TRec index] in rts/STM.c), allocating enough for
+-- the index to be out of date after a GC.
+main :: IO ()
+main = do
+  let n = 20000
+  tvs <- replicateM n (newTVarIO (0 :: Int))
+
+  -- write every TVar, then read them all back in the same transaction
+  s1 <- atomically $ do
+    forM_ (zip tvs [1..]) $ \(tv, i) -> writeTVar tv i
+    sum <$> mapM readTVar (reverse tvs)
+  print s1
+
+  -- a nested transaction that updates every TVar and then retries: its
+  -- updates must be discarded, but its reads are kept
+  s2 <- atomically $ do
+    (forM_ tvs (\tv -> readTVar tv >>= writeTVar tv . (* 2)) >> retry)
+      `orElse` return ()
+    xs <- mapM readTVar tvs
+    return (sum (map (length . show) (replicate 10 xs)), sum xs)
+  print s2
+
+  -- a nested transaction that commits into its enclosing one
+  s3 <- atomically $ do
+    forM_ tvs $ \tv -> readTVar tv >>= writeTVar tv . (+ 1)
+    (forM_ tvs (\tv -> readTVar tv >>= writeTVar tv . negate))
+      `orElse` return ()
+    sum <$> mapM readTVar tvs
+  print s3
+  print . sum =<< mapM readTVarIO tvs
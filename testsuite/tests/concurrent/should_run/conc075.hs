@@ -0,0 +1,44 @@
+module Main where
+
+import Control.Concurrent
+import Control.Monad
+import GHC.Conc
+
+-- Many threads blocked in retry on the same TVars.  A commit wakes only a
+-- batch of them straight away and defers the rest (see Note [STM wakeup
+-- batching] in rts/STM.c), but every thread must still run when there is
+-- something for it to do.
+main :: IO ()
+main = do
+  let n = 1000
+  done <- newEmptyMVar
+
+  -- a herd of consumers, fed one item at a time
+  queue <- newTVarIO []
+  total <- newTVarIO (0 :: Int)
+  forM_ [1..n] $ \_ -> forkIO $ do
+    x <- atomically $ do
+      q <- readTVar queue
+      case q of
+        [] -> retry
+        (x:xs) -> do writeTVar queue xs; return x
+    atomically $ readTVar total >>= writeTVar total . (+ x)
+    putMVar done ()
+  threadDelay 10000
+  forM_ [1..n] $ \i -> atomically $ do
+    q <- readTVar queue
+    writeTVar queue (q ++ [i])
+  replicateM_ n (takeMVar done)
+  readTVarIO total >>= print
+
+  -- a herd released all at once
+  gate <- newTVarIO False
+  released <- newTVarIO (0 :: Int)
+  forM_ [1..n] $ \_ -> forkIO $ do
+    atomically $ readTVar gate >>= \open -> unless open retry
+    atomically $ readTVar released >>= writeTVar released . (+ 1)
+    putMVar done ()
+  threadDelay 10000
+  atomically $ writeTVar gate True
+  replicateM_ n (takeMVar done)
+  readTVarIO released >>= print
@@ -0,0 +1,38 @@
+module Main where
+
+import Control.Concurrent
+import Control.Monad
+import GHC.Conc
+
+-- Bursts of forkIO, which idle capabilities steal from the forking one
+-- (see Note [Stealing threads] in rts/Schedule.c).  Every thread must run
+-- exactly once, and killing a thread straight after forking it, before
+-- anybody has run it, must still work.
+main :: IO ()
+main = do
+  let n = 2000
+  total <- newMVar (0 :: Int)
+  done <- newEmptyMVar
+
+  forM_ [1..3 :: Int] $ \_ -> do
+    forM_ [1..n] $ \i -> forkIO $ do
+      let x = sum [1..i] `mod` 7
+      x `seq` modifyMVar_ total (return . (+ i))
+      putMVar done ()
+    replicateM_ n (takeMVar done)
+
+  -- new threads are runnable, wherever they are
+  blocker <- newEmptyMVar
+  t <- forkIO (takeMVar blocker)
+  s <- threadStatus t
+  print (s == ThreadRunning || s == ThreadBlocked BlockedOnMVar)
+  putMVar blocker ()
+
+  killed <- newMVar (0 :: Int)
+  forM_ [1..n] $ \_ -> do
+    t' <- forkIO (forever yield)
+    killThread t'
+    modifyMVar_ killed (return . (+ 1))
+
+  readMVar total >>= print
+  readMVar killed >>= print
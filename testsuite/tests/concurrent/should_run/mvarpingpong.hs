@@ -0,0 +1,32 @@
+module Main where
+
+import Control.Concurrent
+import Control.Monad
+import System.Environment
+
+-- Pairs of threads on different capabilities passing a counter back and
+-- forth through two MVars.  Every putMVar wakes a thread on the other
+-- capability by sending a message to its inbox (see Note [Lock-free
+-- inbox] in rts/Messages.c), so this is also a benchmark of the inbox:
+-- run it with +RTS -N<n> -s.  The arguments are the number of pairs and
+-- the number of round trips each makes.
+main :: IO ()
+main = do
+  [pairs, n] <- map read <$> getArgs
+  results <- forM [0 .. pairs - 1] $ \i -> pingPong (2 * i) (2 * i + 1) n
+  mapM takeMVar results >>= print . sum
+
+pingPong :: Int -> Int -> Int -> IO (MVar Int)
+pingPong c1 c2 n = do
+  ping <- newEmptyMVar
+  pong <- newEmptyMVar
+  result <- newEmptyMVar
+  _ <- forkOn c2 $ replicateM_ n $ takeMVar ping >>= putMVar pong . (+ 1)
+  _ <- forkOn c1 $ do
+    let loop :: Int -> Int -> IO ()
+        loop 0 x = putMVar result x
+        loop k x = do
+          putMVar ping x
+          takeMVar pong >>= loop (k - 1)
+    loop n 0
+  return result
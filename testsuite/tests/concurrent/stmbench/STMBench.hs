@@ -0,0 +1,126 @@
+-- STM contention benchmarks, see all.T
+--
+--   STMBench <workload> <threads> <transactions per thread>
+
+module Main (main) where
+
+import Control.Concurrent
+import Control.Monad
+import Data.IORef
+import GHC.Conc
+import System.Environment
+
+main :: IO ()
+main = do
+  [workload, threads, iters] <- getArgs
+  case lookup workload workloads of
+    Just run -> run (read threads) (read iters)
+    Nothing  -> error ("unknown workload: " ++ workload)
+
+workloads :: [(String, Int -> Int -> IO ())]
+workloads =
+  [ ("counter",  counter)
+  , ("bank",     bank)
+  , ("disjoint", disjoint)
+  , ("longread", longread)
+  ]
+
+-- Run the actions in threads of their own, and wait for all of them
+concurrently :: [IO ()] -> IO ()
+concurrently acts = do
+  dones <- forM acts $ \act -> do
+    done <- newEmptyMVar
+    _ <- forkIO (act >> putMVar done ())
+    return done
+  mapM_ takeMVar dones
+
+-- A small deterministic random number generator, so that every run does
+-- the same work
+next :: Int -> Int
+next x = (x * 1103515245 + 12345) `mod` 2147483648
+
+-- ---------------------------------------------------------------------------
+-- Every thread increments the same TVar: all the commits conflict.
+
+counter :: Int -> Int -> IO ()
+counter threads iters = do
+  tv <- newTVarIO (0 :: Int)
+  concurrently $ replicate threads $
+    replicateM_ iters $ atomically $ readTVar tv >>= writeTVar tv . (+1)
+  n <- readTVarIO tv
+  print (n == threads * iters)
+
+-- ---------------------------------------------------------------------------
+-- Half the threads move money between accounts, and the other half sum
+-- all the accounts in read-only transactions, which must always see the
+-- same total.
+
+accounts :: Int
+accounts = 64
+
+bank :: Int -> Int -> IO ()
+bank threads iters = do
+  tvs <- replicateM accounts (newTVarIO (1000 :: Int))
+  bad <- newIORef (0 :: Int)
+  let total = accounts * 1000
+      transfer seed = do
+        let r = seed `div` 65536
+            a = r `mod` accounts
+            b = (r `div` accounts) `mod` accounts
+            amount = r `mod` 10 + 1
+        atomically $ do
+          x <- readTVar (tvs !! a)
+          when (x >= amount) $ do
+            writeTVar (tvs !! a) (x - amount)
+            y <- readTVar (tvs !! b)
+            writeTVar (tvs !! b) (y + amount)
+      writer seed = foldM_ (\s _ -> transfer s >> return (next s)) seed
+                           [1..iters]
+      reader = replicateM_ iters $ do
+        s <- atomically $ sum <$> mapM readTVar tvs
+        when (s /= total) $ atomicModifyIORef' bad (\n -> (n+1, ()))
+  concurrently [ if even i then writer (i + 1) else reader
+               | i <- [1..threads] ]
+  s <- sum <$> mapM readTVarIO tvs
+  n <- readIORef bad
+  print (s == total, n)
+
+-- ---------------------------------------------------------------------------
+-- Each thread has TVars of its own, so no two transactions conflict:
+-- this measures how well non-conflicting commits scale.
+
+disjoint :: Int -> Int -> IO ()
+disjoint threads iters = do
+  tvss <- replicateM threads (replicateM 4 (newTVarIO (0 :: Int)))
+  concurrently
+    [ replicateM_ iters $ atomically $ forM_ tvs $ \tv ->
+        readTVar tv >>= writeTVar tv . (+1)
+    | tvs <- tvss ]
+  ns <- mapM readTVarIO (concat tvss)
+  print (all (== iters) ns)
+
+-- ---------------------------------------------------------------------------
+-- One thread in four updates a couple of TVars at a time, keeping their
+-- sum constant, while the others read all of them in long transactions.
+
+longread :: Int -> Int -> IO ()
+longread threads iters = do
+  let size = 1024
+  tvs <- replicateM size (newTVarIO (0 :: Int))
+  bad <- newIORef (0 :: Int)
+  let writer seed = foldM_ (\s _ -> step s >> return (next s)) seed
+                           [1 .. iters * 10]
+      step seed = atomically $ do
+        let r = seed `div` 65536
+            a = tvs !! (r `mod` size)
+            b = tvs !! ((r `div` size) `mod` size)
+        readTVar a >>= writeTVar a . subtract 1
+        readTVar b >>= writeTVar b . (+1)
+      reader = replicateM_ iters $ do
+        s <- atomically $ sum <$> mapM readTVar tvs
+        when (s /= 0) $ atomicModifyIORef' bad (\n -> (n+1, ()))
+  concurrently [ if i `mod` 4 == 0 then writer i else reader
+               | i <- [1..threads] ]
+  s <- sum <$> mapM readTVarIO tvs
+  n <- readIORef bad
+  print (s == 0, n)
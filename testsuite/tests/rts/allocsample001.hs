@@ -0,0 +1,18 @@
+-- Run an allocating program with allocation sampling on (in large
+-- objects too, with the arrays), and check that nothing goes wrong
+import Control.Concurrent
+import Control.Monad
+import Data.IORef
+import GHC.Arr
+
+main :: IO ()
+main = do
+  r <- newIORef (0 :: Int)
+  done <- newEmptyMVar
+  forM_ [1..4] $ \i -> forkIO $ do
+    let xs = [ x * i | x <- [1..200000] ]
+        a = listArray (0, 9999) [1..10000] :: Array Int Int
+    atomicModifyIORef' r (\n -> (n + sum xs + sum (elems a), ()))
+    putMVar done ()
+  replicateM_ 4 (takeMVar done)
+  readIORef r >>= print
@@ -0,0 +1,21 @@
+-- Many threads sleeping in threadDelay in the non-threaded RTS, a third
+-- of which are killed while they sleep.  Exercises the timer queue of
+-- the awaitEvent() backend.
+
+import Control.Concurrent
+import Control.Monad
+
+main :: IO ()
+main = do
+  done <- newChan
+  let n = 3000 :: Int
+      delay i | i `mod` 3 == 0 = 100000000
+              | otherwise      = (i * 7919) `mod` 50000
+  tids <- forM [1 .. n] $ \i -> forkIO $ do
+    threadDelay (delay i)
+    writeChan done i
+  forM_ (zip [1 ..] tids) $ \(i, t) ->
+    when (i `mod` 3 == 0) $ killThread t
+  rs <- replicateM (n - n `div` 3) (readChan done)
+  print (length rs)
+  print (all (\i -> i `mod` 3 /= 0) rs)
@@ -0,0 +1,74 @@
+-- Threads blocked reading from and writing to pipes in the non-threaded
+-- RTS, most of them on file descriptors >= 1024 (beyond FD_SETSIZE).
+-- Each reader waits on its pipe twice, so the descriptor has to be
+-- re-armed after it fires.  Some readers are killed while they wait,
+-- and another thread waits on one of their pipes afterwards.
+
+{-# LANGUAGE ScopedTypeVariables #-}
+
+import Control.Concurrent
+import Control.Exception
+import Control.Monad
+import System.Posix.IO
+import System.Posix.Resource
+
+main :: IO ()
+main = do
+  lim <- getResourceLimit ResourceOpenFiles
+  let soft = case hardLimit lim of
+               ResourceLimit h | h < 2048 -> ResourceLimit h
+               _ -> ResourceLimit 2048
+  setResourceLimit ResourceOpenFiles lim { softLimit = soft }
+
+  let n = 600 :: Int
+      killed i = i `mod` 50 == 0
+      alive = length (filter (not . killed) [0 .. n - 1])
+  pipes <- replicateM n createPipe
+  print (maximum (map fst pipes) >= 1024)
+
+  done <- newChan
+  let reader i r = do
+        threadWaitRead r
+        (s1, _) <- fdRead r 1
+        writeChan done (i, s1)
+        threadWaitRead r
+        (s2, _) <- fdRead r 1
+        writeChan done (i, s2)
+  tids <- forM (zip [0 ..] pipes) $ \(i, (r, _)) -> forkIO (reader i r)
+  threadDelay 10000 -- let them all block
+  forM_ (zip [0 ..] tids) $ \(i, t) -> when (killed i) (killThread t)
+
+  forM_ (reverse pipes) $ \(_, w) -> fdWrite w "a"
+  rs1 <- replicateM alive (readChan done)
+  print (length rs1, all ((== "a") . snd) rs1, all (not . killed . fst) rs1)
+  forM_ pipes $ \(_, w) -> fdWrite w "b"
+  rs2 <- replicateM alive (readChan done)
+  print (length rs2, all ((== "b") . snd) rs2, all (not . killed . fst) rs2)
+
+  -- a new thread waiting on the pipe of a killed reader
+  v <- newEmptyMVar
+  _ <- forkIO $ do threadWaitRead (fst (head pipes))
+                   fdRead (fst (head pipes)) 1 >>= putMVar v . fst
+  print =<< takeMVar v
+
+  -- a thread waiting to write to a full pipe
+  (r, w) <- createPipe
+  setFdOption r NonBlockingRead True
+  setFdOption w NonBlockingRead True
+  let fill = do
+        x <- try (fdWrite w (replicate 4096 'x'))
+        case x of
+          Left (_ :: IOException) -> return ()
+          Right _ -> fill
+      drain = do
+        x <- try (fdRead r 4096)
+        case x of
+          Left (_ :: IOException) -> return ()
+          Right _ -> drain
+  fill
+  wdone <- newEmptyMVar
+  _ <- forkIO (threadWaitWrite w >> putMVar wdone ())
+  threadDelay 10000
+  drain
+  takeMVar wdone
+  putStrLn "writer unblocked"
@@ -0,0 +1,36 @@
+-- Start and stop the eventlog, and switch event classes, at runtime
+import Control.Concurrent
+import Control.Monad
+import Debug.Trace
+import GHC.Eventlog
+
+work :: Int -> IO ()
+work n = do
+  done <- newEmptyMVar
+  forM_ [1..n] $ \i -> forkIO $ do
+    traceEventIO ("thread " ++ show i)
+    putMVar done $! sum [1..i * 1000]
+  forM_ [1..n] $ \_ -> takeMVar done
+
+main :: IO ()
+main = do
+  eventLogRunning >>= print
+  enableEventClasses [SchedulerEvents, GcEvents, UserEvents]
+  disableEventClasses [SparkEvents]
+  getEventClasses >>= print
+
+  startEventLog >>= print
+  eventLogRunning >>= print
+  startEventLog >>= print   -- already running
+  work 100
+  disableEventClasses [SchedulerEvents]
+  work 100
+  getEventClasses >>= print
+  endEventLog
+  eventLogRunning >>= print
+
+  -- and once more
+  startEventLog >>= print
+  work 10
+  endEventLog
+  eventLogRunning >>= print
@@ -0,0 +1,14 @@
+-- Events sent to a named pipe with +RTS --eventlog-socket, see the
+-- eventlogsocket001 rule in the Makefile.
+
+import Control.Concurrent
+import Control.Monad
+import Debug.Trace
+
+main :: IO ()
+main = do
+  -- give the flusher time to connect
+  threadDelay 500000
+  forM_ [1 .. 20000 :: Int] $ \i ->
+    traceEventIO ("eventlogsocket001 " ++ show i)
+  traceEventIO "eventlogsocket001 done"
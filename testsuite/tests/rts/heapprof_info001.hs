@@ -0,0 +1,20 @@
+-- Take heap profiles by info table (+RTS -hi), written to the eventlog
+-- too, with a census done in parallel by the GC threads, and check that
+-- nothing goes wrong
+import Control.Concurrent
+import Control.Monad
+import qualified Data.Map as M
+import System.Mem
+
+data T = T !Int [Int]
+
+main :: IO ()
+main = do
+  done <- newEmptyMVar
+  forM_ [1..4] $ \i -> forkIO $ do
+    let m = M.fromList [ (x, T x [x .. x + i]) | x <- [1 .. 50000 :: Int] ]
+    performMajorGC
+    putMVar done $! sum [ n + length xs | T n xs <- M.elems m ]
+  rs <- replicateM 4 (takeMVar done)
+  performMajorGC
+  print (sum rs)
@@ -0,0 +1,16 @@
+-- +RTS --huge-pages=explicit: the heap should work whether or not the
+-- system has any huge pages for us (if not, we fall back to normal
+-- pages).  Retain enough data to need fresh megablocks, then drop it
+-- so that some of them are freed and reused.
+
+import qualified Data.Map as M
+import System.Mem
+
+main :: IO ()
+main = do
+  let m = M.fromList [ (i, replicate 10 i) | i <- [1 .. 200000 :: Int] ]
+  print (M.size m)
+  print (sum (map sum (M.elems m)))
+  performMajorGC
+  let m' = M.fromList [ (i, show i) | i <- [1 .. 100000 :: Int] ]
+  print (sum (map length (M.elems m')))
@@ -0,0 +1,22 @@
+-- Exercise the concurrent mark of the oldest generation (+RTS -xn):
+-- mutate long-lived IORefs and arrays while the old generation is being
+-- marked, so that the write barrier has to keep new referents alive.
+
+import Control.Monad
+import Data.IORef
+import Data.Array.IO
+import qualified Data.Map as M
+
+main :: IO ()
+main = do
+  refs <- forM [1..1000] $ \i -> newIORef (M.singleton i [i])
+  arr  <- newArray (0, 999) [] :: IO (IOArray Int [Int])
+  forM_ [1..200] $ \n -> do
+    forM_ (zip [0..] refs) $ \(j, r) -> do
+      modifyIORef' r (M.insert (n * 1000 + j) [n, j])
+      when (j `mod` 7 == 0) $ writeArray arr j [n .. n + 10]
+  total <- foldM (\acc r -> do m <- readIORef r
+                              return $! acc + M.size m) 0 refs
+  xs <- getElems arr
+  print total
+  print (sum (map sum xs))
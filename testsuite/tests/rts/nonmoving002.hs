@@ -0,0 +1,33 @@
+-- Exercise the incremental mark of the oldest generation (+RTS -xi).
+-- The old generation is big enough for its mark to take many slices,
+-- and between slices we move old objects around: swapping the elements
+-- of a long-lived array leaves an object reachable only from a slot
+-- that the mark may already have scanned, and updating a long-lived Map
+-- links new objects from old ones.  The sanity way checks the heap at
+-- every GC.
+
+import Control.Monad
+import Data.Array.IO
+import Data.IORef
+import qualified Data.Map.Strict as M
+
+n :: Int
+n = 100000
+
+main :: IO ()
+main = do
+  arr <- newListArray (0, n - 1) [ [i, i + 1] | i <- [0 .. n - 1] ]
+           :: IO (IOArray Int [Int])
+  ref <- newIORef (M.fromList [ (i, [i]) | i <- [0 .. n - 1] ])
+  forM_ [1 .. 100] $ \r -> do
+    forM_ [0, r .. n - 1] $ \i -> do
+      let j = n - 1 - i
+      x <- readArray arr i
+      y <- readArray arr j
+      writeArray arr i y
+      writeArray arr j x
+    modifyIORef' ref (M.insert (n + r) [r] . M.delete r)
+  xs <- getElems arr
+  m <- readIORef ref
+  print (sum (map (toInteger . sum) xs))
+  print (M.size m, sum (map (toInteger . sum) (M.elems m)))
@@ -0,0 +1,19 @@
+-- Compacting major GCs done by several GC threads (+RTS -c -N4 -qg0):
+-- keep a large Map alive while discarding half of it every round, so
+-- that the compacted generation has live objects spread all over it.
+
+import Control.Monad
+import Data.IORef
+import qualified Data.Map as M
+
+main :: IO ()
+main = do
+  ref <- newIORef (M.fromList [ (i, show i) | i <- [1 .. 50000 :: Int] ])
+  forM_ [1 .. 20 :: Int] $ \n -> do
+    m <- readIORef ref
+    let m' = M.union (M.filterWithKey (\k _ -> odd (k + n)) m)
+                     (M.fromList [ (i, show (i * n)) | i <- [1, 3 .. 50000] ])
+    writeIORef ref $! m'
+  m <- readIORef ref
+  print (M.size m)
+  print (sum (map length (M.elems m)))
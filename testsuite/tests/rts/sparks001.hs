@@ -0,0 +1,28 @@
+-- Fine-grained spark throughput, after nofib/parallel/parfib: lots of
+-- tiny sparks, so that the idle capabilities spend most of their time
+-- stealing.  Every spark must be either converted or fizzle; run it with
+-- +RTS -s to see the spark statistics and the time spent.
+
+import Control.Monad
+import GHC.Conc
+import System.Environment
+
+nfib :: Int -> Int
+nfib n | n < 2 = 1
+nfib n = nfib (n-1) + nfib (n-2) + 1
+
+parfib :: Int -> Int -> Int
+parfib t n
+  | n <= t    = nfib n
+  | otherwise = x `par` (y `pseq` x + y + 1)
+  where
+    x = parfib t (n-1)
+    y = parfib t (n-2)
+
+main :: IO ()
+main = do
+  args <- getArgs
+  let (n, t) = case args of
+                 [a, b] -> (read a, read b)
+                 _      -> (27, 8)
+  forM_ [1..3 :: Int] $ \_ -> print (parfib t n)
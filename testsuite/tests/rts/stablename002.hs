@@ -0,0 +1,31 @@
+-- Stable names must survive minor and major GCs, whether the objects
+-- and the StableName objects are in the same or in different
+-- generations.
+
+import Control.Monad
+import System.Mem
+import System.Mem.StableName
+
+main :: IO ()
+main = do
+  let old = [ [i] | i <- [1 .. 20000 :: Int] ]
+  mapM_ (\x -> length x `seq` return ()) old
+  performGC                     -- old objects are now in the old generation
+  ns1 <- mapM makeStableName old
+  performMinorGC                -- new StableNames, old objects
+  ns2 <- mapM makeStableName old
+  print (and (zipWith (==) ns1 ns2))
+  rs <- forM [1 .. 20] $ \k -> do
+    let young = [ [i, k] | i <- [1 .. 1000 :: Int] ]
+    mapM_ (\x -> length x `seq` return ()) young
+    ys1 <- mapM makeStableName young
+    performMinorGC
+    ys2 <- mapM makeStableName young
+    when (k `mod` 5 == 0) performMajorGC
+    ys3 <- mapM makeStableName young
+    return (and (zipWith (==) ys1 ys2) && and (zipWith (==) ys2 ys3))
+  print (and rs)
+  performMajorGC
+  ns3 <- mapM makeStableName old
+  print (and (zipWith (==) ns1 ns3))
+  print (map hashStableName ns1 == map hashStableName ns3)
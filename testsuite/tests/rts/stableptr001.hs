@@ -0,0 +1,32 @@
+-- Create, dereference and free many StablePtrs from several threads at
+-- once, with GCs in between, to exercise the per-Capability caches of
+-- free stable pointer table entries and the growth of the table.
+
+import Control.Concurrent
+import Control.Monad
+import Foreign.StablePtr
+import System.Mem
+
+worker :: Int -> MVar Int -> IO ()
+worker n done = do
+  -- keep some alive across GCs, so that the table has to grow
+  kept <- forM [1 .. 5000] $ \i -> newStablePtr (n * 100000 + i)
+  s <- foldM (\acc i -> do
+                 sp <- newStablePtr (i :: Int)
+                 x <- deRefStablePtr sp
+                 freeStablePtr sp
+                 when (i `mod` 50000 == 0) performGC
+                 return $! acc + x)
+             0 [1 .. 200000]
+  xs <- mapM deRefStablePtr kept
+  mapM_ freeStablePtr kept
+  putMVar done (s + sum xs - sum [n * 100000 + i | i <- [1 .. 5000]])
+
+main :: IO ()
+main = do
+  dones <- forM [1 .. 8] $ \n -> do
+    done <- newEmptyMVar
+    _ <- forkIO (worker n done)
+    return done
+  rs <- mapM takeMVar dones
+  print rs
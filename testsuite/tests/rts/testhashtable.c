@@ -0,0 +1,240 @@
+// Tests for the RTS hash tables (rts/Hash.c).
+//
+// Run with the argument "bench" to time the symbol table workload of the
+// linker (inserting and then looking up many symbol names in a string
+// table) against a chained hash table like the one Hash.c used to be.
+
+#include "Rts.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct hashtable HashTable;
+
+extern HashTable *allocHashTable(void);
+extern HashTable *allocStrHashTable(void);
+extern void insertHashTable(HashTable *table, StgWord key, const void *data);
+extern void *lookupHashTable(const HashTable *table, StgWord key);
+extern void *removeHashTable(HashTable *table, StgWord key, const void *data);
+extern int keyCountHashTable(HashTable *table);
+extern void freeHashTable(HashTable *table, void (*freeDataFun)(void *));
+
+#define N_KEYS 100000
+
+static int failed = 0;
+
+#define EXPECT(cond)                                                    \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            printf("FAIL line %d: %s\n", __LINE__, #cond);              \
+            failed = 1;                                                 \
+        }                                                               \
+    } while (0)
+
+static char *
+symbolName(int i)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "base_GHCziList_zdwfoo%d_closure", i);
+    return strdup(buf);
+}
+
+static void
+testWordTable(void)
+{
+    HashTable *t = allocHashTable();
+    StgWord i;
+
+    for (i = 1; i <= N_KEYS; i++) {
+        insertHashTable(t, i * sizeof(StgWord), (void *)i);
+    }
+    EXPECT(keyCountHashTable(t) == N_KEYS);
+    for (i = 1; i <= N_KEYS; i++) {
+        EXPECT(lookupHashTable(t, i * sizeof(StgWord)) == (void *)i);
+    }
+    EXPECT(lookupHashTable(t, (N_KEYS + 1) * sizeof(StgWord)) == NULL);
+
+    // remove the odd keys, and re-insert some of them
+    for (i = 1; i <= N_KEYS; i += 2) {
+        EXPECT(removeHashTable(t, i * sizeof(StgWord), NULL) == (void *)i);
+    }
+    EXPECT(keyCountHashTable(t) == N_KEYS / 2);
+    for (i = 1; i <= N_KEYS; i++) {
+        EXPECT(lookupHashTable(t, i * sizeof(StgWord))
+               == (i % 2 ? NULL : (void *)i));
+    }
+    for (i = 1; i <= N_KEYS; i += 4) {
+        insertHashTable(t, i * sizeof(StgWord), (void *)(i + 1));
+    }
+    for (i = 1; i <= N_KEYS; i += 4) {
+        EXPECT(lookupHashTable(t, i * sizeof(StgWord)) == (void *)(i + 1));
+    }
+
+    // duplicates: the newest entry wins, and removing it uncovers the
+    // older one
+    insertHashTable(t, 8, (void *)1);
+    insertHashTable(t, 8, (void *)2);
+    insertHashTable(t, 8, (void *)3);
+    EXPECT(lookupHashTable(t, 8) == (void *)3);
+    EXPECT(removeHashTable(t, 8, (void *)2) == (void *)2);
+    EXPECT(lookupHashTable(t, 8) == (void *)3);
+    EXPECT(removeHashTable(t, 8, NULL) == (void *)3);
+    EXPECT(lookupHashTable(t, 8) == (void *)1);
+
+    freeHashTable(t, NULL);
+}
+
+static void
+testStrTable(void)
+{
+    HashTable *t = allocStrHashTable();
+    char **names = malloc(N_KEYS * sizeof(char *));
+    char key[64];
+    int i;
+
+    for (i = 0; i < N_KEYS; i++) {
+        names[i] = symbolName(i);
+        insertHashTable(t, (StgWord)names[i], names[i]);
+    }
+    for (i = 0; i < N_KEYS; i++) {
+        // look up a copy, not the same pointer
+        snprintf(key, sizeof(key), "base_GHCziList_zdwfoo%d_closure", i);
+        EXPECT(lookupHashTable(t, (StgWord)key) == names[i]);
+    }
+    EXPECT(lookupHashTable(t, (StgWord)"no_such_symbol") == NULL);
+    for (i = 0; i < N_KEYS; i += 3) {
+        EXPECT(removeHashTable(t, (StgWord)names[i], names[i]) == names[i]);
+    }
+    for (i = 0; i < N_KEYS; i++) {
+        EXPECT(lookupHashTable(t, (StgWord)names[i])
+               == (i % 3 == 0 ? NULL : names[i]));
+    }
+    freeHashTable(t, free);
+    for (i = 0; i < N_KEYS; i += 3) {
+        free(names[i]);
+    }
+    free(names);
+}
+
+/* -----------------------------------------------------------------------------
+ * The benchmark
+ * -------------------------------------------------------------------------- */
+
+// A chained hash table with the string hash function of the old Hash.c
+typedef struct chain {
+    const char *key;
+    const void *data;
+    struct chain *next;
+} Chain;
+
+typedef struct {
+    Chain **buckets;
+    int size, count;
+} ChainTable;
+
+static int
+oldHashStr(const char *s)
+{
+    int h;
+    for (h = 0; *s; s++) {
+        h *= 128;
+        h += *s;
+        h = h % 1048583;
+    }
+    return h;
+}
+
+static void
+chainGrow(ChainTable *t)
+{
+    Chain **old = t->buckets;
+    int old_size = t->size, i;
+    Chain *c, *next;
+
+    t->size *= 2;
+    t->buckets = calloc(t->size, sizeof(Chain *));
+    for (i = 0; i < old_size; i++) {
+        for (c = old[i]; c != NULL; c = next) {
+            next = c->next;
+            int b = oldHashStr(c->key) & (t->size - 1);
+            c->next = t->buckets[b];
+            t->buckets[b] = c;
+        }
+    }
+    free(old);
+}
+
+static void
+chainInsert(ChainTable *t, const char *key, const void *data)
+{
+    Chain *c = malloc(sizeof(Chain));
+    int b;
+    if (++t->count >= 5 * t->size) chainGrow(t);
+    b = oldHashStr(key) & (t->size - 1);
+    c->key = key;
+    c->data = data;
+    c->next = t->buckets[b];
+    t->buckets[b] = c;
+}
+
+static const void *
+chainLookup(ChainTable *t, const char *key)
+{
+    Chain *c;
+    for (c = t->buckets[oldHashStr(key) & (t->size - 1)]; c; c = c->next) {
+        if (strcmp(c->key, key) == 0) return c->data;
+    }
+    return NULL;
+}
+
+static double
+seconds(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void
+bench(int n)
+{
+    char **names = malloc(n * sizeof(char *));
+    ChainTable ct;
+    HashTable *t;
+    clock_t start;
+    int i, found;
+
+    for (i = 0; i < n; i++) {
+        names[i] = symbolName(i);
+    }
+
+    ct.size = 1024;
+    ct.count = 0;
+    ct.buckets = calloc(ct.size, sizeof(Chain *));
+    start = clock();
+    for (i = 0; i < n; i++) chainInsert(&ct, names[i], names[i]);
+    found = 0;
+    for (i = 0; i < n; i++) found += chainLookup(&ct, names[i]) != NULL;
+    printf("chained:         %d symbols, %.3fs\n", found, seconds(start));
+
+    t = allocStrHashTable();
+    start = clock();
+    for (i = 0; i < n; i++) insertHashTable(t, (StgWord)names[i], names[i]);
+    found = 0;
+    for (i = 0; i < n; i++) found += lookupHashTable(t, (StgWord)names[i]) != NULL;
+    printf("open addressing: %d symbols, %.3fs\n", found, seconds(start));
+    freeHashTable(t, NULL);
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        bench(argc > 2 ? atoi(argv[2]) : 1000000);
+        return 0;
+    }
+
+    testWordTable();
+    testStrTable();
+    if (!failed) printf("ok\n");
+    return failed;
+}
@@ -0,0 +1,109 @@
+// Test stealHalfWSDeque(), the batched steal used for spark pools.
+//
+// As with a spark pool, the owner only pushes onto the deque and takes
+// elements from the top end.  Each thief steals half of the deque into
+// its own deque and then works through that, while the other thieves
+// may steal from it too.  Every element must be taken exactly once.
+
+#define THREADED_RTS
+
+#include "Rts.h"
+#include "WSDeque.h"
+#include <stdio.h>
+
+#define SCRATCH_SIZE (1024*1024)
+#define THREADS 3
+
+WSDeque *q;
+WSDeque *thief_q[THREADS];
+
+StgWord scratch[SCRATCH_SIZE];
+StgWord done;
+StgWord finished;
+
+OSThreadId ids[THREADS];
+
+static void work(void *p, uint32_t n)
+{
+    StgWord val;
+
+    val = *(StgWord *)p;
+    if (val != 0) {
+        fflush(stdout);
+        fflush(stderr);
+        barf("FAIL: %p %d %" FMT_Word, p, n, val);
+    }
+    *(StgWord*)p = n+10;
+}
+
+static void OSThreadProcAttr thief(void *info)
+{
+    void *p;
+    StgWord n;
+    uint32_t i;
+
+    n = (StgWord)info;
+
+    while (!done || !looksEmptyWSDeque(thief_q[n])) {
+        // our own deque first, then the owner's, then the other thieves'
+        p = stealWSDeque_(thief_q[n]);
+        if (p == NULL) {
+            p = stealHalfWSDeque(q, thief_q[n]);
+        }
+        for (i = 0; p == NULL && i < THREADS; i++) {
+            if (i != n) {
+                p = stealHalfWSDeque(thief_q[i], thief_q[n]);
+            }
+        }
+        if (p != NULL) { work(p,n+1); }
+    }
+    atomic_inc(&finished, 1);
+}
+
+int main(int argc, char*argv[])
+{
+    int n;
+    void *p;
+
+    q = newWSDeque(1024);
+    done = 0;
+    finished = 0;
+
+    for (n=0; n < SCRATCH_SIZE; n++) {
+        scratch[n] = 0;
+    }
+
+    for (n=0; n < THREADS; n++) {
+        thief_q[n] = newWSDeque(256);
+    }
+    for (n=0; n < THREADS; n++) {
+        createOSThread(&ids[n], "thief", thief, (void*)(StgWord)n);
+    }
+
+    for (n=0; n < SCRATCH_SIZE; n++) {
+        while (!pushWSDeque(q,&scratch[n])) {
+            p = stealWSDeque(q);
+            if (p != NULL) { work(p,0); }
+        }
+        if (n % 4 == 0) {
+            p = stealWSDeque(q);
+            if (p != NULL) { work(p,0); }
+        }
+    }
+
+    while ((p = stealWSDeque(q)) != NULL) {
+        work(p,0);
+    }
+    done = 1;
+    while (finished < THREADS) {
+        yieldThread();
+    }
+
+    for (n=0; n < SCRATCH_SIZE; n++) {
+        if (scratch[n] == 0) {
+            barf("FAIL: element %d was never taken", n);
+        }
+    }
+    printf("ok\n");
+    exit(0);
+}
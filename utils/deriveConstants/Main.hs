@@ -383,6 +383,7 @@ wanteds os = concat
           ,structField C    "Capability" "interrupt"
           ,structField C    "Capability" "sparks"
           ,structField C    "Capability" "total_allocated"
+          ,structField C    "Capability" "alloc_sample_next"
           ,structField C    "Capability" "weak_ptr_list_hd"
           ,structField C    "Capability" "weak_ptr_list_tl"
 
@@ -515,7 +516,7 @@ wanteds os = concat
 
           ,closureSize  C "StgTVar"
           ,closureField C "StgTVar" "current_value"
-          ,closureField C "StgTVar" "first_watch_queue_entry"
+          ,closureField C "StgTVar" "watchers"
           ,closureField C "StgTVar" "num_updates"
 
           ,closureSize  C "StgWeak"